@@ -0,0 +1,23 @@
+// main starts from seed and moves it on, so neither tier can fold the work
+// to a constant and every run goes through the loop.
+int seed = 17;
+
+int main() {
+    int a = seed;
+    int b = seed % 13 + 5;
+    int s = 0;
+    char f = 'k';
+    for (int i = 0; i < 64; i = i + 1) {
+        int c = a * b + 3;
+        int d = c - a / b + 7;
+        int e = (a + b) * (c - d) + 11;
+        a = a % 1000 + i;
+        b = b % 29 + 3;
+        c = c + d * 2 - e % 7;
+        d = (a - b) * (c + 4) / 3;
+        e = e + a + b + c + d;
+        s = s + e % 97 + f - (c != d) + !(a == b);
+    }
+    seed = seed + 1;
+    return (s % 256 + 256) % 256;
+}
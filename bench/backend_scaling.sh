@@ -0,0 +1,44 @@
+#!/bin/sh
+# Measures how `scc -c` on one large file scales with -j, which is the
+# number of threads the backend compiles its functions on.
+#
+#   bench/backend_scaling.sh [scc binary] [functions]
+#
+# Generates a single unit of loop-and-switch functions, compiles it once
+# per thread count and reports the time plus the speedup over -j1. The
+# objects must come out byte for byte the same at every -j.
+
+SCC=${1:-_gate_build/scc}
+FUNCTIONS=${2:-4000}
+SCC=$(cd "$(dirname "$SCC")" && pwd)/$(basename "$SCC")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+now_ns() {
+    date +%s%N
+}
+
+echo "int a[64];" > "$WORK/unit.c"
+k=0
+while [ $k -lt "$FUNCTIONS" ]; do
+    echo "int f$k(int x, int y) { int s = 0; for (int i = 0; i < x; i = i + 1) {" \
+         "s = s + (i * $((k % 13 + 2)) + y) / $((k % 9 + 2)) + a[((i + y) % 64 + 64) % 64] * (x + y) - (y + x) * 3;" \
+         "switch (((s % 4) + 4) % 4) { case 0: s = s + $k; break; case 1: s = s - x / 7; break; case 3: s = s * 3; } }" \
+         "return s + x % $((k % 11 + 3)); }"
+    k=$((k + 1))
+done >> "$WORK/unit.c"
+echo "int main() { return f0(10, 3) % 256; }" >> "$WORK/unit.c"
+
+CORES=$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 1)
+printf '%-6s %12s %8s\n' "jobs" "ms" "speedup"
+base_ns=0
+j=1
+while [ $j -le "$CORES" ]; do
+    start=$(now_ns)
+    (cd "$WORK" && "$SCC" -j$j -c unit.c -o unit$j.o) || exit 1
+    elapsed=$(( $(now_ns) - start ))
+    [ $base_ns -eq 0 ] && base_ns=$elapsed
+    cmp -s "$WORK/unit1.o" "$WORK/unit$j.o" || { echo "-j$j produced a different object" >&2; exit 1; }
+    printf '%-6d %12d %7d.%02d\n' $j $((elapsed / 1000000)) $((base_ns / elapsed)) $((base_ns * 100 / elapsed % 100))
+    j=$((j * 2))
+done
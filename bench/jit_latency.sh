@@ -0,0 +1,48 @@
+#!/bin/sh
+# Compares `scc --run` with the compile + link + exec round trip for one program.
+#
+#   bench/jit_latency.sh [scc binary] [source file] [iterations]
+#
+# Both paths run the program to completion and must agree on its exit code.
+
+SCC=${1:-_gate_build/scc}
+SOURCE=${2:-main.c}
+ITERATIONS=${3:-200}
+CC=${CC:-cc}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+now_ns() {
+    date +%s%N
+}
+
+"$SCC" --run "$SOURCE"
+jit_result=$?
+"$SCC" -c "$SOURCE" -o "$WORK/prog.o" && "$CC" "$WORK/prog.o" -o "$WORK/prog" && "$WORK/prog"
+aot_result=$?
+if [ "$jit_result" != "$aot_result" ]; then
+    echo "exit codes differ: --run=$jit_result linked=$aot_result" >&2
+    exit 1
+fi
+
+start=$(now_ns)
+i=0
+while [ $i -lt "$ITERATIONS" ]; do
+    "$SCC" --run "$SOURCE"
+    i=$((i + 1))
+done
+jit_ns=$(( $(now_ns) - start ))
+
+start=$(now_ns)
+i=0
+while [ $i -lt "$ITERATIONS" ]; do
+    "$SCC" -c "$SOURCE" -o "$WORK/prog.o"
+    "$CC" "$WORK/prog.o" -o "$WORK/prog"
+    "$WORK/prog"
+    i=$((i + 1))
+done
+aot_ns=$(( $(now_ns) - start ))
+
+printf '%-24s %10s\n' "mode" "us/run"
+printf '%-24s %10d\n' "scc --run" $((jit_ns / ITERATIONS / 1000))
+printf '%-24s %10d\n' "scc -c + cc + exec" $((aot_ns / ITERATIONS / 1000))
@@ -0,0 +1,144 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "scc.h"
+
+// Compares compiling many small files in process through libscc, with one
+// context reused for all of them, against spawning the scc binary per file.
+// Both produce assembly for the same file; the outputs are checked to match
+// and the resident set is reported after the in-process run, which should
+// not grow with the number of compilations.
+//
+//   scc_lib_bench [file.c] [compilations] [path/to/scc]
+
+extern char** environ;
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static char* read_file(const char* path, size_t* size) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *size = (size_t)ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* data = malloc(*size + 1);
+    if (fread(data, 1, *size, f) != *size) {
+        fclose(f);
+        free(data);
+        return NULL;
+    }
+    data[*size] = '\0';
+    fclose(f);
+    return data;
+}
+
+// Runs scc -S on file with stdout redirected to out_path.
+static int spawn_compiler(const char* scc, const char* file, const char* out_path) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 1, out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    char* argv[] = {(char*)scc, "-S", (char*)file, NULL};
+    pid_t pid;
+    int status = posix_spawn(&pid, scc, &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (status != 0) {
+        return -1;
+    }
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)) {
+        return -1;
+    }
+    return WEXITSTATUS(status);
+}
+
+static long max_rss_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+int main(int argc, char** argv) {
+    char* file = argc > 1 ? argv[1] : "bench/arith_kernel.c";
+    long compilations = argc > 2 ? atol(argv[2]) : 5000;
+    char* scc = argc > 3 ? argv[3] : "./scc";
+
+    size_t size;
+    char* source = read_file(file, &size);
+    if (source == NULL) {
+        fprintf(stderr, "Error: cannot read %s\n", file);
+        return 1;
+    }
+
+    scc_context* ctx = scc_create_context();
+    scc_result first;
+    if (scc_compile(ctx, file, source, size, SCC_MODE_ASM, &first) != 0) {
+        fprintf(stderr, "%s", first.diagnostics);
+        return 1;
+    }
+    long rss_warm = max_rss_kb();
+
+    double start = now_seconds();
+    for (long i = 0; i < compilations; ++i) {
+        scc_result result;
+        scc_compile(ctx, file, source, size, SCC_MODE_ASM, &result);
+        if (result.output_size != first.output_size || memcmp(result.output, first.output, first.output_size) != 0) {
+            fprintf(stderr, "in-process output changed on compilation %ld\n", i);
+            return 1;
+        }
+        scc_free_result(&result);
+    }
+    double in_process = now_seconds() - start;
+    long rss_done = max_rss_kb();
+    scc_destroy_context(ctx);
+
+    // Process startup dominates, so fewer runs are enough for a stable figure.
+    long spawns = compilations < 500 ? compilations : 500;
+    char out_path[] = "/tmp/scc_lib_bench_XXXXXX";
+    int out_fd = mkstemp(out_path);
+    if (out_fd < 0) {
+        return 1;
+    }
+    close(out_fd);
+    start = now_seconds();
+    for (long i = 0; i < spawns; ++i) {
+        if (spawn_compiler(scc, file, out_path) != 0) {
+            fprintf(stderr, "Error: cannot run %s\n", scc);
+            unlink(out_path);
+            return 1;
+        }
+    }
+    double spawned = now_seconds() - start;
+
+    size_t cli_size;
+    char* cli_output = read_file(out_path, &cli_size);
+    unlink(out_path);
+    if (cli_output == NULL || cli_size != first.output_size || memcmp(cli_output, first.output, cli_size) != 0) {
+        fprintf(stderr, "library and command line outputs differ\n");
+        return 1;
+    }
+
+    printf("file:            %s (%zu bytes)\n", file, size);
+    printf("in-process:      %ld compilations, %.3f ms per file\n", compilations, in_process * 1e3 / compilations);
+    printf("exec per file:   %ld compilations, %.3f ms per file\n", spawns, spawned * 1e3 / spawns);
+    printf("speedup:         %.1fx\n", (spawned / spawns) / (in_process / compilations));
+    printf("max rss:         %ld KiB after warm-up, %ld KiB after %ld compilations\n", rss_warm, rss_done,
+           compilations);
+
+    free(cli_output);
+    scc_free_result(&first);
+    free(source);
+    return 0;
+}
@@ -0,0 +1,63 @@
+#!/bin/sh
+# Compares how long `scc -c` takes at -O0, which emits code straight from
+# the AST, with the optimizing pipeline on the same inputs.
+#
+#   bench/opt_level_latency.sh [scc binary] [functions] [iterations] [source file...]
+#
+# Without source files it generates one unit of loop-and-switch functions.
+# Every input is compiled iterations times at each level and the mean time
+# reported; both objects are linked and run, and must agree on the exit code.
+
+SCC=${1:-_gate_build/scc}
+FUNCTIONS=${2:-2000}
+ITERATIONS=${3:-5}
+shift 3 2>/dev/null || shift $#
+CC=${CC:-cc}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+now_ns() {
+    date +%s%N
+}
+
+if [ $# -eq 0 ]; then
+    echo "int a[64];" > "$WORK/unit.c"
+    k=0
+    while [ $k -lt "$FUNCTIONS" ]; do
+        echo "int f$k(int x, int y) { int s = 0; for (int i = 0; i < x; i = i + 1) {" \
+             "s = s + (i * $((k % 13 + 2)) + y) / $((k % 9 + 2)) + a[((i + y) % 64 + 64) % 64] * (x + y) - (y + x) * 3;" \
+             "switch (((s % 4) + 4) % 4) { case 0: s = s + $k; break; case 1: s = s - x / 7; break; case 3: s = s * 3; } }" \
+             "return s + x % $((k % 11 + 3)); }"
+        k=$((k + 1))
+    done >> "$WORK/unit.c"
+    echo "int main() { return f0(10, 3) % 256; }" >> "$WORK/unit.c"
+    set -- "$WORK/unit.c"
+fi
+
+# Mean microseconds of compiling $2 at level $1, into $WORK/out$1.o.
+compile_us() {
+    start=$(now_ns)
+    i=0
+    while [ $i -lt "$ITERATIONS" ]; do
+        "$SCC" "$1" -c "$2" -o "$WORK/out$1.o" || exit 1
+        i=$((i + 1))
+    done
+    echo $(( ($(now_ns) - start) / ITERATIONS / 1000 ))
+}
+
+printf '%-24s %10s %10s %8s\n' "input" "-O0 ms" "-O1 ms" "ratio"
+for source in "$@"; do
+    fast=$(compile_us -O0 "$source")
+    full=$(compile_us -O1 "$source")
+    for level in -O0 -O1; do
+        "$CC" "$WORK/out$level.o" -o "$WORK/prog$level" || exit 1
+        "$WORK/prog$level"
+        echo $? > "$WORK/exit$level"
+    done
+    if ! cmp -s "$WORK/exit-O0" "$WORK/exit-O1"; then
+        echo "$source: exit codes differ: -O0=$(cat "$WORK/exit-O0") -O1=$(cat "$WORK/exit-O1")" >&2
+        exit 1
+    fi
+    printf '%-24s %7d.%02d %7d.%02d %7d.%02d\n' "$(basename "$source")" $((fast / 1000)) $((fast % 1000 / 10)) \
+           $((full / 1000)) $((full % 1000 / 10)) $((full / fast)) $((full * 100 / fast % 100))
+done
@@ -0,0 +1,43 @@
+#!/bin/sh
+# Measures multi-file throughput of `scc -c` at increasing -j levels.
+#
+#   bench/parallel_throughput.sh [scc binary] [files] [functions per file]
+#
+# Generates the inputs, compiles them all once per thread count and reports
+# files/s plus the speedup over -j1.
+
+SCC=${1:-_gate_build/scc}
+FILES=${2:-64}
+FUNCTIONS=${3:-300}
+SCC=$(cd "$(dirname "$SCC")" && pwd)/$(basename "$SCC")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+now_ns() {
+    date +%s%N
+}
+
+f=0
+while [ $f -lt "$FILES" ]; do
+    k=0
+    while [ $k -lt "$FUNCTIONS" ]; do
+        echo "int f$k(int a, int b) { int x = a * $k + b; int y = (x - $k) % 7; return x + y * 3; }"
+        k=$((k + 1))
+    done > "$WORK/unit$f.c"
+    echo "int main() { return 0; }" >> "$WORK/unit$f.c"
+    f=$((f + 1))
+done
+
+CORES=$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 1)
+printf '%-6s %12s %10s %8s\n' "jobs" "ms" "files/s" "speedup"
+base_ns=0
+j=1
+while [ $j -le "$CORES" ]; do
+    start=$(now_ns)
+    (cd "$WORK" && "$SCC" -j$j -c unit*.c) || exit 1
+    elapsed=$(( $(now_ns) - start ))
+    [ $base_ns -eq 0 ] && base_ns=$elapsed
+    printf '%-6d %12d %10d %7d.%02d\n' $j $((elapsed / 1000000)) $((FILES * 1000000000 / elapsed)) \
+        $((base_ns / elapsed)) $((base_ns * 100 / elapsed % 100))
+    j=$((j * 2))
+done
@@ -0,0 +1,321 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "buffer.h"
+#include "lexer.h"
+#include "parser.h"
+#include "preprocessor.h"
+
+// Front-end scalability sweep. Each dimension generates programs of growing
+// size, runs them through the tokenizer, preprocessor and parser, and fits
+// time and allocated bytes to n^k by least squares on a log-log scale. A
+// linear phase shows k close to 1; k near 2 is a quadratic to go and find.
+//
+//   scc_bench [--json] [--quick] [--repeat N] [--max-exponent K] [dimension...]
+//
+// Dimensions: functions, statements, depth, globals, expression. The JSON
+// output is one object per dimension and line, for diffing across commits.
+// With --max-exponent the exit status is 1 when any dimension's time grows
+// faster than n^K, so a check can keep a fixed quadratic from coming back.
+
+typedef struct bench_dimension {
+    const char* name;
+    const char* what;
+    void (*generate)(buffer* out, size_t n);
+    size_t sizes[6];
+} bench_dimension;
+
+typedef struct bench_sample {
+    size_t n;
+    size_t source_bytes;
+    double lex_seconds;
+    double preprocess_seconds;
+    double parse_seconds;
+    size_t allocations;
+    size_t bytes;
+} bench_sample;
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// n small functions of a few statements each.
+static void generate_functions(buffer* out, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        buffer_printf(out, "int f%zu(int x) {\n    int a = x + %zu;\n    a = a * 2;\n    return a - x;\n}\n", i, i);
+    }
+}
+
+// One function whose body holds n declarations and assignments.
+static void generate_statements(buffer* out, size_t n) {
+    buffer_puts(out, "int main() {\n    int a = 0;\n");
+    for (size_t i = 0; i < n; ++i) {
+        buffer_printf(out, "    int v%zu = a + %zu;\n    a = v%zu - 1;\n", i, i, i);
+    }
+    buffer_puts(out, "    return a;\n}\n");
+}
+
+// Blocks nested n deep, each declaring a variable and assigning the outermost.
+static void generate_depth(buffer* out, size_t n) {
+    buffer_puts(out, "int main() {\n    int a = 0;\n");
+    for (size_t i = 0; i < n; ++i) {
+        buffer_printf(out, "{ int d%zu = %zu; a = d%zu;\n", i, i, i);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        buffer_puts(out, "}\n");
+    }
+    buffer_puts(out, "    return a;\n}\n");
+}
+
+// n globals, then one function assigning each of them, so every assignment
+// looks its name up through a global scope of size n.
+static void generate_globals(buffer* out, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        buffer_printf(out, "int g%zu = %zu;\n", i, i);
+    }
+    buffer_puts(out, "int main() {\n");
+    for (size_t i = 0; i < n; ++i) {
+        buffer_printf(out, "    g%zu = %zu;\n", n - 1 - i, i);
+    }
+    buffer_puts(out, "    return 0;\n}\n");
+}
+
+// One return statement with an expression of n terms and mixed precedence.
+static void generate_expression(buffer* out, size_t n) {
+    static const char* ops[] = {" + ", " * ", " - ", " % "};
+    buffer_puts(out, "int main() {\n    int a = 3;\n    return a");
+    for (size_t i = 0; i < n; ++i) {
+        buffer_puts(out, ops[i % 4]);
+        if (i % 3 == 0) {
+            buffer_printf(out, "(a + %zu)", i + 1);
+        } else {
+            buffer_printf(out, "%zu", i + 1);
+        }
+    }
+    buffer_puts(out, ";\n}\n");
+}
+
+static const bench_dimension dimensions[] = {
+    {"functions", "top-level functions", generate_functions, {1000, 2000, 4000, 8000, 16000, 32000}},
+    {"statements", "statements in one block", generate_statements, {1000, 2000, 4000, 8000, 16000, 32000}},
+    {"depth", "nested blocks", generate_depth, {250, 500, 1000, 2000, 4000, 8000}},
+    {"globals", "globals assigned from main", generate_globals, {500, 1000, 2000, 4000, 8000, 16000}},
+    {"expression", "terms in one expression", generate_expression, {1000, 2000, 4000, 8000, 16000, 32000}},
+};
+
+static size_t total(const size_t* counters) {
+    size_t sum = 0;
+    for (int i = 0; i < NUM_ALLOC_CATEGORIES; ++i) {
+        sum += counters[i];
+    }
+    return sum;
+}
+
+// One pass over source. AST and symbols go away with the region, tokens and
+// the preprocessor are freed by hand, so runs do not pile up in memory.
+static void run_front_end(char* source, header_cache* headers, bench_sample* sample) {
+    alloc_counters before = *current_alloc_counters();
+    alloc_region region;
+    init_alloc_region(&region);
+    alloc_region* previous = set_alloc_region(&region);
+
+    double start = now_seconds();
+    lexer l = init_lexer_from_source("<bench>", source);
+    token* tokens = tokenizer(&l);
+    int num_tokens = l.tokens_count;
+    double lexed = now_seconds();
+
+    preprocessor pp = init_preprocessor(headers, NULL, 0);
+    token* pp_tokens = preprocess(&pp, "<bench>", &l, tokens);
+    double preprocessed = now_seconds();
+
+    parser p = init_parser(&l, pp_tokens);
+    parse_program(&p);
+    double parsed = now_seconds();
+
+    alloc_counters* after = current_alloc_counters();
+    sample->lex_seconds = lexed - start;
+    sample->preprocess_seconds = preprocessed - lexed;
+    sample->parse_seconds = parsed - preprocessed;
+    sample->allocations = total(after->allocations) - total(before.allocations);
+    sample->bytes = total(after->bytes) - total(before.bytes);
+
+    free_preprocessor(&pp);
+    free(pp_tokens);
+    for (int i = 0; i < num_tokens; ++i) {
+        free(tokens[i].lexme);
+    }
+    free(tokens);
+    set_alloc_region(previous);
+    free_alloc_region(&region);
+}
+
+// Least-squares slope of log(y) against log(n).
+static double fit_exponent(const bench_sample* samples, size_t count, double (*value)(const bench_sample*)) {
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (size_t i = 0; i < count; ++i) {
+        double x = log((double)samples[i].n);
+        double y = log(value(&samples[i]) > 1e-9 ? value(&samples[i]) : 1e-9);
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+    }
+    double denominator = (double)count * sxx - sx * sx;
+    return denominator != 0 ? ((double)count * sxy - sx * sy) / denominator : 0;
+}
+
+static double sample_seconds(const bench_sample* s) {
+    return s->lex_seconds + s->preprocess_seconds + s->parse_seconds;
+}
+
+static double sample_parse_seconds(const bench_sample* s) {
+    return s->parse_seconds;
+}
+
+static double sample_bytes(const bench_sample* s) {
+    return (double)s->bytes;
+}
+
+static const char* growth_label(double k) {
+    if (k < 1.25) {
+        return "linear";
+    }
+    if (k < 1.75) {
+        return "superlinear";
+    }
+    return "QUADRATIC";
+}
+
+static void print_dimension_text(const bench_dimension* d, const bench_sample* samples, size_t count) {
+    printf("== %s (%s) ==\n", d->name, d->what);
+    printf("%8s %10s %10s %10s %10s %10s %12s %12s\n", "n", "source KiB", "lex ms", "pp ms", "parse ms",
+           "total ms", "allocs", "alloc MiB");
+    for (size_t i = 0; i < count; ++i) {
+        const bench_sample* s = &samples[i];
+        printf("%8zu %10.1f %10.3f %10.3f %10.3f %10.3f %12zu %12.2f\n", s->n, (double)s->source_bytes / 1024,
+               s->lex_seconds * 1e3, s->preprocess_seconds * 1e3, s->parse_seconds * 1e3, sample_seconds(s) * 1e3,
+               s->allocations, (double)s->bytes / (1 << 20));
+    }
+    double k_time = fit_exponent(samples, count, sample_seconds);
+    double k_parse = fit_exponent(samples, count, sample_parse_seconds);
+    double k_bytes = fit_exponent(samples, count, sample_bytes);
+    printf("growth: time n^%.2f (%s), parse n^%.2f (%s), bytes n^%.2f (%s)\n\n", k_time, growth_label(k_time),
+           k_parse, growth_label(k_parse), k_bytes, growth_label(k_bytes));
+}
+
+static void print_dimension_json(const bench_dimension* d, const bench_sample* samples, size_t count) {
+    printf("{\"dimension\":\"%s\",\"samples\":[", d->name);
+    for (size_t i = 0; i < count; ++i) {
+        const bench_sample* s = &samples[i];
+        printf("%s{\"n\":%zu,\"source_bytes\":%zu,\"lex_us\":%.1f,\"preprocess_us\":%.1f,\"parse_us\":%.1f,"
+               "\"allocations\":%zu,\"bytes\":%zu}",
+               i ? "," : "", s->n, s->source_bytes, s->lex_seconds * 1e6, s->preprocess_seconds * 1e6,
+               s->parse_seconds * 1e6, s->allocations, s->bytes);
+    }
+    printf("],\"time_exponent\":%.3f,\"parse_exponent\":%.3f,\"bytes_exponent\":%.3f}\n",
+           fit_exponent(samples, count, sample_seconds), fit_exponent(samples, count, sample_parse_seconds),
+           fit_exponent(samples, count, sample_bytes));
+}
+
+static bool selected(const bench_dimension* d, char** names, int num_names) {
+    if (num_names == 0) {
+        return true;
+    }
+    for (int i = 0; i < num_names; ++i) {
+        if (strcmp(names[i], d->name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char** argv) {
+    bool json = false;
+    bool quick = false;
+    int repeat = 3;
+    double max_exponent = 0;
+    int exit_code = 0;
+    char** names = malloc(argc * sizeof(char*));
+    int num_names = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (strcmp(argv[i], "--quick") == 0) {
+            quick = true;
+        } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            repeat = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--max-exponent") == 0 && i + 1 < argc) {
+            max_exponent = atof(argv[++i]);
+        } else {
+            names[num_names++] = argv[i];
+        }
+    }
+    size_t num_dimensions = sizeof(dimensions) / sizeof(dimensions[0]);
+    for (int i = 0; i < num_names; ++i) {
+        bool known = false;
+        for (size_t d = 0; d < num_dimensions; ++d) {
+            known = known || strcmp(names[i], dimensions[d].name) == 0;
+        }
+        if (!known) {
+            fprintf(stderr, "Error: unknown dimension '%s'\n", names[i]);
+            return 1;
+        }
+    }
+
+    header_cache* headers = create_header_cache();
+    for (size_t d = 0; d < num_dimensions; ++d) {
+        const bench_dimension* dimension = &dimensions[d];
+        if (!selected(dimension, names, num_names)) {
+            continue;
+        }
+        // --quick stops at the fourth size, which is still enough for a fit.
+        size_t count = quick ? 4 : sizeof(dimension->sizes) / sizeof(dimension->sizes[0]);
+        bench_sample samples[6] = {0};
+        for (size_t i = 0; i < count; ++i) {
+            buffer source = init_buffer(0);
+            dimension->generate(&source, dimension->sizes[i]);
+            samples[i].n = dimension->sizes[i];
+            samples[i].source_bytes = source.length;
+            buffer_putc(&source, '\0');
+            // Each phase keeps its best time over the repeats.
+            for (int r = 0; r < (repeat > 0 ? repeat : 1); ++r) {
+                bench_sample run;
+                run_front_end(source.data, headers, &run);
+                if (r == 0 || run.lex_seconds < samples[i].lex_seconds) {
+                    samples[i].lex_seconds = run.lex_seconds;
+                }
+                if (r == 0 || run.preprocess_seconds < samples[i].preprocess_seconds) {
+                    samples[i].preprocess_seconds = run.preprocess_seconds;
+                }
+                if (r == 0 || run.parse_seconds < samples[i].parse_seconds) {
+                    samples[i].parse_seconds = run.parse_seconds;
+                }
+                samples[i].allocations = run.allocations;
+                samples[i].bytes = run.bytes;
+            }
+            free_buffer(&source);
+        }
+        if (json) {
+            print_dimension_json(dimension, samples, count);
+        } else {
+            print_dimension_text(dimension, samples, count);
+        }
+        double exponent = fit_exponent(samples, count, sample_seconds);
+        if (max_exponent > 0 && exponent > max_exponent) {
+            fprintf(stderr, "Error: %s time grows as n^%.2f, above the allowed n^%.2f\n", dimension->name, exponent,
+                    max_exponent);
+            exit_code = 1;
+        }
+        fflush(stdout);
+    }
+    free_header_cache(headers);
+    free(names);
+    return exit_code;
+}
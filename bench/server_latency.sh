@@ -0,0 +1,53 @@
+#!/bin/sh
+# Compares per-file latency of `scc -c` run directly and through a compile
+# server.
+#
+#   bench/server_latency.sh [scc binary] [runs] [header macros]
+#
+# Every unit includes the same generated header, so the server's resident
+# header cache is what the comparison measures.
+
+SCC=${1:-_gate_build/scc}
+RUNS=${2:-50}
+MACROS=${3:-2000}
+SCC=$(cd "$(dirname "$SCC")" && pwd)/$(basename "$SCC")
+WORK=$(mktemp -d)
+SOCKET="$WORK/scc.sock"
+trap 'kill $SERVER 2>/dev/null; wait $SERVER 2>/dev/null; rm -rf "$WORK"' EXIT
+
+now_ns() {
+    date +%s%N
+}
+
+k=0
+{
+    echo "#ifndef PRELUDE_H"
+    echo "#define PRELUDE_H"
+    while [ $k -lt "$MACROS" ]; do
+        echo "#define M$k(a, b) ((a) * $((k % 7)) + (b))"
+        k=$((k + 1))
+    done
+    echo "#endif"
+} > "$WORK/prelude.h"
+printf '#include "prelude.h"\nint main() { int x = M3(4, 5); return x; }\n' > "$WORK/unit.c"
+
+"$SCC" --server="$SOCKET" 2>/dev/null &
+SERVER=$!
+while [ ! -S "$SOCKET" ]; do sleep 0.05; done
+
+measure() {
+    label=$1
+    shift
+    start=$(now_ns)
+    i=0
+    while [ $i -lt "$RUNS" ]; do
+        (cd "$WORK" && "$SCC" "$@" -c unit.c -o unit.o) || exit 1
+        i=$((i + 1))
+    done
+    elapsed=$(( $(now_ns) - start ))
+    printf '%-8s %8d.%02d ms/file\n' "$label" $((elapsed / RUNS / 1000000)) $((elapsed / RUNS / 10000 % 100))
+}
+
+printf '%-8s %11s\n' "mode" "latency"
+measure direct
+measure server "--connect=$SOCKET"
@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "buffer.h"
+#include "lexer.h"
+#include "parser.h"
+#include "typecheck.h"
+#include "lower.h"
+#include "fold.h"
+#include "codegen.h"
+#include "peephole.h"
+#include "encoder.h"
+#include "jit.h"
+
+// Times switch dispatch as the number of cases grows. Each size generates
+// three functions that map the same n values to the same results:
+//
+//   table(x)   a switch over 0..n-1, lowered to a jump table
+//   tree(x)    a switch over multiples of 97, searched as a binary tree
+//   chain(x)   one compare after another, written as while (x == k) { return v; }
+//
+// The chain is what a switch would cost without the lowering; it should
+// grow linearly while the table stays flat and the tree grows with log n.
+//
+//   scc_switch_bench [iterations] [n...]
+
+#define SPARSE_STRIDE 97
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static int case_result(size_t i) {
+    return (int)((i * 7919) % 1000);
+}
+
+static void generate(buffer* out, size_t n) {
+    buffer_puts(out, "int table(int x) {\n    switch (x) {\n");
+    for (size_t i = 0; i < n; ++i) {
+        buffer_printf(out, "        case %zu: return %d;\n", i, case_result(i));
+    }
+    buffer_puts(out, "    }\n    return -1;\n}\n");
+
+    buffer_puts(out, "int tree(int x) {\n    switch (x) {\n");
+    for (size_t i = 0; i < n; ++i) {
+        buffer_printf(out, "        case %zu: return %d;\n", i * SPARSE_STRIDE, case_result(i));
+    }
+    buffer_puts(out, "    }\n    return -1;\n}\n");
+
+    buffer_puts(out, "int chain(int x) {\n");
+    for (size_t i = 0; i < n; ++i) {
+        buffer_printf(out, "    while (x == %zu) { return %d; }\n", i, case_result(i));
+    }
+    buffer_puts(out, "    return -1;\n}\n");
+}
+
+typedef int (*dispatch_fn)(int);
+
+static dispatch_fn lookup(jit_image* image, const char* name) {
+    void* entry = jit_lookup(image, name);
+    dispatch_fn fn;
+    memcpy(&fn, &entry, sizeof(fn));
+    return fn;
+}
+
+// Calls fn on every case in turn, so the chain's average is half its length.
+static double time_dispatch(dispatch_fn fn, const int* inputs, size_t n, long iterations, int* checksum) {
+    int sum = 0;
+    double start = now_seconds();
+    for (long k = 0; k < iterations; ++k) {
+        for (size_t i = 0; i < n; ++i) {
+            sum += fn(inputs[i]);
+        }
+    }
+    double seconds = now_seconds() - start;
+    *checksum = sum;
+    return seconds * 1e9 / ((double)iterations * (double)n);
+}
+
+static bool run_size(size_t n, long iterations) {
+    buffer source = init_buffer(0);
+    generate(&source, n);
+    buffer_putc(&source, '\0');
+
+    lexer l = init_lexer_from_source("<switch bench>", source.data);
+    token* tokens = tokenizer(&l);
+    parser p = init_parser(&l, tokens);
+    ast_program_node* program = parse_program(&p);
+    typecheck_program(p.types, program);
+
+    sir_program* sir = create_sir_program();
+    lower_program(program, sir);
+    fold_sir_program(sir);
+    x86_module* module = codegen_program(sir);
+    peephole_stats peephole = { 0 };
+    peephole_module(module, &peephole);
+    x86_object* object = encode_x86_module(module);
+    jit_image image;
+    if (!jit_load(object, &image)) {
+        return false;
+    }
+    dispatch_fn table = lookup(&image, "table");
+    dispatch_fn tree = lookup(&image, "tree");
+    dispatch_fn chain = lookup(&image, "chain");
+
+    int* dense_inputs = malloc(n * sizeof(int));
+    int* sparse_inputs = malloc(n * sizeof(int));
+    for (size_t i = 0; i < n; ++i) {
+        dense_inputs[i] = (int)i;
+        sparse_inputs[i] = (int)(i * SPARSE_STRIDE);
+        if (table(dense_inputs[i]) != case_result(i) || tree(sparse_inputs[i]) != case_result(i) ||
+            chain(dense_inputs[i]) != case_result(i)) {
+            fprintf(stderr, "n = %zu: wrong result for case %zu\n", n, i);
+            return false;
+        }
+    }
+
+    long scaled = (long)(iterations / (long)n) + 1;
+    int table_sum, tree_sum, chain_sum;
+    double table_ns = time_dispatch(table, dense_inputs, n, scaled, &table_sum);
+    double tree_ns = time_dispatch(tree, sparse_inputs, n, scaled, &tree_sum);
+    double chain_ns = time_dispatch(chain, dense_inputs, n, scaled, &chain_sum);
+    if (table_sum != chain_sum || tree_sum != chain_sum) {
+        fprintf(stderr, "n = %zu: checksums differ\n", n);
+        return false;
+    }
+    printf("%6zu %12.2f %12.2f %12.2f %9.1fx\n", n, chain_ns, table_ns, tree_ns, chain_ns / table_ns);
+
+    free(dense_inputs);
+    free(sparse_inputs);
+    jit_unload(&image);
+    free_x86_object(object);
+    free_x86_module(module);
+    free_sir_program(sir);
+    free_buffer(&source);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    long iterations = argc > 1 ? atol(argv[1]) : 2000000;
+    size_t default_sizes[] = { 4, 16, 64, 256, 1024 };
+    size_t num_sizes = sizeof(default_sizes) / sizeof(default_sizes[0]);
+
+    printf("%ld calls per size\n", iterations);
+    printf("%6s %12s %12s %12s %10s\n", "cases", "chain ns", "table ns", "tree ns", "speedup");
+    if (argc > 2) {
+        for (int i = 2; i < argc; ++i) {
+            if (!run_size((size_t)atoi(argv[i]), iterations)) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    for (size_t i = 0; i < num_sizes; ++i) {
+        if (!run_size(default_sizes[i], iterations)) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "parser.h"
+#include "typecheck.h"
+#include "lower.h"
+#include "fold.h"
+#include "inline.h"
+#include "licm.h"
+#include "vectorize.h"
+#include "codegen.h"
+#include "peephole.h"
+#include "encoder.h"
+#include "jit.h"
+
+// Compares scalar code with SSE2 and AVX2 vector code on the saxpy and sum
+// kernels of one program. main runs first, and its result must be the same
+// for every target; then each kernel is timed on its own.
+//
+//   scc_vector_bench [file.c] [iterations] [n]
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+typedef struct bench_target {
+    const char* name;
+    vector_target target;
+    size_t vectorized;
+    int result;                 // of main, then of sum after the timed runs
+    int final;
+    double saxpy_ns;
+    double sum_ns;
+} bench_target;
+
+static bool run_target(ast_program_node* program, bench_target* t, long iterations, int n) {
+    sir_program* sir = create_sir_program();
+    lower_program(program, sir);
+    fold_sir_program(sir);
+    inline_options inlining = { INLINE_DEFAULT_BUDGET, NULL };
+    inline_program(sir, &inlining);
+    licm_sir_program(sir);
+    fold_sir_program(sir);
+    vectorize_options vectorizing = { t->target, NULL };
+    t->vectorized = vectorize_program(sir, &vectorizing);
+    if (t->vectorized > 0) {
+        fold_sir_program(sir);
+    }
+    x86_module* module = codegen_program(sir);
+    peephole_stats peephole = { 0 };
+    peephole_module(module, &peephole);
+    x86_object* object = encode_x86_module(module);
+    jit_image image;
+    if (!jit_load(object, &image)) {
+        return false;
+    }
+
+    void* entry = jit_lookup(&image, "main");
+    int (*native_main)(void);
+    memcpy(&native_main, &entry, sizeof(native_main));
+    entry = jit_lookup(&image, "saxpy");
+    int (*saxpy)(int, int);
+    memcpy(&saxpy, &entry, sizeof(saxpy));
+    entry = jit_lookup(&image, "sum");
+    int (*sum)(int);
+    memcpy(&sum, &entry, sizeof(sum));
+    if (native_main == NULL || saxpy == NULL || sum == NULL) {
+        fprintf(stderr, "the program needs main, saxpy(int, int) and sum(int)\n");
+        return false;
+    }
+    t->result = native_main();
+
+    volatile int sink = 0;
+    double start = now_seconds();
+    for (long i = 0; i < iterations; ++i) {
+        sink += saxpy(n, 3);
+    }
+    t->saxpy_ns = (now_seconds() - start) * 1e9 / (double)iterations;
+
+    start = now_seconds();
+    for (long i = 0; i < iterations; ++i) {
+        sink += sum(n);
+    }
+    t->sum_ns = (now_seconds() - start) * 1e9 / (double)iterations;
+    t->final = sum(n);
+
+    jit_unload(&image);
+    free_x86_object(object);
+    free_x86_module(module);
+    free_sir_program(sir);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    char* file = argc > 1 ? argv[1] : "bench/vector_kernel.c";
+    long iterations = argc > 2 ? atol(argv[2]) : 100000;
+    int n = argc > 3 ? atoi(argv[3]) : 4096;
+
+    lexer l = init_lexer(file);
+    token* tokens = tokenizer(&l);
+    parser p = init_parser(&l, tokens);
+    ast_program_node* program = parse_program(&p);
+    typecheck_program(p.types, program);
+
+    bench_target targets[] = {
+        { "scalar", VECTOR_NONE, 0, 0, 0, 0, 0 },
+        { "sse2", VECTOR_SSE2, 0, 0, 0, 0, 0 },
+        { "avx2", VECTOR_AVX2, 0, 0, 0, 0, 0 },
+    };
+    size_t num_targets = sizeof(targets) / sizeof(targets[0]);
+#if defined(__GNUC__)
+    if (!__builtin_cpu_supports("avx2")) {
+        num_targets--;
+    }
+#endif
+
+    for (size_t i = 0; i < num_targets; ++i) {
+        if (!run_target(program, &targets[i], iterations, n)) {
+            return 1;
+        }
+        if (targets[i].result != targets[0].result || targets[i].final != targets[0].final) {
+            fprintf(stderr, "results differ: scalar=%d/%d %s=%d/%d\n", targets[0].result, targets[0].final,
+                    targets[i].name, targets[i].result, targets[i].final);
+            return 1;
+        }
+    }
+
+    printf("file: %s (%ld iterations, n = %d)\n", file, iterations, n);
+    printf("%-8s %10s %14s %14s %10s\n", "target", "loops", "saxpy ns/run", "sum ns/run", "speedup");
+    for (size_t i = 0; i < num_targets; ++i) {
+        bench_target* t = &targets[i];
+        double speedup = (targets[0].saxpy_ns + targets[0].sum_ns) / (t->saxpy_ns + t->sum_ns);
+        printf("%-8s %10zu %14.1f %14.1f %9.2fx\n", t->name, t->vectorized, t->saxpy_ns, t->sum_ns, speedup);
+    }
+    return 0;
+}
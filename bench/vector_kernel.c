@@ -0,0 +1,26 @@
+int x[4096];
+int y[4096];
+
+int saxpy(int n, int a) {
+    for (int i = 0; i < n; i = i + 1) {
+        y[i] = a * x[i] + y[i];
+    }
+    return 0;
+}
+
+int sum(int n) {
+    int s = 0;
+    for (int i = 0; i < n; i = i + 1) {
+        s = s + y[i];
+    }
+    return s;
+}
+
+int main() {
+    for (int i = 0; i < 4096; i = i + 1) {
+        x[i] = i % 13 - 6;
+        y[i] = i % 7;
+    }
+    saxpy(4093, 3);
+    return sum(4095) % 256;
+}
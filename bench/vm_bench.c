@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "parser.h"
+#include "typecheck.h"
+#include "lower.h"
+#include "fold.h"
+#include "inline.h"
+#include "codegen.h"
+#include "encoder.h"
+#include "jit.h"
+#include "bytecode.h"
+
+// Compares the bytecode tier with native code from the JIT on one program:
+// time to get something runnable, and time per execution of main.
+//
+//   scc_vm_bench [file.c] [iterations]
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char** argv) {
+    char* file = argc > 1 ? argv[1] : "bench/arith_kernel.c";
+    long iterations = argc > 2 ? atol(argv[2]) : 200000;
+
+    lexer l = init_lexer(file);
+    token* tokens = tokenizer(&l);
+    parser p = init_parser(&l, tokens);
+    ast_program_node* program = parse_program(&p);
+    typecheck_program(p.types, program);
+
+    double start = now_seconds();
+    bc_program* bc = compile_bytecode(program);
+    double bc_compile = now_seconds() - start;
+
+    start = now_seconds();
+    sir_program* sir = create_sir_program();
+    lower_program(program, sir);
+    fold_sir_program(sir);
+    inline_options inlining = { INLINE_DEFAULT_BUDGET, NULL };
+    inline_program(sir, &inlining);
+    x86_module* module = codegen_program(sir);
+    x86_object* object = encode_x86_module(module);
+    jit_image image;
+    if (!jit_load(object, &image)) {
+        return 1;
+    }
+    double native_compile = now_seconds() - start;
+
+    bc_function* bc_main = find_bc_function(bc, "main");
+    void* entry = jit_lookup(&image, "main");
+    int (*native_main)(void);
+    memcpy(&native_main, &entry, sizeof(native_main));
+
+    int bc_result = vm_execute(bc, bc_main);
+    int native_result = native_main();
+    if (bc_result != native_result) {
+        fprintf(stderr, "results differ: bytecode=%d native=%d\n", bc_result, native_result);
+        return 1;
+    }
+
+    volatile int sink = 0;
+    start = now_seconds();
+    for (long i = 0; i < iterations; ++i) {
+        sink += vm_execute(bc, bc_main);
+    }
+    double bc_run = now_seconds() - start;
+
+    start = now_seconds();
+    for (long i = 0; i < iterations; ++i) {
+        sink += native_main();
+    }
+    double native_run = now_seconds() - start;
+
+    size_t bc_insts = 0;
+    for (size_t i = 0; i < bc->num_functions; ++i) {
+        bc_insts += bc->functions[i]->num_code;
+    }
+
+    printf("file: %s (%ld iterations)\n", file, iterations);
+    printf("%-10s %14s %14s\n", "tier", "compile (us)", "ns/run");
+    printf("%-10s %14.2f %14.2f\n", "bytecode", bc_compile * 1e6, bc_run * 1e9 / (double)iterations);
+    printf("%-10s %14.2f %14.2f\n", "native", native_compile * 1e6, native_run * 1e9 / (double)iterations);
+    printf("bytecode/native run time: %.2fx, %zu instructions, %zu superinstructions\n",
+           bc_run / native_run, bc_insts, bc->superinstructions);
+
+    jit_unload(&image);
+    free_x86_object(object);
+    free_x86_module(module);
+    free_sir_program(sir);
+    free_bc_program(bc);
+    return 0;
+}
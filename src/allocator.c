@@ -0,0 +1,138 @@
+#include "allocator.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "compat.h"
+
+// Tracked blocks carry a link into their region's list in front of the
+// data; the union keeps the data maximally aligned.
+typedef union alloc_header {
+    struct {
+        union alloc_header* prev;
+        union alloc_header* next;
+    } link;
+    max_align_t align;
+} alloc_header;
+
+static SCC_THREAD_LOCAL alloc_counters counters;
+static SCC_THREAD_LOCAL alloc_region* current_region;
+
+void init_alloc_region(alloc_region* region) {
+    region->head = NULL;
+}
+
+alloc_region* set_alloc_region(alloc_region* region) {
+    alloc_region* previous = current_region;
+    current_region = region;
+    return previous;
+}
+
+void free_alloc_region(alloc_region* region) {
+    alloc_header* block = region->head;
+    while (block != NULL) {
+        alloc_header* next = block->link.next;
+        free(block);
+        block = next;
+    }
+    region->head = NULL;
+}
+
+static bool is_tracked(alloc_category category) {
+    return current_region != NULL && category != ALLOC_LEXER;
+}
+
+static void link_block(alloc_region* region, alloc_header* block) {
+    block->link.prev = NULL;
+    block->link.next = region->head;
+    if (region->head != NULL) {
+        region->head->link.prev = block;
+    }
+    region->head = block;
+}
+
+static void unlink_block(alloc_region* region, alloc_header* block) {
+    if (block->link.prev != NULL) {
+        block->link.prev->link.next = block->link.next;
+    } else {
+        region->head = block->link.next;
+    }
+    if (block->link.next != NULL) {
+        block->link.next->link.prev = block->link.prev;
+    }
+}
+
+static void* tracked_realloc(void* ptr, size_t size) {
+    alloc_header* block = ptr != NULL ? (alloc_header*)ptr - 1 : NULL;
+    if (block != NULL) {
+        unlink_block(current_region, block);
+    }
+    alloc_header* moved = realloc(block, sizeof(alloc_header) + size);
+    if (moved == NULL) {
+        if (block != NULL) {
+            link_block(current_region, block);
+        }
+        return NULL;
+    }
+    link_block(current_region, moved);
+    return moved + 1;
+}
+
+void* counted_malloc(alloc_category category, size_t size) {
+    counters.allocations[category]++;
+    counters.bytes[category] += size;
+    return is_tracked(category) ? tracked_realloc(NULL, size) : malloc(size);
+}
+
+// A realloc is counted as a fresh allocation of the new size; that is what
+// it costs when the block has to move.
+void* counted_realloc(alloc_category category, void* ptr, size_t size) {
+    counters.allocations[category]++;
+    counters.bytes[category] += size;
+    return is_tracked(category) ? tracked_realloc(ptr, size) : realloc(ptr, size);
+}
+
+// Blocks must be freed under the region they were allocated in.
+void counted_free(alloc_category category, void* ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    if (is_tracked(category)) {
+        alloc_header* block = (alloc_header*)ptr - 1;
+        unlink_block(current_region, block);
+        free(block);
+    } else {
+        free(ptr);
+    }
+}
+
+char* counted_strdup(alloc_category category, const char* str) {
+    size_t size = strlen(str) + 1;
+    char* copy = counted_malloc(category, size);
+    if (copy != NULL) {
+        memcpy(copy, str, size);
+    }
+    return copy;
+}
+
+alloc_counters* current_alloc_counters() {
+    return &counters;
+}
+
+const char* alloc_category_tostring(alloc_category category) {
+    switch (category) {
+        case ALLOC_LEXER:
+            return "lexer";
+        case ALLOC_AST:
+            return "ast";
+        case ALLOC_SYMBOLS:
+            return "symbols";
+        case ALLOC_IR:
+            return "ir";
+        case ALLOC_CODEGEN:
+            return "codegen";
+        default:
+            return "unknown";
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include <stddef.h>
+
+// Counting wrappers for the front end's allocations. Counters are per
+// thread, so concurrent compilations never share them.
+typedef enum {
+    ALLOC_LEXER,
+    ALLOC_AST,
+    ALLOC_SYMBOLS,
+    ALLOC_IR,
+    ALLOC_CODEGEN,
+    NUM_ALLOC_CATEGORIES,
+} alloc_category;
+
+typedef struct alloc_counters {
+    size_t allocations[NUM_ALLOC_CATEGORIES];
+    size_t bytes[NUM_ALLOC_CATEGORIES];
+} alloc_counters;
+
+// Owns every counted allocation but the lexer's made on its thread while
+// installed, so a compilation's trees go away in one call however it ended.
+// Lexer allocations have explicit owners that free them and are never
+// tracked.
+typedef struct alloc_region {
+    union alloc_header* head;
+} alloc_region;
+
+void init_alloc_region(alloc_region* region);
+alloc_region* set_alloc_region(alloc_region* region);
+void free_alloc_region(alloc_region* region);
+void* counted_malloc(alloc_category category, size_t size);
+void* counted_realloc(alloc_category category, void* ptr, size_t size);
+void counted_free(alloc_category category, void* ptr);
+char* counted_strdup(alloc_category category, const char* str);
+alloc_counters* current_alloc_counters();
+const char* alloc_category_tostring(alloc_category category);
+
+#endif // ALLOCATOR_H
@@ -1,5 +1,7 @@
 #include "ast.h"
 
+#include <stdint.h>
+
 
 const char* type_tostring(builtin_types type){
     switch (type) {
@@ -20,98 +22,175 @@ const char* type_tostring(builtin_types type){
     }
 }
 
-void print_ast_node(ast_node* node, int level) {
+// Indentation and fixed text go straight into the buffer; only names and
+// values need formatting.
+static void put_line(buffer* out, int level, const char* label, const char* value) {
+    buffer_pad(out, ' ', 2 * (size_t)level);
+    buffer_puts(out, label);
+    if (value != NULL) {
+        buffer_puts(out, value);
+    }
+    buffer_putc(out, '\n');
+}
+
+void print_ast_node(ast_node* node, int level, buffer* out) {
     if (node == NULL) {
-        printf("ROOT!\n");
+        buffer_puts(out, "ROOT!\n");
         return;
     }
-    for (int i = 0; i < level; i++) {
-        printf("  ");
-    }
 
     switch (node->type) {
-        case AST_FUNCTION_DECL:
-            printf("Function Declaration\n");
-            ast_function_decl_node * function_node_decl = (ast_function_decl_node*)node;
-            printf("return type: %s\n", type_tostring(function_node_decl->return_type));
-            printf("Parameters: \n");
+        case AST_FUNCTION_DECL: {
+            ast_function_decl_node* function_node_decl = (ast_function_decl_node*)node;
+            put_line(out, level, "Function Declaration", NULL);
+            put_line(out, 0, "return type: ", type_tostring(function_node_decl->return_type));
+            buffer_puts(out, "Parameters: \n");
             for (size_t i = 0; i < function_node_decl->num_parameters; ++i) {
-                print_ast_node(function_node_decl->parameters[i], 1);
+                print_ast_node(function_node_decl->parameters[i], 1, out);
             }
-            printf("Body: \n");
+            buffer_puts(out, "Body: \n");
             for (size_t i = 0; i < function_node_decl->body->num_declarations; ++i) {
-                print_ast_node(function_node_decl->body->declarations[i], 1);
+                print_ast_node(function_node_decl->body->declarations[i], 1, out);
             }
             break;
+        }
         case AST_VARIABLE_DECL: {
             ast_variable_decl_node* var_decl = (ast_variable_decl_node*)node;
-            printf("Variable Declaration\n");
-            for (int i = 0; i < level; i++) {
-                printf("  ");
-            }
-            char* constant = "false";
-            if (var_decl->is_constant){
-                constant = "true";
+            put_line(out, level, "Variable Declaration", NULL);
+            put_line(out, level + 1, "constant = ", var_decl->is_constant ? "true" : "false");
+            put_line(out, 2, "Type: ", type_tostring(var_decl->type_node));
+            if (var_decl->array_length > 0) {
+                char length[32];
+                snprintf(length, sizeof(length), "%zu", var_decl->array_length);
+                put_line(out, level + 1, "Length: ", length);
             }
-            printf("  constant = %s\n", constant);
-            printf("    Type: %s\n",type_tostring(var_decl->type_node));
-            print_ast_node(var_decl->identifier_node, level + 1);
+            print_ast_node(var_decl->identifier_node, level + 1, out);
             if (var_decl->value != NULL) {
-                print_ast_node(var_decl->value, level + 1);
+                print_ast_node(var_decl->value, level + 1, out);
             }
             break;
         }
         case AST_IDENTIFIER:
-            printf("Identifier: %s\n", node->value);
+            put_line(out, level, "Identifier: ", node->value);
             break;
-        case AST_RETURN_STMT:
+        case AST_RETURN_STMT: {
             ast_return_node* return_stmt = (ast_return_node*)node;
-            printf("Return Statement\n");
-            print_ast_node(return_stmt->expr, level + 1);
+            put_line(out, level, "Return Statement", NULL);
+            if (return_stmt->expr != NULL) {
+                print_ast_node(return_stmt->expr, level + 1, out);
+            }
             break;
+        }
         case AST_PARAMETER:
-            printf("Parameter\n");
+            put_line(out, level, "Parameter", NULL);
             break;
-        case AST_BINARY_EXPR:
+        case AST_BINARY_EXPR: {
             ast_binary_expr_node* binary_epxr = (ast_binary_expr_node*)node;
-            printf("Binary Expression: %s\n", node->value);
-            print_ast_node(binary_epxr->left, level + 1);
-            for (int i = 0; i < level; i++) {
-                printf("  ");
-            }
-            printf("  oprator:  %s\n", op_ToString(binary_epxr->op));
-            print_ast_node(binary_epxr->right, level + 1);
+            put_line(out, level, "Binary Expression", NULL);
+            print_ast_node(binary_epxr->left, level + 1, out);
+            put_line(out, level + 1, "oprator:  ", op_ToString(binary_epxr->op));
+            print_ast_node(binary_epxr->right, level + 1, out);
             break;
-        case AST_UNARY_EXPR:
-            printf("Unary Expression: %s\n", node->value);
+        }
+        case AST_UNARY_EXPR: {
+            ast_unary_expr_node* unary_expr = (ast_unary_expr_node*)node;
+            put_line(out, level, "Unary Expression: ", op_ToString(unary_expr->op));
+            print_ast_node(unary_expr->operand, level + 1, out);
             break;
-        case AST_ASSIGNMENT:
+        }
+        case AST_ASSIGNMENT: {
             ast_assignment_node* var_decl = (ast_assignment_node*)node;
-            printf("Variable Assignment: %s\n", node->value);
-            printf("  Identifier: %s\n", var_decl->identifier_node->value);
-            // Print value
+            put_line(out, level, "Variable Assignment", NULL);
+            put_line(out, level + 1, "Identifier: ", var_decl->identifier_node->value);
+            if (var_decl->index != NULL) {
+                put_line(out, level + 1, "Index:", NULL);
+                print_ast_node(var_decl->index, level + 2, out);
+            }
             if (var_decl->value != NULL) {
-                printf("  Value: ");
-                print_ast_node(var_decl->value, level + 1);
+                put_line(out, level + 1, "Value:", NULL);
+                print_ast_node(var_decl->value, level + 2, out);
             }
             break;
+        }
         case AST_PROGRAM:
-            printf("Program\n");
+            put_line(out, level, "Program", NULL);
             break;
-        case AST_BLOCK:
-            printf("Block: \n");
-            ast_block_node * block_node_decl = (ast_block_node*)node;
+        case AST_BLOCK: {
+            ast_block_node* block_node_decl = (ast_block_node*)node;
+            put_line(out, level, "Block: ", NULL);
             for (size_t i = 0; i < block_node_decl->num_declarations; ++i) {
-                print_ast_node(block_node_decl->declarations[i], 0);
+                print_ast_node(block_node_decl->declarations[i], level + 1, out);
             }
             break;
+        }
         case AST_LITERAL:
-            printf("Literal: %s\n", node->value);
+            put_line(out, level, "Literal: ", node->value);
+            break;
+        case AST_CALL_EXPR: {
+            ast_call_expr_node* call = (ast_call_expr_node*)node;
+            put_line(out, level, "Call: ", call->function_name);
+            for (size_t i = 0; i < call->num_arguments; ++i) {
+                print_ast_node(call->arguments[i], level + 1, out);
+            }
+            break;
+        }
+        case AST_WHILE_STMT:
+        case AST_DO_WHILE_STMT:
+        case AST_FOR_STMT: {
+            ast_loop_node* loop = (ast_loop_node*)node;
+            const char* label = node->type == AST_WHILE_STMT ? "While" : node->type == AST_FOR_STMT ? "For" : "Do While";
+            put_line(out, level, label, NULL);
+            if (loop->init != NULL) {
+                put_line(out, level + 1, "Init:", NULL);
+                print_ast_node(loop->init, level + 2, out);
+            }
+            if (loop->condition != NULL) {
+                put_line(out, level + 1, "Condition:", NULL);
+                print_ast_node(loop->condition, level + 2, out);
+            }
+            if (loop->step != NULL) {
+                put_line(out, level + 1, "Step:", NULL);
+                print_ast_node(loop->step, level + 2, out);
+            }
+            put_line(out, level + 1, "Body:", NULL);
+            print_ast_node(loop->body, level + 2, out);
+            break;
+        }
+        case AST_BREAK_STMT:
+            put_line(out, level, "Break", NULL);
             break;
+        case AST_CONTINUE_STMT:
+            put_line(out, level, "Continue", NULL);
+            break;
+        case AST_INDEX_EXPR: {
+            ast_index_expr_node* index = (ast_index_expr_node*)node;
+            put_line(out, level, "Index Expression", NULL);
+            print_ast_node(index->array, level + 1, out);
+            print_ast_node(index->index, level + 1, out);
+            break;
+        }
+        case AST_SWITCH_STMT: {
+            ast_switch_node* switch_stmt = (ast_switch_node*)node;
+            put_line(out, level, "Switch", NULL);
+            put_line(out, level + 1, "Condition:", NULL);
+            print_ast_node(switch_stmt->condition, level + 2, out);
+            put_line(out, level + 1, "Body:", NULL);
+            print_ast_node(switch_stmt->body, level + 2, out);
+            break;
+        }
+        case AST_CASE_LABEL: {
+            ast_case_node* label = (ast_case_node*)node;
+            if (label->value == NULL) {
+                put_line(out, level, "Default", NULL);
+            } else {
+                put_line(out, level, "Case", NULL);
+                print_ast_node(label->value, level + 1, out);
+            }
+            break;
+        }
         default:
-            printf("Unknown Node Type\n");
+            put_line(out, level, "Unknown Node Type", NULL);
     }
-
 }
 
 const char* op_ToString(operator_type op){
@@ -138,29 +217,408 @@ const char* op_ToString(operator_type op){
             return "+=";
         case OP_DECREMENT:
             return "-=";
+        case OP_LESS:
+            return "<";
+        case OP_LESS_EQUAL:
+            return "<=";
+        case OP_GREATER:
+            return ">";
+        case OP_GREATER_EQUAL:
+            return ">=";
+    }
+}
+
+long long ast_literal_value(ast_node* node) {
+    if (node->type_str != NULL && strcmp(node->type_str, "double") == 0) {
+        fatal_error("Error: floating point literal %s is not supported here\n", node->value);
+    }
+    if (node->type_str != NULL && strcmp(node->type_str, "char") == 0) {
+        const char* value = node->value;
+        if (value[0] == '\\') {
+            switch (value[1]) {
+                case 'n': return '\n';
+                case 'r': return '\r';
+                case 't': return '\t';
+                case '0': return '\0';
+                case 'f': return '\f';
+                case 'a': return '\a';
+                default: return value[1];
+            }
+        }
+        return (signed char)value[0];
+    }
+    return strtoll(node->value, NULL, 0);
+}
+
+// Folds a constant expression, as required for global initializers.
+long long ast_eval_constant(ast_node* node) {
+    switch (node->type) {
+        case AST_LITERAL:
+            return ast_literal_value(node);
+        case AST_UNARY_EXPR: {
+            ast_unary_expr_node* unary = (ast_unary_expr_node*)node;
+            long long operand = ast_eval_constant(unary->operand);
+            switch (unary->op) {
+                case OP_ADD: return operand;
+                case OP_SUBTRACT: return -operand;
+                case OP_LOGICAL_NOT: return !operand;
+                default: break;
+            }
+            break;
+        }
+        case AST_BINARY_EXPR: {
+            ast_binary_expr_node* binary = (ast_binary_expr_node*)node;
+            long long left = ast_eval_constant(binary->left);
+            long long right = ast_eval_constant(binary->right);
+            switch (binary->op) {
+                case OP_ADD: return left + right;
+                case OP_SUBTRACT: return left - right;
+                case OP_MULTIPLY: return left * right;
+                case OP_DIVIDE:
+                case OP_MODULO:
+                    if (right == 0) {
+                        fatal_error("Error: division by zero in constant expression\n");
+                    }
+                    return binary->op == OP_DIVIDE ? left / right : left % right;
+                case OP_EQUAL: return left == right;
+                case OP_NOT_EQUAL: return left != right;
+                case OP_LESS: return left < right;
+                case OP_LESS_EQUAL: return left <= right;
+                case OP_GREATER: return left > right;
+                case OP_GREATER_EQUAL: return left >= right;
+                default: break;
+            }
+            break;
+        }
+        default:
+            break;
     }
+    fatal_error("Error: global initializer is not a constant expression\n");
 }
 
-void print_ast(ast_program_node* root) {
+void print_ast(ast_program_node* root, buffer* out) {
     if (root == NULL || root->num_declarations <= 0) {
-        printf("AST is empty.\n");
+        buffer_printf(out, "AST is empty.\n");
     } else {
-        printf("SIZE OF AST: %zu\n", root->num_declarations);
+        buffer_printf(out, "SIZE OF AST: %zu\n", root->num_declarations);
         for (size_t i = 0; i < root->num_declarations; ++i) {
-            print_ast_node(root->declarations[i], 0);
+            print_ast_node(root->declarations[i], 0, out);
+        }
+    }
+}
+
+static void put_u8(buffer* out, uint8_t value) {
+    buffer_putc(out, (char)value);
+}
+
+static void put_u32(buffer* out, uint32_t value) {
+    buffer_append(out, &value, sizeof(value));
+}
+
+static void put_string(buffer* out, const char* str) {
+    if (str == NULL) {
+        put_u32(out, AST_BINARY_NULL_STRING);
+        return;
+    }
+    uint32_t length = (uint32_t)strlen(str);
+    put_u32(out, length);
+    buffer_append(out, str, length + 1);
+}
+
+void write_ast_node_binary(ast_node* node, buffer* out) {
+    if (node == NULL) {
+        put_u8(out, AST_BINARY_NULL_NODE);
+        return;
+    }
+    put_u8(out, (uint8_t)node->type);
+    switch (node->type) {
+        case AST_FUNCTION_DECL: {
+            ast_function_decl_node* function = (ast_function_decl_node*)node;
+            put_u8(out, (uint8_t)function->return_type);
+            put_string(out, function->function_name);
+            put_u32(out, (uint32_t)function->num_parameters);
+            for (size_t i = 0; i < function->num_parameters; ++i) {
+                write_ast_node_binary(function->parameters[i], out);
+            }
+            write_ast_node_binary((ast_node*)function->body, out);
+            break;
+        }
+        case AST_VARIABLE_DECL: {
+            ast_variable_decl_node* variable = (ast_variable_decl_node*)node;
+            put_u8(out, (uint8_t)variable->type_node);
+            put_u8(out, variable->is_constant);
+            put_u32(out, (uint32_t)variable->array_length);
+            write_ast_node_binary(variable->identifier_node, out);
+            write_ast_node_binary(variable->value, out);
+            break;
+        }
+        case AST_RETURN_STMT:
+            write_ast_node_binary(((ast_return_node*)node)->expr, out);
+            break;
+        case AST_BINARY_EXPR: {
+            ast_binary_expr_node* binary = (ast_binary_expr_node*)node;
+            put_u8(out, (uint8_t)binary->op);
+            write_ast_node_binary(binary->left, out);
+            write_ast_node_binary(binary->right, out);
+            break;
+        }
+        case AST_UNARY_EXPR: {
+            ast_unary_expr_node* unary = (ast_unary_expr_node*)node;
+            put_u8(out, (uint8_t)unary->op);
+            write_ast_node_binary(unary->operand, out);
+            break;
+        }
+        case AST_ASSIGNMENT: {
+            ast_assignment_node* assignment = (ast_assignment_node*)node;
+            write_ast_node_binary(assignment->identifier_node, out);
+            write_ast_node_binary(assignment->value, out);
+            write_ast_node_binary(assignment->index, out);
+            break;
+        }
+        case AST_BLOCK: {
+            ast_block_node* block = (ast_block_node*)node;
+            put_u32(out, (uint32_t)block->num_declarations);
+            for (size_t i = 0; i < block->num_declarations; ++i) {
+                write_ast_node_binary(block->declarations[i], out);
+            }
+            break;
+        }
+        case AST_IDENTIFIER:
+        case AST_LITERAL:
+        case AST_PARAMETER:
+            put_string(out, node->value);
+            put_string(out, node->type_str);
+            break;
+        case AST_CALL_EXPR: {
+            ast_call_expr_node* call = (ast_call_expr_node*)node;
+            put_string(out, call->function_name);
+            put_u32(out, (uint32_t)call->num_arguments);
+            for (size_t i = 0; i < call->num_arguments; ++i) {
+                write_ast_node_binary(call->arguments[i], out);
+            }
+            break;
+        }
+        case AST_WHILE_STMT:
+        case AST_DO_WHILE_STMT:
+        case AST_FOR_STMT: {
+            ast_loop_node* loop = (ast_loop_node*)node;
+            write_ast_node_binary(loop->init, out);
+            write_ast_node_binary(loop->condition, out);
+            write_ast_node_binary(loop->step, out);
+            write_ast_node_binary(loop->body, out);
+            break;
+        }
+        case AST_BREAK_STMT:
+        case AST_CONTINUE_STMT:
+            break;
+        case AST_INDEX_EXPR: {
+            ast_index_expr_node* index = (ast_index_expr_node*)node;
+            write_ast_node_binary(index->array, out);
+            write_ast_node_binary(index->index, out);
+            break;
+        }
+        case AST_SWITCH_STMT: {
+            ast_switch_node* switch_stmt = (ast_switch_node*)node;
+            write_ast_node_binary(switch_stmt->condition, out);
+            write_ast_node_binary(switch_stmt->body, out);
+            break;
+        }
+        case AST_CASE_LABEL:
+            write_ast_node_binary(((ast_case_node*)node)->value, out);
+            break;
+        default:
+            fatal_error("Error: cannot encode AST node of type %d\n", node->type);
+    }
+}
+
+void dump_ast_binary(ast_program_node* root, buffer* out) {
+    buffer_append(out, AST_BINARY_MAGIC, 8);
+    put_u32(out, (uint32_t)root->num_declarations);
+    for (size_t i = 0; i < root->num_declarations; ++i) {
+        write_ast_node_binary(root->declarations[i], out);
+    }
+}
+
+static void put_json_nodes(buffer* out, const char* key, ast_node** nodes, size_t count);
+
+static void put_json_node(buffer* out, ast_node* node) {
+    if (node == NULL) {
+        buffer_puts(out, "null");
+        return;
+    }
+    switch (node->type) {
+        case AST_FUNCTION_DECL: {
+            ast_function_decl_node* function = (ast_function_decl_node*)node;
+            buffer_puts(out, "{\"kind\":\"function\",\"name\":");
+            buffer_put_json_string(out, function->function_name);
+            buffer_puts(out, ",\"return_type\":");
+            buffer_put_json_string(out, type_tostring(function->return_type));
+            put_json_nodes(out, ",\"parameters\":", function->parameters, function->num_parameters);
+            put_json_nodes(out, ",\"body\":", function->body->declarations, function->body->num_declarations);
+            break;
+        }
+        case AST_VARIABLE_DECL: {
+            ast_variable_decl_node* variable = (ast_variable_decl_node*)node;
+            buffer_puts(out, "{\"kind\":\"variable\",\"name\":");
+            buffer_put_json_string(out, variable->identifier_node->value);
+            buffer_puts(out, ",\"type\":");
+            buffer_put_json_string(out, type_tostring(variable->type_node));
+            if (variable->array_length > 0) {
+                buffer_printf(out, ",\"length\":%zu", variable->array_length);
+            }
+            buffer_puts(out, variable->is_constant ? ",\"const\":true,\"value\":" : ",\"const\":false,\"value\":");
+            put_json_node(out, variable->value);
+            break;
+        }
+        case AST_RETURN_STMT:
+            buffer_puts(out, "{\"kind\":\"return\",\"value\":");
+            put_json_node(out, ((ast_return_node*)node)->expr);
+            break;
+        case AST_BINARY_EXPR: {
+            ast_binary_expr_node* binary = (ast_binary_expr_node*)node;
+            buffer_puts(out, "{\"kind\":\"binary\",\"op\":");
+            buffer_put_json_string(out, op_ToString(binary->op));
+            buffer_puts(out, ",\"left\":");
+            put_json_node(out, binary->left);
+            buffer_puts(out, ",\"right\":");
+            put_json_node(out, binary->right);
+            break;
+        }
+        case AST_UNARY_EXPR: {
+            ast_unary_expr_node* unary = (ast_unary_expr_node*)node;
+            buffer_puts(out, "{\"kind\":\"unary\",\"op\":");
+            buffer_put_json_string(out, op_ToString(unary->op));
+            buffer_puts(out, ",\"operand\":");
+            put_json_node(out, unary->operand);
+            break;
+        }
+        case AST_ASSIGNMENT: {
+            ast_assignment_node* assignment = (ast_assignment_node*)node;
+            buffer_puts(out, "{\"kind\":\"assignment\",\"name\":");
+            buffer_put_json_string(out, assignment->identifier_node->value);
+            if (assignment->index != NULL) {
+                buffer_puts(out, ",\"index\":");
+                put_json_node(out, assignment->index);
+            }
+            buffer_puts(out, ",\"value\":");
+            put_json_node(out, assignment->value);
+            break;
+        }
+        case AST_BLOCK: {
+            ast_block_node* block = (ast_block_node*)node;
+            buffer_puts(out, "{\"kind\":\"block\"");
+            put_json_nodes(out, ",\"body\":", block->declarations, block->num_declarations);
+            break;
+        }
+        case AST_IDENTIFIER:
+            buffer_puts(out, "{\"kind\":\"identifier\",\"name\":");
+            buffer_put_json_string(out, node->value);
+            break;
+        case AST_LITERAL:
+            buffer_puts(out, "{\"kind\":\"literal\",\"value\":");
+            buffer_put_json_string(out, node->value);
+            buffer_puts(out, ",\"type\":");
+            buffer_put_json_string(out, node->type_str);
+            break;
+        case AST_PARAMETER:
+            buffer_puts(out, "{\"kind\":\"parameter\",\"name\":");
+            buffer_put_json_string(out, node->value);
+            buffer_puts(out, ",\"type\":");
+            buffer_put_json_string(out, node->type_str);
+            break;
+        case AST_CALL_EXPR: {
+            ast_call_expr_node* call = (ast_call_expr_node*)node;
+            buffer_puts(out, "{\"kind\":\"call\",\"name\":");
+            buffer_put_json_string(out, call->function_name);
+            put_json_nodes(out, ",\"arguments\":", call->arguments, call->num_arguments);
+            break;
+        }
+        case AST_WHILE_STMT:
+        case AST_DO_WHILE_STMT:
+        case AST_FOR_STMT: {
+            ast_loop_node* loop = (ast_loop_node*)node;
+            const char* kind = node->type == AST_WHILE_STMT ? "while" : node->type == AST_FOR_STMT ? "for" : "do_while";
+            buffer_printf(out, "{\"kind\":\"%s\"", kind);
+            if (node->type == AST_FOR_STMT) {
+                buffer_puts(out, ",\"init\":");
+                put_json_node(out, loop->init);
+            }
+            buffer_puts(out, ",\"condition\":");
+            put_json_node(out, loop->condition);
+            if (node->type == AST_FOR_STMT) {
+                buffer_puts(out, ",\"step\":");
+                put_json_node(out, loop->step);
+            }
+            buffer_puts(out, ",\"body\":");
+            put_json_node(out, loop->body);
+            break;
+        }
+        case AST_BREAK_STMT:
+            buffer_puts(out, "{\"kind\":\"break\"");
+            break;
+        case AST_CONTINUE_STMT:
+            buffer_puts(out, "{\"kind\":\"continue\"");
+            break;
+        case AST_INDEX_EXPR: {
+            ast_index_expr_node* index = (ast_index_expr_node*)node;
+            buffer_puts(out, "{\"kind\":\"index\",\"array\":");
+            buffer_put_json_string(out, index->array->value);
+            buffer_puts(out, ",\"index\":");
+            put_json_node(out, index->index);
+            break;
+        }
+        case AST_SWITCH_STMT: {
+            ast_switch_node* switch_stmt = (ast_switch_node*)node;
+            buffer_puts(out, "{\"kind\":\"switch\",\"condition\":");
+            put_json_node(out, switch_stmt->condition);
+            buffer_puts(out, ",\"body\":");
+            put_json_node(out, switch_stmt->body);
+            break;
         }
+        case AST_CASE_LABEL: {
+            ast_case_node* label = (ast_case_node*)node;
+            if (label->value == NULL) {
+                buffer_puts(out, "{\"kind\":\"default\"");
+            } else {
+                buffer_puts(out, "{\"kind\":\"case\",\"value\":");
+                put_json_node(out, label->value);
+            }
+            break;
+        }
+        default:
+            buffer_printf(out, "{\"kind\":\"unknown\",\"type\":%d", (int)node->type);
+            break;
     }
+    buffer_putc(out, '}');
+}
+
+static void put_json_nodes(buffer* out, const char* key, ast_node** nodes, size_t count) {
+    buffer_puts(out, key);
+    buffer_putc(out, '[');
+    for (size_t i = 0; i < count; ++i) {
+        if (i > 0) {
+            buffer_putc(out, ',');
+        }
+        put_json_node(out, nodes[i]);
+    }
+    buffer_putc(out, ']');
+}
+
+// One object on one line, so several dumps can share a stream as JSON Lines.
+void dump_ast_json(ast_program_node* root, buffer* out) {
+    buffer_putc(out, '{');
+    put_json_nodes(out, "\"declarations\":", root->declarations, root->num_declarations);
+    buffer_puts(out, "}\n");
 }
 
 void add_child(ast_node* parent, ast_node* child) {
     ast_program_node* program_node = (ast_program_node*)parent;
 
     // Allocate memory for the new child
-    ast_node** new_declarations = realloc(program_node->declarations, (program_node->num_declarations + 1) * sizeof(ast_node*));
+    ast_node** new_declarations = counted_realloc(ALLOC_AST, program_node->declarations, (program_node->num_declarations + 1) * sizeof(ast_node*));
 
     if (new_declarations == NULL) {
-        fprintf(stderr, "Error: Memory allocation failed in add_child.\n");
-        exit(1);
+        fatal_error("Error: Memory allocation failed in add_child.\n");
     }
 
     program_node->declarations = new_declarations;
@@ -169,26 +627,28 @@ void add_child(ast_node* parent, ast_node* child) {
 
 
 ast_assignment_node* create_assignment_node(ast_node* identifier_node, ast_node* value) {
-    ast_assignment_node* assignment_node = malloc(sizeof(ast_assignment_node));
+    ast_assignment_node* assignment_node = counted_malloc(ALLOC_AST, sizeof(ast_assignment_node));
     assignment_node->type = AST_ASSIGNMENT;
     assignment_node->identifier_node = identifier_node;
     assignment_node->value = value;
+    assignment_node->index = NULL;
     return assignment_node;
 }
 
 ast_variable_decl_node* create_variable_decl_node(builtin_types type_node, ast_node* identifier_node, ast_node* value,
                                                     bool constant) {
-    ast_variable_decl_node* decl_node = malloc(sizeof(ast_variable_decl_node));
+    ast_variable_decl_node* decl_node = counted_malloc(ALLOC_AST, sizeof(ast_variable_decl_node));
     decl_node->type = AST_VARIABLE_DECL;
     decl_node->type_node = type_node;
     decl_node->identifier_node = identifier_node;
     decl_node->value = value;
     decl_node->is_constant = constant;
+    decl_node->array_length = 0;
     return decl_node;
 }
 
 ast_program_node* create_program_node() {
-    ast_program_node* program_node = malloc(sizeof(ast_program_node));
+    ast_program_node* program_node = counted_malloc(ALLOC_AST, sizeof(ast_program_node));
     program_node->type = AST_PROGRAM;
     program_node->declarations = NULL;
     program_node->num_declarations = 0;
@@ -196,7 +656,7 @@ ast_program_node* create_program_node() {
 }
 
 ast_block_node* create_block_node() {
-    ast_block_node* block_node = malloc(sizeof(ast_block_node));
+    ast_block_node* block_node = counted_malloc(ALLOC_AST, sizeof(ast_block_node));
     block_node->type = AST_BLOCK;
     block_node->declarations = NULL;
     block_node->num_declarations = 0;
@@ -204,32 +664,31 @@ ast_block_node* create_block_node() {
 }
 
 ast_node* create_ast_node(ast_node_type type, const char* value, const char* type_str) {
-    ast_node* node = malloc(sizeof(ast_node));
+    ast_node* node = counted_malloc(ALLOC_AST, sizeof(ast_node));
     node->type = type;
-    node->value = (value != NULL) ? _strdup(value) : NULL;
-    node->type_str = (type_str != NULL) ? _strdup(type_str) : NULL;
+    node->value = (value != NULL) ? counted_strdup(ALLOC_AST, value) : NULL;
+    node->type_str = (type_str != NULL) ? counted_strdup(ALLOC_AST, type_str) : NULL;
     node->children = NULL;
     node->num_children = 0;
+    node->value_type = NULL;
     return node;
 }
 
 
 ast_function_decl_node* create_function_decl_node(builtin_types return_type, const char* function_name, ast_node** parameters, size_t num_parameters, ast_block_node* body) {
-    ast_function_decl_node* node = (ast_function_decl_node*)malloc(sizeof(ast_function_decl_node));
+    ast_function_decl_node* node = (ast_function_decl_node*)counted_malloc(ALLOC_AST, sizeof(ast_function_decl_node));
     if (!node) {
-        fprintf(stderr, "Memory allocation failed for function declaration node.\n");
-        exit(EXIT_FAILURE);
+        fatal_error("Memory allocation failed for function declaration node.\n");
     }
 
     node->type = AST_FUNCTION_DECL;
     node->return_type = return_type;
-    node->function_name = _strdup(function_name);
+    node->function_name = counted_strdup(ALLOC_AST, function_name);
 
     // Copy parameters
-    node->parameters = (ast_node**)malloc(num_parameters * sizeof(ast_node*));
+    node->parameters = (ast_node**)counted_malloc(ALLOC_AST, num_parameters * sizeof(ast_node*));
     if (!node->parameters) {
-        fprintf(stderr, "Memory allocation failed for function parameters.\n");
-        exit(EXIT_FAILURE);
+        fatal_error("Memory allocation failed for function parameters.\n");
     }
     for (size_t i = 0; i < num_parameters; ++i) {
         node->parameters[i] = parameters[i];
@@ -244,10 +703,9 @@ ast_function_decl_node* create_function_decl_node(builtin_types return_type, con
 
 // Function to create a return statement node
 ast_return_node* create_return_node(ast_node* expr) {
-    ast_return_node* node = (ast_return_node*)malloc(sizeof(ast_return_node));
+    ast_return_node* node = (ast_return_node*)counted_malloc(ALLOC_AST, sizeof(ast_return_node));
     if (node == NULL) {
-        fprintf(stderr, "Error: Memory allocation failed for return statement node.\n");
-        exit(EXIT_FAILURE);
+        fatal_error("Error: Memory allocation failed for return statement node.\n");
     }
 
     node->type = AST_RETURN_STMT;
@@ -258,30 +716,101 @@ ast_return_node* create_return_node(ast_node* expr) {
 
 
 ast_binary_expr_node* create_binary_expr_node(ast_node* left, ast_node* right, operator_type op) {
-    ast_binary_expr_node* node = (ast_binary_expr_node*)malloc(sizeof(ast_binary_expr_node));
+    ast_binary_expr_node* node = (ast_binary_expr_node*)counted_malloc(ALLOC_AST, sizeof(ast_binary_expr_node));
     if (node == NULL) {
-        fprintf(stderr, "Error: Memory allocation failed for binary expression node.\n");
-        exit(EXIT_FAILURE);
+        fatal_error("Error: Memory allocation failed for binary expression node.\n");
     }
 
     node->type = AST_BINARY_EXPR;
     node->left = left;
     node->right = right;
     node->op = op;
+    node->value_type = NULL;
 
     return node;
 }
 
 ast_unary_expr_node* create_unary_expr_node(ast_node* operand, operator_type op) {
-    ast_unary_expr_node* node = (ast_unary_expr_node*)malloc(sizeof(ast_unary_expr_node));
+    ast_unary_expr_node* node = (ast_unary_expr_node*)counted_malloc(ALLOC_AST, sizeof(ast_unary_expr_node));
     if (node == NULL) {
-        fprintf(stderr, "Error: Memory allocation failed for unary expression node.\n");
-        exit(EXIT_FAILURE);
+        fatal_error("Error: Memory allocation failed for unary expression node.\n");
     }
 
     node->type = AST_UNARY_EXPR;
     node->operand = operand;
     node->op = op;
+    node->value_type = NULL;
+
+    return node;
+}
+
+// Takes ownership of arguments, which must come from the AST region.
+ast_call_expr_node* create_call_expr_node(const char* function_name, ast_node** arguments, size_t num_arguments) {
+    ast_call_expr_node* node = (ast_call_expr_node*)counted_malloc(ALLOC_AST, sizeof(ast_call_expr_node));
+    if (node == NULL) {
+        fatal_error("Error: Memory allocation failed for call expression node.\n");
+    }
+
+    node->type = AST_CALL_EXPR;
+    node->function_name = counted_strdup(ALLOC_AST, function_name);
+    node->arguments = arguments;
+    node->num_arguments = num_arguments;
+    node->value_type = NULL;
+
+    return node;
+}
+
+ast_loop_node* create_loop_node(ast_node_type type, ast_node* init, ast_node* condition, ast_node* step,
+                                ast_node* body) {
+    ast_loop_node* node = (ast_loop_node*)counted_malloc(ALLOC_AST, sizeof(ast_loop_node));
+    if (node == NULL) {
+        fatal_error("Error: Memory allocation failed for loop node.\n");
+    }
+
+    node->type = type;
+    node->init = init;
+    node->condition = condition;
+    node->step = step;
+    node->body = body;
+
+    return node;
+}
+
+ast_index_expr_node* create_index_expr_node(ast_node* array, ast_node* index) {
+    ast_index_expr_node* node = (ast_index_expr_node*)counted_malloc(ALLOC_AST, sizeof(ast_index_expr_node));
+    if (node == NULL) {
+        fatal_error("Error: Memory allocation failed for index expression node.\n");
+    }
+
+    node->type = AST_INDEX_EXPR;
+    node->array = array;
+    node->index = index;
+    node->value_type = NULL;
+
+    return node;
+}
+
+ast_switch_node* create_switch_node(ast_node* condition, ast_node* body) {
+    ast_switch_node* node = (ast_switch_node*)counted_malloc(ALLOC_AST, sizeof(ast_switch_node));
+    if (node == NULL) {
+        fatal_error("Error: Memory allocation failed for switch node.\n");
+    }
+
+    node->type = AST_SWITCH_STMT;
+    node->condition = condition;
+    node->body = body;
+
+    return node;
+}
+
+ast_case_node* create_case_node(ast_node* value) {
+    ast_case_node* node = (ast_case_node*)counted_malloc(ALLOC_AST, sizeof(ast_case_node));
+    if (node == NULL) {
+        fatal_error("Error: Memory allocation failed for case node.\n");
+    }
+
+    node->type = AST_CASE_LABEL;
+    node->value = value;
 
     return node;
 }
@@ -5,6 +5,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include "compat.h"
+#include "allocator.h"
+#include "buffer.h"
+#include "diagnostics.h"
 
 typedef enum {
     INT,
@@ -25,6 +29,10 @@ typedef enum {
     OP_LOGICAL_NOT,
     OP_INCREMENT,
     OP_DECREMENT,
+    OP_LESS,
+    OP_LESS_EQUAL,
+    OP_GREATER,
+    OP_GREATER_EQUAL,
 } operator_type;
 
 typedef enum {
@@ -38,15 +46,29 @@ typedef enum {
     AST_ASSIGNMENT,
     AST_PROGRAM,
     AST_BLOCK,
-    AST_LITERAL
+    AST_LITERAL,
+    AST_CALL_EXPR,
+    AST_WHILE_STMT,
+    AST_DO_WHILE_STMT,
+    AST_FOR_STMT,
+    AST_BREAK_STMT,     // plain ast_node, as is continue
+    AST_CONTINUE_STMT,
+    AST_INDEX_EXPR,
+    AST_SWITCH_STMT,
+    AST_CASE_LABEL,     // case or default, a statement of its own
 } ast_node_type;
 
+struct c_type;
+
+// Expression nodes have a value_type, left NULL by the parser and filled in
+// by the type checker.
 typedef struct ast_node {
     ast_node_type type;
     char* value;
     char* type_str;
     struct ast_node** children;
     size_t num_children;
+    const struct c_type* value_type;
 } ast_node;
 
 typedef struct ast_program_node {
@@ -69,6 +91,7 @@ typedef struct ast_unary_expr_node {
     ast_node_type type;
     struct ast_node* operand;
     operator_type op;
+    const struct c_type* value_type;
 } ast_unary_expr_node;
 
 typedef struct ast_binary_expr_node {
@@ -76,22 +99,45 @@ typedef struct ast_binary_expr_node {
     struct ast_node* left;
     struct ast_node* right;
     operator_type op;
+    const struct c_type* value_type;
 } ast_binary_expr_node;
 
+// A call, as an expression or on its own as a statement.
+typedef struct ast_call_expr_node {
+    ast_node_type type;
+    char* function_name;
+    struct ast_node** arguments;
+    size_t num_arguments;
+    const struct c_type* value_type;
+} ast_call_expr_node;
+
+// An array has array_length elements of type_node and no initializer;
+// array_length is 0 for any other variable.
 typedef struct ast_variable_decl_node {
     ast_node_type type;
     builtin_types type_node;
     ast_node* identifier_node;
     ast_node* value;
     bool is_constant;
+    size_t array_length;
 } ast_variable_decl_node;
 
+// index is set when an element of an array is assigned, as in a[i] = v.
 typedef struct ast_assignment_node {
     ast_node_type type;
     ast_node* identifier_node;
     ast_node* value;
+    ast_node* index;
 } ast_assignment_node;
 
+// array[index], where array is an identifier naming an array.
+typedef struct ast_index_expr_node {
+    ast_node_type type;
+    ast_node* array;
+    ast_node* index;
+    const struct c_type* value_type;
+} ast_index_expr_node;
+
 typedef struct ast_block_node {
     ast_node_type type;
     struct ast_node** declarations;
@@ -107,16 +153,54 @@ typedef struct ast_function_decl_node {
     ast_block_node* body;
 } ast_function_decl_node;
 
+// while, do-while and for share one node. Only a for has an init and a
+// step, either of which may be NULL, as may its condition, which then
+// always holds. The body is a single statement, often a block.
+typedef struct ast_loop_node {
+    ast_node_type type;
+    ast_node* init;
+    ast_node* condition;
+    ast_node* step;
+    ast_node* body;
+} ast_loop_node;
+
+// The body of a switch is one statement, usually a block, and its case
+// labels may sit anywhere inside it, as in C.
+typedef struct ast_switch_node {
+    ast_node_type type;
+    ast_node* condition;
+    ast_node* body;
+} ast_switch_node;
+
+// value is an integer constant expression, or NULL for default.
+typedef struct ast_case_node {
+    ast_node_type type;
+    ast_node* value;
+} ast_case_node;
+
 typedef struct ast_return_node {
     ast_node_type type;
     ast_node* expr;
 } ast_return_node;
 
-void print_ast_node(ast_node* node, int level);
-void print_ast(ast_program_node* root);
+// Binary encoding shared by --dump-ast=bin and precompiled headers. A node
+// is its type byte followed by its fields, children in preorder; integers
+// are host order and strings a u32 length then the bytes and a NUL. A bin
+// dump is the magic, a u32 declaration count and that many nodes.
+#define AST_BINARY_MAGIC "SCCAST03"
+#define AST_BINARY_NULL_NODE 0xFF
+#define AST_BINARY_NULL_STRING 0xFFFFFFFFu
+
+void print_ast_node(ast_node* node, int level, buffer* out);
+void print_ast(ast_program_node* root, buffer* out);
+void write_ast_node_binary(ast_node* node, buffer* out);
+void dump_ast_binary(ast_program_node* root, buffer* out);
+void dump_ast_json(ast_program_node* root, buffer* out);
 const char* type_tostring(builtin_types type);
 void add_child(ast_node* parent, ast_node* child);
 const char* op_ToString(operator_type op);
+long long ast_literal_value(ast_node* node);
+long long ast_eval_constant(ast_node* node);
 ast_block_node* create_block_node();
 ast_assignment_node* create_assignment_node(ast_node* identifier_node, ast_node* value);
 ast_variable_decl_node* create_variable_decl_node(builtin_types type_node, ast_node* identifier_node,
@@ -129,6 +213,12 @@ ast_literal_node* create_literal_node(const char* value);
 ast_binary_expr_node* create_binary_expr_node(ast_node* left, ast_node* right, operator_type op);
 ast_unary_expr_node* create_unary_expr_node(ast_node* operand, operator_type op);
 ast_return_node* create_return_node(ast_node* value);
+ast_call_expr_node* create_call_expr_node(const char* function_name, ast_node** arguments, size_t num_arguments);
+ast_loop_node* create_loop_node(ast_node_type type, ast_node* init, ast_node* condition, ast_node* step,
+                                ast_node* body);
+ast_index_expr_node* create_index_expr_node(ast_node* array, ast_node* index);
+ast_switch_node* create_switch_node(ast_node* condition, ast_node* body);
+ast_case_node* create_case_node(ast_node* value);
 
 #endif // AST_H
 
@@ -0,0 +1,157 @@
+#include "backend.h"
+#include "fold.h"
+#include "licm.h"
+#include "codegen.h"
+#include "diagnostics.h"
+#include "thread_pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Everything one function's passes produce. Tasks share nothing but the
+// program, which they only read; each function's SIR is its own.
+typedef struct function_task {
+    sir_program* program;
+    sir_function* fn;
+    const backend_options* options;
+    size_t size;
+    x86_function* code;
+    buffer report;
+    simplify_stats simplify;
+    peephole_stats peephole;
+    size_t eliminated;
+    diagnostics diag;
+    bool failed;
+} function_task;
+
+static void optimize_function(function_task* t) {
+    sir_program* program = t->program;
+    sir_function* fn = t->fn;
+    const backend_options* options = t->options;
+
+    // Preheaders that nothing was hoisted into are folded away again.
+    licm_sir_function(program, fn);
+    fold_sir_function(program, fn);
+
+    vectorize_options vectorizing = { options->vector_target, options->vectorize_report ? &t->report : NULL };
+    if (vectorize_sir_function(program, fn, &vectorizing) > 0) {
+        fold_sir_function(program, fn);
+    }
+    if (options->simplify) {
+        simplify_sir_function(fn, &t->simplify);
+        fold_sir_function(program, fn);
+    }
+    if (options->gvn) {
+        t->eliminated = gvn_sir_function(fn);
+        fold_sir_function(program, fn);
+    }
+
+    t->code = codegen_function(program, fn);
+    peephole_function(t->code, &t->peephole);
+}
+
+// Runs on a worker, where a fatal error has nowhere to unwind to but here.
+static void run_function_task(void* arg) {
+    function_task* t = arg;
+    jmp_buf recovery;
+    diagnostics* previous = set_diagnostics(&t->diag);
+    t->diag.recovery = &recovery;
+    if (setjmp(recovery) == 0) {
+        optimize_function(t);
+    } else {
+        t->failed = true;
+    }
+    t->diag.recovery = NULL;
+    set_diagnostics(previous);
+}
+
+static int compare_task_size(const void* a, const void* b) {
+    const function_task* x = *(function_task* const*)a;
+    const function_task* y = *(function_task* const*)b;
+    return x->size < y->size ? 1 : x->size > y->size ? -1 : 0;
+}
+
+static void add_stats(backend_stats* stats, function_task* t) {
+    for (size_t r = 0; r < SIMPLIFY_MAX_RULES; ++r) {
+        stats->simplify.hits[r] += t->simplify.hits[r];
+    }
+    stats->simplify.reduced += t->simplify.reduced;
+    add_gvn_function_stats(&stats->gvn, t->fn->name, t->eliminated);
+    for (size_t r = 0; r < PEEPHOLE_MAX_RULES; ++r) {
+        stats->peephole.hits[r] += t->peephole.hits[r];
+    }
+    stats->peephole.insts_before += t->peephole.insts_before;
+    stats->peephole.insts_after += t->peephole.insts_after;
+}
+
+x86_module* run_backend(sir_program* program, const backend_options* options, backend_stats* stats) {
+    size_t n = program->num_functions;
+    function_task* tasks = calloc(n + 1, sizeof(function_task));
+    function_task** order = malloc((n + 1) * sizeof(function_task*));
+    size_t total_size = 0;
+    for (size_t i = 0; i < n; ++i) {
+        function_task* t = &tasks[i];
+        t->program = program;
+        t->fn = program->functions[i];
+        t->options = options;
+        t->size = sir_function_size(t->fn);
+        t->report = init_buffer(0);
+        init_diagnostics(&t->diag);
+        order[i] = t;
+        total_size += t->size;
+    }
+
+    size_t num_threads = options->num_threads < n ? options->num_threads : n;
+    if (num_threads > total_size / BACKEND_MIN_THREAD_SIZE) {
+        num_threads = total_size / BACKEND_MIN_THREAD_SIZE;
+    }
+    if (num_threads <= 1) {
+        num_threads = 1;
+        for (size_t i = 0; i < n; ++i) {
+            run_function_task(&tasks[i]);
+        }
+    } else {
+        // Largest first, so that no big function starts last and runs alone.
+        qsort(order, n, sizeof(function_task*), compare_task_size);
+        thread_pool* pool = create_thread_pool(num_threads);
+        for (size_t i = 0; i < n; ++i) {
+            thread_pool_submit(pool, run_function_task, order[i]);
+        }
+        thread_pool_wait(pool);
+        free_thread_pool(pool);
+    }
+
+    x86_module* m = create_x86_module();
+    codegen_globals(program, m);
+    function_task* failed = NULL;
+    for (size_t i = 0; i < n; ++i) {
+        function_task* t = &tasks[i];
+        if (t->code != NULL) {
+            add_x86_function(m, t->code);
+        }
+        if (t->failed && failed == NULL) {
+            failed = t;
+        }
+        if (options->vectorize_report != NULL) {
+            buffer_append(options->vectorize_report, t->report.data, t->report.length);
+        }
+        add_stats(stats, t);
+    }
+    stats->num_functions += n;
+    stats->num_threads = num_threads;
+
+    if (failed != NULL) {
+        report_error("%.*s", (int)failed->diag.messages.length, failed->diag.messages.data);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        free_buffer(&tasks[i].report);
+        free_diagnostics(&tasks[i].diag);
+    }
+    free(order);
+    free(tasks);
+    if (failed != NULL) {
+        free_x86_module(m);
+        abort_compilation();
+    }
+    return m;
+}
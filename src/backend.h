@@ -0,0 +1,42 @@
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include <stddef.h>
+#include "buffer.h"
+#include "sir.h"
+#include "x86.h"
+#include "vectorize.h"
+#include "simplify.h"
+#include "gvn.h"
+#include "peephole.h"
+
+// Instructions of SIR each worker needs for its start-up to pay off; a
+// program with less than twice this runs on the calling thread.
+#define BACKEND_MIN_THREAD_SIZE 1024
+
+typedef struct backend_options {
+    vector_target vector_target;
+    buffer* vectorize_report;   // or NULL
+    bool simplify;
+    bool gvn;
+    size_t num_threads;         // at most; 1 runs every function on the calling thread
+} backend_options;
+
+// Counters of every function's passes, added to what is already there.
+typedef struct backend_stats {
+    simplify_stats simplify;
+    gvn_stats gvn;
+    peephole_stats peephole;
+    size_t num_functions;
+    size_t num_threads;
+} backend_stats;
+
+// The part of the native pipeline after inlining: licm, vectorizing,
+// simplification, value numbering, codegen and the peephole pass. None of
+// them looks past the function it is given, so each function is one task
+// for a pool of workers, largest first; the resulting code is put back in
+// program order, and so are the vectorizer's report lines. A fatal error
+// in any function fails the compilation once all of them are done.
+x86_module* run_backend(sir_program* program, const backend_options* options, backend_stats* stats);
+
+#endif // BACKEND_H
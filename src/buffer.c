@@ -0,0 +1,159 @@
+#include "buffer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+
+#ifdef _MSC_VER
+#include <io.h>
+#define write _write
+#define open _open
+#define close _close
+#else
+#include <unistd.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+buffer init_buffer(size_t capacity) {
+    buffer b = { NULL, 0, 0 };
+    if (capacity > 0) {
+        buffer_reserve(&b, capacity);
+    }
+    return b;
+}
+
+void free_buffer(buffer* b) {
+    free(b->data);
+    b->data = NULL;
+    b->length = 0;
+    b->capacity = 0;
+}
+
+void buffer_reserve(buffer* b, size_t extra) {
+    if (b->length + extra <= b->capacity) {
+        return;
+    }
+
+    size_t new_capacity = b->capacity ? b->capacity : 4096;
+    while (new_capacity < b->length + extra) {
+        new_capacity *= 2;
+    }
+
+    char* data = realloc(b->data, new_capacity);
+    if (data == NULL) {
+        fprintf(stderr, "Error: Failed to grow output buffer to %zu bytes!\n", new_capacity);
+        exit(1);
+    }
+    b->data = data;
+    b->capacity = new_capacity;
+}
+
+void buffer_append(buffer* b, const void* data, size_t size) {
+    if (size == 0) {
+        return;
+    }
+    buffer_reserve(b, size);
+    memcpy(b->data + b->length, data, size);
+    b->length += size;
+}
+
+void buffer_putc(buffer* b, char c) {
+    buffer_reserve(b, 1);
+    b->data[b->length++] = c;
+}
+
+void buffer_puts(buffer* b, const char* str) {
+    buffer_append(b, str, strlen(str));
+}
+
+void buffer_pad(buffer* b, char c, size_t count) {
+    buffer_reserve(b, count);
+    memset(b->data + b->length, c, count);
+    b->length += count;
+}
+
+// Writes str as a quoted JSON string, or null.
+void buffer_put_json_string(buffer* b, const char* str) {
+    if (str == NULL) {
+        buffer_append(b, "null", 4);
+        return;
+    }
+    buffer_putc(b, '"');
+    const char* run = str;
+    for (const char* c = str; *c; ++c) {
+        unsigned char ch = (unsigned char)*c;
+        if (ch != '"' && ch != '\\' && ch >= 0x20) {
+            continue;
+        }
+        buffer_append(b, run, (size_t)(c - run));
+        if (ch < 0x20) {
+            buffer_printf(b, "\\u%04x", ch);
+        } else {
+            buffer_putc(b, '\\');
+            buffer_putc(b, (char)ch);
+        }
+        run = c + 1;
+    }
+    buffer_append(b, run, strlen(run));
+    buffer_putc(b, '"');
+}
+
+void buffer_vprintf(buffer* b, const char* fmt, va_list args) {
+    buffer_reserve(b, 64);
+
+    va_list copy;
+    va_copy(copy, args);
+    int needed = vsnprintf(b->data + b->length, b->capacity - b->length, fmt, copy);
+    va_end(copy);
+
+    if (needed < 0) {
+        fprintf(stderr, "Error: Failed to format output!\n");
+        exit(1);
+    }
+
+    if ((size_t)needed >= b->capacity - b->length) {
+        buffer_reserve(b, (size_t)needed + 1);
+        vsnprintf(b->data + b->length, b->capacity - b->length, fmt, args);
+    }
+    b->length += (size_t)needed;
+}
+
+void buffer_printf(buffer* b, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    buffer_vprintf(b, fmt, args);
+    va_end(args);
+}
+
+// Hands the whole buffer to the OS. write() may accept less than requested on
+// pipes, so keep going until everything is out.
+bool buffer_flush(buffer* b, int fd) {
+    size_t written = 0;
+    while (written < b->length) {
+        long n = (long)write(fd, b->data + written, (unsigned)(b->length - written));
+        if (n <= 0) {
+            return false;
+        }
+        written += (size_t)n;
+    }
+    b->length = 0;
+    return true;
+}
+
+bool buffer_write_file(buffer* b, const char* file_name) {
+    if (file_name == NULL) {
+        return buffer_flush(b, 1);
+    }
+
+    int fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = buffer_flush(b, fd);
+    close(fd);
+    return ok;
+}
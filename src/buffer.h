@@ -0,0 +1,29 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdarg.h>
+
+// Growable byte buffer. All compiler output is accumulated here and handed to
+// the OS in one go instead of going through per-line stdio calls.
+typedef struct buffer {
+    char* data;
+    size_t length;
+    size_t capacity;
+} buffer;
+
+buffer init_buffer(size_t capacity);
+void free_buffer(buffer* b);
+void buffer_reserve(buffer* b, size_t extra);
+void buffer_append(buffer* b, const void* data, size_t size);
+void buffer_putc(buffer* b, char c);
+void buffer_puts(buffer* b, const char* str);
+void buffer_pad(buffer* b, char c, size_t count);
+void buffer_put_json_string(buffer* b, const char* str);
+void buffer_printf(buffer* b, const char* fmt, ...);
+void buffer_vprintf(buffer* b, const char* fmt, va_list args);
+bool buffer_flush(buffer* b, int fd);
+bool buffer_write_file(buffer* b, const char* file_name);
+
+#endif // BUFFER_H
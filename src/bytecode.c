@@ -0,0 +1,708 @@
+#include "bytecode.h"
+
+#include <limits.h>
+
+#define BC_MAX_REGISTERS 256
+
+typedef struct bc_local {
+    const char* name;
+    builtin_types type;
+    int reg;
+} bc_local;
+
+// A break or continue waiting for the end of its loop to learn where it
+// jumps to.
+typedef struct bc_jump {
+    size_t at;
+    bool is_break;
+} bc_jump;
+
+typedef struct bc_case {
+    int value;
+    int target;
+} bc_case;
+
+// The labels of the switch being compiled, with the positions they mark.
+typedef struct bc_case_labels {
+    bc_case* cases;
+    size_t num_cases;
+    size_t max_cases;
+    int otherwise;          // -1 until a default is seen
+} bc_case_labels;
+
+typedef struct bc_compiler {
+    bc_program* bc;
+    bc_function* fn;
+    bc_local* locals;
+    size_t num_locals;
+    size_t max_locals;
+    int locals_top;         // registers below this belong to live locals
+    int next_register;      // temporaries are handed out from here upwards
+    bc_jump* jumps;
+    size_t num_jumps;
+    size_t max_jumps;
+    size_t loop_jumps;      // where the innermost loop's jumps start
+    size_t label;           // last jump target; nothing is fused across it
+    bc_case_labels* labels; // of the innermost switch
+} bc_compiler;
+
+static int compile_expression(bc_compiler* c, ast_node* node);
+static void compile_statement(bc_compiler* c, ast_node* node);
+
+const char* bc_opcode_tostring(bc_opcode op) {
+    switch (op) {
+        case BC_LOADK: return "loadk";
+        case BC_MOVE: return "move";
+        case BC_LOADG: return "loadg";
+        case BC_STOREG: return "storeg";
+        case BC_LOADX: return "loadx";
+        case BC_STOREX: return "storex";
+        case BC_ADD: return "add";
+        case BC_SUB: return "sub";
+        case BC_MUL: return "mul";
+        case BC_DIV: return "div";
+        case BC_MOD: return "mod";
+        case BC_EQ: return "eq";
+        case BC_NE: return "ne";
+        case BC_LT: return "lt";
+        case BC_LE: return "le";
+        case BC_NEG: return "neg";
+        case BC_NOT: return "not";
+        case BC_TRUNC8: return "trunc8";
+        case BC_CALL: return "call";
+        case BC_RET: return "ret";
+        case BC_JMP: return "jmp";
+        case BC_JZ: return "jz";
+        case BC_JNZ: return "jnz";
+        case BC_SWITCH: return "switch";
+        case BC_ADDK: return "addk";
+        case BC_SUBK: return "subk";
+        case BC_MULK: return "mulk";
+        case BC_ADD_STOREG: return "add_storeg";
+        case BC_ADD_RET: return "add_ret";
+        case BC_RETK: return "retk";
+        default: return "?";
+    }
+}
+
+static bc_inst make_inst(bc_opcode op, int a, int b, int c, int k) {
+    bc_inst inst = { (unsigned char)op, (unsigned char)a, (unsigned char)b, (unsigned char)c, k };
+    return inst;
+}
+
+static bool is_temporary(bc_compiler* c, int reg) {
+    return reg >= c->locals_top;
+}
+
+// Only the instruction before the next one to be emitted, and only if no
+// jump can land between the two.
+static bc_inst* last_inst(bc_compiler* c) {
+    return c->fn->num_code > c->label ? &c->fn->code[c->fn->num_code - 1] : NULL;
+}
+
+static void append_inst(bc_compiler* c, bc_inst inst) {
+    bc_function* fn = c->fn;
+    if (fn->num_code == fn->max_code) {
+        fn->max_code = fn->max_code ? fn->max_code * 2 : 32;
+        fn->code = realloc(fn->code, fn->max_code * sizeof(bc_inst));
+    }
+    fn->code[fn->num_code++] = inst;
+}
+
+// Emits inst, folding it into the previous instruction when the pair has a
+// superinstruction. Only temporaries are folded away: they are written once
+// and read once, so nothing else can observe the register that disappears.
+static void emit(bc_compiler* c, bc_inst inst) {
+    bc_inst* prev = last_inst(c);
+    if (prev != NULL) {
+        bool prev_writes_temp = is_temporary(c, prev->a);
+
+        if (prev->op == BC_LOADK && prev_writes_temp) {
+            int k = prev->k;
+            if ((inst.op == BC_ADD || inst.op == BC_MUL) && inst.b == prev->a && inst.c != prev->a) {
+                inst.b = inst.c;
+                inst.c = prev->a;
+            }
+            if ((inst.op == BC_ADD || inst.op == BC_SUB || inst.op == BC_MUL) && inst.c == prev->a &&
+                inst.b != prev->a) {
+                bc_opcode fused = inst.op == BC_ADD ? BC_ADDK : (inst.op == BC_SUB ? BC_SUBK : BC_MULK);
+                *prev = make_inst(fused, inst.a, inst.b, 0, k);
+                c->bc->superinstructions++;
+                return;
+            }
+            if (inst.op == BC_RET && inst.a == prev->a) {
+                *prev = make_inst(BC_RETK, 0, 0, 0, k);
+                c->bc->superinstructions++;
+                return;
+            }
+        }
+
+        if (prev->op == BC_ADD && prev_writes_temp) {
+            if (inst.op == BC_MOVE && inst.b == prev->a) {
+                prev->a = inst.a;
+                c->bc->superinstructions++;
+                return;
+            }
+            if (inst.op == BC_STOREG && inst.a == prev->a) {
+                *prev = make_inst(BC_ADD_STOREG, 0, prev->b, prev->c, inst.k);
+                c->bc->superinstructions++;
+                return;
+            }
+            if (inst.op == BC_RET && inst.a == prev->a) {
+                *prev = make_inst(BC_ADD_RET, 0, prev->b, prev->c, 0);
+                c->bc->superinstructions++;
+                return;
+            }
+        }
+    }
+    append_inst(c, inst);
+}
+
+// The position of the next instruction, as the target of a jump.
+static size_t mark_label(bc_compiler* c) {
+    c->label = c->fn->num_code;
+    return c->label;
+}
+
+// Emits a jump whose target is patched in later; returns its position.
+static size_t emit_jump(bc_compiler* c, bc_opcode op, int reg) {
+    append_inst(c, make_inst(op, reg, 0, 0, -1));
+    return c->fn->num_code - 1;
+}
+
+static void patch_jump(bc_compiler* c, size_t at, size_t target) {
+    c->fn->code[at].k = (int)target;
+}
+
+static int alloc_register(bc_compiler* c) {
+    if (c->next_register >= BC_MAX_REGISTERS) {
+        fatal_error("Error: function %s needs more than %d bytecode registers\n", c->fn->name, BC_MAX_REGISTERS);
+    }
+    int reg = c->next_register++;
+    if (c->next_register > c->fn->num_registers) {
+        c->fn->num_registers = c->next_register;
+    }
+    return reg;
+}
+
+static bc_local* find_bc_local(bc_compiler* c, const char* name) {
+    for (size_t i = c->num_locals; i > 0; --i) {
+        if (strcmp(c->locals[i - 1].name, name) == 0) {
+            return &c->locals[i - 1];
+        }
+    }
+    return NULL;
+}
+
+static int find_bc_global(bc_program* bc, const char* name) {
+    for (size_t i = 0; i < bc->num_globals; ++i) {
+        if (strcmp(bc->global_names[i], name) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static int find_bc_function_index(bc_program* bc, const char* name) {
+    for (size_t i = 0; i < bc->num_functions; ++i) {
+        if (strcmp(bc->functions[i]->name, name) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static bc_local* add_bc_local(bc_compiler* c, const char* name, builtin_types type) {
+    if (type != INT && type != CHAR) {
+        fatal_error("Error: bytecode does not support locals of type %s\n", type_tostring(type));
+    }
+    if (c->num_locals == c->max_locals) {
+        c->max_locals = c->max_locals ? c->max_locals * 2 : 16;
+        c->locals = realloc(c->locals, c->max_locals * sizeof(bc_local));
+    }
+    bc_local* local = &c->locals[c->num_locals++];
+    local->name = name;
+    local->type = type;
+    local->reg = alloc_register(c);
+    c->locals_top = c->next_register;
+    return local;
+}
+
+static bc_opcode binary_opcode(operator_type op) {
+    switch (op) {
+        case OP_ADD: return BC_ADD;
+        case OP_SUBTRACT: return BC_SUB;
+        case OP_MULTIPLY: return BC_MUL;
+        case OP_DIVIDE: return BC_DIV;
+        case OP_MODULO: return BC_MOD;
+        case OP_EQUAL: return BC_EQ;
+        case OP_NOT_EQUAL: return BC_NE;
+        case OP_LESS:
+        case OP_GREATER: return BC_LT;
+        case OP_LESS_EQUAL:
+        case OP_GREATER_EQUAL: return BC_LE;
+        default:
+            fatal_error("Error: bytecode does not support binary operator %s\n", op_ToString(op));
+    }
+}
+
+// Returns the register holding the value. Locals are returned in place, so
+// the caller must not write to the result unless it is a temporary.
+static int compile_expression(bc_compiler* c, ast_node* node) {
+    switch (node->type) {
+        case AST_LITERAL: {
+            int reg = alloc_register(c);
+            emit(c, make_inst(BC_LOADK, reg, 0, 0, (int)ast_literal_value(node)));
+            return reg;
+        }
+        case AST_IDENTIFIER: {
+            bc_local* local = find_bc_local(c, node->value);
+            if (local != NULL) {
+                return local->reg;
+            }
+            int global = find_bc_global(c->bc, node->value);
+            if (global < 0) {
+                fatal_error("Error: bytecode could not resolve '%s'\n", node->value);
+            }
+            int reg = alloc_register(c);
+            emit(c, make_inst(BC_LOADG, reg, 0, 0, c->bc->global_slots[global]));
+            return reg;
+        }
+        case AST_INDEX_EXPR: {
+            ast_index_expr_node* index = (ast_index_expr_node*)node;
+            int global = find_bc_global(c->bc, index->array->value);
+            if (global < 0) {
+                fatal_error("Error: bytecode could not resolve '%s'\n", index->array->value);
+            }
+            int saved = c->next_register;
+            int position = compile_expression(c, index->index);
+            c->next_register = saved;
+            int dst = alloc_register(c);
+            emit(c, make_inst(BC_LOADX, dst, position, 0, global));
+            return dst;
+        }
+        case AST_BINARY_EXPR: {
+            ast_binary_expr_node* binary = (ast_binary_expr_node*)node;
+            int saved = c->next_register;
+            int left = compile_expression(c, binary->left);
+            int right = compile_expression(c, binary->right);
+            c->next_register = saved;
+            int dst = alloc_register(c);
+            // a > b is b < a, and likewise for >=.
+            if (binary->op == OP_GREATER || binary->op == OP_GREATER_EQUAL) {
+                emit(c, make_inst(binary_opcode(binary->op), dst, right, left, 0));
+            } else {
+                emit(c, make_inst(binary_opcode(binary->op), dst, left, right, 0));
+            }
+            return dst;
+        }
+        case AST_UNARY_EXPR: {
+            ast_unary_expr_node* unary = (ast_unary_expr_node*)node;
+            int saved = c->next_register;
+            int operand = compile_expression(c, unary->operand);
+            if (unary->op == OP_ADD) {
+                return operand;
+            }
+            c->next_register = saved;
+            int dst = alloc_register(c);
+            if (unary->op == OP_SUBTRACT) {
+                emit(c, make_inst(BC_NEG, dst, operand, 0, 0));
+            } else if (unary->op == OP_LOGICAL_NOT) {
+                emit(c, make_inst(BC_NOT, dst, operand, 0, 0));
+            } else {
+                fatal_error("Error: bytecode does not support unary operator %s\n", op_ToString(unary->op));
+            }
+            return dst;
+        }
+        case AST_CALL_EXPR: {
+            // Arguments go to consecutive registers, each computed above
+            // the ones already placed.
+            ast_call_expr_node* call = (ast_call_expr_node*)node;
+            int function = find_bc_function_index(c->bc, call->function_name);
+            if (function < 0) {
+                fatal_error("Error: bytecode could not resolve function '%s'\n", call->function_name);
+            }
+            int saved = c->next_register;
+            int base = c->next_register;
+            for (size_t i = 0; i < call->num_arguments; ++i) {
+                alloc_register(c);
+            }
+            for (size_t i = 0; i < call->num_arguments; ++i) {
+                int slot = base + (int)i;
+                int value = compile_expression(c, call->arguments[i]);
+                if (value != slot) {
+                    emit(c, make_inst(BC_MOVE, slot, value, 0, 0));
+                }
+                c->next_register = base + (int)call->num_arguments;
+            }
+            c->next_register = saved;
+            int dst = alloc_register(c);
+            emit(c, make_inst(BC_CALL, dst, base, (int)call->num_arguments, function));
+            return dst;
+        }
+        default:
+            fatal_error("Error: bytecode does not support expression node %d\n", node->type);
+    }
+}
+
+static void store_to_local(bc_compiler* c, bc_local* local, int value) {
+    if (local->type == CHAR) {
+        emit(c, make_inst(BC_TRUNC8, local->reg, value, 0, 0));
+    } else if (value != local->reg) {
+        emit(c, make_inst(BC_MOVE, local->reg, value, 0, 0));
+    }
+}
+
+static void compile_block(bc_compiler* c, ast_block_node* block) {
+    size_t scope_start = c->num_locals;
+    int saved_top = c->locals_top;
+    for (size_t i = 0; i < block->num_declarations; ++i) {
+        compile_statement(c, block->declarations[i]);
+    }
+    c->num_locals = scope_start;
+    c->locals_top = saved_top;
+    c->next_register = saved_top;
+}
+
+static void add_pending_jump(bc_compiler* c, size_t at, bool is_break) {
+    if (c->num_jumps == c->max_jumps) {
+        c->max_jumps = c->max_jumps ? c->max_jumps * 2 : 8;
+        c->jumps = realloc(c->jumps, c->max_jumps * sizeof(bc_jump));
+    }
+    c->jumps[c->num_jumps].at = at;
+    c->jumps[c->num_jumps].is_break = is_break;
+    c->num_jumps++;
+}
+
+// Jumps to exit when the condition is false; a missing condition is true.
+static void compile_exit_test(bc_compiler* c, ast_node* condition) {
+    if (condition != NULL) {
+        int value = compile_expression(c, condition);
+        add_pending_jump(c, emit_jump(c, BC_JZ, value), true);
+        c->next_register = c->locals_top;
+    }
+}
+
+// while:     top: test; body; jmp top
+// for:       init; top: test; body; next: step; jmp top
+// do-while:  top: body; next: if (cond) jmp top
+// A continue goes to next, or to top for a while.
+static void compile_loop(bc_compiler* c, ast_loop_node* loop) {
+    size_t scope_start = c->num_locals;
+    int saved_top = c->locals_top;
+    size_t outer_jumps = c->loop_jumps;
+    c->loop_jumps = c->num_jumps;
+
+    if (loop->init != NULL) {
+        compile_statement(c, loop->init);
+    }
+    size_t top = mark_label(c);
+    if (loop->type != AST_DO_WHILE_STMT) {
+        compile_exit_test(c, loop->condition);
+    }
+    compile_statement(c, loop->body);
+    size_t next = mark_label(c);
+    if (loop->type == AST_DO_WHILE_STMT) {
+        int value = compile_expression(c, loop->condition);
+        patch_jump(c, emit_jump(c, BC_JNZ, value), top);
+        c->next_register = c->locals_top;
+    } else {
+        if (loop->step != NULL) {
+            compile_statement(c, loop->step);
+        }
+        patch_jump(c, emit_jump(c, BC_JMP, 0), top);
+    }
+    size_t exit = mark_label(c);
+
+    for (size_t i = c->loop_jumps; i < c->num_jumps; ++i) {
+        bc_jump* jump = &c->jumps[i];
+        patch_jump(c, jump->at, jump->is_break ? exit : (loop->type == AST_WHILE_STMT ? top : next));
+    }
+    c->num_jumps = c->loop_jumps;
+    c->loop_jumps = outer_jumps;
+    c->num_locals = scope_start;
+    c->locals_top = saved_top;
+    c->next_register = saved_top;
+}
+
+static int compare_bc_cases(const void* a, const void* b) {
+    int x = ((const bc_case*)a)->value;
+    int y = ((const bc_case*)b)->value;
+    return (x > y) - (x < y);
+}
+
+// A table at least a quarter full is laid out densely.
+static void build_switch_table(bc_switch* table, bc_case_labels* labels, int otherwise) {
+    bc_case* cases = labels->cases;
+    size_t count = labels->num_cases;
+    if (count > 1) {
+        qsort(cases, count, sizeof(bc_case), compare_bc_cases);
+    }
+    table->low = count > 0 ? cases[0].value : 0;
+    table->otherwise = otherwise;
+    long long range = count > 0 ? (long long)cases[count - 1].value - cases[0].value + 1 : 0;
+    if (range <= 4 * (long long)count) {
+        table->values = NULL;
+        table->length = (size_t)range;
+        table->targets = malloc((table->length + 1) * sizeof(int));
+        for (size_t i = 0; i < table->length; ++i) {
+            table->targets[i] = otherwise;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            table->targets[cases[i].value - table->low] = cases[i].target;
+        }
+    } else {
+        table->length = count;
+        table->values = malloc(count * sizeof(int));
+        table->targets = malloc(count * sizeof(int));
+        for (size_t i = 0; i < count; ++i) {
+            table->values[i] = cases[i].value;
+            table->targets[i] = cases[i].target;
+        }
+    }
+}
+
+// switch: k = table; body, each label marking a position; exit:
+// A break goes to exit; a continue is left for the loop around the switch.
+static void compile_switch(bc_compiler* c, ast_switch_node* switch_stmt) {
+    bc_function* fn = c->fn;
+    int value = compile_expression(c, switch_stmt->condition);
+    size_t table = fn->num_switches++;
+    fn->switches = realloc(fn->switches, fn->num_switches * sizeof(bc_switch));
+    append_inst(c, make_inst(BC_SWITCH, value, 0, 0, (int)table));
+    c->next_register = c->locals_top;
+
+    bc_case_labels labels = { NULL, 0, 0, -1 };
+    bc_case_labels* outer = c->labels;
+    c->labels = &labels;
+    size_t first_jump = c->num_jumps;
+    compile_statement(c, switch_stmt->body);
+    c->labels = outer;
+    size_t exit = mark_label(c);
+
+    size_t kept = first_jump;
+    for (size_t i = first_jump; i < c->num_jumps; ++i) {
+        if (c->jumps[i].is_break) {
+            patch_jump(c, c->jumps[i].at, exit);
+        } else {
+            c->jumps[kept++] = c->jumps[i];
+        }
+    }
+    c->num_jumps = kept;
+
+    build_switch_table(&fn->switches[table], &labels, labels.otherwise >= 0 ? labels.otherwise : (int)exit);
+    free(labels.cases);
+}
+
+static void compile_case_label(bc_compiler* c, ast_case_node* label) {
+    bc_case_labels* labels = c->labels;
+    int position = (int)mark_label(c);
+    if (label->value == NULL) {
+        labels->otherwise = position;
+        return;
+    }
+    if (labels->num_cases == labels->max_cases) {
+        labels->max_cases = labels->max_cases ? labels->max_cases * 2 : 8;
+        labels->cases = realloc(labels->cases, labels->max_cases * sizeof(bc_case));
+    }
+    labels->cases[labels->num_cases].value = (int)ast_eval_constant(label->value);
+    labels->cases[labels->num_cases].target = position;
+    labels->num_cases++;
+}
+
+static void compile_statement(bc_compiler* c, ast_node* node) {
+    switch (node->type) {
+        case AST_VARIABLE_DECL: {
+            ast_variable_decl_node* var_decl = (ast_variable_decl_node*)node;
+            int value = -1;
+            if (var_decl->value != NULL) {
+                value = compile_expression(c, var_decl->value);
+            }
+            // The initializer's temporary (if any) becomes the local's register.
+            if (value >= 0 && is_temporary(c, value) && value == c->locals_top) {
+                c->next_register = value;
+            } else {
+                c->next_register = c->locals_top;
+            }
+            bc_local* local = add_bc_local(c, var_decl->identifier_node->value, var_decl->type_node);
+            if (value >= 0 && (value != local->reg || local->type == CHAR)) {
+                store_to_local(c, local, value);
+            }
+            break;
+        }
+        case AST_ASSIGNMENT: {
+            ast_assignment_node* assignment = (ast_assignment_node*)node;
+            const char* name = assignment->identifier_node->value;
+            int value = compile_expression(c, assignment->value);
+            bc_local* local = find_bc_local(c, name);
+            if (local != NULL) {
+                store_to_local(c, local, value);
+            } else {
+                int global = find_bc_global(c->bc, name);
+                if (global < 0) {
+                    fatal_error("Error: bytecode could not resolve '%s'\n", name);
+                }
+                if (c->bc->global_sizes[global] == 1) {
+                    int tmp = alloc_register(c);
+                    emit(c, make_inst(BC_TRUNC8, tmp, value, 0, 0));
+                    value = tmp;
+                }
+                if (assignment->index != NULL) {
+                    int position = compile_expression(c, assignment->index);
+                    emit(c, make_inst(BC_STOREX, value, position, 0, global));
+                } else {
+                    emit(c, make_inst(BC_STOREG, value, 0, 0, c->bc->global_slots[global]));
+                }
+            }
+            c->next_register = c->locals_top;
+            break;
+        }
+        case AST_RETURN_STMT: {
+            ast_return_node* return_stmt = (ast_return_node*)node;
+            if (return_stmt->expr != NULL) {
+                emit(c, make_inst(BC_RET, compile_expression(c, return_stmt->expr), 0, 0, 0));
+            } else {
+                emit(c, make_inst(BC_RETK, 0, 0, 0, 0));
+            }
+            c->next_register = c->locals_top;
+            break;
+        }
+        case AST_BLOCK:
+            compile_block(c, (ast_block_node*)node);
+            break;
+        case AST_CALL_EXPR:
+            compile_expression(c, node);
+            c->next_register = c->locals_top;
+            break;
+        case AST_WHILE_STMT:
+        case AST_DO_WHILE_STMT:
+        case AST_FOR_STMT:
+            compile_loop(c, (ast_loop_node*)node);
+            break;
+        case AST_SWITCH_STMT:
+            compile_switch(c, (ast_switch_node*)node);
+            break;
+        case AST_CASE_LABEL:
+            compile_case_label(c, (ast_case_node*)node);
+            break;
+        case AST_BREAK_STMT:
+        case AST_CONTINUE_STMT:
+            add_pending_jump(c, emit_jump(c, BC_JMP, 0), node->type == AST_BREAK_STMT);
+            break;
+        default:
+            fatal_error("Error: bytecode does not support statement node %d\n", node->type);
+    }
+}
+
+static bc_function* create_bc_function(const char* name) {
+    bc_function* fn = malloc(sizeof(bc_function));
+    fn->name = _strdup(name);
+    fn->code = NULL;
+    fn->num_code = 0;
+    fn->max_code = 0;
+    fn->num_registers = 0;
+    fn->switches = NULL;
+    fn->num_switches = 0;
+    return fn;
+}
+
+static void compile_function(bc_program* bc, bc_function* fn, ast_function_decl_node* function_decl) {
+    bc_compiler c = { bc, fn, NULL, 0, 0, 0, 0, NULL, 0, 0, 0, 0, NULL };
+    // Arguments arrive in the first registers as the caller computed them.
+    for (size_t i = 0; i < function_decl->num_parameters; ++i) {
+        ast_variable_decl_node* param = (ast_variable_decl_node*)function_decl->parameters[i];
+        bc_local* local = add_bc_local(&c, param->identifier_node->value, param->type_node);
+        if (local->type == CHAR) {
+            append_inst(&c, make_inst(BC_TRUNC8, local->reg, local->reg, 0, 0));
+        }
+    }
+    compile_block(&c, function_decl->body);
+
+    // A fall-through return must never be fused with the code before it.
+    append_inst(&c, make_inst(BC_RETK, 0, 0, 0, 0));
+
+    free(c.locals);
+    free(c.jumps);
+}
+
+bc_program* compile_bytecode(ast_program_node* program) {
+    bc_program* bc = malloc(sizeof(bc_program));
+    bc->functions = NULL;
+    bc->num_functions = 0;
+    bc->global_names = NULL;
+    bc->global_sizes = NULL;
+    bc->global_slots = NULL;
+    bc->global_lengths = NULL;
+    bc->globals = NULL;
+    bc->num_globals = 0;
+    bc->num_slots = 0;
+    bc->superinstructions = 0;
+
+    // Functions are numbered up front so calls can refer to later ones.
+    for (size_t i = 0; i < program->num_declarations; ++i) {
+        ast_node* declaration = program->declarations[i];
+        if (declaration->type == AST_FUNCTION_DECL) {
+            bc->functions = realloc(bc->functions, (bc->num_functions + 1) * sizeof(bc_function*));
+            bc->functions[bc->num_functions++] =
+                create_bc_function(((ast_function_decl_node*)declaration)->function_name);
+        }
+    }
+
+    size_t next_function = 0;
+    for (size_t i = 0; i < program->num_declarations; ++i) {
+        ast_node* declaration = program->declarations[i];
+        if (declaration->type == AST_VARIABLE_DECL) {
+            ast_variable_decl_node* var_decl = (ast_variable_decl_node*)declaration;
+            size_t n = bc->num_globals + 1;
+            size_t slots = var_decl->array_length > 0 ? var_decl->array_length : 1;
+            bc->global_names = realloc(bc->global_names, n * sizeof(char*));
+            bc->global_sizes = realloc(bc->global_sizes, n * sizeof(int));
+            bc->global_slots = realloc(bc->global_slots, n * sizeof(int));
+            bc->global_lengths = realloc(bc->global_lengths, n * sizeof(int));
+            bc->globals = realloc(bc->globals, (bc->num_slots + slots) * sizeof(int));
+            bc->global_names[bc->num_globals] = var_decl->identifier_node->value;
+            bc->global_sizes[bc->num_globals] = var_decl->type_node == CHAR ? 1 : 4;
+            bc->global_slots[bc->num_globals] = (int)bc->num_slots;
+            bc->global_lengths[bc->num_globals] = (int)var_decl->array_length;
+            int value = var_decl->value != NULL ? (int)ast_eval_constant(var_decl->value) : 0;
+            bc->globals[bc->num_slots] = var_decl->type_node == CHAR ? (signed char)value : value;
+            memset(&bc->globals[bc->num_slots + 1], 0, (slots - 1) * sizeof(int));
+            bc->num_globals = n;
+            bc->num_slots += slots;
+        } else if (declaration->type == AST_FUNCTION_DECL) {
+            compile_function(bc, bc->functions[next_function++], (ast_function_decl_node*)declaration);
+        } else {
+            fatal_error("Error: bytecode does not support global declaration node %d\n", declaration->type);
+        }
+    }
+    return bc;
+}
+
+bc_function* find_bc_function(bc_program* bc, const char* name) {
+    for (size_t i = 0; i < bc->num_functions; ++i) {
+        if (strcmp(bc->functions[i]->name, name) == 0) {
+            return bc->functions[i];
+        }
+    }
+    return NULL;
+}
+
+void free_bc_program(bc_program* bc) {
+    for (size_t i = 0; i < bc->num_functions; ++i) {
+        free(bc->functions[i]->name);
+        free(bc->functions[i]->code);
+        for (size_t j = 0; j < bc->functions[i]->num_switches; ++j) {
+            free(bc->functions[i]->switches[j].values);
+            free(bc->functions[i]->switches[j].targets);
+        }
+        free(bc->functions[i]->switches);
+        free(bc->functions[i]);
+    }
+    free(bc->functions);
+    free(bc->global_names);
+    free(bc->global_sizes);
+    free(bc->global_slots);
+    free(bc->global_lengths);
+    free(bc->globals);
+    free(bc);
+}
@@ -0,0 +1,103 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "ast.h"
+
+// Register-based bytecode for the interpreter tier. Every local owns a
+// register for the whole function; expression temporaries are allocated
+// above the locals in stack order, so operands can be read straight from
+// the variables that hold them.
+typedef enum {
+    BC_LOADK,           // r[a] = k
+    BC_MOVE,            // r[a] = r[b]
+    BC_LOADG,           // r[a] = globals[k]
+    BC_STOREG,          // globals[k] = r[a]
+    BC_LOADX,           // r[a] = element r[b] of array global k
+    BC_STOREX,          // element r[b] of array global k = r[a]
+    BC_ADD,             // r[a] = r[b] + r[c]
+    BC_SUB,
+    BC_MUL,
+    BC_DIV,
+    BC_MOD,
+    BC_EQ,
+    BC_NE,
+    BC_LT,              // r[a] = r[b] < r[c]
+    BC_LE,              // r[a] = r[b] <= r[c]
+    BC_NEG,             // r[a] = -r[b]
+    BC_NOT,             // r[a] = !r[b]
+    BC_TRUNC8,          // r[a] = (signed char)r[b]
+    BC_CALL,            // r[a] = functions[k](r[b], ..., r[b + c - 1])
+    BC_RET,             // return r[a]
+    BC_JMP,             // goto k
+    BC_JZ,              // if (!r[a]) goto k
+    BC_JNZ,             // if (r[a]) goto k
+    BC_SWITCH,          // goto where switches[k] sends r[a]
+
+    // Superinstructions, formed while emitting from common pairs.
+    BC_ADDK,            // r[a] = r[b] + k          (LOADK + ADD)
+    BC_SUBK,            // r[a] = r[b] - k          (LOADK + SUB)
+    BC_MULK,            // r[a] = r[b] * k          (LOADK + MUL)
+    BC_ADD_STOREG,      // globals[k] = r[b] + r[c] (ADD + STOREG)
+    BC_ADD_RET,         // return r[b] + r[c]       (ADD + RET)
+    BC_RETK,            // return k                 (LOADK + RET)
+
+    BC_NUM_OPCODES,
+} bc_opcode;
+
+typedef struct bc_inst {
+    unsigned char op;
+    unsigned char a;
+    unsigned char b;
+    unsigned char c;
+    int k;
+} bc_inst;
+
+// Where a switch goes for each case value, as code positions. A dense
+// table has an entry for every value from low up, so values is NULL and a
+// lookup is one index; a sparse one keeps its values sorted for a binary
+// search. Values without an entry go to otherwise.
+typedef struct bc_switch {
+    int low;
+    int* values;
+    int* targets;
+    size_t length;
+    int otherwise;
+} bc_switch;
+
+typedef struct bc_function {
+    char* name;
+    bc_inst* code;
+    size_t num_code;
+    size_t max_code;
+    int num_registers;
+    bc_switch* switches;
+    size_t num_switches;
+} bc_function;
+
+// An array global owns global_lengths[i] consecutive slots of globals from
+// global_slots[i]; a scalar owns one and has length 0. LOADG and STOREG
+// address slots, LOADX and STOREX address globals.
+typedef struct bc_program {
+    bc_function** functions;
+    size_t num_functions;
+    char** global_names;
+    int* global_sizes;
+    int* global_slots;
+    int* global_lengths;
+    int* globals;
+    size_t num_globals;
+    size_t num_slots;
+    size_t superinstructions;   // pairs fused while compiling
+} bc_program;
+
+bc_program* compile_bytecode(ast_program_node* program);
+bc_function* find_bc_function(bc_program* bc, const char* name);
+void free_bc_program(bc_program* bc);
+const char* bc_opcode_tostring(bc_opcode op);
+int vm_execute(bc_program* bc, bc_function* fn);
+int vm_call(bc_program* bc, bc_function* fn, const int* args, int num_args);
+int vm_run_main(bc_program* bc);
+
+#endif // BYTECODE_H
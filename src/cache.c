@@ -0,0 +1,364 @@
+#include "cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "hash.h"
+#include "compat.h"
+
+#define CACHE_MAGIC "SCCCACH2"
+#define CACHE_SUFFIX ".scc"
+#define CACHE_HEADER_SIZE (8 + 16 + 8 + 8)
+// Temporary files left behind by a killed writer are swept after this long.
+#define CACHE_STALE_TEMP_SECONDS 3600
+
+typedef struct cache_entry {
+    char* path;
+    off_t size;
+    struct timespec mtime;
+} cache_entry;
+
+char* default_cache_directory() {
+    const char* base = getenv("XDG_CACHE_HOME");
+    const char* suffix = "/scc";
+    if (base == NULL || base[0] == '\0') {
+        base = getenv("HOME");
+        suffix = "/.cache/scc";
+    }
+    if (base == NULL || base[0] == '\0') {
+        return NULL;
+    }
+    char* directory = malloc(strlen(base) + strlen(suffix) + 1);
+    strcpy(directory, base);
+    strcat(directory, suffix);
+    return directory;
+}
+
+static bool make_directories(const char* path) {
+    char* copy = _strdup(path);
+    for (char* p = copy + 1; *p; ++p) {
+        if (*p == '/') {
+            *p = '\0';
+            if (mkdir(copy, 0777) != 0 && errno != EEXIST) {
+                free(copy);
+                return false;
+            }
+            *p = '/';
+        }
+    }
+    bool ok = mkdir(copy, 0777) == 0 || errno == EEXIST;
+    free(copy);
+    return ok;
+}
+
+// The compiler binary stands in for a version number: rebuilding scc changes
+// its size or mtime and with that every key.
+uint64_t compute_compiler_id() {
+    struct stat st;
+    uint64_t id = hash_string("scc", 0);
+    if (stat("/proc/self/exe", &st) == 0) {
+        id = hash_combine(id, (uint64_t)st.st_size);
+        id = hash_combine(id, (uint64_t)st.st_mtim.tv_sec);
+        id = hash_combine(id, (uint64_t)st.st_mtim.tv_nsec);
+    }
+    return id;
+}
+
+bool init_compile_cache(compile_cache* cache, const char* directory, size_t max_bytes) {
+    if (directory == NULL || !make_directories(directory)) {
+        return false;
+    }
+    cache->directory = _strdup(directory);
+    cache->max_bytes = max_bytes;
+    cache->compiler_id = compute_compiler_id();
+    return true;
+}
+
+void free_compile_cache(compile_cache* cache) {
+    free(cache->directory);
+    cache->directory = NULL;
+}
+
+cache_key compute_cache_key(const compile_cache* cache, const char* source, size_t size, const char* flags) {
+    cache_key key;
+    for (int i = 0; i < 2; ++i) {
+        uint64_t h = hash_bytes(source, size, (uint64_t)i + 1);
+        h = hash_combine(h, hash_string(flags, (uint64_t)i + 1));
+        key.hash[i] = hash_combine(h, cache->compiler_id);
+    }
+    snprintf(key.name, sizeof(key.name), "%016llx%016llx",
+             (unsigned long long)key.hash[0], (unsigned long long)key.hash[1]);
+    return key;
+}
+
+static char* entry_path(const compile_cache* cache, const char* name) {
+    size_t length = strlen(cache->directory) + 1 + strlen(name) + strlen(CACHE_SUFFIX) + 1;
+    char* path = malloc(length);
+    snprintf(path, length, "%s/%s%s", cache->directory, name, CACHE_SUFFIX);
+    return path;
+}
+
+static bool read_fully(int fd, void* data, size_t size) {
+    char* p = data;
+    while (size > 0) {
+        ssize_t n = read(fd, p, size);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+static bool write_fully(int fd, const void* data, size_t size) {
+    const char* p = data;
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+bool dependency_unchanged(const char* path, uint64_t hash) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    bool unchanged = false;
+    if (fstat(fd, &st) == 0) {
+        size_t size = (size_t)st.st_size;
+        char* content = malloc(size + 1);
+        unchanged = content != NULL && read_fully(fd, content, size) && hash_bytes(content, size, 0) == hash;
+        free(content);
+    }
+    close(fd);
+    return unchanged;
+}
+
+// Checks the dependency list at the front of a payload and returns where the
+// artifact starts, or 0 if any dependency changed.
+static size_t check_dependencies(const char* payload, size_t size) {
+    uint64_t num_dependencies;
+    size_t offset = 8;
+    if (size < offset) {
+        return 0;
+    }
+    memcpy(&num_dependencies, payload, 8);
+    for (uint64_t i = 0; i < num_dependencies; ++i) {
+        uint64_t hash, length;
+        if (size - offset < 16) {
+            return 0;
+        }
+        memcpy(&hash, payload + offset, 8);
+        memcpy(&length, payload + offset + 8, 8);
+        offset += 16;
+        if (size - offset < length) {
+            return 0;
+        }
+        char* path = malloc(length + 1);
+        memcpy(path, payload + offset, length);
+        path[length] = '\0';
+        bool unchanged = dependency_unchanged(path, hash);
+        free(path);
+        if (!unchanged) {
+            return 0;
+        }
+        offset += length;
+    }
+    return offset;
+}
+
+// Entries carry their key and a checksum of the payload, so a truncated or
+// foreign file reads as a miss instead of as bad output.
+bool cache_lookup(const compile_cache* cache, const cache_key* key, buffer* out) {
+    char* path = entry_path(cache, key->name);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        free(path);
+        return false;
+    }
+
+    unsigned char header[CACHE_HEADER_SIZE];
+    uint64_t hash[2], size, checksum;
+    char* payload = NULL;
+    bool hit = read_fully(fd, header, sizeof(header)) && memcmp(header, CACHE_MAGIC, 8) == 0;
+    if (hit) {
+        memcpy(hash, header + 8, 16);
+        memcpy(&size, header + 24, 8);
+        memcpy(&checksum, header + 32, 8);
+        hit = hash[0] == key->hash[0] && hash[1] == key->hash[1];
+    }
+    if (hit) {
+        payload = malloc((size_t)size + 1);
+        hit = payload != NULL && read_fully(fd, payload, (size_t)size) &&
+              hash_bytes(payload, (size_t)size, 0) == checksum;
+    }
+    close(fd);
+
+    if (hit) {
+        size_t start = check_dependencies(payload, (size_t)size);
+        hit = start != 0;
+        if (hit) {
+            buffer_append(out, payload + start, (size_t)size - start);
+        }
+    }
+    free(payload);
+
+    // Touching the entry is what makes eviction least-recently-used.
+    if (hit) {
+        utime(path, NULL);
+    }
+    free(path);
+    return hit;
+}
+
+static int compare_entries(const void* a, const void* b) {
+    const cache_entry* x = a;
+    const cache_entry* y = b;
+    if (x->mtime.tv_sec != y->mtime.tv_sec) {
+        return x->mtime.tv_sec < y->mtime.tv_sec ? -1 : 1;
+    }
+    if (x->mtime.tv_nsec != y->mtime.tv_nsec) {
+        return x->mtime.tv_nsec < y->mtime.tv_nsec ? -1 : 1;
+    }
+    return 0;
+}
+
+// Deletes least recently used entries until the cache is back under 90% of
+// its limit. Another process may be evicting at the same time; losing an
+// unlink race is harmless.
+static void evict_entries(const compile_cache* cache) {
+    DIR* dir = opendir(cache->directory);
+    if (dir == NULL) {
+        return;
+    }
+
+    cache_entry* entries = NULL;
+    size_t num_entries = 0;
+    size_t max_entries = 0;
+    size_t total = 0;
+    size_t suffix_length = strlen(CACHE_SUFFIX);
+    time_t now = time(NULL);
+    struct dirent* dirent;
+    while ((dirent = readdir(dir)) != NULL) {
+        const char* name = dirent->d_name;
+        size_t length = strlen(name);
+        bool is_temp = strncmp(name, ".tmp.", 5) == 0;
+        bool is_entry = length > suffix_length && strcmp(name + length - suffix_length, CACHE_SUFFIX) == 0;
+        if (!is_temp && !is_entry) {
+            continue;
+        }
+
+        size_t path_length = strlen(cache->directory) + 1 + length + 1;
+        char* path = malloc(path_length);
+        snprintf(path, path_length, "%s/%s", cache->directory, name);
+        struct stat st;
+        if (stat(path, &st) != 0) {
+            free(path);
+            continue;
+        }
+        if (is_temp) {
+            if (now - st.st_mtim.tv_sec > CACHE_STALE_TEMP_SECONDS) {
+                unlink(path);
+            }
+            free(path);
+            continue;
+        }
+
+        if (num_entries == max_entries) {
+            max_entries = max_entries ? max_entries * 2 : 64;
+            entries = realloc(entries, max_entries * sizeof(cache_entry));
+        }
+        entries[num_entries].path = path;
+        entries[num_entries].size = st.st_size;
+        entries[num_entries].mtime = st.st_mtim;
+        num_entries++;
+        total += (size_t)st.st_size;
+    }
+    closedir(dir);
+
+    if (total > cache->max_bytes) {
+        size_t target = cache->max_bytes / 10 * 9;
+        qsort(entries, num_entries, sizeof(cache_entry), compare_entries);
+        for (size_t i = 0; i < num_entries && total > target; ++i) {
+            if (unlink(entries[i].path) == 0) {
+                total -= (size_t)entries[i].size;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < num_entries; ++i) {
+        free(entries[i].path);
+    }
+    free(entries);
+}
+
+// Writes to a private temporary file and renames it into place, so readers
+// see either no entry or a complete one.
+bool cache_store(const compile_cache* cache, const cache_key* key, const cache_dependency* dependencies,
+                 size_t num_dependencies, const buffer* data) {
+    size_t temp_length = strlen(cache->directory) + sizeof("/.tmp.XXXXXX");
+    char* temp_path = malloc(temp_length);
+    snprintf(temp_path, temp_length, "%s/.tmp.XXXXXX", cache->directory);
+    int fd = mkstemp(temp_path);
+    if (fd < 0) {
+        free(temp_path);
+        return false;
+    }
+
+    buffer payload = init_buffer(data->length + 64);
+    uint64_t count = num_dependencies;
+    buffer_append(&payload, &count, 8);
+    for (size_t i = 0; i < num_dependencies; ++i) {
+        uint64_t length = strlen(dependencies[i].path);
+        buffer_append(&payload, &dependencies[i].hash, 8);
+        buffer_append(&payload, &length, 8);
+        buffer_append(&payload, dependencies[i].path, (size_t)length);
+    }
+    buffer_append(&payload, data->data, data->length);
+
+    unsigned char header[CACHE_HEADER_SIZE];
+    uint64_t size = payload.length;
+    uint64_t checksum = hash_bytes(payload.data, payload.length, 0);
+    memcpy(header, CACHE_MAGIC, 8);
+    memcpy(header + 8, key->hash, 16);
+    memcpy(header + 24, &size, 8);
+    memcpy(header + 32, &checksum, 8);
+
+    bool ok = write_fully(fd, header, sizeof(header)) && write_fully(fd, payload.data, payload.length);
+    free_buffer(&payload);
+    fchmod(fd, 0644);
+    ok = close(fd) == 0 && ok;
+
+    char* path = entry_path(cache, key->name);
+    ok = ok && rename(temp_path, path) == 0;
+    if (!ok) {
+        unlink(temp_path);
+    }
+    free(path);
+    free(temp_path);
+
+    if (ok) {
+        evict_entries(cache);
+    }
+    return ok;
+}
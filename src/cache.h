@@ -0,0 +1,44 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "buffer.h"
+
+#define CACHE_DEFAULT_MAX_BYTES ((size_t)256 << 20)
+
+// On-disk cache of compilation outputs, addressed by a hash of the source
+// bytes, the compiler binary and the flags that shape the output. Entries are
+// published with rename() so concurrent scc processes can share a directory,
+// and the least recently used ones are evicted once it grows past max_bytes.
+typedef struct compile_cache {
+    char* directory;
+    size_t max_bytes;
+    uint64_t compiler_id;
+} compile_cache;
+
+// A file besides the main source that the output depends on, such as an
+// included header. An entry only hits while every dependency still hashes the
+// same.
+typedef struct cache_dependency {
+    const char* path;
+    uint64_t hash;
+} cache_dependency;
+
+typedef struct cache_key {
+    uint64_t hash[2];
+    char name[33];
+} cache_key;
+
+char* default_cache_directory();
+uint64_t compute_compiler_id();
+bool dependency_unchanged(const char* path, uint64_t hash);
+bool init_compile_cache(compile_cache* cache, const char* directory, size_t max_bytes);
+void free_compile_cache(compile_cache* cache);
+cache_key compute_cache_key(const compile_cache* cache, const char* source, size_t size, const char* flags);
+bool cache_lookup(const compile_cache* cache, const cache_key* key, buffer* out);
+bool cache_store(const compile_cache* cache, const cache_key* key, const cache_dependency* dependencies,
+                 size_t num_dependencies, const buffer* data);
+
+#endif // CACHE_H
@@ -0,0 +1,144 @@
+#include "callgraph.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+static void add_callee(call_graph_node* node, size_t callee) {
+    if (node->num_callees == node->max_callees) {
+        node->max_callees = node->max_callees ? node->max_callees * 2 : 4;
+        node->callees = realloc(node->callees, node->max_callees * sizeof(size_t));
+    }
+    node->callees[node->num_callees++] = callee;
+}
+
+// One frame of the depth-first search: the node and how many of its
+// callees have been looked at.
+typedef struct search_frame {
+    size_t node;
+    size_t next;
+} search_frame;
+
+// Tarjan's algorithm, with an explicit stack so that deep call chains do not
+// overflow the real one. It finishes a component only after every component
+// it can reach, which is exactly bottom-up order.
+static void find_components(call_graph* graph) {
+    size_t n = graph->num_nodes;
+    size_t* order = malloc((n + 1) * sizeof(size_t));
+    size_t* lowlink = malloc((n + 1) * sizeof(size_t));
+    bool* on_stack = calloc(n + 1, sizeof(bool));
+    size_t* stack = malloc((n + 1) * sizeof(size_t));
+    search_frame* frames = malloc((n + 1) * sizeof(search_frame));
+    size_t depth = 0;
+    size_t num_frames = 0;
+    size_t counter = 0;
+    size_t emitted = 0;
+    for (size_t i = 0; i < n; ++i) {
+        order[i] = SIZE_MAX;
+    }
+
+    for (size_t root = 0; root < n; ++root) {
+        if (order[root] != SIZE_MAX) {
+            continue;
+        }
+        order[root] = lowlink[root] = counter++;
+        stack[depth++] = root;
+        on_stack[root] = true;
+        frames[num_frames++] = (search_frame){ root, 0 };
+        while (num_frames > 0) {
+            search_frame* frame = &frames[num_frames - 1];
+            call_graph_node* node = &graph->nodes[frame->node];
+            if (frame->next < node->num_callees) {
+                size_t callee = node->callees[frame->next++];
+                if (order[callee] == SIZE_MAX) {
+                    order[callee] = lowlink[callee] = counter++;
+                    stack[depth++] = callee;
+                    on_stack[callee] = true;
+                    frames[num_frames++] = (search_frame){ callee, 0 };
+                } else if (on_stack[callee] && order[callee] < lowlink[frame->node]) {
+                    lowlink[frame->node] = order[callee];
+                }
+                continue;
+            }
+            size_t v = frame->node;
+            --num_frames;
+            if (lowlink[v] == order[v]) {
+                size_t w;
+                do {
+                    w = stack[--depth];
+                    on_stack[w] = false;
+                    graph->nodes[w].component = graph->num_components;
+                    graph->bottom_up[emitted++] = w;
+                } while (w != v);
+                graph->num_components++;
+            }
+            if (num_frames > 0 && lowlink[v] < lowlink[frames[num_frames - 1].node]) {
+                lowlink[frames[num_frames - 1].node] = lowlink[v];
+            }
+        }
+    }
+
+    free(order);
+    free(lowlink);
+    free(on_stack);
+    free(stack);
+    free(frames);
+}
+
+call_graph* build_call_graph(sir_program* program) {
+    call_graph* graph = malloc(sizeof(call_graph));
+    graph->num_nodes = program->num_functions;
+    graph->nodes = calloc(graph->num_nodes + 1, sizeof(call_graph_node));
+    graph->bottom_up = malloc((graph->num_nodes + 1) * sizeof(size_t));
+    graph->num_components = 0;
+
+    // seen[j] == i + 1 once function i is known to call j.
+    size_t* seen = calloc(graph->num_nodes + 1, sizeof(size_t));
+    for (size_t i = 0; i < program->num_functions; ++i) {
+        sir_function* fn = program->functions[i];
+        call_graph_node* node = &graph->nodes[i];
+        for (size_t b = 0; b < fn->num_blocks; ++b) {
+            sir_block* block = fn->blocks[b];
+            for (size_t j = 0; j < block->num_insts; ++j) {
+                sir_inst* inst = &block->insts[j];
+                if (inst->op != SIR_CALL) {
+                    continue;
+                }
+                size_t k = find_sir_function_index(program, inst->symbol);
+                if (k == SIZE_MAX) {
+                    continue;
+                }
+                node->num_call_sites++;
+                node->recursive |= k == i;
+                if (seen[k] != i + 1) {
+                    seen[k] = i + 1;
+                    add_callee(node, k);
+                }
+            }
+        }
+    }
+    free(seen);
+
+    find_components(graph);
+    size_t* members = calloc(graph->num_components + 1, sizeof(size_t));
+    for (size_t i = 0; i < graph->num_nodes; ++i) {
+        members[graph->nodes[i].component]++;
+    }
+    for (size_t i = 0; i < graph->num_nodes; ++i) {
+        graph->nodes[i].recursive |= members[graph->nodes[i].component] > 1;
+    }
+    free(members);
+    return graph;
+}
+
+bool is_recursive(call_graph* graph, size_t function) {
+    return graph->nodes[function].recursive;
+}
+
+void free_call_graph(call_graph* graph) {
+    for (size_t i = 0; i < graph->num_nodes; ++i) {
+        free(graph->nodes[i].callees);
+    }
+    free(graph->nodes);
+    free(graph->bottom_up);
+    free(graph);
+}
@@ -0,0 +1,31 @@
+#ifndef CALLGRAPH_H
+#define CALLGRAPH_H
+
+#include "sir.h"
+
+// Who calls whom among the functions of one program. Nodes are indexed like
+// program->functions; calls to functions defined elsewhere are left out.
+typedef struct call_graph_node {
+    size_t* callees;            // distinct, in order of first call
+    size_t num_callees;
+    size_t max_callees;
+    size_t num_call_sites;
+    size_t component;           // strongly connected component
+    bool recursive;             // on a cycle, if only through itself
+} call_graph_node;
+
+// bottom_up lists every function after all the functions it calls, except
+// where they call each other back: the members of a cycle share a component
+// and come out next to one another.
+typedef struct call_graph {
+    call_graph_node* nodes;
+    size_t num_nodes;
+    size_t* bottom_up;
+    size_t num_components;
+} call_graph;
+
+call_graph* build_call_graph(sir_program* program);
+bool is_recursive(call_graph* graph, size_t function);
+void free_call_graph(call_graph* graph);
+
+#endif // CALLGRAPH_H
@@ -0,0 +1,589 @@
+#include "codegen.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "diagnostics.h"
+
+// Straightforward lowering of SIR: every vreg has a home in the frame, and
+// each instruction loads its operands into %eax and %ecx, computes and
+// stores the result back. The peephole pass cleans up the traffic between
+// neighbouring instructions.
+//
+// A function that makes no calls but tail calls needs no frame of its own
+// when its slots fit in the red zone, the RED_ZONE_SIZE bytes below %rsp
+// that the System V ABI keeps for it. Its slots are then addressed off
+// %rsp, 8 bytes lower than they would be off %rbp, which accounts for the
+// %rbp a frame would have pushed.
+
+static const x86_reg argument_registers[] = { REG_RDI, REG_RSI, REG_RDX, REG_RCX, REG_R8, REG_R9 };
+
+#define NUM_ARGUMENT_REGISTERS 6
+#define RED_ZONE_SIZE 128
+
+static x86_operand eax() {
+    return x86_reg_operand(REG_RAX, 4);
+}
+
+static x86_operand ecx() {
+    return x86_reg_operand(REG_RCX, 4);
+}
+
+static int vreg_size(codegen* cg, int vreg) {
+    return cg->ir->vregs[vreg].size;
+}
+
+// size bytes at offset into vreg's slot.
+static x86_operand slot_operand(codegen* cg, int vreg, int offset, int size) {
+    if (!cg->has_frame) {
+        return x86_mem_operand(REG_RSP, cg->slots[vreg] + offset - 8, size);
+    }
+    return x86_mem_operand(REG_RBP, cg->slots[vreg] + offset, size);
+}
+
+static x86_operand vreg_operand(codegen* cg, int vreg) {
+    return slot_operand(cg, vreg, 0, vreg_size(cg, vreg));
+}
+
+static void load(codegen* cg, x86_reg reg, sir_operand operand) {
+    x86_operand dst = x86_reg_operand(reg, 4);
+    if (operand.kind == SIR_OPERAND_IMM) {
+        x86_emit(cg->fn, X86_MOV, dst, x86_imm_operand(operand.imm, 4));
+    } else if (vreg_size(cg, operand.vreg) == 1) {
+        x86_emit(cg->fn, X86_MOVSX, dst, vreg_operand(cg, operand.vreg));
+    } else {
+        x86_emit(cg->fn, X86_MOV, dst, vreg_operand(cg, operand.vreg));
+    }
+}
+
+// The right operand of an ALU instruction: immediates and int vregs can be
+// used in place, bytes must be widened into %ecx first.
+static x86_operand source(codegen* cg, sir_operand operand) {
+    if (operand.kind == SIR_OPERAND_IMM) {
+        return x86_imm_operand(operand.imm, 4);
+    }
+    if (vreg_size(cg, operand.vreg) == 4) {
+        return vreg_operand(cg, operand.vreg);
+    }
+    load(cg, REG_RCX, operand);
+    return ecx();
+}
+
+static void store(codegen* cg, int dst) {
+    x86_emit(cg->fn, X86_MOV, vreg_operand(cg, dst), x86_reg_operand(REG_RAX, vreg_size(cg, dst)));
+}
+
+static int global_size(codegen* cg, const char* name) {
+    sir_global* global = find_sir_global(cg->program, name);
+    if (global == NULL) {
+        fatal_error("Error: codegen could not resolve '%s' in function %s\n", name, cg->ir->name);
+    }
+    return global->size;
+}
+
+// symbol[index] as an indexed operand of size bytes: the index ends up in
+// %rax and the array's address in %rcx.
+static x86_operand element_operand(codegen* cg, const char* symbol, sir_operand index, int size) {
+    int element_size = global_size(cg, symbol);
+    load(cg, REG_RAX, index);
+    x86_emit(cg->fn, X86_MOVSX, x86_reg_operand(REG_RAX, 8), eax());
+    x86_emit(cg->fn, X86_LEA, x86_reg_operand(REG_RCX, 8), x86_symbol_operand(symbol, 8));
+    return x86_index_operand(REG_RCX, REG_RAX, element_size, size ? size : element_size);
+}
+
+// Vector register reg, as wide as vreg.
+static x86_operand xmm(codegen* cg, int reg, int vreg) {
+    return x86_vec_operand(reg, vreg_size(cg, vreg));
+}
+
+static void load_vector(codegen* cg, int reg, int vreg) {
+    x86_emit(cg->fn, X86_MOVDQU, xmm(cg, reg, vreg), vreg_operand(cg, vreg));
+}
+
+// SSE2 has no 32-bit lanewise multiply, so even and odd lanes are
+// multiplied into 64-bit products separately and the low halves merged.
+static void gen_vector_multiply(codegen* cg, sir_inst* inst) {
+    int a = inst->a.vreg;
+    int b = inst->b.vreg;
+    load_vector(cg, 0, a);
+    load_vector(cg, 1, b);
+    if (vreg_size(cg, inst->dst) == 32) {
+        x86_emit(cg->fn, X86_PMULLD, xmm(cg, 0, a), xmm(cg, 1, b));
+        return;
+    }
+    load_vector(cg, 2, a);
+    load_vector(cg, 3, b);
+    x86_operand shift = x86_imm_operand(32, 1);
+    x86_emit(cg->fn, X86_PMULUDQ, xmm(cg, 0, a), xmm(cg, 1, b));
+    x86_emit(cg->fn, X86_PSLLQ, xmm(cg, 0, a), shift);
+    x86_emit(cg->fn, X86_PSRLQ, xmm(cg, 0, a), shift);
+    x86_emit(cg->fn, X86_PSRLQ, xmm(cg, 2, a), shift);
+    x86_emit(cg->fn, X86_PSRLQ, xmm(cg, 3, b), shift);
+    x86_emit(cg->fn, X86_PMULUDQ, xmm(cg, 2, a), xmm(cg, 3, b));
+    x86_emit(cg->fn, X86_PSLLQ, xmm(cg, 2, a), shift);
+    x86_emit(cg->fn, X86_POR, xmm(cg, 0, a), xmm(cg, 2, a));
+}
+
+static void gen_vector_inst(codegen* cg, sir_inst* inst) {
+    switch (inst->op) {
+        case SIR_VLOAD: {
+            x86_operand element = element_operand(cg, inst->symbol, inst->a, vreg_size(cg, inst->dst));
+            x86_emit(cg->fn, X86_MOVDQU, xmm(cg, 0, inst->dst), element);
+            break;
+        }
+        case SIR_VSTORE: {
+            x86_operand element = element_operand(cg, inst->symbol, inst->a, vreg_size(cg, inst->b.vreg));
+            load_vector(cg, 0, inst->b.vreg);
+            x86_emit(cg->fn, X86_MOVDQU, element, xmm(cg, 0, inst->b.vreg));
+            return;
+        }
+        case SIR_VSPLAT: {
+            x86_operand value = x86_imm_operand(inst->a.imm, 4);
+            if (inst->a.kind == SIR_OPERAND_VREG) {
+                load(cg, REG_RAX, inst->a);
+                value = eax();
+            }
+            for (int lane = 0; lane < vreg_size(cg, inst->dst); lane += 4) {
+                x86_emit(cg->fn, X86_MOV, slot_operand(cg, inst->dst, lane, 4), value);
+            }
+            return;
+        }
+        case SIR_VADD:
+        case SIR_VSUB:
+            load_vector(cg, 0, inst->a.vreg);
+            load_vector(cg, 1, inst->b.vreg);
+            x86_emit(cg->fn, inst->op == SIR_VADD ? X86_PADDD : X86_PSUBD, xmm(cg, 0, inst->dst),
+                     xmm(cg, 1, inst->dst));
+            break;
+        case SIR_VMUL:
+            gen_vector_multiply(cg, inst);
+            break;
+        case SIR_VSUM: {
+            int vreg = inst->a.vreg;
+            x86_emit(cg->fn, X86_MOV, eax(), slot_operand(cg, vreg, 0, 4));
+            for (int lane = 4; lane < vreg_size(cg, vreg); lane += 4) {
+                x86_emit(cg->fn, X86_ADD, eax(), slot_operand(cg, vreg, lane, 4));
+            }
+            store(cg, inst->dst);
+            return;
+        }
+        default:
+            return;
+    }
+    x86_emit(cg->fn, X86_MOVDQU, vreg_operand(cg, inst->dst), xmm(cg, 0, inst->dst));
+}
+
+static x86_cond compare_cond(sir_opcode op) {
+    switch (op) {
+        case SIR_EQ: return CC_E;
+        case SIR_NE: return CC_NE;
+        case SIR_LT: return CC_L;
+        case SIR_LE: return CC_LE;
+        case SIR_GT: return CC_G;
+        case SIR_ULT: return CC_B;
+        case SIR_BIT_TEST: return CC_B;
+        default: return CC_GE;
+    }
+}
+
+static bool is_compare(sir_opcode op) {
+    return op >= SIR_EQ && op <= SIR_BIT_TEST;
+}
+
+// Sets the flags for a compare: bt leaves the bit in the carry, the
+// others compare a with b.
+static void gen_flags(codegen* cg, sir_inst* inst) {
+    if (inst->op == SIR_BIT_TEST) {
+        load(cg, REG_RCX, inst->a);
+        load(cg, REG_RAX, inst->b);
+        x86_emit(cg->fn, X86_BT, eax(), ecx());
+        return;
+    }
+    load(cg, REG_RAX, inst->a);
+    x86_emit(cg->fn, X86_CMP, eax(), source(cg, inst->b));
+}
+
+static void gen_setcc(codegen* cg, x86_cond cond) {
+    x86_emit_cc(cg->fn, X86_SETCC, cond, x86_reg_operand(REG_RAX, 1));
+    x86_emit(cg->fn, X86_MOVZX, eax(), x86_reg_operand(REG_RAX, 1));
+}
+
+static void gen_compare(codegen* cg, x86_cond cond, x86_operand right) {
+    x86_emit(cg->fn, X86_CMP, eax(), right);
+    gen_setcc(cg, cond);
+}
+
+// The table holds each target's offset from the table itself, so the code
+// stays position independent:
+//
+//   leaq .Ltable(%rip), %rcx; movslq (%rcx,%rax,4), %rdx; addq %rcx, %rdx; jmp *%rdx
+static void gen_jump_table(codegen* cg, sir_inst* inst) {
+    int table = x86_new_label(cg->fn);
+    load(cg, REG_RAX, inst->a);
+    x86_emit(cg->fn, X86_LEA, x86_reg_operand(REG_RCX, 8), x86_label_operand(table));
+    x86_emit(cg->fn, X86_MOVSX, x86_reg_operand(REG_RDX, 8), x86_index_operand(REG_RCX, REG_RAX, 4, 4));
+    x86_emit(cg->fn, X86_ADD, x86_reg_operand(REG_RDX, 8), x86_reg_operand(REG_RCX, 8));
+    x86_emit(cg->fn, X86_JMP, x86_reg_operand(REG_RDX, 8), x86_none());
+    x86_emit_label(cg->fn, table);
+    for (size_t k = 0; k < inst->table_size; ++k) {
+        x86_emit(cg->fn, X86_TABLE_ENTRY, x86_label_operand(cg->labels[inst->table[k]->index]),
+                 x86_label_operand(table));
+    }
+}
+
+// Arguments past the sixth are pushed right to left, padded so the call
+// itself still happens on a 16-byte boundary.
+static void gen_call(codegen* cg, sir_inst* inst) {
+    size_t num_stack = inst->num_args > NUM_ARGUMENT_REGISTERS ? inst->num_args - NUM_ARGUMENT_REGISTERS : 0;
+    int cleanup = (int)(num_stack + (num_stack & 1)) * 8;
+    if (num_stack & 1) {
+        x86_emit(cg->fn, X86_SUB, x86_reg_operand(REG_RSP, 8), x86_imm_operand(8, 4));
+    }
+    if (cg->uses_ymm) {
+        x86_emit(cg->fn, X86_VZEROUPPER, x86_none(), x86_none());
+    }
+    for (size_t i = inst->num_args; i > NUM_ARGUMENT_REGISTERS; --i) {
+        load(cg, REG_RAX, inst->args[i - 1]);
+        x86_emit(cg->fn, X86_PUSH, x86_reg_operand(REG_RAX, 8), x86_none());
+    }
+    for (size_t i = 0; i < inst->num_args && i < NUM_ARGUMENT_REGISTERS; ++i) {
+        load(cg, argument_registers[i], inst->args[i]);
+    }
+    x86_emit(cg->fn, X86_CALL, x86_symbol_operand(inst->symbol, 8), x86_none());
+    if (cleanup > 0) {
+        x86_emit(cg->fn, X86_ADD, x86_reg_operand(REG_RSP, 8), x86_imm_operand(cleanup, 4));
+    }
+    if (inst->dst >= 0) {
+        store(cg, inst->dst);
+    }
+}
+
+// A call whose result, if it has one, is returned right away, with every
+// argument in a register: the callee can return straight to our caller.
+static bool is_tail_call(codegen* cg, sir_block* block, size_t i) {
+    sir_inst* call = &block->insts[i];
+    if (call->op != SIR_CALL || call->num_args > NUM_ARGUMENT_REGISTERS || i + 1 >= block->num_insts) {
+        return false;
+    }
+    sir_inst* ret = &block->insts[i + 1];
+    return ret->op == SIR_RETURN &&
+           (ret->a.kind == SIR_OPERAND_NONE ||
+            (ret->a.kind == SIR_OPERAND_VREG && ret->a.vreg == call->dst && vreg_size(cg, call->dst) == 4));
+}
+
+// Undoes the prologue, leaving %rsp where the caller had it.
+static void gen_leave(codegen* cg) {
+    if (cg->uses_ymm) {
+        x86_emit(cg->fn, X86_VZEROUPPER, x86_none(), x86_none());
+    }
+    if (cg->has_frame) {
+        x86_emit(cg->fn, X86_MOV, x86_reg_operand(REG_RSP, 8), x86_reg_operand(REG_RBP, 8));
+        x86_emit(cg->fn, X86_POP, x86_reg_operand(REG_RBP, 8), x86_none());
+    }
+}
+
+// The frame goes before the jump, so recursion through tail calls runs in
+// constant stack.
+static void gen_tail_call(codegen* cg, sir_inst* inst) {
+    for (size_t i = 0; i < inst->num_args; ++i) {
+        load(cg, argument_registers[i], inst->args[i]);
+    }
+    gen_leave(cg);
+    x86_emit(cg->fn, X86_JMP, x86_symbol_operand(inst->symbol, 8), x86_none());
+}
+
+static void gen_inst(codegen* cg, sir_inst* inst) {
+    switch (inst->op) {
+        case SIR_COPY:
+            if (inst->a.kind == SIR_OPERAND_IMM) {
+                int size = vreg_size(cg, inst->dst);
+                x86_emit(cg->fn, X86_MOV, vreg_operand(cg, inst->dst),
+                         x86_imm_operand(sir_truncate(inst->a.imm, size), size));
+            } else {
+                load(cg, REG_RAX, inst->a);
+                store(cg, inst->dst);
+            }
+            break;
+        case SIR_LOAD_GLOBAL: {
+            int size = global_size(cg, inst->symbol);
+            x86_emit(cg->fn, size == 1 ? X86_MOVSX : X86_MOV, eax(), x86_symbol_operand(inst->symbol, size));
+            store(cg, inst->dst);
+            break;
+        }
+        case SIR_STORE_GLOBAL: {
+            int size = global_size(cg, inst->symbol);
+            if (inst->a.kind == SIR_OPERAND_IMM) {
+                x86_emit(cg->fn, X86_MOV, x86_symbol_operand(inst->symbol, size),
+                         x86_imm_operand(sir_truncate(inst->a.imm, size), size));
+            } else {
+                load(cg, REG_RAX, inst->a);
+                x86_emit(cg->fn, X86_MOV, x86_symbol_operand(inst->symbol, size), x86_reg_operand(REG_RAX, size));
+            }
+            break;
+        }
+        case SIR_LOAD_ELEM: {
+            x86_operand element = element_operand(cg, inst->symbol, inst->a, 0);
+            x86_emit(cg->fn, element.size == 1 ? X86_MOVSX : X86_MOV, eax(), element);
+            store(cg, inst->dst);
+            break;
+        }
+        case SIR_STORE_ELEM: {
+            x86_operand element = element_operand(cg, inst->symbol, inst->a, 0);
+            if (inst->b.kind == SIR_OPERAND_IMM) {
+                x86_emit(cg->fn, X86_MOV, element, x86_imm_operand(sir_truncate(inst->b.imm, element.size), element.size));
+            } else {
+                load(cg, REG_RDX, inst->b);
+                x86_emit(cg->fn, X86_MOV, element, x86_reg_operand(REG_RDX, element.size));
+            }
+            break;
+        }
+        case SIR_VLOAD:
+        case SIR_VSTORE:
+        case SIR_VSPLAT:
+        case SIR_VADD:
+        case SIR_VSUB:
+        case SIR_VMUL:
+        case SIR_VSUM:
+            gen_vector_inst(cg, inst);
+            break;
+        case SIR_ADD:
+        case SIR_SUB:
+        case SIR_MUL:
+        case SIR_EQ:
+        case SIR_NE:
+        case SIR_LT:
+        case SIR_LE:
+        case SIR_GT:
+        case SIR_GE:
+        case SIR_ULT: {
+            load(cg, REG_RAX, inst->a);
+            x86_operand right = source(cg, inst->b);
+            if (inst->op == SIR_ADD) {
+                x86_emit(cg->fn, X86_ADD, eax(), right);
+            } else if (inst->op == SIR_SUB) {
+                x86_emit(cg->fn, X86_SUB, eax(), right);
+            } else if (inst->op == SIR_MUL) {
+                x86_emit(cg->fn, X86_IMUL, eax(), right);
+            } else {
+                gen_compare(cg, compare_cond(inst->op), right);
+            }
+            store(cg, inst->dst);
+            break;
+        }
+        case SIR_DIV:
+        case SIR_MOD:
+            load(cg, REG_RCX, inst->b);
+            load(cg, REG_RAX, inst->a);
+            x86_emit(cg->fn, X86_CDQ, eax(), x86_none());
+            x86_emit(cg->fn, X86_IDIV, ecx(), x86_none());
+            if (inst->op == SIR_MOD) {
+                x86_emit(cg->fn, X86_MOV, eax(), x86_reg_operand(REG_RDX, 4));
+            }
+            store(cg, inst->dst);
+            break;
+        case SIR_BIT_TEST:
+            gen_flags(cg, inst);
+            gen_setcc(cg, CC_B);
+            store(cg, inst->dst);
+            break;
+        case SIR_SHL:
+        case SIR_SAR:
+        case SIR_SHR: {
+            x86_opcode op = inst->op == SIR_SHL ? X86_SHL : inst->op == SIR_SAR ? X86_SAR : X86_SHR;
+            x86_operand count = x86_imm_operand(inst->b.imm & 31, 1);
+            if (inst->b.kind != SIR_OPERAND_IMM) {
+                load(cg, REG_RCX, inst->b);
+                count = x86_reg_operand(REG_RCX, 1);
+            }
+            load(cg, REG_RAX, inst->a);
+            x86_emit(cg->fn, op, eax(), count);
+            store(cg, inst->dst);
+            break;
+        }
+        case SIR_MUL_HIGH: {
+            // The full product of the sign-extended operands, shifted down.
+            x86_operand rax = x86_reg_operand(REG_RAX, 8);
+            load(cg, REG_RAX, inst->a);
+            x86_emit(cg->fn, X86_MOVSX, rax, eax());
+            if (inst->b.kind == SIR_OPERAND_IMM) {
+                x86_emit(cg->fn, X86_IMUL, rax, x86_imm_operand(inst->b.imm, 4));
+            } else {
+                load(cg, REG_RCX, inst->b);
+                x86_emit(cg->fn, X86_MOVSX, x86_reg_operand(REG_RCX, 8), ecx());
+                x86_emit(cg->fn, X86_IMUL, rax, x86_reg_operand(REG_RCX, 8));
+            }
+            x86_emit(cg->fn, X86_SAR, rax, x86_imm_operand(32, 1));
+            store(cg, inst->dst);
+            break;
+        }
+        case SIR_NEG:
+            load(cg, REG_RAX, inst->a);
+            x86_emit(cg->fn, X86_NEG, eax(), x86_none());
+            store(cg, inst->dst);
+            break;
+        case SIR_NOT:
+            load(cg, REG_RAX, inst->a);
+            gen_compare(cg, CC_E, x86_imm_operand(0, 4));
+            store(cg, inst->dst);
+            break;
+        case SIR_CALL:
+            gen_call(cg, inst);
+            break;
+        case SIR_JUMP:
+            x86_emit(cg->fn, X86_JMP, x86_label_operand(cg->labels[inst->target->index]), x86_none());
+            break;
+        case SIR_BRANCH:
+            load(cg, REG_RAX, inst->a);
+            x86_emit(cg->fn, X86_CMP, eax(), x86_imm_operand(0, 4));
+            x86_emit_cc(cg->fn, X86_JCC, CC_NE, x86_label_operand(cg->labels[inst->target->index]));
+            x86_emit(cg->fn, X86_JMP, x86_label_operand(cg->labels[inst->other->index]), x86_none());
+            break;
+        case SIR_JUMP_TABLE:
+            gen_jump_table(cg, inst);
+            break;
+        case SIR_RETURN:
+            if (inst->a.kind != SIR_OPERAND_NONE) {
+                load(cg, REG_RAX, inst->a);
+            }
+            x86_emit(cg->fn, X86_JMP, x86_label_operand(cg->return_label), x86_none());
+            break;
+    }
+}
+
+// A compare whose only use is the branch right after it sets the flags
+// for the branch directly instead of materializing a 0 or 1.
+static bool gen_compare_branch(codegen* cg, sir_inst* compare, sir_inst* branch) {
+    if (!is_compare(compare->op) || branch->op != SIR_BRANCH || branch->a.kind != SIR_OPERAND_VREG ||
+        branch->a.vreg != compare->dst || cg->uses[compare->dst] != 1) {
+        return false;
+    }
+    gen_flags(cg, compare);
+    x86_emit_cc(cg->fn, X86_JCC, compare_cond(compare->op), x86_label_operand(cg->labels[branch->target->index]));
+    x86_emit(cg->fn, X86_JMP, x86_label_operand(cg->labels[branch->other->index]), x86_none());
+    return true;
+}
+
+static void count_use(codegen* cg, sir_operand operand) {
+    if (operand.kind == SIR_OPERAND_VREG) {
+        cg->uses[operand.vreg]++;
+    }
+}
+
+static void count_uses(codegen* cg) {
+    sir_function* ir = cg->ir;
+    cg->uses = calloc(ir->num_vregs + 1, sizeof(int));
+    for (size_t i = 0; i < ir->num_blocks; ++i) {
+        sir_block* block = ir->blocks[i];
+        for (size_t j = 0; j < block->num_insts; ++j) {
+            sir_inst* inst = &block->insts[j];
+            count_use(cg, inst->a);
+            count_use(cg, inst->b);
+            for (size_t k = 0; k < inst->num_args; ++k) {
+                count_use(cg, inst->args[k]);
+            }
+        }
+    }
+}
+
+static void assign_slots(codegen* cg) {
+    sir_function* ir = cg->ir;
+    // 0 is never a frame offset, so it marks the vregs still without a home.
+    cg->slots = calloc(ir->num_vregs + 1, sizeof(int));
+    // Stack-passed arguments already live above the return address.
+    for (size_t i = NUM_ARGUMENT_REGISTERS; i < ir->num_params; ++i) {
+        cg->slots[ir->params[i]] = 16 + 8 * (int)(i - NUM_ARGUMENT_REGISTERS);
+    }
+    for (size_t v = 0; v < ir->num_vregs; ++v) {
+        cg->uses_ymm |= ir->vregs[v].size == 32;
+        if (cg->slots[v] == 0) {
+            int size = ir->vregs[v].size;
+            cg->stack_size = (cg->stack_size + size + size - 1) / size * size;
+            cg->slots[v] = -cg->stack_size;
+        }
+    }
+}
+
+// Only a call that returns here needs %rsp kept aligned below a frame.
+static bool needs_frame(codegen* cg) {
+    if (cg->stack_size + 8 > RED_ZONE_SIZE) {
+        return true;
+    }
+    for (size_t i = 0; i < cg->ir->num_blocks; ++i) {
+        sir_block* block = cg->ir->blocks[i];
+        for (size_t j = 0; j < block->num_insts; ++j) {
+            if (block->insts[j].op == SIR_CALL && !is_tail_call(cg, block, j)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+x86_function* codegen_function(sir_program* program, sir_function* ir) {
+    codegen cg = { program, ir, create_x86_function(ir->name), NULL, NULL, NULL, 0, 0, false, true };
+    cg.return_label = x86_new_label(cg.fn);
+    number_sir_blocks(ir);
+    cg.labels = malloc((ir->num_blocks + 1) * sizeof(int));
+    for (size_t i = 0; i < ir->num_blocks; ++i) {
+        cg.labels[i] = x86_new_label(cg.fn);
+    }
+    assign_slots(&cg);
+    count_uses(&cg);
+
+    cg.has_frame = needs_frame(&cg);
+    if (cg.has_frame) {
+        x86_emit(cg.fn, X86_PUSH, x86_reg_operand(REG_RBP, 8), x86_none());
+        x86_emit(cg.fn, X86_MOV, x86_reg_operand(REG_RBP, 8), x86_reg_operand(REG_RSP, 8));
+        x86_emit(cg.fn, X86_SUB, x86_reg_operand(REG_RSP, 8), x86_imm_operand((cg.stack_size + 15) / 16 * 16, 4));
+    }
+
+    for (size_t i = 0; i < ir->num_params && i < NUM_ARGUMENT_REGISTERS; ++i) {
+        int vreg = ir->params[i];
+        x86_emit(cg.fn, X86_MOV, vreg_operand(&cg, vreg), x86_reg_operand(argument_registers[i], vreg_size(&cg, vreg)));
+    }
+
+    for (size_t i = 0; i < ir->num_blocks; ++i) {
+        sir_block* block = ir->blocks[i];
+        x86_emit_label(cg.fn, cg.labels[i]);
+        for (size_t j = 0; j < block->num_insts; ++j) {
+            if (is_tail_call(&cg, block, j)) {
+                gen_tail_call(&cg, &block->insts[j]);
+                ++j;
+                continue;
+            }
+            if (j + 1 < block->num_insts && gen_compare_branch(&cg, &block->insts[j], &block->insts[j + 1])) {
+                ++j;
+                continue;
+            }
+            gen_inst(&cg, &block->insts[j]);
+        }
+    }
+
+    x86_emit_label(cg.fn, cg.return_label);
+    gen_leave(&cg);
+    x86_emit(cg.fn, X86_RET, x86_none(), x86_none());
+
+    free(cg.slots);
+    free(cg.labels);
+    free(cg.uses);
+    return cg.fn;
+}
+
+void codegen_globals(sir_program* program, x86_module* m) {
+    for (size_t i = 0; i < program->num_globals; ++i) {
+        sir_global* global = &program->globals[i];
+        if (global->length > 0) {
+            add_x86_array(m, global->name, global->size, global->length, global->is_const);
+        } else {
+            add_x86_global(m, global->name, global->size, global->value, global->is_const);
+        }
+    }
+}
+
+x86_module* codegen_program(sir_program* program) {
+    x86_module* m = create_x86_module();
+    codegen_globals(program, m);
+    for (size_t i = 0; i < program->num_functions; ++i) {
+        add_x86_function(m, codegen_function(program, program->functions[i]));
+    }
+    return m;
+}
@@ -0,0 +1,25 @@
+#ifndef CODEGEN_H
+#define CODEGEN_H
+
+#include "sir.h"
+#include "x86.h"
+
+typedef struct codegen {
+    sir_program* program;
+    sir_function* ir;
+    x86_function* fn;
+    int* slots;         // frame offset of each vreg, from %rbp
+    int* labels;        // label of each block
+    int* uses;          // number of times each vreg is read
+    int stack_size;
+    int return_label;
+    bool uses_ymm;      // vzeroupper before leaving for other code
+    bool has_frame;     // else the slots are in the red zone, off %rsp
+} codegen;
+
+x86_module* codegen_program(sir_program* program);
+// The program's globals, without any code; codegen_function makes that.
+void codegen_globals(sir_program* program, x86_module* m);
+x86_function* codegen_function(sir_program* program, sir_function* ir);
+
+#endif // CODEGEN_H
@@ -0,0 +1,38 @@
+#ifndef COMPAT_H
+#define COMPAT_H
+
+#ifdef _MSC_VER
+#define SCC_THREAD_LOCAL __declspec(thread)
+#define SCC_NORETURN __declspec(noreturn)
+#else
+#define SCC_THREAD_LOCAL _Thread_local
+#define SCC_NORETURN __attribute__((noreturn))
+#endif
+
+// The front end was written against the MSVC CRT. Map the few secure/underscored
+// helpers it relies on onto their POSIX counterparts everywhere else.
+#ifndef _MSC_VER
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#define _strdup strdup
+
+static inline int fopen_s(FILE** fp, const char* file_name, const char* mode) {
+    *fp = fopen(file_name, mode);
+    return (*fp == NULL) ? errno : 0;
+}
+
+static inline int strncpy_s(char* dest, size_t dest_size, const char* src, size_t count) {
+    if (dest == NULL || src == NULL || count >= dest_size) {
+        return EINVAL;
+    }
+    memcpy(dest, src, count);
+    dest[count] = '\0';
+    return 0;
+}
+
+#endif // _MSC_VER
+
+#endif // COMPAT_H
@@ -0,0 +1,60 @@
+#include "diagnostics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+static SCC_THREAD_LOCAL diagnostics* current;
+
+void init_diagnostics(diagnostics* d) {
+    d->messages = init_buffer(256);
+    d->recovery = NULL;
+    d->num_errors = 0;
+}
+
+void free_diagnostics(diagnostics* d) {
+    free_buffer(&d->messages);
+}
+
+// Installs d for the calling thread and returns whatever was installed before.
+diagnostics* set_diagnostics(diagnostics* d) {
+    diagnostics* previous = current;
+    current = d;
+    return previous;
+}
+
+diagnostics* current_diagnostics() {
+    return current;
+}
+
+static void report_errorv(const char* fmt, va_list args) {
+    if (current == NULL) {
+        vfprintf(stderr, fmt, args);
+        return;
+    }
+    buffer_vprintf(&current->messages, fmt, args);
+    current->num_errors++;
+}
+
+void report_error(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    report_errorv(fmt, args);
+    va_end(args);
+}
+
+void fatal_error(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    report_errorv(fmt, args);
+    va_end(args);
+    abort_compilation();
+}
+
+// Gives up on the current compilation after its errors have been reported.
+void abort_compilation() {
+    if (current != NULL && current->recovery != NULL) {
+        longjmp(*current->recovery, 1);
+    }
+    exit(1);
+}
@@ -0,0 +1,27 @@
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include <setjmp.h>
+#include <stdbool.h>
+#include "compat.h"
+#include "buffer.h"
+
+// Per-compilation error sink. While a diagnostics context is installed on the
+// current thread, errors are collected in its buffer and fatal ones unwind to
+// its recovery point instead of terminating the process. Without one, errors
+// go straight to stderr and fatal ones exit(1), as they always have.
+typedef struct diagnostics {
+    buffer messages;
+    jmp_buf* recovery;
+    size_t num_errors;
+} diagnostics;
+
+void init_diagnostics(diagnostics* d);
+void free_diagnostics(diagnostics* d);
+diagnostics* set_diagnostics(diagnostics* d);
+diagnostics* current_diagnostics();
+void report_error(const char* fmt, ...);
+SCC_NORETURN void fatal_error(const char* fmt, ...);
+SCC_NORETURN void abort_compilation();
+
+#endif // DIAGNOSTICS_H
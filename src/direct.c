@@ -0,0 +1,549 @@
+#include "direct.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+
+static const x86_reg argument_registers[] = { REG_RDI, REG_RSI, REG_RDX, REG_RCX, REG_R8, REG_R9 };
+
+#define NUM_ARGUMENT_REGISTERS 6
+
+// A local's home in the frame, from %rbp. Scopes only decide which one a
+// name means at each point.
+typedef struct direct_local {
+    const char* name;
+    int offset;
+    int size;
+} direct_local;
+
+typedef struct direct_case {
+    int value;
+    int label;
+} direct_case;
+
+typedef struct direct_switch {
+    direct_case* cases;
+    size_t num_cases;
+    size_t max_cases;
+    int default_label;          // -1 without a default
+} direct_switch;
+
+typedef struct direct {
+    x86_module* m;
+    x86_function* fn;
+    const char* name;
+    int return_size;
+    int return_label;
+    direct_local* locals;
+    size_t num_locals;
+    size_t max_locals;
+    int stack_size;             // bytes of locals in scope
+    int frame_size;             // the most there ever were
+    int depth;                  // 8-byte slots pushed below the frame
+    int break_label;
+    int continue_label;
+    direct_switch* current_switch;
+} direct;
+
+static x86_operand eax() {
+    return x86_reg_operand(REG_RAX, 4);
+}
+
+static x86_operand ecx() {
+    return x86_reg_operand(REG_RCX, 4);
+}
+
+static x86_operand rsp() {
+    return x86_reg_operand(REG_RSP, 8);
+}
+
+static int type_size(builtin_types type) {
+    switch (type) {
+        case CHAR:
+            return 1;
+        case INT:
+            return 4;
+        default:
+            fatal_error("Error: codegen does not support locals of type %s\n", type_tostring(type));
+    }
+}
+
+static void push_local(direct* d, const char* name, int offset, int size) {
+    if (d->num_locals == d->max_locals) {
+        d->max_locals = d->max_locals ? d->max_locals * 2 : 16;
+        d->locals = counted_realloc(ALLOC_CODEGEN, d->locals, d->max_locals * sizeof(direct_local));
+    }
+    d->locals[d->num_locals].name = name;
+    d->locals[d->num_locals].offset = offset;
+    d->locals[d->num_locals].size = size;
+    d->num_locals++;
+}
+
+static direct_local* find_local(direct* d, const char* name) {
+    for (size_t i = d->num_locals; i > 0; --i) {
+        if (strcmp(d->locals[i - 1].name, name) == 0) {
+            return &d->locals[i - 1];
+        }
+    }
+    return NULL;
+}
+
+static int new_slot(direct* d, int size) {
+    d->stack_size = (d->stack_size + size + size - 1) / size * size;
+    if (d->stack_size > d->frame_size) {
+        d->frame_size = d->stack_size;
+    }
+    return -d->stack_size;
+}
+
+static x86_global* resolve_global(direct* d, const char* name) {
+    x86_global* global = find_x86_global(d->m, name);
+    if (global == NULL) {
+        fatal_error("Error: codegen could not resolve '%s' in function %s\n", name, d->name);
+    }
+    return global;
+}
+
+static x86_operand local_operand(direct_local* local) {
+    return x86_mem_operand(REG_RBP, local->offset, local->size);
+}
+
+// Widens a value of size bytes into %eax, as every expression leaves it.
+static void load(direct* d, x86_operand value) {
+    x86_emit(d->fn, value.size == 1 ? X86_MOVSX : X86_MOV, eax(), value);
+}
+
+static void push(direct* d, x86_reg reg) {
+    x86_emit(d->fn, X86_PUSH, x86_reg_operand(reg, 8), x86_none());
+    d->depth++;
+}
+
+static void pop(direct* d, x86_reg reg) {
+    x86_emit(d->fn, X86_POP, x86_reg_operand(reg, 8), x86_none());
+    d->depth--;
+}
+
+static void jump(direct* d, int label) {
+    x86_emit(d->fn, X86_JMP, x86_label_operand(label), x86_none());
+}
+
+static void gen_expression(direct* d, ast_node* node);
+
+// array[index] as an indexed operand: the index in %rax, the array's
+// address in %rcx.
+static x86_operand element_operand(direct* d, const char* name, ast_node* index) {
+    x86_global* global = resolve_global(d, name);
+    gen_expression(d, index);
+    x86_emit(d->fn, X86_MOVSX, x86_reg_operand(REG_RAX, 8), eax());
+    x86_emit(d->fn, X86_LEA, x86_reg_operand(REG_RCX, 8), x86_symbol_operand(global->name, 8));
+    return x86_index_operand(REG_RCX, REG_RAX, global->size, global->size);
+}
+
+// Arguments are evaluated left to right. The first six are pushed and
+// popped into their registers just before the call; the rest are stored
+// straight into the area reserved for them, padded so that the call
+// happens on a 16-byte boundary whatever is pushed at the time.
+static void gen_call(direct* d, ast_call_expr_node* call) {
+    size_t num_args = call->num_arguments;
+    size_t num_registers = num_args < NUM_ARGUMENT_REGISTERS ? num_args : NUM_ARGUMENT_REGISTERS;
+    size_t num_stack = num_args - num_registers;
+    int reserved = (int)(num_stack + ((d->depth + num_stack) & 1)) * 8;
+    if (reserved > 0) {
+        x86_emit(d->fn, X86_SUB, rsp(), x86_imm_operand(reserved, 4));
+        d->depth += reserved / 8;
+    }
+    for (size_t i = 0; i < num_args; ++i) {
+        gen_expression(d, call->arguments[i]);
+        if (i < NUM_ARGUMENT_REGISTERS) {
+            push(d, REG_RAX);
+        } else {
+            int offset = (int)(num_registers + i - NUM_ARGUMENT_REGISTERS) * 8;
+            x86_emit(d->fn, X86_MOV, x86_mem_operand(REG_RSP, offset, 4), eax());
+        }
+    }
+    for (size_t i = num_registers; i > 0; --i) {
+        pop(d, argument_registers[i - 1]);
+    }
+    x86_emit(d->fn, X86_CALL, x86_symbol_operand(call->function_name, 8), x86_none());
+    if (reserved > 0) {
+        x86_emit(d->fn, X86_ADD, rsp(), x86_imm_operand(reserved, 4));
+        d->depth -= reserved / 8;
+    }
+}
+
+// Leaves the left operand in %eax and returns the right one: a literal is
+// used in place, anything else is computed into %ecx while the left waits
+// on the stack.
+static x86_operand gen_operands(direct* d, ast_binary_expr_node* binary) {
+    if (binary->right->type == AST_LITERAL) {
+        gen_expression(d, binary->left);
+        return x86_imm_operand((int)ast_literal_value(binary->right), 4);
+    }
+    gen_expression(d, binary->left);
+    push(d, REG_RAX);
+    gen_expression(d, binary->right);
+    x86_emit(d->fn, X86_MOV, ecx(), eax());
+    pop(d, REG_RAX);
+    return ecx();
+}
+
+static bool compare_cond(operator_type op, x86_cond* cond) {
+    switch (op) {
+        case OP_EQUAL: *cond = CC_E; return true;
+        case OP_NOT_EQUAL: *cond = CC_NE; return true;
+        case OP_LESS: *cond = CC_L; return true;
+        case OP_LESS_EQUAL: *cond = CC_LE; return true;
+        case OP_GREATER: *cond = CC_G; return true;
+        case OP_GREATER_EQUAL: *cond = CC_GE; return true;
+        default: return false;
+    }
+}
+
+static void gen_binary(direct* d, ast_binary_expr_node* binary) {
+    x86_operand right = gen_operands(d, binary);
+    x86_cond cond;
+    switch (binary->op) {
+        case OP_ADD:
+            x86_emit(d->fn, X86_ADD, eax(), right);
+            return;
+        case OP_SUBTRACT:
+            x86_emit(d->fn, X86_SUB, eax(), right);
+            return;
+        case OP_MULTIPLY:
+            x86_emit(d->fn, X86_IMUL, eax(), right);
+            return;
+        case OP_DIVIDE:
+        case OP_MODULO:
+            if (right.kind == OPERAND_IMM) {
+                x86_emit(d->fn, X86_MOV, ecx(), right);
+            }
+            x86_emit(d->fn, X86_CDQ, eax(), x86_none());
+            x86_emit(d->fn, X86_IDIV, ecx(), x86_none());
+            if (binary->op == OP_MODULO) {
+                x86_emit(d->fn, X86_MOV, eax(), x86_reg_operand(REG_RDX, 4));
+            }
+            return;
+        default:
+            if (!compare_cond(binary->op, &cond)) {
+                fatal_error("Error: codegen does not support binary operator %s\n", op_ToString(binary->op));
+            }
+            x86_emit(d->fn, X86_CMP, eax(), right);
+            x86_emit_cc(d->fn, X86_SETCC, cond, x86_reg_operand(REG_RAX, 1));
+            x86_emit(d->fn, X86_MOVZX, eax(), x86_reg_operand(REG_RAX, 1));
+            return;
+    }
+}
+
+static void gen_expression(direct* d, ast_node* node) {
+    switch (node->type) {
+        case AST_LITERAL:
+            x86_emit(d->fn, X86_MOV, eax(), x86_imm_operand((int)ast_literal_value(node), 4));
+            break;
+        case AST_IDENTIFIER: {
+            direct_local* local = find_local(d, node->value);
+            if (local != NULL) {
+                load(d, local_operand(local));
+            } else {
+                x86_global* global = resolve_global(d, node->value);
+                load(d, x86_symbol_operand(global->name, global->size));
+            }
+            break;
+        }
+        case AST_BINARY_EXPR:
+            gen_binary(d, (ast_binary_expr_node*)node);
+            break;
+        case AST_UNARY_EXPR: {
+            ast_unary_expr_node* unary = (ast_unary_expr_node*)node;
+            gen_expression(d, unary->operand);
+            if (unary->op == OP_SUBTRACT) {
+                x86_emit(d->fn, X86_NEG, eax(), x86_none());
+            } else if (unary->op == OP_LOGICAL_NOT) {
+                x86_emit(d->fn, X86_CMP, eax(), x86_imm_operand(0, 4));
+                x86_emit_cc(d->fn, X86_SETCC, CC_E, x86_reg_operand(REG_RAX, 1));
+                x86_emit(d->fn, X86_MOVZX, eax(), x86_reg_operand(REG_RAX, 1));
+            } else if (unary->op != OP_ADD) {
+                fatal_error("Error: codegen does not support unary operator %s\n", op_ToString(unary->op));
+            }
+            break;
+        }
+        case AST_CALL_EXPR:
+            gen_call(d, (ast_call_expr_node*)node);
+            break;
+        case AST_INDEX_EXPR: {
+            ast_index_expr_node* index = (ast_index_expr_node*)node;
+            load(d, element_operand(d, index->array->value, index->index));
+            break;
+        }
+        default:
+            fatal_error("Error: codegen does not support expression node %d\n", node->type);
+    }
+}
+
+// Jumps to label when condition holds. A comparison sets the flags for the
+// jump itself instead of making a 0 or 1 first.
+static void jump_if(direct* d, ast_node* condition, int label) {
+    x86_cond cond;
+    if (condition->type == AST_BINARY_EXPR && compare_cond(((ast_binary_expr_node*)condition)->op, &cond)) {
+        x86_operand right = gen_operands(d, (ast_binary_expr_node*)condition);
+        x86_emit(d->fn, X86_CMP, eax(), right);
+    } else {
+        gen_expression(d, condition);
+        x86_emit(d->fn, X86_CMP, eax(), x86_imm_operand(0, 4));
+        cond = CC_NE;
+    }
+    x86_emit_cc(d->fn, X86_JCC, cond, x86_label_operand(label));
+}
+
+static void gen_statement(direct* d, ast_node* node);
+
+static void gen_block(direct* d, ast_block_node* block) {
+    size_t scope_start = d->num_locals;
+    int stack_start = d->stack_size;
+    for (size_t i = 0; i < block->num_declarations; ++i) {
+        gen_statement(d, block->declarations[i]);
+    }
+    d->num_locals = scope_start;
+    d->stack_size = stack_start;
+}
+
+// The same layout as the optimizing pipeline's, test at the bottom:
+//
+//   init; jmp test
+//   body: ...
+//   next: step
+//   test: jcc body
+//   exit:
+//
+// A do-while enters at body and tests right after next.
+static void gen_loop(direct* d, ast_loop_node* loop) {
+    size_t scope_start = d->num_locals;
+    int stack_start = d->stack_size;
+    int outer_break = d->break_label;
+    int outer_continue = d->continue_label;
+    if (loop->init != NULL) {
+        gen_statement(d, loop->init);
+    }
+
+    int body = x86_new_label(d->fn);
+    int test = x86_new_label(d->fn);
+    d->break_label = x86_new_label(d->fn);
+    d->continue_label = x86_new_label(d->fn);
+    jump(d, loop->type == AST_DO_WHILE_STMT ? body : test);
+
+    x86_emit_label(d->fn, body);
+    gen_statement(d, loop->body);
+    x86_emit_label(d->fn, d->continue_label);
+    if (loop->step != NULL) {
+        gen_statement(d, loop->step);
+    }
+    x86_emit_label(d->fn, test);
+    if (loop->condition != NULL) {
+        jump_if(d, loop->condition, body);
+    } else {
+        jump(d, body);
+    }
+    x86_emit_label(d->fn, d->break_label);
+
+    d->break_label = outer_break;
+    d->continue_label = outer_continue;
+    d->num_locals = scope_start;
+    d->stack_size = stack_start;
+}
+
+// The dispatch goes after the body, once every case label is known, and
+// compares the value, still in %eax from before the body, with each case
+// in turn:
+//
+//   cond; jmp dispatch
+//   body: ...; jmp exit
+//   dispatch: cmp; je case ...; jmp default
+//   exit:
+static void gen_switch(direct* d, ast_switch_node* node) {
+    gen_expression(d, node->condition);
+    int dispatch = x86_new_label(d->fn);
+    int exit = x86_new_label(d->fn);
+    jump(d, dispatch);
+
+    direct_switch* outer_switch = d->current_switch;
+    int outer_break = d->break_label;
+    direct_switch cases = { NULL, 0, 0, -1 };
+    d->current_switch = &cases;
+    d->break_label = exit;
+    gen_statement(d, node->body);
+    jump(d, exit);
+    d->current_switch = outer_switch;
+    d->break_label = outer_break;
+
+    x86_emit_label(d->fn, dispatch);
+    for (size_t i = 0; i < cases.num_cases; ++i) {
+        x86_emit(d->fn, X86_CMP, eax(), x86_imm_operand(cases.cases[i].value, 4));
+        x86_emit_cc(d->fn, X86_JCC, CC_E, x86_label_operand(cases.cases[i].label));
+    }
+    jump(d, cases.default_label >= 0 ? cases.default_label : exit);
+    x86_emit_label(d->fn, exit);
+    counted_free(ALLOC_CODEGEN, cases.cases);
+}
+
+static void gen_case_label(direct* d, ast_case_node* node) {
+    direct_switch* current = d->current_switch;
+    if (current == NULL) {
+        fatal_error("Error: codegen found a case label outside of a switch in function %s\n", d->name);
+    }
+    int label = x86_new_label(d->fn);
+    x86_emit_label(d->fn, label);
+    if (node->value == NULL) {
+        current->default_label = label;
+        return;
+    }
+    if (current->num_cases == current->max_cases) {
+        current->max_cases = current->max_cases ? current->max_cases * 2 : 16;
+        current->cases = counted_realloc(ALLOC_CODEGEN, current->cases, current->max_cases * sizeof(direct_case));
+    }
+    current->cases[current->num_cases].value = (int)ast_eval_constant(node->value);
+    current->cases[current->num_cases].label = label;
+    current->num_cases++;
+}
+
+// Stores %eax, truncated to the destination's size.
+static void gen_assignment(direct* d, ast_assignment_node* assignment) {
+    const char* name = assignment->identifier_node->value;
+    gen_expression(d, assignment->value);
+    if (assignment->index != NULL) {
+        push(d, REG_RAX);
+        x86_operand element = element_operand(d, name, assignment->index);
+        pop(d, REG_RDX);
+        x86_emit(d->fn, X86_MOV, element, x86_reg_operand(REG_RDX, element.size));
+        return;
+    }
+    direct_local* local = find_local(d, name);
+    x86_operand target;
+    if (local != NULL) {
+        target = local_operand(local);
+    } else {
+        x86_global* global = resolve_global(d, name);
+        target = x86_symbol_operand(global->name, global->size);
+    }
+    x86_emit(d->fn, X86_MOV, target, x86_reg_operand(REG_RAX, target.size));
+}
+
+static void gen_statement(direct* d, ast_node* node) {
+    switch (node->type) {
+        case AST_VARIABLE_DECL: {
+            ast_variable_decl_node* var_decl = (ast_variable_decl_node*)node;
+            int size = type_size(var_decl->type_node);
+            if (var_decl->value != NULL) {
+                gen_expression(d, var_decl->value);
+            }
+            int offset = new_slot(d, size);
+            if (var_decl->value != NULL) {
+                x86_emit(d->fn, X86_MOV, x86_mem_operand(REG_RBP, offset, size), x86_reg_operand(REG_RAX, size));
+            }
+            push_local(d, var_decl->identifier_node->value, offset, size);
+            break;
+        }
+        case AST_ASSIGNMENT:
+            gen_assignment(d, (ast_assignment_node*)node);
+            break;
+        case AST_RETURN_STMT: {
+            ast_return_node* return_stmt = (ast_return_node*)node;
+            if (return_stmt->expr != NULL) {
+                gen_expression(d, return_stmt->expr);
+            }
+            // A char function's result is converted like any other store.
+            if (d->return_size == 1 && return_stmt->expr != NULL) {
+                x86_emit(d->fn, X86_MOVSX, eax(), x86_reg_operand(REG_RAX, 1));
+            }
+            jump(d, d->return_label);
+            break;
+        }
+        case AST_BLOCK:
+            gen_block(d, (ast_block_node*)node);
+            break;
+        case AST_CALL_EXPR:
+            gen_call(d, (ast_call_expr_node*)node);
+            break;
+        case AST_WHILE_STMT:
+        case AST_DO_WHILE_STMT:
+        case AST_FOR_STMT:
+            gen_loop(d, (ast_loop_node*)node);
+            break;
+        case AST_SWITCH_STMT:
+            gen_switch(d, (ast_switch_node*)node);
+            break;
+        case AST_CASE_LABEL:
+            gen_case_label(d, (ast_case_node*)node);
+            break;
+        case AST_BREAK_STMT:
+            jump(d, d->break_label);
+            break;
+        case AST_CONTINUE_STMT:
+            jump(d, d->continue_label);
+            break;
+        default:
+            fatal_error("Error: codegen does not support statement node %d\n", node->type);
+    }
+}
+
+// The frame's size is only known at the end, so the prologue's sub is
+// patched then.
+static void gen_function(x86_module* m, ast_function_decl_node* function_decl) {
+    direct d = { 0 };
+    d.m = m;
+    d.fn = create_x86_function(function_decl->function_name);
+    add_x86_function(m, d.fn);
+    d.name = function_decl->function_name;
+    d.return_size = function_decl->return_type == VOID ? 0 : type_size(function_decl->return_type);
+    d.return_label = x86_new_label(d.fn);
+
+    x86_emit(d.fn, X86_PUSH, x86_reg_operand(REG_RBP, 8), x86_none());
+    x86_emit(d.fn, X86_MOV, x86_reg_operand(REG_RBP, 8), rsp());
+    size_t frame = x86_emit(d.fn, X86_SUB, rsp(), x86_imm_operand(0, 4));
+
+    // Stack-passed arguments already live above the return address.
+    for (size_t i = 0; i < function_decl->num_parameters; ++i) {
+        ast_variable_decl_node* param = (ast_variable_decl_node*)function_decl->parameters[i];
+        int size = type_size(param->type_node);
+        int offset = 16 + 8 * (int)(i - NUM_ARGUMENT_REGISTERS);
+        if (i < NUM_ARGUMENT_REGISTERS) {
+            offset = new_slot(&d, size);
+            x86_emit(d.fn, X86_MOV, x86_mem_operand(REG_RBP, offset, size),
+                     x86_reg_operand(argument_registers[i], size));
+        }
+        push_local(&d, param->identifier_node->value, offset, size);
+    }
+
+    gen_block(&d, function_decl->body);
+
+    // Falling off the end of a function returns 0, which is what main needs.
+    if (d.return_size > 0) {
+        x86_emit(d.fn, X86_MOV, eax(), x86_imm_operand(0, 4));
+    }
+    x86_emit_label(d.fn, d.return_label);
+    x86_emit(d.fn, X86_MOV, rsp(), x86_reg_operand(REG_RBP, 8));
+    x86_emit(d.fn, X86_POP, x86_reg_operand(REG_RBP, 8), x86_none());
+    x86_emit(d.fn, X86_RET, x86_none(), x86_none());
+    d.fn->insts[frame].src.imm = (d.frame_size + 15) / 16 * 16;
+
+    counted_free(ALLOC_CODEGEN, d.locals);
+}
+
+void compile_direct(ast_program_node* program, x86_module* m) {
+    for (size_t i = 0; i < program->num_declarations; ++i) {
+        ast_node* declaration = program->declarations[i];
+        if (declaration->type == AST_VARIABLE_DECL) {
+            ast_variable_decl_node* var_decl = (ast_variable_decl_node*)declaration;
+            int size = type_size(var_decl->type_node);
+            if (var_decl->array_length > 0) {
+                add_x86_array(m, var_decl->identifier_node->value, size, var_decl->array_length,
+                              var_decl->is_constant);
+                continue;
+            }
+            long long value = var_decl->value != NULL ? ast_eval_constant(var_decl->value) : 0;
+            add_x86_global(m, var_decl->identifier_node->value, size, value, var_decl->is_constant);
+        } else if (declaration->type == AST_FUNCTION_DECL) {
+            gen_function(m, (ast_function_decl_node*)declaration);
+        } else {
+            fatal_error("Error: codegen does not support global declaration node %d\n", declaration->type);
+        }
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef DIRECT_H
+#define DIRECT_H
+
+#include "ast.h"
+#include "x86.h"
+
+// The -O0 tier: one walk over a type-checked program that emits machine
+// code as it goes, with no SIR in between. Expressions are evaluated as on
+// a stack machine, into %eax with intermediate values pushed, and every
+// local lives in the frame. Globals and functions are added to m as they
+// are reached, so that a fatal error leaves nothing m does not own; m then
+// goes through the same encoder, ELF writer and JIT as the optimizing
+// pipeline's.
+void compile_direct(ast_program_node* program, x86_module* m);
+
+#endif // DIRECT_H
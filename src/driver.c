@@ -0,0 +1,699 @@
+#include "driver.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parser.h"
+#include "typecheck.h"
+#include "lower.h"
+#include "fold.h"
+#include "inline.h"
+#include "encoder.h"
+#include "elf.h"
+#include "jit.h"
+#include "bytecode.h"
+#include "backend.h"
+#include "direct.h"
+#include "stats.h"
+#include "cache.h"
+#include "hash.h"
+#include "thread_pool.h"
+
+// foo/bar.c -> bar.o (or bar.s), matching what cc does without -o.
+static char* default_output_name(const char* input_file, const char* extension) {
+    const char* base = strrchr(input_file, '/');
+    base = base ? base + 1 : input_file;
+    const char* dot = strrchr(base, '.');
+    size_t length = dot ? (size_t)(dot - base) : strlen(base);
+    char* name = malloc(length + strlen(extension) + 1);
+    memcpy(name, base, length);
+    strcpy(name + length, extension);
+    return name;
+}
+
+// The SIR is kept in sir so that it is freed even if codegen fails. At -O0
+// there is none: the module is built straight from the AST into module,
+// which is kept for the same reason.
+static void build_module(compile_job* job, ast_program_node* program, sir_program* sir, x86_module** module,
+                         compile_stats* stats) {
+    const compile_options* options = job->options;
+    if (options->opt_level == 0) {
+        stats_begin_phase(stats, "direct");
+        *module = create_x86_module();
+        compile_direct(program, *module);
+        stats_end_phase(stats);
+        return;
+    }
+
+    stats_begin_phase(stats, "lower");
+    lower_program(program, sir);
+    stats_end_phase(stats);
+
+    stats_begin_phase(stats, "fold");
+    fold_sir_program(sir);
+    stats_end_phase(stats);
+
+    stats_begin_phase(stats, "inline");
+    inline_options inlining = { options->inline_budget, options->inline_report ? &job->report : NULL };
+    inline_program(sir, &inlining);
+    stats_end_phase(stats);
+
+    // From here on each function is compiled on its own, on as many threads
+    // as the job was given.
+    stats_begin_phase(stats, "backend");
+    backend_options backend = { options->vector_target, options->vectorize_report ? &job->report : NULL,
+                                options->simplify, options->gvn, options->backend_threads };
+    *module = run_backend(sir, &backend, &stats->backend);
+    stats_end_phase(stats);
+}
+
+static x86_object* encode_module(x86_module* module, compile_stats* stats) {
+    stats_begin_phase(stats, "encode");
+    x86_object* object = encode_x86_module(module);
+    stats_end_phase(stats);
+    return object;
+}
+
+// Paths on the command line are relative to the directory scc was started
+// in, which for a compile server is the client's, not the process's own.
+static char* resolve_path(const compile_options* options, const char* path) {
+    if (options->working_directory == NULL || path[0] == '/') {
+        return _strdup(path);
+    }
+    char* resolved = malloc(strlen(options->working_directory) + strlen(path) + 2);
+    strcpy(resolved, options->working_directory);
+    strcat(resolved, "/");
+    strcat(resolved, path);
+    return resolved;
+}
+
+static void write_output(const compile_options* options, buffer* out, const char* file_name) {
+    char* path = resolve_path(options, file_name);
+    bool written = buffer_write_file(out, path);
+    free(path);
+    if (!written) {
+        fatal_error("Error: Failed to write %s\n", file_name);
+    }
+}
+
+void init_compile_options(compile_options* options) {
+    memset(options, 0, sizeof(*options));
+    options->inline_budget = INLINE_DEFAULT_BUDGET;
+    options->vector_target = VECTORIZE_DEFAULT_TARGET;
+    options->opt_level = 1;
+    options->simplify = true;
+    options->gvn = true;
+}
+
+void init_compile_job(compile_job* job, char* input_file, const compile_options* options) {
+    job->input_file = input_file;
+    job->source = NULL;
+    job->source_size = 0;
+    job->failed = false;
+    job->options = options;
+    job->output = init_buffer(0);
+    job->report = init_buffer(0);
+    init_diagnostics(&job->diag);
+    job->exit_code = 0;
+}
+
+void free_compile_job(compile_job* job) {
+    free_buffer(&job->output);
+    free_buffer(&job->report);
+    free_diagnostics(&job->diag);
+}
+
+// The flags that change what ends up in the artifact. Objects also record
+// the source name in their symbol table, and the include path decides which
+// headers are found.
+static void cache_flags(compile_job* job, buffer* flags) {
+    const compile_options* options = job->options;
+    if (options->emit_object) {
+        buffer_printf(flags, "obj:%s", job->input_file);
+    } else if (options->emit_asm) {
+        buffer_puts(flags, "asm");
+    } else {
+        buffer_printf(flags, "dump:%d:%d", (int)options->dump_ast, (int)options->dump_symbols);
+    }
+    if ((options->emit_object || options->emit_asm) && options->opt_level == 0) {
+        buffer_puts(flags, " O0");
+    } else if (options->emit_object || options->emit_asm) {
+        buffer_printf(flags, " inline:%d vector:%s simplify:%d gvn:%d", options->inline_budget,
+                      vector_target_name(options->vector_target), (int)options->simplify, (int)options->gvn);
+    }
+    for (size_t i = 0; i < options->num_include_dirs; ++i) {
+        buffer_printf(flags, " -I%s", options->include_dirs[i]);
+    }
+    if (options->pch != NULL) {
+        buffer_printf(flags, " pch:%016llx", (unsigned long long)options->pch->content_hash);
+    }
+    buffer_putc(flags, '\0');
+}
+
+// Everything besides the main source that went into the output. A PCH also
+// records the header it was built from and whatever its own PCH came from.
+static cache_dependency* collect_dependencies(compile_job* job, preprocessor* pp, size_t* num_dependencies) {
+    const compile_options* options = job->options;
+    size_t count = pp->num_dependencies;
+    if (options->emit_pch && options->pch != NULL) {
+        count += options->pch->num_dependencies;
+    }
+    cache_dependency* dependencies = malloc((count + 2) * sizeof(cache_dependency));
+    size_t n = 0;
+    for (size_t i = 0; i < pp->num_dependencies; ++i) {
+        dependencies[n].path = pp->dependencies[i]->path;
+        dependencies[n++].hash = pp->dependencies[i]->content_hash;
+    }
+    if (options->emit_pch && options->pch != NULL) {
+        for (size_t i = 0; i < options->pch->num_dependencies; ++i) {
+            dependencies[n++] = options->pch->dependencies[i];
+        }
+    }
+    *num_dependencies = n;
+    return dependencies;
+}
+
+// --dump-ast[=FORMAT] and --dump-symbols[=FORMAT]; a bare flag means text.
+static bool parse_dump_format(const char* arg, bool allow_binary, dump_format* format) {
+    if (*arg == '\0' || strcmp(arg, "=text") == 0) {
+        *format = DUMP_TEXT;
+    } else if (strcmp(arg, "=json") == 0) {
+        *format = DUMP_JSON;
+    } else if (allow_binary && strcmp(arg, "=bin") == 0) {
+        *format = DUMP_BINARY;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Sends the finished artifact wherever the mode says it goes.
+static void deliver_artifact(compile_job* job, buffer* artifact) {
+    const compile_options* options = job->options;
+    if (options->keep_output) {
+        buffer_append(&job->output, artifact->data, artifact->length);
+    } else if (options->emit_pch) {
+        char* pch_file = options->output_file ? _strdup(options->output_file) : NULL;
+        if (pch_file == NULL) {
+            // prelude.h -> prelude.h.pch, next to the header like gcc's .gch.
+            pch_file = malloc(strlen(job->input_file) + 5);
+            strcpy(pch_file, job->input_file);
+            strcat(pch_file, ".pch");
+        }
+        write_output(options, artifact, pch_file);
+        free(pch_file);
+    } else if (options->emit_object) {
+        char* object_file = options->output_file ? _strdup(options->output_file) : default_output_name(job->input_file, ".o");
+        write_output(options, artifact, object_file);
+        free(object_file);
+    } else if (options->emit_asm && options->multiple_inputs) {
+        // Several inputs each get their own .s file, as with cc -S.
+        char* asm_file = default_output_name(job->input_file, ".s");
+        write_output(options, artifact, asm_file);
+        free(asm_file);
+    } else if (options->emit_asm && options->output_file) {
+        write_output(options, artifact, options->output_file);
+    } else {
+        buffer_append(&job->output, artifact->data, artifact->length);
+    }
+}
+
+// Everything compile allocates for one job. It lives in run_compile_job so
+// that a fatal error unwinding out of any phase still releases it, which a
+// long-lived compile server or libscc context depends on.
+typedef struct compile_state {
+    char* source;
+    char* source_path;
+    token* tokens;
+    int num_tokens;
+    preprocessor pp;
+    bool has_preprocessor;
+    buffer artifact;
+    sir_program* sir;
+    x86_module* module;
+    x86_object* object;
+    bc_program* bc;
+} compile_state;
+
+static void free_compile_state(compile_state* state) {
+    if (state->bc != NULL) {
+        free_bc_program(state->bc);
+    }
+    if (state->object != NULL) {
+        free_x86_object(state->object);
+    }
+    if (state->module != NULL) {
+        free_x86_module(state->module);
+    }
+    if (state->sir != NULL) {
+        free_sir_program(state->sir);
+    }
+    free_buffer(&state->artifact);
+    if (state->has_preprocessor) {
+        free(state->pp.output);
+        free_preprocessor(&state->pp);
+    }
+    for (int i = 0; i < state->num_tokens; ++i) {
+        free(state->tokens[i].lexme);
+    }
+    free(state->tokens);
+    free(state->source);
+    free(state->source_path);
+}
+
+static void compile(compile_job* job, compile_state* state, compile_stats* stats) {
+    const compile_options* options = job->options;
+    char* input_file = job->input_file;
+    bool cacheable = options->cache != NULL && !options->run && !options->interpret && !options->emit_pch;
+    cache_key key;
+
+    stats_begin_phase(stats, "read_source");
+    size_t source_size = job->source_size;
+    char* source_path = state->source_path = resolve_path(options, input_file);
+    char* source;
+    if (job->source != NULL) {
+        // The lexer owns and frees its content, so in-memory sources are copied.
+        source = counted_malloc(ALLOC_LEXER, source_size + 1);
+        if (source == NULL) {
+            fatal_error("Error: Failed to allocate memory for file %s!\n", input_file);
+        }
+        memcpy(source, job->source, source_size);
+        source[source_size] = '\0';
+    } else {
+        source = read_source_file(source_path, &source_size);
+    }
+    state->source = source;
+    stats_end_phase(stats);
+
+    buffer* artifact = &state->artifact;
+    if (cacheable) {
+        stats_begin_phase(stats, "cache_lookup");
+        buffer flags = init_buffer(64);
+        cache_flags(job, &flags);
+        key = compute_cache_key(options->cache, source, source_size, flags.data);
+        bool hit = cache_lookup(options->cache, &key, artifact);
+        free_buffer(&flags);
+        stats_end_phase(stats);
+
+        if (hit) {
+            stats_begin_phase(stats, "write_output");
+            deliver_artifact(job, artifact);
+            stats_end_phase(stats);
+            return;
+        }
+    }
+
+    stats_begin_phase(stats, "init_lexer");
+    lexer l = init_lexer_from_source(input_file, source);
+    stats_end_phase(stats);
+
+    stats_begin_phase(stats, "tokenizer");
+    token* tokens = state->tokens = tokenizer(&l);
+    state->num_tokens = l.tokens_count;
+    stats_end_phase(stats);
+
+    stats_begin_phase(stats, "preprocess");
+    preprocessor* pp = &state->pp;
+    *pp = init_preprocessor(options->headers, options->include_dirs, options->num_include_dirs);
+    state->has_preprocessor = true;
+    if (options->pch != NULL) {
+        apply_pch_macros(options->pch, pp);
+    }
+    token* pp_tokens = preprocess(pp, source_path, &l, tokens);
+    stats_end_phase(stats);
+
+    stats_begin_phase(stats, "init_parser");
+    parser p = init_parser(&l, pp_tokens);
+    stats_end_phase(stats);
+
+    ast_program_node* program = create_program_node();
+    if (options->pch != NULL) {
+        stats_begin_phase(stats, "load_pch");
+        apply_pch_declarations(options->pch, p.global_symbol_table, p.types, program);
+        stats_end_phase(stats);
+    }
+
+    stats_begin_phase(stats, "parse_program");
+    parse_declarations(&p, program);
+    stats_end_phase(stats);
+
+    stats_begin_phase(stats, "typecheck");
+    typecheck_program(p.types, program);
+    stats_end_phase(stats);
+
+    if (options->interpret) {
+        stats_begin_phase(stats, "bytecode");
+        bc_program* bc = state->bc = compile_bytecode(program);
+        stats_end_phase(stats);
+
+        stats_begin_phase(stats, "vm");
+        job->exit_code = vm_run_main(bc);
+        stats_end_phase(stats);
+    } else if (options->run) {
+        state->sir = create_sir_program();
+        build_module(job, program, state->sir, &state->module, stats);
+        x86_object* object = state->object = encode_module(state->module, stats);
+
+        stats_begin_phase(stats, "jit");
+        job->exit_code = jit_run_main(object);
+        stats_end_phase(stats);
+    } else {
+        if (options->emit_pch) {
+            stats_begin_phase(stats, "write_pch");
+            size_t num_dependencies;
+            cache_dependency* dependencies = collect_dependencies(job, pp, &num_dependencies);
+            char* path = realpath(source_path, NULL);
+            dependencies[num_dependencies].path = path ? path : input_file;
+            dependencies[num_dependencies++].hash = hash_bytes(source, source_size, 0);
+            // A later #include of the header itself is then a no-op.
+            mark_once_file(pp, dependencies[num_dependencies - 1].path);
+            write_pch(pp, dependencies, num_dependencies, p.global_symbol_table, program, artifact);
+            free(dependencies);
+            free(path);
+            stats_end_phase(stats);
+        } else if (options->emit_object) {
+            state->sir = create_sir_program();
+            build_module(job, program, state->sir, &state->module, stats);
+            state->object = encode_module(state->module, stats);
+
+            stats_begin_phase(stats, "write_elf");
+            write_elf_object(state->object, p.global_symbol_table, input_file, artifact);
+            stats_end_phase(stats);
+        } else if (options->emit_asm) {
+            state->sir = create_sir_program();
+            build_module(job, program, state->sir, &state->module, stats);
+
+            stats_begin_phase(stats, "write_asm");
+            x86_write_asm(state->module, artifact);
+            stats_end_phase(stats);
+        } else {
+            dump_format ast_format = options->dump_ast;
+            dump_format symbols_format = options->dump_symbols;
+            if (ast_format == DUMP_NONE && symbols_format == DUMP_NONE) {
+                ast_format = DUMP_TEXT;
+                symbols_format = DUMP_TEXT;
+            }
+            if (ast_format != DUMP_NONE) {
+                stats_begin_phase(stats, "print_ast");
+                if (ast_format == DUMP_JSON) {
+                    dump_ast_json(program, artifact);
+                } else if (ast_format == DUMP_BINARY) {
+                    dump_ast_binary(program, artifact);
+                } else {
+                    print_ast(program, artifact);
+                }
+                stats_end_phase(stats);
+            }
+            if (symbols_format != DUMP_NONE) {
+                stats_begin_phase(stats, "print_symbol_table");
+                if (symbols_format == DUMP_JSON) {
+                    dump_symbol_table_json(p.global_symbol_table, artifact);
+                } else {
+                    print_symbol_table(p.global_symbol_table, artifact);
+                }
+                stats_end_phase(stats);
+            }
+        }
+
+        if (cacheable) {
+            stats_begin_phase(stats, "cache_store");
+            size_t num_dependencies;
+            cache_dependency* dependencies = collect_dependencies(job, pp, &num_dependencies);
+            cache_store(options->cache, &key, dependencies, num_dependencies, artifact);
+            free(dependencies);
+            stats_end_phase(stats);
+        }
+
+        stats_begin_phase(stats, "write_output");
+        deliver_artifact(job, artifact);
+        stats_end_phase(stats);
+    }
+}
+
+static void report_stats(compile_job* job, compile_stats* stats) {
+    const compile_options* options = job->options;
+    if (options->multiple_inputs && !options->stats_json) {
+        buffer_printf(&job->report, "== %s ==\n", job->input_file);
+    }
+    if (options->stats_json) {
+        print_stats_json(stats, &job->report);
+    } else {
+        print_stats_text(stats, &job->report);
+    }
+}
+
+// Task entry point. Fatal errors anywhere in the pipeline unwind back here
+// and fail only this job. The AST and symbol tables live in a region that
+// is dropped when the job ends, whichever way it ends.
+void run_compile_job(void* arg) {
+    compile_job* job = arg;
+    jmp_buf recovery;
+    diagnostics* previous = set_diagnostics(&job->diag);
+    job->diag.recovery = &recovery;
+    alloc_region region;
+    init_alloc_region(&region);
+    alloc_region* previous_region = set_alloc_region(&region);
+    compile_state state = {0};
+    compile_stats stats;
+    init_compile_stats(&stats);
+    if (setjmp(recovery) == 0) {
+        compile(job, &state, &stats);
+        if (job->options->show_stats) {
+            report_stats(job, &stats);
+        }
+    } else {
+        job->exit_code = 1;
+        job->failed = true;
+    }
+    free_compile_state(&state);
+    free_compile_stats(&stats);
+    set_alloc_region(previous_region);
+    free_alloc_region(&region);
+    job->diag.recovery = NULL;
+    set_diagnostics(previous);
+}
+
+void flush_compile_job(compile_job* job) {
+    buffer_flush(&job->output, job->options->output_fd);
+    buffer_flush(&job->diag.messages, job->options->error_fd);
+    buffer_flush(&job->report, job->options->error_fd);
+}
+
+// Opening a PCH is the one setup step that reports through diagnostics, so
+// it gets its own recovery point: a bad PCH fails this run and, under a
+// compile server or in libscc, never takes the process down. Errors are
+// appended to messages.
+const pch_file* open_pch(pch_cache* pchs, const char* path, pch_file** owned, buffer* messages) {
+    diagnostics diag;
+    init_diagnostics(&diag);
+    jmp_buf recovery;
+    diag.recovery = &recovery;
+    diagnostics* previous = set_diagnostics(&diag);
+    const pch_file* pch = NULL;
+    if (setjmp(recovery) == 0) {
+        if (pchs != NULL) {
+            pch = acquire_pch(pchs, path);
+        } else {
+            *owned = load_pch(path);
+            pch = *owned;
+        }
+    }
+    set_diagnostics(previous);
+    buffer_append(messages, diag.messages.data, diag.messages.length);
+    free_diagnostics(&diag);
+    return pch;
+}
+
+int run_compiler(int argc, char** argv, const compile_environment* env) {
+    compile_options options;
+    init_compile_options(&options);
+    options.working_directory = env->working_directory;
+    options.output_fd = env->output_fd;
+    options.error_fd = env->error_fd;
+    char** input_files = malloc(argc * sizeof(char*));
+    size_t num_inputs = 0;
+    size_t num_threads = 0;
+    bool use_cache = false;
+    char* cache_directory = getenv("SCC_CACHE_DIR");
+    size_t cache_size = CACHE_DEFAULT_MAX_BYTES;
+    compile_cache cache;
+    char* pch_path = NULL;
+    char** include_dirs = malloc(argc * sizeof(char*));
+    size_t num_include_dirs = 0;
+    int exit_code = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-S") == 0) {
+            options.emit_asm = true;
+        } else if (strcmp(argv[i], "-c") == 0) {
+            options.emit_object = true;
+        } else if (strcmp(argv[i], "--emit-pch") == 0) {
+            options.emit_pch = true;
+        } else if (strcmp(argv[i], "--use-pch") == 0 && i + 1 < argc) {
+            pch_path = argv[++i];
+        } else if (strncmp(argv[i], "--use-pch=", 10) == 0) {
+            pch_path = argv[i] + 10;
+        } else if (strcmp(argv[i], "--run") == 0) {
+            options.run = true;
+        } else if (strcmp(argv[i], "--interp") == 0) {
+            options.interpret = true;
+        } else if (strcmp(argv[i], "--stats") == 0 || strcmp(argv[i], "--stats=text") == 0) {
+            options.show_stats = true;
+        } else if (strcmp(argv[i], "--stats=json") == 0) {
+            options.show_stats = true;
+            options.stats_json = true;
+        } else if (strncmp(argv[i], "--dump-ast", 10) == 0 && (argv[i][10] == '\0' || argv[i][10] == '=')) {
+            if (!parse_dump_format(argv[i] + 10, true, &options.dump_ast)) {
+                dprintf(options.error_fd, "Error: unknown AST dump format '%s' (expected json, text or bin)\n", argv[i] + 11);
+                exit_code = 1;
+            }
+        } else if (strncmp(argv[i], "--dump-symbols", 14) == 0 && (argv[i][14] == '\0' || argv[i][14] == '=')) {
+            if (!parse_dump_format(argv[i] + 14, false, &options.dump_symbols)) {
+                dprintf(options.error_fd, "Error: unknown symbol dump format '%s' (expected json or text)\n", argv[i] + 15);
+                exit_code = 1;
+            }
+        } else if (strncmp(argv[i], "--inline-budget=", 16) == 0) {
+            options.inline_budget = atoi(argv[i] + 16);
+        } else if (strcmp(argv[i], "--inline-report") == 0) {
+            options.inline_report = true;
+        } else if (strcmp(argv[i], "--target=sse2") == 0) {
+            options.vector_target = VECTOR_SSE2;
+        } else if (strcmp(argv[i], "--target=avx2") == 0) {
+            options.vector_target = VECTOR_AVX2;
+        } else if (strncmp(argv[i], "--target=", 9) == 0) {
+            dprintf(options.error_fd, "Error: unknown target '%s' (expected sse2 or avx2)\n", argv[i] + 9);
+            exit_code = 1;
+        } else if (strcmp(argv[i], "--no-vectorize") == 0) {
+            options.vector_target = VECTOR_NONE;
+        } else if (strcmp(argv[i], "--vectorize-report") == 0) {
+            options.vectorize_report = true;
+        } else if (strcmp(argv[i], "--no-simplify") == 0) {
+            options.simplify = false;
+        } else if (strcmp(argv[i], "--no-gvn") == 0) {
+            options.gvn = false;
+        } else if (strncmp(argv[i], "-O", 2) == 0) {
+            options.opt_level = strcmp(argv[i], "-O0") == 0 ? 0 : 1;
+        } else if (strcmp(argv[i], "--cache") == 0) {
+            use_cache = true;
+        } else if (strncmp(argv[i], "--cache-dir=", 12) == 0) {
+            use_cache = true;
+            cache_directory = argv[i] + 12;
+        } else if (strncmp(argv[i], "--cache-size=", 13) == 0) {
+            cache_size = (size_t)strtoull(argv[i] + 13, NULL, 10) << 20;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            options.output_file = argv[++i];
+        } else if (strcmp(argv[i], "-I") == 0 && i + 1 < argc) {
+            include_dirs[num_include_dirs++] = resolve_path(&options, argv[++i]);
+        } else if (strncmp(argv[i], "-I", 2) == 0 && argv[i][2] != '\0') {
+            include_dirs[num_include_dirs++] = resolve_path(&options, argv[i] + 2);
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            num_threads = strtoul(argv[++i], NULL, 10);
+        } else if (strncmp(argv[i], "-j", 2) == 0 && argv[i][2] != '\0') {
+            num_threads = strtoul(argv[i] + 2, NULL, 10);
+        } else {
+            input_files[num_inputs++] = argv[i];
+        }
+    }
+
+    if (num_inputs == 0) {
+        dprintf(options.output_fd, "ERROR: no input file\n");
+        exit_code = 1;
+    }
+    options.multiple_inputs = num_inputs > 1;
+#if defined(__GNUC__)
+    // Code run in process must not use instructions this machine lacks.
+    if (options.run && options.vector_target == VECTOR_AVX2 && !__builtin_cpu_supports("avx2")) {
+        dprintf(options.error_fd, "Error: --target=avx2 with --run, but this CPU has no AVX2\n");
+        exit_code = 1;
+    }
+#endif
+    if (options.multiple_inputs && options.output_file && (options.emit_object || options.emit_asm || options.emit_pch)) {
+        dprintf(options.error_fd, "Error: cannot specify -o with -c, -S or --emit-pch and multiple input files\n");
+        exit_code = 1;
+    }
+
+    // SCC_CACHE_DIR turns the cache on without touching build scripts.
+    if (exit_code == 0 && (use_cache || (cache_directory != NULL && cache_directory[0] != '\0'))) {
+        char* directory = cache_directory && cache_directory[0] ? resolve_path(&options, cache_directory) : default_cache_directory();
+        if (init_compile_cache(&cache, directory, cache_size)) {
+            options.cache = &cache;
+        } else {
+            dprintf(options.error_fd, "Warning: cannot use cache directory %s; compiling without cache\n", directory ? directory : "<none>");
+        }
+        free(directory);
+    }
+
+    // Headers are lexed once per run, or once per server, and shared by all jobs.
+    options.headers = env->headers ? env->headers : create_header_cache();
+    options.include_dirs = include_dirs;
+    options.num_include_dirs = num_include_dirs;
+
+    // The PCH is mapped once and applied to every job.
+    pch_file* owned_pch = NULL;
+    if (exit_code == 0 && pch_path != NULL) {
+        char* path = resolve_path(&options, pch_path);
+        buffer messages = init_buffer(0);
+        options.pch = open_pch(env->pchs, path, &owned_pch, &messages);
+        buffer_flush(&messages, options.error_fd);
+        free_buffer(&messages);
+        free(path);
+        if (options.pch == NULL) {
+            exit_code = 1;
+        }
+    }
+
+    if (exit_code == 0) {
+        compile_job* jobs = malloc(num_inputs * sizeof(compile_job));
+        for (size_t i = 0; i < num_inputs; ++i) {
+            init_compile_job(&jobs[i], input_files[i], &options);
+        }
+
+        if (num_threads == 0) {
+            num_threads = available_cores();
+        }
+        // Threads the files leave over go to compiling each file's functions,
+        // though run_backend only starts them for programs large enough to gain.
+        options.backend_threads = num_threads > num_inputs ? num_threads / num_inputs : 1;
+        if (num_threads > num_inputs) {
+            num_threads = num_inputs;
+        }
+        if (num_threads <= 1) {
+            for (size_t i = 0; i < num_inputs; ++i) {
+                run_compile_job(&jobs[i]);
+            }
+        } else {
+            thread_pool* pool = create_thread_pool(num_threads);
+            for (size_t i = 0; i < num_inputs; ++i) {
+                thread_pool_submit(pool, run_compile_job, &jobs[i]);
+            }
+            thread_pool_wait(pool);
+            free_thread_pool(pool);
+        }
+
+        // Results come out in input order no matter which worker finished first.
+        for (size_t i = 0; i < num_inputs; ++i) {
+            flush_compile_job(&jobs[i]);
+            if (exit_code == 0) {
+                exit_code = jobs[i].exit_code;
+            }
+            free_compile_job(&jobs[i]);
+        }
+        free(jobs);
+    }
+
+    if (options.cache != NULL) {
+        free_compile_cache(options.cache);
+    }
+    if (owned_pch != NULL) {
+        free_pch(owned_pch);
+    }
+    if (env->headers == NULL) {
+        free_header_cache(options.headers);
+    }
+    for (size_t i = 0; i < num_include_dirs; ++i) {
+        free(include_dirs[i]);
+    }
+    free(include_dirs);
+    free(input_files);
+    return exit_code;
+}
@@ -0,0 +1,103 @@
+#ifndef DRIVER_H
+#define DRIVER_H
+
+#include <stdbool.h>
+#include "buffer.h"
+#include "diagnostics.h"
+#include "cache.h"
+#include "preprocessor.h"
+#include "pch.h"
+#include "vectorize.h"
+
+// What the dump mode prints for --dump-ast and --dump-symbols. With neither
+// given, both are printed as text.
+typedef enum dump_format {
+    DUMP_NONE,
+    DUMP_TEXT,
+    DUMP_JSON,
+    DUMP_BINARY,
+} dump_format;
+
+typedef struct compile_options {
+    char* output_file;
+    compile_cache* cache;
+    header_cache* headers;
+    const pch_file* pch;
+    char** include_dirs;
+    size_t num_include_dirs;
+    bool emit_asm;
+    bool emit_object;
+    bool emit_pch;
+    bool run;
+    bool interpret;
+    bool show_stats;
+    bool stats_json;
+    bool multiple_inputs;
+    dump_format dump_ast;
+    dump_format dump_symbols;
+    // Callee size inlined without bonuses, 0 to turn inlining off; with
+    // inline_report the reason for each decision goes to the report.
+    int inline_budget;
+    bool inline_report;
+    // Instruction set loops are vectorized for, VECTOR_NONE for none; with
+    // vectorize_report every loop considered is reported.
+    vector_target vector_target;
+    bool vectorize_report;
+    // 0 compiles straight from the AST with no optimization at all, for
+    // the least latency; the rest run the full pipeline below.
+    int opt_level;
+    // Algebraic simplification and strength reduction of the SIR.
+    bool simplify;
+    // Global value numbering, which removes repeated computations.
+    bool gvn;
+    // Workers that optimize and generate code for one file's functions.
+    size_t backend_threads;
+    // Every artifact, objects included, stays in the job's output buffer.
+    bool keep_output;
+    const char* working_directory;
+    int output_fd;
+    int error_fd;
+} compile_options;
+
+// The defaults the command line starts from, shared with libscc so that
+// both compile the same source to the same code.
+void init_compile_options(compile_options* options);
+
+// Everything one input file needs. Jobs share nothing but their options, so
+// any number of them can run at once; what they would have printed is kept
+// in their buffers until the driver flushes them in input order. When source
+// is set it is compiled instead of reading input_file, which then only names
+// the unit.
+typedef struct compile_job {
+    char* input_file;
+    const char* source;
+    size_t source_size;
+    const compile_options* options;
+    buffer output;
+    buffer report;
+    diagnostics diag;
+    int exit_code;
+    bool failed;
+} compile_job;
+
+void init_compile_job(compile_job* job, char* input_file, const compile_options* options);
+void free_compile_job(compile_job* job);
+void run_compile_job(void* job);
+void flush_compile_job(compile_job* job);
+
+// Where one invocation of scc reads and writes. A plain run leaves
+// working_directory NULL and uses stdout and stderr; the compile server fills
+// this in per client and lends its resident header and PCH caches, which a
+// plain run creates for itself.
+typedef struct compile_environment {
+    const char* working_directory;
+    int output_fd;
+    int error_fd;
+    header_cache* headers;
+    pch_cache* pchs;
+} compile_environment;
+
+const pch_file* open_pch(pch_cache* pchs, const char* path, pch_file** owned, buffer* messages);
+int run_compiler(int argc, char** argv, const compile_environment* env);
+
+#endif // DRIVER_H
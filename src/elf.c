@@ -0,0 +1,282 @@
+#include "elf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Minimal ELF64 relocatable object writer for x86-64. Only the pieces the
+// system linker needs are produced: section contents, .symtab/.strtab and one
+// .rela section for every section that carries relocations.
+
+#define SHT_PROGBITS 1
+#define SHT_SYMTAB 2
+#define SHT_STRTAB 3
+#define SHT_RELA 4
+
+#define SHF_WRITE 0x1
+#define SHF_ALLOC 0x2
+#define SHF_EXECINSTR 0x4
+#define SHF_INFO_LINK 0x40
+
+#define STB_LOCAL 0
+#define STB_GLOBAL 1
+#define STT_NOTYPE 0
+#define STT_OBJECT 1
+#define STT_FUNC 2
+#define STT_SECTION 3
+#define STT_FILE 4
+#define SHN_ABS 0xfff1
+
+#define R_X86_64_PC32 2
+#define R_X86_64_PLT32 4
+
+typedef struct elf_section {
+    const char* name;
+    unsigned int type;
+    unsigned long long flags;
+    buffer* contents;
+    unsigned int link;
+    unsigned int info;
+    unsigned long long align;
+    unsigned long long entsize;
+    unsigned int name_offset;
+    unsigned long long file_offset;
+} elf_section;
+
+typedef struct elf_symbol_entry {
+    const char* name;
+    unsigned char info;
+    unsigned short shndx;
+    unsigned long long value;
+    unsigned long long size;
+} elf_symbol_entry;
+
+typedef struct elf_writer {
+    elf_section sections[16];
+    int num_sections;
+    elf_symbol_entry* symbols;
+    size_t num_symbols;
+    buffer strtab;
+    buffer shstrtab;
+    buffer symtab;
+    buffer relas[NUM_SECTIONS];
+} elf_writer;
+
+static const char* section_names[NUM_SECTIONS] = { ".text", ".data", ".rodata" };
+static const char* rela_names[NUM_SECTIONS] = { ".rela.text", ".rela.data", ".rela.rodata" };
+
+static void put_u16(buffer* b, unsigned int value) {
+    unsigned char bytes[2] = { value & 0xff, (value >> 8) & 0xff };
+    buffer_append(b, bytes, 2);
+}
+
+static void put_u32(buffer* b, unsigned int value) {
+    unsigned char bytes[4] = { value & 0xff, (value >> 8) & 0xff, (value >> 16) & 0xff, (value >> 24) & 0xff };
+    buffer_append(b, bytes, 4);
+}
+
+static void put_u64(buffer* b, unsigned long long value) {
+    put_u32(b, (unsigned int)value);
+    put_u32(b, (unsigned int)(value >> 32));
+}
+
+static unsigned int add_string(buffer* table, const char* str) {
+    unsigned int offset = (unsigned int)table->length;
+    buffer_append(table, str, strlen(str) + 1);
+    return offset;
+}
+
+static int add_section(elf_writer* w, const char* name, unsigned int type, unsigned long long flags,
+                       buffer* contents, unsigned long long align, unsigned long long entsize) {
+    elf_section* section = &w->sections[w->num_sections];
+    memset(section, 0, sizeof(elf_section));
+    section->name = name;
+    section->type = type;
+    section->flags = flags;
+    section->contents = contents;
+    section->align = align;
+    section->entsize = entsize;
+    return w->num_sections++;
+}
+
+static size_t add_elf_symbol(elf_writer* w, const char* name, unsigned char info, unsigned short shndx,
+                             unsigned long long value, unsigned long long size) {
+    w->symbols = realloc(w->symbols, (w->num_symbols + 1) * sizeof(elf_symbol_entry));
+    elf_symbol_entry* sym = &w->symbols[w->num_symbols];
+    sym->name = name;
+    sym->info = info;
+    sym->shndx = shndx;
+    sym->value = value;
+    sym->size = size;
+    return w->num_symbols++;
+}
+
+static size_t find_elf_symbol(elf_writer* w, const char* name) {
+    for (size_t i = 0; i < w->num_symbols; ++i) {
+        if (w->symbols[i].name != NULL && strcmp(w->symbols[i].name, name) == 0 &&
+            (w->symbols[i].info & 0xf) != STT_FILE && (w->symbols[i].info & 0xf) != STT_SECTION) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+static void add_defined_symbol(elf_writer* w, object_symbol* sym, const int* section_index) {
+    if (find_elf_symbol(w, sym->name) != 0) {
+        return;
+    }
+    unsigned char info = (STB_GLOBAL << 4) | (sym->is_function ? STT_FUNC : STT_OBJECT);
+    add_elf_symbol(w, sym->name, info, (unsigned short)section_index[sym->section], sym->offset, sym->size);
+}
+
+void write_elf_object(x86_object* obj, symbol_table* st, const char* source_name, buffer* out) {
+    elf_writer w;
+    memset(&w, 0, sizeof(elf_writer));
+    w.strtab = init_buffer(256);
+    w.shstrtab = init_buffer(128);
+    w.symtab = init_buffer(256);
+    buffer empty = init_buffer(0);
+
+    int section_index[NUM_SECTIONS];
+    add_section(&w, "", 0, 0, &empty, 0, 0);
+    section_index[SECTION_TEXT] = add_section(&w, section_names[SECTION_TEXT], SHT_PROGBITS,
+                                              SHF_ALLOC | SHF_EXECINSTR, &obj->sections[SECTION_TEXT], 16, 0);
+    section_index[SECTION_DATA] = add_section(&w, section_names[SECTION_DATA], SHT_PROGBITS,
+                                              SHF_ALLOC | SHF_WRITE, &obj->sections[SECTION_DATA], 16, 0);
+    section_index[SECTION_RODATA] = add_section(&w, section_names[SECTION_RODATA], SHT_PROGBITS,
+                                                SHF_ALLOC, &obj->sections[SECTION_RODATA], 16, 0);
+
+    // Locals first: the file symbol and one symbol per section.
+    add_string(&w.strtab, "");
+    add_elf_symbol(&w, NULL, 0, 0, 0, 0);
+    add_elf_symbol(&w, source_name, (STB_LOCAL << 4) | STT_FILE, SHN_ABS, 0, 0);
+    for (int i = 0; i < NUM_SECTIONS; ++i) {
+        add_elf_symbol(&w, NULL, (STB_LOCAL << 4) | STT_SECTION, (unsigned short)section_index[i], 0, 0);
+    }
+    size_t first_global = w.num_symbols;
+
+    // Globals follow the order of the front end's global scope, then anything
+    // the object defines or references that the scope does not know about.
+    scope* global_scope = st->scopes[0];
+    for (size_t i = 0; i < global_scope->num_symbols; ++i) {
+        object_symbol* sym = find_object_symbol(obj, global_scope->symbols[i]->name);
+        if (sym != NULL) {
+            add_defined_symbol(&w, sym, section_index);
+        }
+    }
+    for (size_t i = 0; i < obj->num_symbols; ++i) {
+        add_defined_symbol(&w, &obj->symbols[i], section_index);
+    }
+    for (size_t i = 0; i < obj->num_relocs; ++i) {
+        if (find_elf_symbol(&w, obj->relocs[i].symbol) == 0) {
+            add_elf_symbol(&w, obj->relocs[i].symbol, (STB_GLOBAL << 4) | STT_NOTYPE, 0, 0, 0);
+        }
+    }
+
+    for (size_t i = 0; i < w.num_symbols; ++i) {
+        elf_symbol_entry* sym = &w.symbols[i];
+        put_u32(&w.symtab, sym->name != NULL && i != 0 ? add_string(&w.strtab, sym->name) : 0);
+        buffer_putc(&w.symtab, (char)sym->info);
+        buffer_putc(&w.symtab, 0);
+        put_u16(&w.symtab, sym->shndx);
+        put_u64(&w.symtab, sym->value);
+        put_u64(&w.symtab, sym->size);
+    }
+
+    for (int i = 0; i < NUM_SECTIONS; ++i) {
+        w.relas[i] = init_buffer(0);
+    }
+    for (size_t i = 0; i < obj->num_relocs; ++i) {
+        object_reloc* reloc = &obj->relocs[i];
+        buffer* rela = &w.relas[reloc->section];
+        unsigned long long type = reloc->type == RELOC_PLT32 ? R_X86_64_PLT32 : R_X86_64_PC32;
+        put_u64(rela, reloc->offset);
+        put_u64(rela, ((unsigned long long)find_elf_symbol(&w, reloc->symbol) << 32) | type);
+        put_u64(rela, (unsigned long long)reloc->addend);
+    }
+
+    int symtab_index = w.num_sections + 0;
+    for (int i = 0; i < NUM_SECTIONS; ++i) {
+        if (w.relas[i].length > 0) {
+            symtab_index++;
+        }
+    }
+    for (int i = 0; i < NUM_SECTIONS; ++i) {
+        if (w.relas[i].length > 0) {
+            int index = add_section(&w, rela_names[i], SHT_RELA, SHF_INFO_LINK, &w.relas[i], 8, 24);
+            w.sections[index].link = (unsigned int)symtab_index;
+            w.sections[index].info = (unsigned int)section_index[i];
+        }
+    }
+    int symtab = add_section(&w, ".symtab", SHT_SYMTAB, 0, &w.symtab, 8, 24);
+    int strtab = add_section(&w, ".strtab", SHT_STRTAB, 0, &w.strtab, 1, 0);
+    w.sections[symtab].link = (unsigned int)strtab;
+    w.sections[symtab].info = (unsigned int)first_global;
+    add_section(&w, ".note.GNU-stack", SHT_PROGBITS, 0, &empty, 1, 0);
+    int shstrtab = add_section(&w, ".shstrtab", SHT_STRTAB, 0, &w.shstrtab, 1, 0);
+
+    for (int i = 0; i < w.num_sections; ++i) {
+        w.sections[i].name_offset = add_string(&w.shstrtab, w.sections[i].name);
+    }
+
+    // Lay out section contents after the 64-byte header, then the header table.
+    unsigned long long offset = 64;
+    for (int i = 1; i < w.num_sections; ++i) {
+        elf_section* section = &w.sections[i];
+        unsigned long long align = section->align ? section->align : 1;
+        offset = (offset + align - 1) / align * align;
+        section->file_offset = offset;
+        offset += section->contents->length;
+    }
+    unsigned long long shoff = (offset + 7) / 8 * 8;
+
+    static const unsigned char ident[16] = { 0x7f, 'E', 'L', 'F', 2, 1, 1, 0 };
+    buffer_append(out, ident, 16);
+    put_u16(out, 1);                    // ET_REL
+    put_u16(out, 62);                   // EM_X86_64
+    put_u32(out, 1);                    // EV_CURRENT
+    put_u64(out, 0);                    // e_entry
+    put_u64(out, 0);                    // e_phoff
+    put_u64(out, shoff);
+    put_u32(out, 0);                    // e_flags
+    put_u16(out, 64);                   // e_ehsize
+    put_u16(out, 0);                    // e_phentsize
+    put_u16(out, 0);                    // e_phnum
+    put_u16(out, 64);                   // e_shentsize
+    put_u16(out, (unsigned int)w.num_sections);
+    put_u16(out, (unsigned int)shstrtab);
+
+    size_t base = out->length - 64;
+    for (int i = 1; i < w.num_sections; ++i) {
+        elf_section* section = &w.sections[i];
+        while (out->length - base < section->file_offset) {
+            buffer_putc(out, 0);
+        }
+        buffer_append(out, section->contents->data, section->contents->length);
+    }
+    while (out->length - base < shoff) {
+        buffer_putc(out, 0);
+    }
+
+    for (int i = 0; i < w.num_sections; ++i) {
+        elf_section* section = &w.sections[i];
+        put_u32(out, section->name_offset);
+        put_u32(out, section->type);
+        put_u64(out, section->flags);
+        put_u64(out, 0);
+        put_u64(out, i == 0 ? 0 : section->file_offset);
+        put_u64(out, section->contents->length);
+        put_u32(out, section->link);
+        put_u32(out, section->info);
+        put_u64(out, section->align);
+        put_u64(out, section->entsize);
+    }
+
+    for (int i = 0; i < NUM_SECTIONS; ++i) {
+        free_buffer(&w.relas[i]);
+    }
+    free_buffer(&w.strtab);
+    free_buffer(&w.shstrtab);
+    free_buffer(&w.symtab);
+    free(w.symbols);
+}
@@ -0,0 +1,11 @@
+#ifndef ELF_H
+#define ELF_H
+
+#include <stdbool.h>
+#include "encoder.h"
+#include "symbol_table.h"
+#include "buffer.h"
+
+void write_elf_object(x86_object* obj, symbol_table* st, const char* source_name, buffer* out);
+
+#endif // ELF_H
@@ -0,0 +1,585 @@
+#include "encoder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "diagnostics.h"
+
+// Label fixups are resolved per function once every label offset is known.
+typedef struct label_fixup {
+    size_t offset;      // position of the rel32 field in .text
+    int label;
+    int base;           // label the offset is taken from, or -1 for the end of the field
+} label_fixup;
+
+typedef struct encoder {
+    x86_object* obj;
+    buffer* text;
+    size_t* label_offsets;
+    label_fixup* fixups;
+    size_t num_fixups;
+    size_t max_fixups;
+} encoder;
+
+static void emit_byte(encoder* e, unsigned char byte) {
+    buffer_putc(e->text, (char)byte);
+}
+
+static void emit_u32(encoder* e, unsigned int value) {
+    unsigned char bytes[4] = { value & 0xff, (value >> 8) & 0xff, (value >> 16) & 0xff, (value >> 24) & 0xff };
+    buffer_append(e->text, bytes, 4);
+}
+
+static void emit_imm(encoder* e, long long value, int size) {
+    for (int i = 0; i < size; ++i) {
+        emit_byte(e, (unsigned char)((unsigned long long)value >> (8 * i)));
+    }
+}
+
+static bool fits_in_byte(long long value) {
+    return value >= -128 && value <= 127;
+}
+
+static void add_reloc(x86_object* obj, object_section section, size_t offset, const char* symbol,
+                      reloc_type type, long long addend) {
+    if (obj->num_relocs == obj->max_relocs) {
+        obj->max_relocs = obj->max_relocs ? obj->max_relocs * 2 : 16;
+        obj->relocs = realloc(obj->relocs, obj->max_relocs * sizeof(object_reloc));
+    }
+    object_reloc* reloc = &obj->relocs[obj->num_relocs++];
+    reloc->section = section;
+    reloc->offset = offset;
+    reloc->symbol = symbol;
+    reloc->type = type;
+    reloc->addend = addend;
+}
+
+static void add_symbol(x86_object* obj, const char* name, object_section section, size_t offset, size_t size,
+                       bool is_function) {
+    obj->symbols = realloc(obj->symbols, (obj->num_symbols + 1) * sizeof(object_symbol));
+    object_symbol* sym = &obj->symbols[obj->num_symbols++];
+    sym->name = name;
+    sym->section = section;
+    sym->offset = offset;
+    sym->size = size;
+    sym->is_function = is_function;
+}
+
+static void emit_label_offset(encoder* e, int label, int base) {
+    if (e->num_fixups == e->max_fixups) {
+        e->max_fixups = e->max_fixups ? e->max_fixups * 2 : 16;
+        e->fixups = realloc(e->fixups, e->max_fixups * sizeof(label_fixup));
+    }
+    e->fixups[e->num_fixups].offset = e->text->length;
+    e->fixups[e->num_fixups].label = label;
+    e->fixups[e->num_fixups].base = base;
+    e->num_fixups++;
+    emit_u32(e, 0);
+}
+
+static void emit_label_ref(encoder* e, int label) {
+    emit_label_offset(e, label, -1);
+}
+
+static bool is_byte_reg_needing_rex(x86_operand operand) {
+    return operand.kind == OPERAND_REG && operand.size == 1 && operand.reg >= REG_RSP && operand.reg <= REG_RDI;
+}
+
+// The r/m operand's register, or its base register for memory.
+static int rm_reg(x86_operand rm) {
+    return (rm.kind == OPERAND_REG || rm.kind == OPERAND_MEM || rm.kind == OPERAND_VEC) ? rm.reg : 0;
+}
+
+static int rm_index(x86_operand rm) {
+    return rm.kind == OPERAND_MEM && rm.scale != 0 ? rm.index : 0;
+}
+
+static int scale_bits(int scale) {
+    return scale == 8 ? 3 : scale == 4 ? 2 : scale == 2 ? 1 : 0;
+}
+
+// Emits ModRM [SIB] [disp] for an r/m operand that is a register, a base +
+// displacement or base + index * scale memory reference or a %rip-relative
+// symbol or label. trailing_bytes is the size of any immediate that follows, which
+// %rip-relative relocations have to account for.
+static void emit_modrm(encoder* e, int reg_field, x86_operand rm, int trailing_bytes) {
+    int reg_bits = (reg_field & 7) << 3;
+    switch (rm.kind) {
+        case OPERAND_REG:
+        case OPERAND_VEC:
+            emit_byte(e, (unsigned char)(0xC0 | reg_bits | (rm.reg & 7)));
+            break;
+        case OPERAND_MEM: {
+            int base = rm.reg & 7;
+            bool needs_sib = base == (REG_RSP & 7) || rm.scale != 0;
+            int rm_bits = needs_sib ? 4 : base;
+            unsigned char sib = 0x24;
+            if (rm.scale != 0) {
+                sib = (unsigned char)((scale_bits(rm.scale) << 6) | ((rm.index & 7) << 3) | base);
+            }
+            if (rm.imm == 0 && base != (REG_RBP & 7)) {
+                emit_byte(e, (unsigned char)(0x00 | reg_bits | rm_bits));
+                if (needs_sib) {
+                    emit_byte(e, sib);
+                }
+            } else if (fits_in_byte(rm.imm)) {
+                emit_byte(e, (unsigned char)(0x40 | reg_bits | rm_bits));
+                if (needs_sib) {
+                    emit_byte(e, sib);
+                }
+                emit_byte(e, (unsigned char)rm.imm);
+            } else {
+                emit_byte(e, (unsigned char)(0x80 | reg_bits | rm_bits));
+                if (needs_sib) {
+                    emit_byte(e, sib);
+                }
+                emit_u32(e, (unsigned int)rm.imm);
+            }
+            break;
+        }
+        case OPERAND_SYMBOL:
+            emit_byte(e, (unsigned char)(0x05 | reg_bits));
+            add_reloc(e->obj, SECTION_TEXT, e->text->length, rm.symbol, RELOC_PC32, -4 - trailing_bytes);
+            emit_u32(e, 0);
+            break;
+        case OPERAND_LABEL:
+            if (trailing_bytes != 0) {
+                fatal_error("Error: label operand followed by an immediate\n");
+            }
+            emit_byte(e, (unsigned char)(0x05 | reg_bits));
+            emit_label_ref(e, (int)rm.imm);
+            break;
+        default:
+            fatal_error("Error: invalid r/m operand kind %d\n", rm.kind);
+    }
+}
+
+// Emits [REX] opcode ModRM [SIB] [disp].
+static void emit_modrm_inst(encoder* e, bool rex_w, const unsigned char* opcode, int opcode_length,
+                            x86_operand reg, int reg_field, x86_operand rm, int trailing_bytes) {
+    unsigned char rex = 0x40;
+    if (rex_w) {
+        rex |= 0x08;
+    }
+    if (reg_field >= 8) {
+        rex |= 0x04;
+    }
+    if (rm_index(rm) >= 8) {
+        rex |= 0x02;
+    }
+    if (rm_reg(rm) >= 8) {
+        rex |= 0x01;
+    }
+    if (rex != 0x40 || is_byte_reg_needing_rex(reg) || is_byte_reg_needing_rex(rm)) {
+        emit_byte(e, rex);
+    }
+
+    for (int i = 0; i < opcode_length; ++i) {
+        emit_byte(e, opcode[i]);
+    }
+    emit_modrm(e, reg_field, rm, trailing_bytes);
+}
+
+// Legacy SSE: the mandatory prefix goes before any REX.
+static void emit_sse_inst(encoder* e, unsigned char prefix, const unsigned char* opcode, int opcode_length,
+                          int reg_field, x86_operand rm, int trailing_bytes) {
+    emit_byte(e, prefix);
+    emit_modrm_inst(e, false, opcode, opcode_length, x86_none(), reg_field, rm, trailing_bytes);
+}
+
+// Three-byte VEX: map is 1 for 0F and 2 for 0F38, pp encodes the implied
+// prefix (1 for 66, 2 for F3) and vvvv names the first source register.
+static void emit_vex_inst(encoder* e, int map, int pp, int vvvv, unsigned char opcode, int reg_field,
+                          x86_operand rm, int trailing_bytes) {
+    emit_byte(e, 0xC4);
+    emit_byte(e, (unsigned char)((reg_field >= 8 ? 0 : 0x80) | (rm_index(rm) >= 8 ? 0 : 0x40) |
+                                 (rm_reg(rm) >= 8 ? 0 : 0x20) | map));
+    emit_byte(e, (unsigned char)((~vvvv & 15) << 3 | 0x04 | pp));
+    emit_byte(e, opcode);
+    emit_modrm(e, reg_field, rm, trailing_bytes);
+}
+
+// movdqu and the lanewise arithmetic: 66 0F op for SSE2, or the VEX.256
+// form when the operands are 32 bytes. A store reverses the operands.
+static void encode_vector(encoder* e, x86_inst* inst, int map, unsigned char opcode) {
+    bool is_store = inst->op == X86_MOVDQU && inst->dst.kind != OPERAND_VEC;
+    x86_operand reg = is_store ? inst->src : inst->dst;
+    x86_operand rm = is_store ? inst->dst : inst->src;
+    if (inst->op == X86_MOVDQU) {
+        opcode = is_store ? 0x7F : 0x6F;
+    }
+    int pp = inst->op == X86_MOVDQU ? 2 : 1;
+    if (reg.size == 32) {
+        // movdqu has no first source; vvvv must then be all ones.
+        int vvvv = inst->op == X86_MOVDQU ? 0 : reg.reg;
+        emit_vex_inst(e, map, pp, vvvv, opcode, reg.reg, rm, 0);
+        return;
+    }
+    unsigned char bytes[3] = { 0x0F, opcode, 0 };
+    if (map == 2) {
+        bytes[1] = 0x38;
+        bytes[2] = opcode;
+    }
+    emit_sse_inst(e, pp == 2 ? 0xF3 : 0x66, bytes, map == 2 ? 3 : 2, reg.reg, rm, 0);
+}
+
+// psllq/psrlq by an immediate: 66 0F 73 /digit ib.
+static void encode_vector_shift(encoder* e, x86_inst* inst, int digit) {
+    unsigned char opcode[2] = { 0x0F, 0x73 };
+    emit_sse_inst(e, 0x66, opcode, 2, digit, inst->dst, 1);
+    emit_imm(e, inst->src.imm, 1);
+}
+
+static void emit_modrm_digit(encoder* e, bool rex_w, const unsigned char* opcode, int opcode_length,
+                             int digit, x86_operand rm, int trailing_bytes) {
+    emit_modrm_inst(e, rex_w, opcode, opcode_length, x86_none(), digit, rm, trailing_bytes);
+}
+
+static bool is_memory(x86_operand operand) {
+    return operand.kind == OPERAND_MEM || operand.kind == OPERAND_SYMBOL;
+}
+
+static void encode_mov(encoder* e, x86_inst* inst) {
+    x86_operand dst = inst->dst;
+    x86_operand src = inst->src;
+    int size = dst.size;
+    bool rex_w = size == 8;
+
+    if (src.kind == OPERAND_IMM) {
+        if (dst.kind == OPERAND_REG && size != 8) {
+            int imm_size = size == 1 ? 1 : 4;
+            if (dst.reg >= 8) {
+                emit_byte(e, 0x41);
+            } else if (is_byte_reg_needing_rex(dst)) {
+                emit_byte(e, 0x40);
+            }
+            emit_byte(e, (unsigned char)((size == 1 ? 0xB0 : 0xB8) + (dst.reg & 7)));
+            emit_imm(e, src.imm, imm_size);
+            return;
+        }
+        int imm_size = size == 1 ? 1 : 4;
+        unsigned char opcode = size == 1 ? 0xC6 : 0xC7;
+        emit_modrm_digit(e, rex_w, &opcode, 1, 0, dst, imm_size);
+        emit_imm(e, src.imm, imm_size);
+        return;
+    }
+
+    if (is_memory(src)) {
+        unsigned char opcode = size == 1 ? 0x8A : 0x8B;
+        emit_modrm_inst(e, rex_w, &opcode, 1, dst, dst.reg, src, 0);
+    } else {
+        unsigned char opcode = size == 1 ? 0x88 : 0x89;
+        emit_modrm_inst(e, rex_w, &opcode, 1, src, src.reg, dst, 0);
+    }
+}
+
+static void encode_extend(encoder* e, x86_inst* inst) {
+    bool rex_w = inst->dst.size == 8;
+    if (inst->op == X86_MOVSX && inst->src.size == 4) {
+        unsigned char opcode = 0x63;
+        emit_modrm_inst(e, rex_w, &opcode, 1, inst->dst, inst->dst.reg, inst->src, 0);
+        return;
+    }
+    unsigned char opcode[2] = { 0x0F, 0 };
+    if (inst->op == X86_MOVSX) {
+        opcode[1] = inst->src.size == 1 ? 0xBE : 0xBF;
+    } else {
+        opcode[1] = inst->src.size == 1 ? 0xB6 : 0xB7;
+    }
+    emit_modrm_inst(e, rex_w, opcode, 2, inst->dst, inst->dst.reg, inst->src, 0);
+}
+
+// add/sub/xor/cmp share the classic ALU encoding: base opcode plus /digit forms.
+static void encode_alu(encoder* e, x86_inst* inst, unsigned char base, int digit) {
+    x86_operand dst = inst->dst;
+    x86_operand src = inst->src;
+    int size = dst.size;
+    bool rex_w = size == 8;
+
+    if (src.kind == OPERAND_IMM) {
+        if (size == 1) {
+            unsigned char opcode = 0x80;
+            emit_modrm_digit(e, rex_w, &opcode, 1, digit, dst, 1);
+            emit_imm(e, src.imm, 1);
+        } else if (fits_in_byte(src.imm)) {
+            unsigned char opcode = 0x83;
+            emit_modrm_digit(e, rex_w, &opcode, 1, digit, dst, 1);
+            emit_imm(e, src.imm, 1);
+        } else {
+            unsigned char opcode = 0x81;
+            emit_modrm_digit(e, rex_w, &opcode, 1, digit, dst, 4);
+            emit_imm(e, src.imm, 4);
+        }
+        return;
+    }
+
+    if (is_memory(src)) {
+        unsigned char opcode = (unsigned char)(base + (size == 1 ? 2 : 3));
+        emit_modrm_inst(e, rex_w, &opcode, 1, dst, dst.reg, src, 0);
+    } else {
+        unsigned char opcode = (unsigned char)(base + (size == 1 ? 0 : 1));
+        emit_modrm_inst(e, rex_w, &opcode, 1, src, src.reg, dst, 0);
+    }
+}
+
+static void encode_imul(encoder* e, x86_inst* inst) {
+    bool rex_w = inst->dst.size == 8;
+    if (inst->src.kind == OPERAND_IMM) {
+        if (fits_in_byte(inst->src.imm)) {
+            unsigned char opcode = 0x6B;
+            emit_modrm_inst(e, rex_w, &opcode, 1, inst->dst, inst->dst.reg, inst->dst, 1);
+            emit_imm(e, inst->src.imm, 1);
+        } else {
+            unsigned char opcode = 0x69;
+            emit_modrm_inst(e, rex_w, &opcode, 1, inst->dst, inst->dst.reg, inst->dst, 4);
+            emit_imm(e, inst->src.imm, 4);
+        }
+        return;
+    }
+    unsigned char opcode[2] = { 0x0F, 0xAF };
+    emit_modrm_inst(e, rex_w, opcode, 2, inst->dst, inst->dst.reg, inst->src, 0);
+}
+
+// shl/shr/sar: C1 /digit ib by an immediate, D3 /digit by %cl.
+static void encode_shift(encoder* e, x86_inst* inst, int digit) {
+    bool rex_w = inst->dst.size == 8;
+    if (inst->src.kind == OPERAND_IMM) {
+        unsigned char opcode = 0xC1;
+        emit_modrm_digit(e, rex_w, &opcode, 1, digit, inst->dst, 1);
+        emit_imm(e, inst->src.imm, 1);
+        return;
+    }
+    unsigned char opcode = 0xD3;
+    emit_modrm_digit(e, rex_w, &opcode, 1, digit, inst->dst, 0);
+}
+
+static void encode_push_pop(encoder* e, x86_operand reg, unsigned char base) {
+    if (reg.reg >= 8) {
+        emit_byte(e, 0x41);
+    }
+    emit_byte(e, (unsigned char)(base + (reg.reg & 7)));
+}
+
+static void encode_inst(encoder* e, x86_inst* inst) {
+    switch (inst->op) {
+        case X86_LABEL:
+            e->label_offsets[inst->dst.imm] = e->text->length;
+            break;
+        case X86_MOV:
+            encode_mov(e, inst);
+            break;
+        case X86_MOVSX:
+        case X86_MOVZX:
+            encode_extend(e, inst);
+            break;
+        case X86_ADD:
+            encode_alu(e, inst, 0x00, 0);
+            break;
+        case X86_SUB:
+            encode_alu(e, inst, 0x28, 5);
+            break;
+        case X86_XOR:
+            encode_alu(e, inst, 0x30, 6);
+            break;
+        case X86_CMP:
+            encode_alu(e, inst, 0x38, 7);
+            break;
+        case X86_IMUL:
+            encode_imul(e, inst);
+            break;
+        case X86_BT: {
+            unsigned char opcode[2] = { 0x0F, 0xA3 };
+            emit_modrm_inst(e, inst->dst.size == 8, opcode, 2, inst->src, inst->src.reg, inst->dst, 0);
+            break;
+        }
+        case X86_IDIV: {
+            unsigned char opcode = inst->dst.size == 1 ? 0xF6 : 0xF7;
+            emit_modrm_digit(e, inst->dst.size == 8, &opcode, 1, 7, inst->dst, 0);
+            break;
+        }
+        case X86_NEG: {
+            unsigned char opcode = inst->dst.size == 1 ? 0xF6 : 0xF7;
+            emit_modrm_digit(e, inst->dst.size == 8, &opcode, 1, 3, inst->dst, 0);
+            break;
+        }
+        case X86_SHL:
+            encode_shift(e, inst, 4);
+            break;
+        case X86_SHR:
+            encode_shift(e, inst, 5);
+            break;
+        case X86_SAR:
+            encode_shift(e, inst, 7);
+            break;
+        case X86_CDQ:
+            if (inst->dst.size == 8) {
+                emit_byte(e, 0x48);
+            }
+            emit_byte(e, 0x99);
+            break;
+        case X86_SETCC: {
+            unsigned char opcode[2] = { 0x0F, (unsigned char)(0x90 | inst->cond) };
+            emit_modrm_digit(e, false, opcode, 2, 0, inst->dst, 0);
+            break;
+        }
+        case X86_JMP:
+            if (inst->dst.kind == OPERAND_REG) {
+                unsigned char opcode = 0xFF;
+                emit_modrm_digit(e, false, &opcode, 1, 4, inst->dst, 0);
+                break;
+            }
+            emit_byte(e, 0xE9);
+            if (inst->dst.kind == OPERAND_SYMBOL) {
+                add_reloc(e->obj, SECTION_TEXT, e->text->length, inst->dst.symbol, RELOC_PLT32, -4);
+                emit_u32(e, 0);
+                break;
+            }
+            emit_label_ref(e, (int)inst->dst.imm);
+            break;
+        case X86_JCC:
+            emit_byte(e, 0x0F);
+            emit_byte(e, (unsigned char)(0x80 | inst->cond));
+            emit_label_ref(e, (int)inst->dst.imm);
+            break;
+        case X86_PUSH:
+            encode_push_pop(e, inst->dst, 0x50);
+            break;
+        case X86_POP:
+            encode_push_pop(e, inst->dst, 0x58);
+            break;
+        case X86_CALL:
+            emit_byte(e, 0xE8);
+            add_reloc(e->obj, SECTION_TEXT, e->text->length, inst->dst.symbol, RELOC_PLT32, -4);
+            emit_u32(e, 0);
+            break;
+        case X86_RET:
+            emit_byte(e, 0xC3);
+            break;
+        case X86_LEA: {
+            unsigned char opcode = 0x8D;
+            emit_modrm_inst(e, inst->dst.size == 8, &opcode, 1, inst->dst, inst->dst.reg, inst->src, 0);
+            break;
+        }
+        case X86_TABLE_ENTRY:
+            emit_label_offset(e, (int)inst->dst.imm, (int)inst->src.imm);
+            break;
+        case X86_MOVDQU:
+            encode_vector(e, inst, 1, 0);
+            break;
+        case X86_PADDD:
+            encode_vector(e, inst, 1, 0xFE);
+            break;
+        case X86_PSUBD:
+            encode_vector(e, inst, 1, 0xFA);
+            break;
+        case X86_PMULLD:
+            encode_vector(e, inst, 2, 0x40);
+            break;
+        case X86_PMULUDQ:
+            encode_vector(e, inst, 1, 0xF4);
+            break;
+        case X86_PSLLQ:
+            encode_vector_shift(e, inst, 6);
+            break;
+        case X86_PSRLQ:
+            encode_vector_shift(e, inst, 2);
+            break;
+        case X86_POR:
+            encode_vector(e, inst, 1, 0xEB);
+            break;
+        case X86_VZEROUPPER:
+            emit_byte(e, 0xC5);
+            emit_byte(e, 0xF8);
+            emit_byte(e, 0x77);
+            break;
+    }
+}
+
+void encode_x86_function(x86_object* obj, x86_function* fn) {
+    encoder e = { obj, &obj->sections[SECTION_TEXT], NULL, NULL, 0, 0 };
+    e.label_offsets = malloc((fn->num_labels + 1) * sizeof(size_t));
+
+    // Keep function entries 16-byte aligned, padding with int3.
+    while (e.text->length % 16 != 0) {
+        emit_byte(&e, 0xCC);
+    }
+
+    size_t start = e.text->length;
+    for (size_t i = 0; i < fn->num_insts; ++i) {
+        encode_inst(&e, &fn->insts[i]);
+    }
+
+    for (size_t i = 0; i < e.num_fixups; ++i) {
+        label_fixup* fixup = &e.fixups[i];
+        size_t origin = fixup->base >= 0 ? e.label_offsets[fixup->base] : fixup->offset + 4;
+        long long rel = (long long)e.label_offsets[fixup->label] - (long long)origin;
+        unsigned int value = (unsigned int)rel;
+        memcpy(e.text->data + fixup->offset, &value, 4);
+    }
+
+    add_symbol(obj, fn->name, SECTION_TEXT, start, e.text->length - start, true);
+
+    free(e.label_offsets);
+    free(e.fixups);
+}
+
+x86_object* encode_x86_module(x86_module* m) {
+    x86_object* obj = malloc(sizeof(x86_object));
+    for (int i = 0; i < NUM_SECTIONS; ++i) {
+        obj->sections[i] = init_buffer(0);
+    }
+    obj->symbols = NULL;
+    obj->num_symbols = 0;
+    obj->relocs = NULL;
+    obj->num_relocs = 0;
+    obj->max_relocs = 0;
+
+    for (size_t i = 0; i < m->num_globals; ++i) {
+        x86_global* global = &m->globals[i];
+        buffer* section = &obj->sections[global->is_const ? SECTION_RODATA : SECTION_DATA];
+        // Arrays are aligned for vector loads and stores.
+        size_t align = global->length > 0 ? 16 : (size_t)global->size;
+        while (section->length % align != 0) {
+            buffer_putc(section, 0);
+        }
+        if (global->length > 0) {
+            size_t size = global->length * (size_t)global->size;
+            add_symbol(obj, global->name, global->is_const ? SECTION_RODATA : SECTION_DATA, section->length, size,
+                       false);
+            for (size_t j = 0; j < size; ++j) {
+                buffer_putc(section, 0);
+            }
+            continue;
+        }
+        add_symbol(obj, global->name, global->is_const ? SECTION_RODATA : SECTION_DATA, section->length,
+                   global->size, false);
+        unsigned long long value = (unsigned long long)global->value;
+        for (int j = 0; j < global->size; ++j) {
+            buffer_putc(section, (char)(value >> (8 * j)));
+        }
+    }
+
+    for (size_t i = 0; i < m->num_functions; ++i) {
+        encode_x86_function(obj, m->functions[i]);
+    }
+
+    return obj;
+}
+
+object_symbol* find_object_symbol(x86_object* obj, const char* name) {
+    for (size_t i = 0; i < obj->num_symbols; ++i) {
+        if (strcmp(obj->symbols[i].name, name) == 0) {
+            return &obj->symbols[i];
+        }
+    }
+    return NULL;
+}
+
+void free_x86_object(x86_object* obj) {
+    for (int i = 0; i < NUM_SECTIONS; ++i) {
+        free_buffer(&obj->sections[i]);
+    }
+    free(obj->symbols);
+    free(obj->relocs);
+    free(obj);
+}
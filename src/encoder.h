@@ -0,0 +1,51 @@
+#ifndef ENCODER_H
+#define ENCODER_H
+
+#include "x86.h"
+#include "buffer.h"
+
+typedef enum {
+    SECTION_TEXT,
+    SECTION_DATA,
+    SECTION_RODATA,
+    NUM_SECTIONS,
+} object_section;
+
+typedef enum {
+    RELOC_PC32,         // S + A - P, %rip-relative data access
+    RELOC_PLT32,        // L + A - P, call through the PLT if needed
+} reloc_type;
+
+typedef struct object_reloc {
+    object_section section;
+    size_t offset;
+    const char* symbol;
+    reloc_type type;
+    long long addend;
+} object_reloc;
+
+typedef struct object_symbol {
+    const char* name;
+    object_section section;
+    size_t offset;
+    size_t size;
+    bool is_function;
+} object_symbol;
+
+// Machine code and data for one module, plus everything a linker (or the JIT)
+// needs to place it: symbol definitions and unresolved references.
+typedef struct x86_object {
+    buffer sections[NUM_SECTIONS];
+    object_symbol* symbols;
+    size_t num_symbols;
+    object_reloc* relocs;
+    size_t num_relocs;
+    size_t max_relocs;
+} x86_object;
+
+x86_object* encode_x86_module(x86_module* m);
+void encode_x86_function(x86_object* obj, x86_function* fn);
+object_symbol* find_object_symbol(x86_object* obj, const char* name);
+void free_x86_object(x86_object* obj);
+
+#endif // ENCODER_H
@@ -0,0 +1,411 @@
+#include "fold.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FOLD_MAX_ROUNDS 8
+
+// dst of an instruction that dead code removal is about to drop.
+#define DEAD (-2)
+
+// What is known about a vreg at the current point of the block being
+// folded. A fact only holds while its stamp matches the block, so moving on
+// to the next block forgets everything without clearing the array. A copy
+// is only good while its source still has the version it had then.
+typedef struct vreg_fact {
+    int stamp;
+    bool is_constant;
+    int value;
+    int copy_of;
+    int copy_version;
+} vreg_fact;
+
+typedef struct folder {
+    sir_program* program;
+    sir_function* fn;
+    vreg_fact* facts;
+    int* versions;
+    int* uses;
+    int stamp;
+    bool changed;
+} folder;
+
+static vreg_fact* define(folder* f, int dst) {
+    vreg_fact* fact = &f->facts[dst];
+    f->versions[dst]++;
+    fact->stamp = f->stamp;
+    fact->is_constant = false;
+    fact->copy_of = -1;
+    return fact;
+}
+
+static void define_constant(folder* f, int dst, int value) {
+    vreg_fact* fact = define(f, dst);
+    fact->is_constant = true;
+    fact->value = sir_truncate(value, f->fn->vregs[dst].size);
+}
+
+// A byte copy of a wider vreg truncates, so it is not the same value.
+static void define_copy(folder* f, int dst, int src) {
+    vreg_fact* fact = define(f, dst);
+    if (dst != src && (f->fn->vregs[dst].size >= f->fn->vregs[src].size)) {
+        fact->copy_of = src;
+        fact->copy_version = f->versions[src];
+    }
+}
+
+static void substitute(folder* f, sir_operand* operand) {
+    if (operand->kind != SIR_OPERAND_VREG) {
+        return;
+    }
+    vreg_fact* fact = &f->facts[operand->vreg];
+    if (fact->stamp != f->stamp) {
+        return;
+    }
+    if (fact->is_constant) {
+        *operand = sir_imm_operand(fact->value);
+        f->changed = true;
+    } else if (fact->copy_of >= 0 && f->versions[fact->copy_of] == fact->copy_version) {
+        operand->vreg = fact->copy_of;
+        f->changed = true;
+    }
+}
+
+// Arithmetic wraps like the machine does. Division that would trap is left
+// for run time.
+static bool evaluate(sir_opcode op, int a, int b, int* result) {
+    unsigned int ua = (unsigned int)a;
+    unsigned int ub = (unsigned int)b;
+    switch (op) {
+        case SIR_ADD: *result = (int)(ua + ub); return true;
+        case SIR_SUB: *result = (int)(ua - ub); return true;
+        case SIR_MUL: *result = (int)(ua * ub); return true;
+        case SIR_DIV:
+        case SIR_MOD:
+            if (b == 0 || (b == -1 && a == INT_MIN)) {
+                return false;
+            }
+            *result = op == SIR_DIV ? a / b : a % b;
+            return true;
+        case SIR_SHL:
+        case SIR_SAR:
+        case SIR_SHR:
+            if (ub >= 32) {
+                return false;
+            }
+            *result = op == SIR_SHL ? (int)(ua << ub) : op == SIR_SAR ? a >> ub : (int)(ua >> ub);
+            return true;
+        case SIR_MUL_HIGH: *result = (int)(((long long)a * b) >> 32); return true;
+        case SIR_EQ: *result = a == b; return true;
+        case SIR_NE: *result = a != b; return true;
+        case SIR_LT: *result = a < b; return true;
+        case SIR_LE: *result = a <= b; return true;
+        case SIR_GT: *result = a > b; return true;
+        case SIR_GE: *result = a >= b; return true;
+        case SIR_ULT: *result = ua < ub; return true;
+        case SIR_BIT_TEST:
+            if (ua >= 32) {
+                return false;
+            }
+            *result = (int)((ub >> ua) & 1);
+            return true;
+        case SIR_NEG: *result = (int)(0u - ua); return true;
+        case SIR_NOT: *result = !a; return true;
+        default: return false;
+    }
+}
+
+static void make_copy(sir_inst* inst, int value) {
+    inst->op = SIR_COPY;
+    inst->a = sir_imm_operand(value);
+    inst->b = sir_none();
+    inst->symbol = NULL;
+}
+
+// Returns false when the instruction can be dropped.
+static bool fold_inst(folder* f, sir_inst* inst) {
+    substitute(f, &inst->a);
+    substitute(f, &inst->b);
+    for (size_t i = 0; i < inst->num_args; ++i) {
+        substitute(f, &inst->args[i]);
+    }
+
+    int value;
+    switch (inst->op) {
+        case SIR_COPY:
+            if (inst->a.kind == SIR_OPERAND_IMM) {
+                define_constant(f, inst->dst, inst->a.imm);
+            } else if (inst->a.vreg == inst->dst) {
+                f->changed = true;
+                return false;
+            } else {
+                define_copy(f, inst->dst, inst->a.vreg);
+            }
+            return true;
+        case SIR_LOAD_GLOBAL: {
+            sir_global* global = find_sir_global(f->program, inst->symbol);
+            if (global != NULL && global->is_const) {
+                make_copy(inst, sir_truncate((int)global->value, global->size));
+                define_constant(f, inst->dst, inst->a.imm);
+                f->changed = true;
+            } else {
+                define(f, inst->dst);
+            }
+            return true;
+        }
+        case SIR_ADD:
+        case SIR_SUB:
+        case SIR_MUL:
+        case SIR_DIV:
+        case SIR_MOD:
+        case SIR_SHL:
+        case SIR_SAR:
+        case SIR_SHR:
+        case SIR_MUL_HIGH:
+        case SIR_EQ:
+        case SIR_NE:
+        case SIR_LT:
+        case SIR_LE:
+        case SIR_GT:
+        case SIR_GE:
+        case SIR_ULT:
+        case SIR_BIT_TEST:
+            if (inst->a.kind == SIR_OPERAND_IMM && inst->b.kind == SIR_OPERAND_IMM &&
+                evaluate(inst->op, inst->a.imm, inst->b.imm, &value)) {
+                make_copy(inst, value);
+                define_constant(f, inst->dst, value);
+                f->changed = true;
+            } else {
+                define(f, inst->dst);
+            }
+            return true;
+        case SIR_NEG:
+        case SIR_NOT:
+            if (inst->a.kind == SIR_OPERAND_IMM && evaluate(inst->op, inst->a.imm, 0, &value)) {
+                make_copy(inst, value);
+                define_constant(f, inst->dst, value);
+                f->changed = true;
+            } else {
+                define(f, inst->dst);
+            }
+            return true;
+        case SIR_LOAD_ELEM:
+        case SIR_VLOAD:
+        case SIR_VSPLAT:
+        case SIR_VADD:
+        case SIR_VSUB:
+        case SIR_VMUL:
+        case SIR_VSUM:
+            define(f, inst->dst);
+            return true;
+        case SIR_CALL:
+            if (inst->dst >= 0) {
+                define(f, inst->dst);
+            }
+            return true;
+        case SIR_BRANCH:
+            if (inst->a.kind == SIR_OPERAND_IMM || inst->target == inst->other) {
+                inst->op = SIR_JUMP;
+                if (inst->a.kind == SIR_OPERAND_IMM && inst->a.imm == 0) {
+                    inst->target = inst->other;
+                }
+                inst->other = NULL;
+                inst->a = sir_none();
+                f->changed = true;
+            }
+            return true;
+        case SIR_JUMP_TABLE:
+            if (inst->a.kind == SIR_OPERAND_IMM && (unsigned int)inst->a.imm < inst->table_size) {
+                inst->op = SIR_JUMP;
+                inst->target = inst->table[inst->a.imm];
+                inst->a = sir_none();
+                free(inst->table);
+                inst->table = NULL;
+                inst->table_size = 0;
+                f->changed = true;
+            }
+            return true;
+        default:
+            return true;
+    }
+}
+
+static void fold_blocks(folder* f) {
+    for (size_t i = 0; i < f->fn->num_blocks; ++i) {
+        sir_block* block = f->fn->blocks[i];
+        f->stamp++;
+        size_t kept = 0;
+        for (size_t j = 0; j < block->num_insts; ++j) {
+            if (fold_inst(f, &block->insts[j])) {
+                block->insts[kept++] = block->insts[j];
+            } else {
+                free(block->insts[j].args);
+                free(block->insts[j].table);
+            }
+        }
+        block->num_insts = kept;
+    }
+}
+
+static void count_use(folder* f, sir_operand operand, int delta) {
+    if (operand.kind == SIR_OPERAND_VREG) {
+        f->uses[operand.vreg] += delta;
+    }
+}
+
+static void count_uses(folder* f, sir_inst* inst, int delta) {
+    count_use(f, inst->a, delta);
+    count_use(f, inst->b, delta);
+    for (size_t i = 0; i < inst->num_args; ++i) {
+        count_use(f, inst->args[i], delta);
+    }
+}
+
+// Walking each block backwards lets a chain of dead temporaries go in one
+// sweep: dropping a use can kill the definition just before it.
+static void remove_dead_code(folder* f) {
+    memset(f->uses, 0, f->fn->num_vregs * sizeof(int));
+    for (size_t i = 0; i < f->fn->num_blocks; ++i) {
+        sir_block* block = f->fn->blocks[i];
+        for (size_t j = 0; j < block->num_insts; ++j) {
+            count_uses(f, &block->insts[j], 1);
+        }
+    }
+    for (size_t i = 0; i < f->fn->num_blocks; ++i) {
+        sir_block* block = f->fn->blocks[i];
+        bool any_dead = false;
+        for (size_t j = block->num_insts; j > 0; --j) {
+            sir_inst* inst = &block->insts[j - 1];
+            if (inst->dst >= 0 && f->uses[inst->dst] == 0 && !sir_has_side_effects(inst->op)) {
+                count_uses(f, inst, -1);
+                inst->dst = DEAD;
+                any_dead = true;
+            }
+        }
+        if (any_dead) {
+            size_t kept = 0;
+            for (size_t j = 0; j < block->num_insts; ++j) {
+                if (block->insts[j].dst != DEAD) {
+                    block->insts[kept++] = block->insts[j];
+                }
+            }
+            block->num_insts = kept;
+            f->changed = true;
+        }
+    }
+}
+
+static void mark_reachable(sir_function* fn, bool* reachable) {
+    sir_block** stack = malloc(fn->num_blocks * sizeof(sir_block*));
+    size_t depth = 0;
+    stack[depth++] = fn->blocks[0];
+    reachable[0] = true;
+    while (depth > 0) {
+        sir_inst* term = sir_terminator(stack[--depth]);
+        size_t count = term ? sir_num_successors(term) : 0;
+        for (size_t k = 0; k < count; ++k) {
+            sir_block* successor = *sir_successor(term, k);
+            if (!reachable[successor->index]) {
+                reachable[successor->index] = true;
+                stack[depth++] = successor;
+            }
+        }
+    }
+    free(stack);
+}
+
+// A block that only jumps on can be skipped by whoever jumps to it.
+static sir_block* skip_empty(sir_block* block) {
+    for (int hops = 0; hops < 8 && block->num_insts == 1 && block->insts[0].op == SIR_JUMP &&
+                       block->insts[0].target != block; ++hops) {
+        block = block->insts[0].target;
+    }
+    return block;
+}
+
+static void simplify_cfg(folder* f) {
+    sir_function* fn = f->fn;
+    number_sir_blocks(fn);
+    for (size_t i = 0; i < fn->num_blocks; ++i) {
+        sir_inst* term = sir_terminator(fn->blocks[i]);
+        size_t count = term ? sir_num_successors(term) : 0;
+        for (size_t k = 0; k < count; ++k) {
+            sir_block** successor = sir_successor(term, k);
+            sir_block* skipped = skip_empty(*successor);
+            if (skipped != *successor) {
+                *successor = skipped;
+                f->changed = true;
+            }
+        }
+    }
+
+    bool* removed = calloc(fn->num_blocks, sizeof(bool));
+    int* preds = calloc(fn->num_blocks, sizeof(int));
+    mark_reachable(fn, removed);
+    for (size_t i = 0; i < fn->num_blocks; ++i) {
+        removed[i] = !removed[i];
+        f->changed |= removed[i];
+    }
+    for (size_t i = 0; i < fn->num_blocks; ++i) {
+        sir_inst* term = sir_terminator(fn->blocks[i]);
+        size_t count = !removed[i] && term != NULL ? sir_num_successors(term) : 0;
+        for (size_t k = 0; k < count; ++k) {
+            preds[(*sir_successor(term, k))->index]++;
+        }
+    }
+
+    // Fold each block's sole successor into it for as long as there is one.
+    for (size_t i = 0; i < fn->num_blocks; ++i) {
+        sir_block* block = fn->blocks[i];
+        if (removed[i]) {
+            continue;
+        }
+        for (;;) {
+            sir_inst* term = sir_terminator(block);
+            if (term == NULL || term->op != SIR_JUMP) {
+                break;
+            }
+            sir_block* next = term->target;
+            if (next == block || next->index == 0 || preds[next->index] != 1 || removed[next->index]) {
+                break;
+            }
+            block->num_insts--;
+            for (size_t j = 0; j < next->num_insts; ++j) {
+                sir_append(block, next->insts[j]);
+            }
+            next->num_insts = 0;
+            removed[next->index] = true;
+            f->changed = true;
+        }
+    }
+
+    remove_sir_blocks(fn, removed);
+    free(removed);
+    free(preds);
+}
+
+void fold_sir_function(sir_program* program, sir_function* fn) {
+    folder f = { program, fn, NULL, NULL, NULL, 0, false };
+    f.facts = calloc(fn->num_vregs + 1, sizeof(vreg_fact));
+    f.versions = calloc(fn->num_vregs + 1, sizeof(int));
+    f.uses = calloc(fn->num_vregs + 1, sizeof(int));
+    for (int round = 0; round < FOLD_MAX_ROUNDS; ++round) {
+        f.changed = false;
+        simplify_cfg(&f);
+        fold_blocks(&f);
+        remove_dead_code(&f);
+        if (!f.changed) {
+            break;
+        }
+    }
+    free(f.facts);
+    free(f.versions);
+    free(f.uses);
+}
+
+void fold_sir_program(sir_program* program) {
+    for (size_t i = 0; i < program->num_functions; ++i) {
+        fold_sir_function(program, program->functions[i]);
+    }
+}
@@ -0,0 +1,13 @@
+#ifndef FOLD_H
+#define FOLD_H
+
+#include "sir.h"
+
+// Cleans up a function after lowering or inlining: propagates constants and
+// copies within blocks, folds what became constant (const globals
+// included), drops dead instructions and unreachable blocks and merges
+// straight-line chains of blocks. Repeats until nothing changes.
+void fold_sir_function(sir_program* program, sir_function* fn);
+void fold_sir_program(sir_program* program);
+
+#endif // FOLD_H
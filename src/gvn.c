@@ -0,0 +1,345 @@
+#include "gvn.h"
+#include "loops.h"
+#include "hash.h"
+#include "compat.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A constant, or the number of a value known only by name. Numbers of
+// values held by vregs that are defined more than once are local: they
+// are only seen again within the block that made them.
+typedef struct gvn_value {
+    bool is_constant;
+    bool is_local;
+    int number;
+} gvn_value;
+
+typedef struct gvn_key {
+    sir_opcode op;
+    gvn_value a;
+    gvn_value b;
+    const char* symbol;
+    int memory;                 // for loads: the memory state read
+} gvn_key;
+
+// holder had value when the entry was made; the entry is good for as long
+// as it still does.
+typedef struct gvn_entry {
+    gvn_key key;
+    uint64_t hash;
+    int holder;
+    gvn_value value;
+    int next;                   // in the same bucket, -1 at the end
+} gvn_entry;
+
+typedef struct gvn {
+    sir_function* fn;
+    loop_info* info;
+    bool* stable;               // one definition, seen by every use
+    gvn_value* values;
+    int* stamps;                // block a local value was made in
+    int stamp;
+    int next_number;
+    int memory;
+    int* buckets;
+    size_t bucket_mask;
+    gvn_entry* entries;
+    size_t num_entries;
+    size_t eliminated;
+} gvn;
+
+static gvn_value new_value(gvn* g, bool is_local) {
+    gvn_value value = { false, is_local, g->next_number++ };
+    return value;
+}
+
+static gvn_value constant_value(int constant) {
+    gvn_value value = { true, false, constant };
+    return value;
+}
+
+static bool same_value(gvn_value a, gvn_value b) {
+    return a.is_constant == b.is_constant && a.number == b.number;
+}
+
+static gvn_value vreg_value(gvn* g, int vreg) {
+    if (!g->stable[vreg] && g->stamps[vreg] != g->stamp) {
+        g->values[vreg] = new_value(g, true);
+        g->stamps[vreg] = g->stamp;
+    }
+    return g->values[vreg];
+}
+
+static gvn_value operand_value(gvn* g, sir_operand operand) {
+    switch (operand.kind) {
+        case SIR_OPERAND_VREG: return vreg_value(g, operand.vreg);
+        case SIR_OPERAND_IMM: return constant_value(operand.imm);
+        default: return constant_value(0);
+    }
+}
+
+// A byte vreg holds its value truncated, which is a different value. A
+// stable vreg is read in other blocks, so it cannot share a local number.
+static void set_value(gvn* g, int vreg, gvn_value value) {
+    if (g->fn->vregs[vreg].size == 1 && !value.is_constant) {
+        value = new_value(g, !g->stable[vreg]);
+    } else if (value.is_constant) {
+        value.number = sir_truncate(value.number, g->fn->vregs[vreg].size);
+    } else if (g->stable[vreg] && value.is_local) {
+        value = new_value(g, false);
+    }
+    g->values[vreg] = value;
+    g->stamps[vreg] = g->stamp;
+}
+
+static bool is_commutative(sir_opcode op) {
+    return op == SIR_ADD || op == SIR_MUL || op == SIR_MUL_HIGH || op == SIR_EQ || op == SIR_NE;
+}
+
+// Division is numbered too: if the first one did not trap, neither will
+// a repeat of it.
+static bool is_numbered(sir_opcode op) {
+    switch (op) {
+        case SIR_LOAD_GLOBAL:
+        case SIR_LOAD_ELEM:
+        case SIR_ADD:
+        case SIR_SUB:
+        case SIR_MUL:
+        case SIR_DIV:
+        case SIR_MOD:
+        case SIR_SHL:
+        case SIR_SAR:
+        case SIR_SHR:
+        case SIR_MUL_HIGH:
+        case SIR_EQ:
+        case SIR_NE:
+        case SIR_LT:
+        case SIR_LE:
+        case SIR_GT:
+        case SIR_GE:
+        case SIR_ULT:
+        case SIR_BIT_TEST:
+        case SIR_NEG:
+        case SIR_NOT: return true;
+        default: return false;
+    }
+}
+
+static bool writes_memory(sir_opcode op) {
+    return op == SIR_STORE_GLOBAL || op == SIR_STORE_ELEM || op == SIR_VSTORE || op == SIR_CALL;
+}
+
+static bool value_before(gvn_value a, gvn_value b) {
+    return a.is_constant != b.is_constant ? b.is_constant : a.number < b.number;
+}
+
+static gvn_key make_key(gvn* g, sir_inst* inst) {
+    gvn_key key;
+    key.op = inst->op;
+    key.a = operand_value(g, inst->a);
+    key.b = operand_value(g, inst->b);
+    if (is_commutative(inst->op) && value_before(key.b, key.a)) {
+        gvn_value a = key.a;
+        key.a = key.b;
+        key.b = a;
+    }
+    key.symbol = inst->symbol;
+    key.memory = inst->op == SIR_LOAD_GLOBAL || inst->op == SIR_LOAD_ELEM ? g->memory : 0;
+    return key;
+}
+
+static uint64_t hash_value(uint64_t h, gvn_value value) {
+    return hash_combine(h, ((uint64_t)value.is_constant << 32) | (uint32_t)value.number);
+}
+
+static uint64_t hash_key(gvn_key* key) {
+    uint64_t h = hash_combine((uint64_t)key->op, (uint64_t)(uint32_t)key->memory);
+    h = hash_value(h, key->a);
+    h = hash_value(h, key->b);
+    return key->symbol != NULL ? hash_string(key->symbol, h) : h;
+}
+
+static bool same_key(gvn_key* a, gvn_key* b) {
+    return a->op == b->op && a->memory == b->memory && same_value(a->a, b->a) && same_value(a->b, b->b) &&
+           (a->symbol == b->symbol || (a->symbol != NULL && b->symbol != NULL && strcmp(a->symbol, b->symbol) == 0));
+}
+
+static gvn_entry* find_entry(gvn* g, gvn_key* key, uint64_t hash) {
+    for (int e = g->buckets[hash & g->bucket_mask]; e >= 0; e = g->entries[e].next) {
+        gvn_entry* entry = &g->entries[e];
+        if (entry->hash == hash && same_key(&entry->key, key) &&
+            same_value(vreg_value(g, entry->holder), entry->value)) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Entries are only ever added at the head of a bucket and removed in the
+// opposite order, so leaving a dominator subtree just unwinds them.
+static void add_entry(gvn* g, gvn_key* key, uint64_t hash, int holder, gvn_value value) {
+    size_t bucket = hash & g->bucket_mask;
+    gvn_entry* entry = &g->entries[g->num_entries];
+    entry->key = *key;
+    entry->hash = hash;
+    entry->holder = holder;
+    entry->value = value;
+    entry->next = g->buckets[bucket];
+    g->buckets[bucket] = (int)g->num_entries++;
+}
+
+static void remove_entries(gvn* g, size_t mark) {
+    while (g->num_entries > mark) {
+        gvn_entry* entry = &g->entries[--g->num_entries];
+        g->buckets[entry->hash & g->bucket_mask] = entry->next;
+    }
+}
+
+static void number_block(gvn* g, sir_block* block) {
+    g->stamp++;
+    g->memory++;
+    for (size_t i = 0; i < block->num_insts; ++i) {
+        sir_inst* inst = &block->insts[i];
+        if (inst->dst >= 0 && is_numbered(inst->op)) {
+            gvn_key key = make_key(g, inst);
+            uint64_t hash = hash_key(&key);
+            gvn_entry* entry = find_entry(g, &key, hash);
+            if (entry != NULL) {
+                inst->op = SIR_COPY;
+                inst->a = sir_vreg_operand(entry->holder);
+                inst->b = sir_none();
+                inst->symbol = NULL;
+                set_value(g, inst->dst, entry->value);
+                g->eliminated++;
+            } else {
+                set_value(g, inst->dst, new_value(g, !g->stable[inst->dst]));
+                if (g->fn->vregs[inst->dst].size == 4) {
+                    add_entry(g, &key, hash, inst->dst, g->values[inst->dst]);
+                }
+            }
+        } else if (inst->op == SIR_COPY) {
+            set_value(g, inst->dst, operand_value(g, inst->a));
+        } else if (inst->dst >= 0) {
+            set_value(g, inst->dst, new_value(g, !g->stable[inst->dst]));
+        }
+        if (writes_memory(inst->op)) {
+            g->memory++;
+        }
+    }
+}
+
+// Preorder over the dominator tree. A block is pushed again as ~index to
+// mark where its subtree ends.
+static void number_dominator_tree(gvn* g) {
+    sir_function* fn = g->fn;
+    size_t n = fn->num_blocks;
+    int* child_start = calloc(n + 2, sizeof(int));
+    int* children = malloc((n + 1) * sizeof(int));
+    for (size_t i = 0; i < n; ++i) {
+        if (g->info->order_index[i] >= 0 && g->info->idom[i] >= 0) {
+            child_start[g->info->idom[i] + 2]++;
+        }
+    }
+    for (size_t i = 0; i < n; ++i) {
+        child_start[i + 2] += child_start[i + 1];
+    }
+    for (size_t i = 0; i < n; ++i) {
+        if (g->info->order_index[i] >= 0 && g->info->idom[i] >= 0) {
+            children[child_start[g->info->idom[i] + 1]++] = (int)i;
+        }
+    }
+
+    size_t* marks = malloc((n + 1) * sizeof(size_t));
+    int* stack = malloc((2 * n + 1) * sizeof(int));
+    size_t depth = 0;
+    stack[depth++] = 0;
+    while (depth > 0) {
+        int b = stack[--depth];
+        if (b < 0) {
+            remove_entries(g, marks[~b]);
+            continue;
+        }
+        marks[b] = g->num_entries;
+        number_block(g, fn->blocks[b]);
+        stack[depth++] = ~b;
+        for (int k = child_start[b]; k < child_start[b + 1]; ++k) {
+            stack[depth++] = children[k];
+        }
+    }
+    free(stack);
+    free(marks);
+    free(children);
+    free(child_start);
+}
+
+size_t gvn_sir_function(sir_function* fn) {
+    if (fn->num_blocks == 0) {
+        return 0;
+    }
+    gvn g = { 0 };
+    g.fn = fn;
+    g.info = analyze_loops(fn);
+    int* defs = malloc((fn->num_vregs + 1) * sizeof(int));
+    g.stable = malloc((fn->num_vregs + 1) * sizeof(bool));
+    find_definitions(g.info, defs, g.stable);
+    g.values = malloc((fn->num_vregs + 1) * sizeof(gvn_value));
+    g.stamps = calloc(fn->num_vregs + 1, sizeof(int));
+    for (size_t v = 0; v < fn->num_vregs; ++v) {
+        g.stable[v] = g.stable[v] && defs[v] == 1;
+        g.values[v] = new_value(&g, !g.stable[v]);
+    }
+
+    size_t size = sir_function_size(fn);
+    size_t num_buckets = 16;
+    while (num_buckets < 2 * size) {
+        num_buckets *= 2;
+    }
+    g.buckets = malloc(num_buckets * sizeof(int));
+    memset(g.buckets, 0xff, num_buckets * sizeof(int));
+    g.bucket_mask = num_buckets - 1;
+    g.entries = malloc((size + 1) * sizeof(gvn_entry));
+    number_dominator_tree(&g);
+
+    free(g.entries);
+    free(g.buckets);
+    free(g.stamps);
+    free(g.values);
+    free(g.stable);
+    free(defs);
+    free_loop_info(g.info);
+    return g.eliminated;
+}
+
+void add_gvn_function_stats(gvn_stats* stats, const char* name, size_t eliminated) {
+    if (eliminated == 0) {
+        return;
+    }
+    stats->functions = realloc(stats->functions, (stats->num_functions + 1) * sizeof(gvn_function_stats));
+    stats->functions[stats->num_functions].name = _strdup(name);
+    stats->functions[stats->num_functions].eliminated = eliminated;
+    stats->num_functions++;
+    stats->eliminated += eliminated;
+}
+
+void gvn_sir_program(sir_program* program, gvn_stats* stats) {
+    for (size_t i = 0; i < program->num_functions; ++i) {
+        sir_function* fn = program->functions[i];
+        add_gvn_function_stats(stats, fn->name, gvn_sir_function(fn));
+    }
+}
+
+void print_gvn_stats(gvn_stats* stats, buffer* out) {
+    buffer_printf(out, "gvn: %zu instructions eliminated\n", stats->eliminated);
+    for (size_t i = 0; i < stats->num_functions; ++i) {
+        buffer_printf(out, "  %-20s %8zu\n", stats->functions[i].name, stats->functions[i].eliminated);
+    }
+}
+
+void free_gvn_stats(gvn_stats* stats) {
+    for (size_t i = 0; i < stats->num_functions; ++i) {
+        free(stats->functions[i].name);
+    }
+    free(stats->functions);
+}
@@ -0,0 +1,32 @@
+#ifndef GVN_H
+#define GVN_H
+
+#include <stddef.h>
+#include "buffer.h"
+#include "sir.h"
+
+typedef struct gvn_function_stats {
+    char* name;
+    size_t eliminated;
+} gvn_function_stats;
+
+// Functions that had anything eliminated, in program order.
+typedef struct gvn_stats {
+    gvn_function_stats* functions;
+    size_t num_functions;
+    size_t eliminated;
+} gvn_stats;
+
+// Global value numbering. Walks the dominator tree giving every value a
+// number, and an instruction that computes what an earlier one in a
+// dominating position already has (same opcode, same operand numbers, in
+// either order for commutative ones) becomes a copy of it. A vreg defined
+// more than once only keeps its number within a block, and so do loads.
+// Returns the number of instructions replaced; fold removes them.
+size_t gvn_sir_function(sir_function* fn);
+void gvn_sir_program(sir_program* program, gvn_stats* stats);
+void add_gvn_function_stats(gvn_stats* stats, const char* name, size_t eliminated);
+void print_gvn_stats(gvn_stats* stats, buffer* out);
+void free_gvn_stats(gvn_stats* stats);
+
+#endif // GVN_H
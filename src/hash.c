@@ -0,0 +1,46 @@
+#include "hash.h"
+
+#include <string.h>
+
+#define HASH_PRIME_1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME_2 0xC2B2AE3D27D4EB4FULL
+
+static uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// splitmix64 finalizer: every input bit affects every output bit.
+static uint64_t avalanche(uint64_t h) {
+    h ^= h >> 30;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 27;
+    h *= 0x94D049BB133111EBULL;
+    h ^= h >> 31;
+    return h;
+}
+
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed) {
+    const unsigned char* p = data;
+    uint64_t h = seed ^ (size * HASH_PRIME_1);
+
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        h ^= rotl64(word * HASH_PRIME_2, 31) * HASH_PRIME_1;
+        h = rotl64(h, 27) * HASH_PRIME_1 + HASH_PRIME_2;
+        p += 8;
+        size -= 8;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, p, size);
+    h ^= rotl64(tail * HASH_PRIME_2, 31) * HASH_PRIME_1;
+    return avalanche(h);
+}
+
+uint64_t hash_string(const char* str, uint64_t seed) {
+    return hash_bytes(str, strlen(str), seed);
+}
+
+uint64_t hash_combine(uint64_t h, uint64_t value) {
+    return avalanche(h ^ (value + HASH_PRIME_1 + (h << 6) + (h >> 2)));
+}
@@ -0,0 +1,13 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Fast non-cryptographic 64-bit hash. Different seeds give independent
+// hashes of the same bytes.
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed);
+uint64_t hash_string(const char* str, uint64_t seed);
+uint64_t hash_combine(uint64_t h, uint64_t value);
+
+#endif // HASH_H
@@ -0,0 +1,187 @@
+#include "inline.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "callgraph.h"
+#include "fold.h"
+
+static sir_operand remap(sir_operand operand, int base) {
+    if (operand.kind == SIR_OPERAND_VREG) {
+        operand.vreg += base;
+    }
+    return operand;
+}
+
+// Replaces the call at block->insts[index] with a copy of callee's body.
+// The block is split after the call; the arguments are copied into the
+// callee's parameters, each return becomes a copy into the call's dst and a
+// jump to the rest of the block.
+static void inline_call(sir_function* fn, size_t position, size_t index, sir_function* callee) {
+    sir_block* block = fn->blocks[position];
+    sir_inst call = block->insts[index];
+    number_sir_blocks(callee);
+
+    sir_block* rest = insert_sir_block(fn, position + 1);
+    for (size_t j = index + 1; j < block->num_insts; ++j) {
+        sir_append(rest, block->insts[j]);
+    }
+    block->num_insts = index;
+
+    sir_block** clones = malloc(callee->num_blocks * sizeof(sir_block*));
+    for (size_t i = 0; i < callee->num_blocks; ++i) {
+        clones[i] = insert_sir_block(fn, position + 1 + i);
+    }
+
+    int base = (int)fn->num_vregs;
+    for (size_t v = 0; v < callee->num_vregs; ++v) {
+        new_sir_vreg(fn, callee->vregs[v].size, callee->vregs[v].name);
+    }
+    for (size_t i = 0; i < callee->num_params; ++i) {
+        sir_emit(block, SIR_COPY, base + callee->params[i], call.args[i], sir_none());
+    }
+    sir_emit(block, SIR_JUMP, -1, sir_none(), sir_none())->target = clones[0];
+
+    for (size_t i = 0; i < callee->num_blocks; ++i) {
+        sir_block* source = callee->blocks[i];
+        for (size_t j = 0; j < source->num_insts; ++j) {
+            sir_inst inst = source->insts[j];
+            if (inst.op == SIR_RETURN) {
+                if (call.dst >= 0 && inst.a.kind != SIR_OPERAND_NONE) {
+                    sir_emit(clones[i], SIR_COPY, call.dst, remap(inst.a, base), sir_none());
+                }
+                sir_emit(clones[i], SIR_JUMP, -1, sir_none(), sir_none())->target = rest;
+                continue;
+            }
+            if (inst.dst >= 0) {
+                inst.dst += base;
+            }
+            inst.a = remap(inst.a, base);
+            inst.b = remap(inst.b, base);
+            // Every call owns its args, even an empty array.
+            if (inst.args != NULL) {
+                inst.args = malloc((inst.num_args + 1) * sizeof(sir_operand));
+                for (size_t k = 0; k < inst.num_args; ++k) {
+                    inst.args[k] = remap(source->insts[j].args[k], base);
+                }
+            }
+            inst.target = inst.target ? clones[inst.target->index] : NULL;
+            inst.other = inst.other ? clones[inst.other->index] : NULL;
+            if (inst.table_size > 0) {
+                inst.table = malloc(inst.table_size * sizeof(sir_block*));
+                for (size_t k = 0; k < inst.table_size; ++k) {
+                    inst.table[k] = clones[source->insts[j].table[k]->index];
+                }
+            }
+            sir_append(clones[i], inst);
+        }
+    }
+
+    free(clones);
+    free(call.args);
+}
+
+static size_t count_constants(sir_inst* call) {
+    size_t count = 0;
+    for (size_t i = 0; i < call->num_args; ++i) {
+        count += call->args[i].kind == SIR_OPERAND_IMM;
+    }
+    return count;
+}
+
+// Decides on one call and says why. Calls to functions defined elsewhere
+// never get here. A recursive callee is never inlined, even into a caller
+// outside its cycle: its body would bring the recursive call along, and the
+// rescan would inline that again until the caller hit its size limit.
+static bool should_inline(call_graph* graph, size_t callee_index, sir_function* fn, sir_function* callee,
+                          sir_inst* call, const inline_options* options) {
+    buffer* report = options->report;
+    if (is_recursive(graph, callee_index)) {
+        if (report) {
+            buffer_printf(report, "inline: kept call to %s in %s: recursive\n", callee->name, fn->name);
+        }
+        return false;
+    }
+    size_t size = sir_function_size(callee);
+    size_t constants = count_constants(call);
+    size_t allowed = (size_t)options->budget + constants * INLINE_CONSTANT_BONUS;
+    if (size > allowed) {
+        if (report) {
+            buffer_printf(report, "inline: kept call to %s in %s: size %zu > budget %d", callee->name, fn->name, size,
+                          options->budget);
+            if (constants > 0) {
+                buffer_printf(report, " + %zu constant argument%s x %d", constants, constants == 1 ? "" : "s",
+                              INLINE_CONSTANT_BONUS);
+            }
+            buffer_putc(report, '\n');
+        }
+        return false;
+    }
+    if (sir_function_size(fn) + size > INLINE_MAX_CALLER_SIZE) {
+        if (report) {
+            buffer_printf(report, "inline: kept call to %s in %s: %s would grow past %d instructions\n", callee->name,
+                          fn->name, fn->name, INLINE_MAX_CALLER_SIZE);
+        }
+        return false;
+    }
+    if (report) {
+        buffer_printf(report, "inline: inlined %s into %s: size %zu <= budget %d", callee->name, fn->name, size,
+                      options->budget);
+        if (constants > 0) {
+            buffer_printf(report, " + %zu constant argument%s x %d", constants, constants == 1 ? "" : "s",
+                          INLINE_CONSTANT_BONUS);
+        }
+        buffer_putc(report, '\n');
+    }
+    return true;
+}
+
+// Blocks added for an inlined body come right after the call, so the scan
+// goes on into them and also considers the calls the body makes.
+static size_t inline_calls(sir_program* program, call_graph* graph, size_t caller, const inline_options* options) {
+    sir_function* fn = program->functions[caller];
+    size_t inlined = 0;
+    for (size_t b = 0; b < fn->num_blocks; ++b) {
+        sir_block* block = fn->blocks[b];
+        for (size_t j = 0; j < block->num_insts; ++j) {
+            sir_inst* call = &block->insts[j];
+            if (call->op != SIR_CALL) {
+                continue;
+            }
+            size_t callee_index = find_sir_function_index(program, call->symbol);
+            if (callee_index == SIZE_MAX) {
+                continue;
+            }
+            sir_function* callee = program->functions[callee_index];
+            if (should_inline(graph, callee_index, fn, callee, call, options)) {
+                inline_call(fn, b, j, callee);
+                inlined++;
+                break;
+            }
+        }
+    }
+    return inlined;
+}
+
+size_t inline_program(sir_program* program, const inline_options* options) {
+    if (options->budget <= 0) {
+        return 0;
+    }
+    call_graph* graph = build_call_graph(program);
+    size_t inlined = 0;
+    for (size_t i = 0; i < graph->num_nodes; ++i) {
+        size_t caller = graph->bottom_up[i];
+        if (graph->nodes[caller].num_call_sites == 0) {
+            continue;
+        }
+        // Folding first turns arguments into constants wherever it can.
+        fold_sir_function(program, program->functions[caller]);
+        size_t count = inline_calls(program, graph, caller, options);
+        if (count > 0) {
+            fold_sir_function(program, program->functions[caller]);
+            inlined += count;
+        }
+    }
+    free_call_graph(graph);
+    return inlined;
+}
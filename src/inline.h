@@ -0,0 +1,24 @@
+#ifndef INLINE_H
+#define INLINE_H
+
+#include "buffer.h"
+#include "sir.h"
+
+#define INLINE_DEFAULT_BUDGET 30
+// Extra size allowed for each argument that is a constant at the call site,
+// since folding is likely to shrink the inlined body by about that much.
+#define INLINE_CONSTANT_BONUS 10
+// No caller is grown past this many instructions by inlining.
+#define INLINE_MAX_CALLER_SIZE 4096
+
+typedef struct inline_options {
+    int budget;                 // largest callee inlined without bonus; 0 disables
+    buffer* report;             // one line per call considered, or NULL
+} inline_options;
+
+// Inlines calls bottom-up over the call graph, so that a callee has already
+// had its own calls inlined and been folded when its size is weighed.
+// Returns the number of call sites inlined.
+size_t inline_program(sir_program* program, const inline_options* options);
+
+#endif // INLINE_H
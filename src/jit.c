@@ -0,0 +1,150 @@
+#include "jit.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "diagnostics.h"
+#include <sys/mman.h>
+#include <dlfcn.h>
+#include <unistd.h>
+
+// jmp *0(%rip) followed by the absolute target, used for calls that leave the
+// image (libc and friends may be further than a rel32 away).
+#define STUB_SIZE 14
+
+static size_t round_up(size_t value, size_t align) {
+    return (value + align - 1) / align * align;
+}
+
+static unsigned char* resolve_symbol(jit_image* image, const char* name) {
+    object_symbol* sym = find_object_symbol(image->obj, name);
+    if (sym != NULL) {
+        return image->section_base[sym->section] + sym->offset;
+    }
+    return NULL;
+}
+
+bool jit_load(x86_object* obj, jit_image* image) {
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+    // Every external call target gets its own stub after the code.
+    const char** externals = NULL;
+    size_t num_externals = 0;
+    for (size_t i = 0; i < obj->num_relocs; ++i) {
+        const char* name = obj->relocs[i].symbol;
+        if (find_object_symbol(obj, name) != NULL) {
+            continue;
+        }
+        bool seen = false;
+        for (size_t j = 0; j < num_externals; ++j) {
+            if (strcmp(externals[j], name) == 0) {
+                seen = true;
+                break;
+            }
+        }
+        if (!seen) {
+            const char** grown = realloc(externals, (num_externals + 1) * sizeof(char*));
+            if (grown == NULL) {
+                free(externals);
+                fatal_error("Error: jit could not allocate external symbols\n");
+            }
+            externals = grown;
+            externals[num_externals++] = name;
+        }
+    }
+
+    size_t text_size = obj->sections[SECTION_TEXT].length;
+    size_t code_size = round_up(text_size + num_externals * STUB_SIZE, page_size);
+    size_t data_size = round_up(obj->sections[SECTION_DATA].length, page_size);
+    size_t rodata_size = round_up(obj->sections[SECTION_RODATA].length, page_size);
+    image->size = code_size + data_size + rodata_size;
+    image->obj = obj;
+
+    void* memory = mmap(NULL, image->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        report_error("Error: jit could not map %zu bytes\n", image->size);
+        free(externals);
+        return false;
+    }
+    image->memory = memory;
+    image->section_base[SECTION_TEXT] = image->memory;
+    image->section_base[SECTION_DATA] = image->memory + code_size;
+    image->section_base[SECTION_RODATA] = image->memory + code_size + data_size;
+
+    for (int i = 0; i < NUM_SECTIONS; ++i) {
+        if (obj->sections[i].length > 0) {
+            memcpy(image->section_base[i], obj->sections[i].data, obj->sections[i].length);
+        }
+    }
+
+    unsigned char* stubs = image->memory + text_size;
+    for (size_t i = 0; i < num_externals; ++i) {
+        void* target = dlsym(RTLD_DEFAULT, externals[i]);
+        if (target == NULL) {
+            report_error("Error: jit could not resolve external symbol '%s'\n", externals[i]);
+            munmap(image->memory, image->size);
+            free(externals);
+            return false;
+        }
+        unsigned char* stub = stubs + i * STUB_SIZE;
+        static const unsigned char jmp_indirect[6] = { 0xFF, 0x25, 0, 0, 0, 0 };
+        memcpy(stub, jmp_indirect, 6);
+        memcpy(stub + 6, &target, 8);
+    }
+
+    for (size_t i = 0; i < obj->num_relocs; ++i) {
+        object_reloc* reloc = &obj->relocs[i];
+        unsigned char* target = resolve_symbol(image, reloc->symbol);
+        if (target == NULL) {
+            for (size_t j = 0; j < num_externals; ++j) {
+                if (strcmp(externals[j], reloc->symbol) == 0) {
+                    target = stubs + j * STUB_SIZE;
+                    break;
+                }
+            }
+        }
+        unsigned char* place = image->section_base[reloc->section] + reloc->offset;
+        long long value = (long long)(target - place) + reloc->addend;
+        int rel32 = (int)value;
+        memcpy(place, &rel32, 4);
+    }
+    free(externals);
+
+    if (mprotect(image->memory, code_size, PROT_READ | PROT_EXEC) != 0 ||
+        (rodata_size > 0 && mprotect(image->section_base[SECTION_RODATA], rodata_size, PROT_READ) != 0)) {
+        report_error("Error: jit could not make code executable\n");
+        munmap(image->memory, image->size);
+        return false;
+    }
+    return true;
+}
+
+void* jit_lookup(jit_image* image, const char* name) {
+    return resolve_symbol(image, name);
+}
+
+void jit_unload(jit_image* image) {
+    munmap(image->memory, image->size);
+    image->memory = NULL;
+    image->size = 0;
+}
+
+int jit_run_main(x86_object* obj) {
+    jit_image image;
+    if (!jit_load(obj, &image)) {
+        abort_compilation();
+    }
+
+    void* entry = jit_lookup(&image, "main");
+    if (entry == NULL) {
+        jit_unload(&image);
+        fatal_error("Error: jit found no 'main' function\n");
+    }
+
+    int (*main_fn)(void);
+    memcpy(&main_fn, &entry, sizeof(main_fn));
+    int exit_code = main_fn();
+
+    jit_unload(&image);
+    return exit_code;
+}
@@ -0,0 +1,22 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "encoder.h"
+
+// An object loaded into executable memory. The mapping is filled while it is
+// writable and only then flipped to read+execute (W^X).
+typedef struct jit_image {
+    unsigned char* memory;
+    size_t size;
+    unsigned char* section_base[NUM_SECTIONS];
+    x86_object* obj;
+} jit_image;
+
+bool jit_load(x86_object* obj, jit_image* image);
+void* jit_lookup(jit_image* image, const char* name);
+void jit_unload(jit_image* image);
+int jit_run_main(x86_object* obj);
+
+#endif // JIT_H
@@ -1,23 +1,22 @@
 #include "lexer.h"
 
-lexer init_lexer(char* file_name) {
+// Reads the whole file into a NUL-terminated buffer owned by the caller.
+char* read_source_file(char* file_name, size_t* size) {
     FILE* fp;
     char* buffer;
     long file_size;
 
     if (fopen_s(&fp, file_name, "rb") != 0) {
-        printf("Error: File %s not found!\n", file_name);
-        exit(1);
+        fatal_error("Error: File %s not found!\n", file_name);
     }
 
     fseek(fp, 0, SEEK_END);
     file_size = ftell(fp);
     fseek(fp, 0, SEEK_SET);
 
-    buffer = (char*)malloc((file_size + 1) * sizeof(char));
+    buffer = (char*)counted_malloc(ALLOC_LEXER, (file_size + 1) * sizeof(char));
     if (buffer == NULL) {
-        printf("Error: Failed to allocate memory for file %s!\n", file_name);
-        exit(1);
+        fatal_error("Error: Failed to allocate memory for file %s!\n", file_name);
     }
 
     fread(buffer, sizeof(char), file_size, fp);
@@ -25,10 +24,17 @@ lexer init_lexer(char* file_name) {
 
     fclose(fp);
 
+    if (size != NULL) {
+        *size = (size_t)file_size;
+    }
+    return buffer;
+}
+
+lexer init_lexer_from_source(char* file_name, char* content) {
     lexer l = {
         file_name,
         0,
-        buffer,
+        content,
         1,
         1,
         0,
@@ -36,6 +42,10 @@ lexer init_lexer(char* file_name) {
     return l;
 }
 
+lexer init_lexer(char* file_name) {
+    return init_lexer_from_source(file_name, read_source_file(file_name, NULL));
+}
+
 int is_digit(char c) {
     return isdigit(c);
 }
@@ -52,36 +62,35 @@ int is_alnum(char c) {
 
 void resize_tokens(token** tokens, int* max_tokens) {
     *max_tokens *= 2;
-    *tokens = realloc(*tokens, *max_tokens * sizeof(token));
+    *tokens = counted_realloc(ALLOC_LEXER, *tokens, *max_tokens * sizeof(token));
 
     if (*tokens == NULL) {
-        printf("Error: Failed to reallocate memory for tokens!\n");
-        exit(1);
+        fatal_error("Error: Failed to reallocate memory for tokens!\n");
     }
 }
 
 void push_token(token** tokens, int* num_tokens, int* max_tokens, const char* lexme, tag kind) {
     if (*num_tokens == *max_tokens) {
         *max_tokens *= 2;
-        *tokens = realloc(*tokens, *max_tokens * sizeof(token));
+        *tokens = counted_realloc(ALLOC_LEXER, *tokens, *max_tokens * sizeof(token));
 
         if (*tokens == NULL) {
-            printf("Error: Failed to reallocate memory for tokens!\n");
-            exit(1);
+            fatal_error("Error: Failed to reallocate memory for tokens!\n");
         }
     }
 
     char* lexme_copy = NULL;
     if (lexme != NULL) {
-        lexme_copy = _strdup(lexme);
+        lexme_copy = counted_strdup(ALLOC_LEXER, lexme);
         if (lexme_copy == NULL) {
-            printf("Error: Failed to allocate memory for lexme!\n");
-            exit(1);
+            fatal_error("Error: Failed to allocate memory for lexme!\n");
         }
     }
 
     (*tokens)[*num_tokens].lexme = lexme_copy;
     (*tokens)[*num_tokens].kind = kind;
+    (*tokens)[*num_tokens].line = 0;
+    (*tokens)[*num_tokens].flags = 0;
     *num_tokens += 1;
 }
 
@@ -155,8 +164,10 @@ tag get_directive(const char* value) {
         return PP_PRAGMA;
     } else if (strcmp(value, "undef") == 0) {
         return PP_UNDEF;
+    } else if (strcmp(value, "error") == 0) {
+        return PP_ERROR;
     } else {
-        return IDENTIFIER;
+        return PP_UNKNOWN;
     }
 }
 
@@ -164,23 +175,36 @@ tag get_directive(const char* value) {
 token* tokenizer(lexer* lex) {
     int max_tokens = 20;
     int num_tokens = 0;
-    token* tokens = malloc(max_tokens * sizeof(token));
+    token* tokens = counted_malloc(ALLOC_LEXER, max_tokens * sizeof(token));
 
     if (!tokens) {
-        printf("Error: Failed to allocate memory for tokens!\n");
-        exit(1);
+        fatal_error("Error: Failed to allocate memory for tokens!\n");
     }
 
     int content_length = strlen(lex->content);
+    unsigned char pending_flags = TOKEN_AT_LINE_START;
 
     while (lex->index < content_length) {
         char current_char = lex->content[lex->index];
+        int first_new_token = num_tokens;
+        int line = lex->current_line;
         switch (current_char) {
             case '\n': {
                 lex->index += 1;
                 lex->current_line += 1;
                 break;
             }
+            case '\\': {
+                lex->index += 1;
+                if (lex->content[lex->index] == '\n') {
+                    lex->index += 1;
+                    lex->current_line += 1;
+                } else if (lex->content[lex->index] == '\r' && lex->content[lex->index + 1] == '\n') {
+                    lex->index += 2;
+                    lex->current_line += 1;
+                }
+                break;
+            }
             case '(': {
                 lex->index += 1;
                 lex->current_col += 1;
@@ -205,6 +229,18 @@ token* tokenizer(lexer* lex) {
                 push_token(&tokens, &num_tokens, &max_tokens, "}", RBRACE);
                 break;
             }
+            case '[': {
+                lex->index += 1;
+                lex->current_col += 1;
+                push_token(&tokens, &num_tokens, &max_tokens, "[", LBRACKET);
+                break;
+            }
+            case ']': {
+                lex->index += 1;
+                lex->current_col += 1;
+                push_token(&tokens, &num_tokens, &max_tokens, "]", RBRACKET);
+                break;
+            }
             case ';': {
                 lex->index += 1;
                 lex->current_col += 1;
@@ -247,6 +283,36 @@ token* tokenizer(lexer* lex) {
                 push_token(&tokens, &num_tokens, &max_tokens, "*", MULTIPLY);
                 break;
             }
+            case '/': {
+                lex->index += 1;
+                lex->current_col += 1;
+                if (lex->content[lex->index] == '/') {
+                    while (lex->content[lex->index] != '\n' && lex->content[lex->index] != '\0') {
+                        lex->index += 1;
+                    }
+                } else if (lex->content[lex->index] == '*') {
+                    lex->index += 1;
+                    while (lex->content[lex->index] != '\0' &&
+                           !(lex->content[lex->index] == '*' && lex->content[lex->index + 1] == '/')) {
+                        if (lex->content[lex->index] == '\n') {
+                            lex->current_line += 1;
+                        }
+                        lex->index += 1;
+                    }
+                    if (lex->content[lex->index] != '\0') {
+                        lex->index += 2;
+                    }
+                } else {
+                    push_token(&tokens, &num_tokens, &max_tokens, "/", DIVIDE);
+                }
+                break;
+            }
+            case '%': {
+                lex->index += 1;
+                lex->current_col += 1;
+                push_token(&tokens, &num_tokens, &max_tokens, "%", MODULO);
+                break;
+            }
             case '.': {
                 lex->index += 1;
                 lex->current_col += 1;
@@ -273,7 +339,31 @@ token* tokenizer(lexer* lex) {
                     lex->current_col += 1;
                     push_token(&tokens, &num_tokens, &max_tokens, "!=", NOT_EQUAL);
                 } else {
+                    push_token(&tokens, &num_tokens, &max_tokens, "!", LOGICAL_NOT);
+                }
+                break;
+            }
+            case '&': {
+                lex->index += 1;
+                lex->current_col += 1;
+                if (lex->content[lex->index] == '&') {
+                    lex->index += 1;
+                    lex->current_col += 1;
+                    push_token(&tokens, &num_tokens, &max_tokens, "&&", LOGICAL_AND);
+                } else {
+                    push_token(&tokens, &num_tokens, &max_tokens, "&", BITWISE_AND);
+                }
+                break;
+            }
+            case '|': {
+                lex->index += 1;
+                lex->current_col += 1;
+                if (lex->content[lex->index] == '|') {
                     lex->index += 1;
+                    lex->current_col += 1;
+                    push_token(&tokens, &num_tokens, &max_tokens, "||", LOGICAL_OR);
+                } else {
+                    push_token(&tokens, &num_tokens, &max_tokens, "|", BITWISE_OR);
                 }
                 break;
             }
@@ -305,6 +395,19 @@ token* tokenizer(lexer* lex) {
                 lex->index += 1;
                 lex->current_col += 1;
 
+                // Only a '#' that starts a line introduces a directive; elsewhere it is
+                // the stringizing or pasting operator of a macro body.
+                if (!(pending_flags & TOKEN_AT_LINE_START)) {
+                    if (lex->content[lex->index] == '#') {
+                        lex->index += 1;
+                        lex->current_col += 1;
+                        push_token(&tokens, &num_tokens, &max_tokens, "##", HASH_HASH);
+                    } else {
+                        push_token(&tokens, &num_tokens, &max_tokens, "#", HASH);
+                    }
+                    break;
+                }
+
                 while (lex->content[lex->index] == ' ' || lex->content[lex->index] == '\t') {
                     lex->index += 1;
                     lex->current_col += 1;
@@ -316,7 +419,7 @@ token* tokenizer(lexer* lex) {
                     lex->current_col += 1;
                 }
                 int end_index = lex->index;
-                char* directive = malloc((end_index - start_index + 1) * sizeof(char));
+                char* directive = counted_malloc(ALLOC_LEXER, (end_index - start_index + 1) * sizeof(char));
                 strncpy_s(directive, (end_index - start_index + 1), lex->content + start_index, (end_index - start_index));
                 directive[end_index - start_index] = '\0';
 
@@ -340,24 +443,27 @@ token* tokenizer(lexer* lex) {
                         }
                         int end_index = lex->index;
                         size_t path_size = end_index - start_index + 1;
-                        char* path = malloc(path_size * sizeof(char));
+                        char* path = counted_malloc(ALLOC_LEXER, path_size * sizeof(char));
 
                         if (path != NULL) {
                             if (strncpy_s(path, path_size, lex->content + start_index, end_index - start_index) == 0) {
                                 path[path_size - 1] = '\0';
 
-                                push_token(&tokens, &num_tokens, &max_tokens, path, IDENTIFIER);
+                                // "path" becomes a STRING and <path> an IDENTIFIER, so the
+                                // preprocessor can tell which search order applies.
+                                push_token(&tokens, &num_tokens, &max_tokens, path, end_char == '"' ? STRING : IDENTIFIER);
+                                free(path);
 
                                 if (lex->content[lex->index] == end_char) {
                                     lex->index += 1;
                                     lex->current_col += 1;
                                 }
                             } else {
-                                fprintf(stderr, "Error: strncpy_s failed for path\n");
+                                report_error("Error: strncpy_s failed for path\n");
                                 free(path);
                             }
                         } else {
-                            fprintf(stderr, "Error: Failed to allocate memory for path\n");
+                            report_error("Error: Failed to allocate memory for path\n");
                         }
                     }
                 }
@@ -368,7 +474,7 @@ token* tokenizer(lexer* lex) {
             case '\'': {
                 lex->index += 1;
                 lex->current_col += 1;
-                char* char_value = malloc(2);
+                char* char_value = counted_malloc(ALLOC_LEXER, 2);
                 char_value[0] = '\0';
                 int index = 0;
 
@@ -399,7 +505,7 @@ token* tokenizer(lexer* lex) {
                         }
                     }
 
-                    char_value = realloc(char_value, index + 2);
+                    char_value = counted_realloc(ALLOC_LEXER, char_value, index + 2);
                     char_value[index] = current_char;
                     index += 1;
                     lex->index += 1;
@@ -415,13 +521,13 @@ token* tokenizer(lexer* lex) {
             case '\"': {
                 lex->current_col += 1;
                 lex->index += 1;
-                char* string_value = malloc(1);
+                char* string_value = counted_malloc(ALLOC_LEXER, 1);
                 string_value[0] = '\0';
                 int index = 0;
 
                 while (lex->content[lex->index] != '\"') {
                     current_char = lex->content[lex->index];
-                    string_value = realloc(string_value, index + 2);
+                    string_value = counted_realloc(ALLOC_LEXER, string_value, index + 2);
                     string_value[index] = current_char;
                     index += 1;
                     lex->index += 1;
@@ -442,18 +548,19 @@ token* tokenizer(lexer* lex) {
                     }
                     int end_index = lex->index;
                     size_t value_size = end_index - start_index + 1;
-                    char* value = malloc(value_size * sizeof(char));
+                    char* value = counted_malloc(ALLOC_LEXER, value_size * sizeof(char));
 
                     if (value != NULL) {
                         if (strncpy_s(value, value_size, lex->content + start_index, end_index - start_index) == 0) {
                             value[value_size - 1] = '\0';
 
                             push_token(&tokens, &num_tokens, &max_tokens, value, NUMBER);
+                            free(value);
                         } else {
                             free(value);
                         }
                     } else {
-                        fprintf(stderr, "ERROR: memory in toknizer (numbers)\n");
+                        report_error("ERROR: memory in toknizer (numbers)\n");
                     }
                 } else if (is_alpha(current_char)) {
                     int start_index = lex->index;
@@ -463,7 +570,7 @@ token* tokenizer(lexer* lex) {
                     }
                     int end_index = lex->index;
                     size_t value_size = end_index - start_index + 1;
-                    char* value = malloc(value_size * sizeof(char));
+                    char* value = counted_malloc(ALLOC_LEXER, value_size * sizeof(char));
 
                     if (value != NULL) {
                         if (strncpy_s(value, value_size, lex->content + start_index, end_index - start_index) == 0) {
@@ -472,12 +579,13 @@ token* tokenizer(lexer* lex) {
                             tag keyword_kind = get_keyword(value);
 
                             push_token(&tokens, &num_tokens, &max_tokens, value, keyword_kind);
+                            free(value);
                         } else {
-                            fprintf(stderr, "Error: strncpy_s failed for path\n");
+                            report_error("Error: strncpy_s failed for path\n");
                             free(value);
                         }
                     } else {
-                        fprintf(stderr, "ERROR: memory in toknizer (identifiers)\n");
+                        report_error("ERROR: memory in toknizer (identifiers)\n");
                     }
                 } else {
                     lex->index += 1;
@@ -485,6 +593,18 @@ token* tokenizer(lexer* lex) {
                 break;
             }
         }
+
+        if (num_tokens > first_new_token) {
+            tokens[first_new_token].flags = pending_flags;
+            for (int i = first_new_token; i < num_tokens; ++i) {
+                tokens[i].line = line;
+            }
+            pending_flags = 0;
+        } else if (current_char == '\n') {
+            pending_flags = TOKEN_AT_LINE_START;
+        } else {
+            pending_flags |= TOKEN_AFTER_SPACE;
+        }
     }
 
     if (num_tokens == max_tokens) {
@@ -492,6 +612,8 @@ token* tokenizer(lexer* lex) {
     }
 
     push_token(&tokens, &num_tokens, &max_tokens, NULL, ENDOF);
+    tokens[num_tokens - 1].line = lex->current_line;
+    tokens[num_tokens - 1].flags = TOKEN_AT_LINE_START;
     lex->tokens_count = num_tokens;
 
     return tokens;
@@ -509,10 +631,14 @@ char* token_to_string(token* token) {
         case LPAREN: return "left_paren";
         case RBRACE: return "right_brace";
         case LBRACE: return "left_brace";
+        case RBRACKET: return "right_bracket";
+        case LBRACKET: return "left_bracket";
         case SIMICOLON: return "semicolon";
         case COLON: return "colon";
         case DOT: return "dot";
         case COMMA: return "comma";
+        case HASH: return "hash";
+        case HASH_HASH: return "hash_hash";
 
         // Operators
         case EQUAL: return "equal";
@@ -525,6 +651,12 @@ char* token_to_string(token* token) {
         case MINUS: return "minus";
         case MULTIPLY: return "multiply";
         case DIVIDE: return "divide";
+        case MODULO: return "modulo";
+        case LOGICAL_NOT: return "logical_not";
+        case LOGICAL_AND: return "logical_and";
+        case LOGICAL_OR: return "logical_or";
+        case BITWISE_AND: return "bitwise_and";
+        case BITWISE_OR: return "bitwise_or";
         case ASSIGN: return "assign";
 
         // keywords
@@ -563,6 +695,7 @@ char* token_to_string(token* token) {
         case PP_IFNDEF: return "preprocessor_ifndef";
         case PP_ERROR: return "preprocessor_error";
         case PP_PRAGMA: return "preprocessor_pragma";
+        case PP_UNKNOWN: return "preprocessor_unknown";
         default: return "UNDEF";
     }
 }
@@ -578,10 +711,14 @@ const char* tag_tostring(tag t) {
         case LPAREN: return "left_paren";
         case RBRACE: return "right_brace";
         case LBRACE: return "left_brace";
+        case RBRACKET: return "right_bracket";
+        case LBRACKET: return "left_bracket";
         case SIMICOLON: return "semicolon";
         case COLON: return "colon";
         case DOT: return "dot";
         case COMMA: return "comma";
+        case HASH: return "hash";
+        case HASH_HASH: return "hash_hash";
 
         // Operators
         case EQUAL: return "equal";
@@ -594,6 +731,12 @@ const char* tag_tostring(tag t) {
         case MINUS: return "minus";
         case MULTIPLY: return "multiply";
         case DIVIDE: return "divide";
+        case MODULO: return "modulo";
+        case LOGICAL_NOT: return "logical_not";
+        case LOGICAL_AND: return "logical_and";
+        case LOGICAL_OR: return "logical_or";
+        case BITWISE_AND: return "bitwise_and";
+        case BITWISE_OR: return "bitwise_or";
         case ASSIGN: return "assign";
 
         // keywords
@@ -632,6 +775,7 @@ const char* tag_tostring(tag t) {
         case PP_IFNDEF: return "preprocessor_ifndef";
         case PP_ERROR: return "preprocessor_error";
         case PP_PRAGMA: return "preprocessor_pragma";
+        case PP_UNKNOWN: return "preprocessor_unknown";
         default: return "UNDEF";
     }
 }
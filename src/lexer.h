@@ -1,7 +1,13 @@
+#ifndef LEXER_H
+#define LEXER_H
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include "compat.h"
+#include "allocator.h"
+#include "diagnostics.h"
 
 typedef enum tag {
     IDENTIFIER,
@@ -48,10 +54,14 @@ typedef enum tag {
     LPAREN,             // (
     RBRACE,             // }
     LBRACE,             // {
+    RBRACKET,           // ]
+    LBRACKET,           // [
     SIMICOLON,          // ;
     COLON,              // :
     DOT,                // .
     COMMA,              // ,
+    HASH,               // # inside a directive
+    HASH_HASH,          // ##
 
     //  Keywords
     KW_INT,
@@ -88,14 +98,21 @@ typedef enum tag {
     PP_IFNDEF,         // #ifndef
     PP_ERROR,          // #error
     PP_PRAGMA,         // #pragma
+    PP_UNKNOWN,        // # followed by anything else
 
     ENDOF,
 } tag;
 
 
+// Token flags. Directives end at the next token that starts a line.
+#define TOKEN_AT_LINE_START 0x1
+#define TOKEN_AFTER_SPACE   0x2
+
 typedef struct token {
     char* lexme;
     tag kind;
+    int line;
+    unsigned char flags;
 } token;
 
 typedef struct lexer {
@@ -108,6 +125,8 @@ typedef struct lexer {
 } lexer;
 
 
+char* read_source_file(char* file_name, size_t* size);
+lexer init_lexer_from_source(char* file_name, char* content);
 lexer init_lexer(char* file_name);
 
 void resize_tokens(token** tokens, int* max_tokens);
@@ -127,3 +146,5 @@ int is_alnum(char c);
 
 
 const char* tag_tostring(tag t);
+
+#endif // LEXER_H
@@ -0,0 +1,152 @@
+#include "licm.h"
+#include "loops.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// dst of an instruction that has been hoisted and is to be dropped.
+#define HOISTED (-2)
+
+typedef struct licm {
+    sir_program* program;
+    sir_function* fn;
+    loop_info* info;
+    int* defs;                  // definitions of each vreg in the function
+    int* loop_defs;             // definitions of each vreg in the current loop
+    bool* dominates_uses;       // the vreg's only definition dominates its uses
+    size_t hoisted;
+} licm;
+
+static bool is_invariant(licm* m, sir_operand operand) {
+    return operand.kind != SIR_OPERAND_VREG || m->loop_defs[operand.vreg] == 0;
+}
+
+// Whether the loop may write global symbol: stores to it, or calls anything.
+static bool loop_writes(licm* m, sir_loop* loop, const char* symbol) {
+    for (size_t i = 0; i < m->fn->num_blocks; ++i) {
+        if (!loop->contains[i]) {
+            continue;
+        }
+        sir_block* block = m->fn->blocks[i];
+        for (size_t j = 0; j < block->num_insts; ++j) {
+            sir_inst* inst = &block->insts[j];
+            bool is_store = inst->op == SIR_STORE_GLOBAL || inst->op == SIR_STORE_ELEM || inst->op == SIR_VSTORE;
+            if (inst->op == SIR_CALL || (is_store && strcmp(inst->symbol, symbol) == 0)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Division is left alone even with invariant operands: it may trap, and the
+// loop might not have reached it. For the same reason an element is only
+// loaded early when its index is a constant inside the array.
+static bool can_hoist(licm* m, sir_loop* loop, sir_inst* inst) {
+    if (inst->dst < 0 || sir_has_side_effects(inst->op) || m->defs[inst->dst] != 1 ||
+        !m->dominates_uses[inst->dst] || !is_invariant(m, inst->a) || !is_invariant(m, inst->b)) {
+        return false;
+    }
+    switch (inst->op) {
+        case SIR_LOAD_GLOBAL:
+            return !loop_writes(m, loop, inst->symbol);
+        case SIR_LOAD_ELEM: {
+            sir_global* global = find_sir_global(m->program, inst->symbol);
+            return inst->a.kind == SIR_OPERAND_IMM && global != NULL && inst->a.imm >= 0 &&
+                   (size_t)inst->a.imm < global->length && !loop_writes(m, loop, inst->symbol);
+        }
+        case SIR_VLOAD:
+            return false;
+        default:
+            return true;
+    }
+}
+
+static void hoist_loop(licm* m, sir_loop* loop) {
+    sir_function* fn = m->fn;
+    sir_block* preheader = loop_preheader(m->info, loop);
+    memset(m->loop_defs, 0, fn->num_vregs * sizeof(int));
+    for (size_t i = 0; i < fn->num_blocks; ++i) {
+        if (!loop->contains[i]) {
+            continue;
+        }
+        sir_block* block = fn->blocks[i];
+        for (size_t j = 0; j < block->num_insts; ++j) {
+            if (block->insts[j].dst >= 0) {
+                m->loop_defs[block->insts[j].dst]++;
+            }
+        }
+    }
+
+    // Hoisting one instruction can make the ones reading it invariant, so
+    // walk the loop in order until nothing more moves.
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t n = 0; n < m->info->num_reachable; ++n) {
+            int b = m->info->order[n];
+            if (!loop->contains[b]) {
+                continue;
+            }
+            sir_block* block = fn->blocks[b];
+            for (size_t j = 0; j < block->num_insts; ++j) {
+                sir_inst* inst = &block->insts[j];
+                if (!can_hoist(m, loop, inst)) {
+                    continue;
+                }
+                sir_inst moved = *inst;
+                sir_inst* term = sir_terminator(preheader);
+                sir_inst jump = *term;
+                *term = moved;
+                sir_append(preheader, jump);
+                m->loop_defs[moved.dst]--;
+                inst->dst = HOISTED;
+                m->hoisted++;
+                changed = true;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < fn->num_blocks; ++i) {
+        if (!loop->contains[i]) {
+            continue;
+        }
+        sir_block* block = fn->blocks[i];
+        size_t kept = 0;
+        for (size_t j = 0; j < block->num_insts; ++j) {
+            if (block->insts[j].dst != HOISTED) {
+                block->insts[kept++] = block->insts[j];
+            }
+        }
+        block->num_insts = kept;
+    }
+}
+
+size_t licm_sir_function(sir_program* program, sir_function* fn) {
+    licm m = { program, fn, NULL, NULL, NULL, NULL, 0 };
+    m.info = analyze_loops_with_preheaders(fn);
+    if (m.info->num_loops > 0) {
+        m.defs = calloc(fn->num_vregs + 1, sizeof(int));
+        m.loop_defs = calloc(fn->num_vregs + 1, sizeof(int));
+        m.dominates_uses = calloc(fn->num_vregs + 1, sizeof(bool));
+        // Hoisting to a preheader keeps the single definitions where they
+        // were seen by every use, so this is worked out once.
+        find_definitions(m.info, m.defs, m.dominates_uses);
+        for (size_t i = 0; i < m.info->num_loops; ++i) {
+            hoist_loop(&m, &m.info->loops[i]);
+        }
+        free(m.defs);
+        free(m.loop_defs);
+        free(m.dominates_uses);
+    }
+    free_loop_info(m.info);
+    return m.hoisted;
+}
+
+size_t licm_sir_program(sir_program* program) {
+    size_t hoisted = 0;
+    for (size_t i = 0; i < program->num_functions; ++i) {
+        hoisted += licm_sir_function(program, program->functions[i]);
+    }
+    return hoisted;
+}
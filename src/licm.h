@@ -0,0 +1,13 @@
+#ifndef LICM_H
+#define LICM_H
+
+#include "sir.h"
+
+// Loop-invariant code motion. Gives every natural loop a preheader, then
+// moves each pure instruction whose operands do not change in the loop out
+// to it, inner loops first so that code can travel out of a nest one level
+// at a time. Returns the number of instructions hoisted.
+size_t licm_sir_function(sir_program* program, sir_function* fn);
+size_t licm_sir_program(sir_program* program);
+
+#endif // LICM_H
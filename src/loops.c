@@ -0,0 +1,369 @@
+#include "loops.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Edges are counted once per terminator field, so a block can show up
+// among another's predecessors more than once; nothing here minds.
+static int num_successors(sir_block* block) {
+    sir_inst* term = sir_terminator(block);
+    return term != NULL ? (int)sir_num_successors(term) : 0;
+}
+
+static sir_block* successor(sir_block* block, int k) {
+    return *sir_successor(sir_terminator(block), (size_t)k);
+}
+
+// Predecessors in compressed rows: count, prefix-sum, fill.
+static void find_predecessors(loop_info* info) {
+    sir_function* fn = info->fn;
+    size_t n = fn->num_blocks;
+    info->pred_start = calloc(n + 1, sizeof(int));
+    for (size_t i = 0; i < n; ++i) {
+        int count = num_successors(fn->blocks[i]);
+        for (int k = 0; k < count; ++k) {
+            info->pred_start[successor(fn->blocks[i], k)->index + 1]++;
+        }
+    }
+    for (size_t i = 0; i < n; ++i) {
+        info->pred_start[i + 1] += info->pred_start[i];
+    }
+    info->preds = malloc((info->pred_start[n] + 1) * sizeof(int));
+    int* fill = malloc((n + 1) * sizeof(int));
+    memcpy(fill, info->pred_start, n * sizeof(int));
+    for (size_t i = 0; i < n; ++i) {
+        int count = num_successors(fn->blocks[i]);
+        for (int k = 0; k < count; ++k) {
+            info->preds[fill[successor(fn->blocks[i], k)->index]++] = (int)i;
+        }
+    }
+    free(fill);
+}
+
+// Depth-first from the entry with an explicit stack; a block's postorder
+// number is taken once all of its successors are done.
+static void number_blocks(loop_info* info) {
+    sir_function* fn = info->fn;
+    size_t n = fn->num_blocks;
+    int* postorder = malloc((n + 1) * sizeof(int));
+    int* stack = malloc((n + 1) * sizeof(int));
+    int* next_succ = calloc(n + 1, sizeof(int));
+    bool* visited = calloc(n + 1, sizeof(bool));
+    size_t num_post = 0;
+    size_t depth = 0;
+    stack[depth++] = 0;
+    visited[0] = true;
+    while (depth > 0) {
+        int b = stack[depth - 1];
+        if (next_succ[b] < num_successors(fn->blocks[b])) {
+            int s = successor(fn->blocks[b], next_succ[b]++)->index;
+            if (!visited[s]) {
+                visited[s] = true;
+                stack[depth++] = s;
+            }
+        } else {
+            postorder[num_post++] = b;
+            depth--;
+        }
+    }
+
+    info->num_reachable = num_post;
+    info->order = malloc((n + 1) * sizeof(int));
+    info->order_index = malloc((n + 1) * sizeof(int));
+    for (size_t i = 0; i < n; ++i) {
+        info->order_index[i] = -1;
+    }
+    for (size_t i = 0; i < num_post; ++i) {
+        int b = postorder[num_post - 1 - i];
+        info->order[i] = b;
+        info->order_index[b] = (int)i;
+    }
+    free(postorder);
+    free(stack);
+    free(next_succ);
+    free(visited);
+}
+
+static int intersect(loop_info* info, int a, int b) {
+    while (a != b) {
+        while (info->order_index[a] > info->order_index[b]) {
+            a = info->idom[a];
+        }
+        while (info->order_index[b] > info->order_index[a]) {
+            b = info->idom[b];
+        }
+    }
+    return a;
+}
+
+// Cooper, Harvey and Kennedy's iterative algorithm: walk the blocks in
+// reverse postorder, meeting the dominators of the processed predecessors,
+// until nothing changes. It settles in a couple of passes on reducible code.
+static void find_dominators(loop_info* info) {
+    size_t n = info->fn->num_blocks;
+    info->idom = malloc((n + 1) * sizeof(int));
+    for (size_t i = 0; i < n; ++i) {
+        info->idom[i] = -1;
+    }
+    info->idom[0] = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 1; i < info->num_reachable; ++i) {
+            int b = info->order[i];
+            int new_idom = -1;
+            for (int k = info->pred_start[b]; k < info->pred_start[b + 1]; ++k) {
+                int p = info->preds[k];
+                if (info->idom[p] < 0) {
+                    continue;
+                }
+                new_idom = new_idom < 0 ? p : intersect(info, p, new_idom);
+            }
+            if (new_idom != info->idom[b]) {
+                info->idom[b] = new_idom;
+                changed = true;
+            }
+        }
+    }
+    info->idom[0] = -1;
+}
+
+bool block_dominates(loop_info* info, int a, int b) {
+    if (info->order_index[b] < 0) {
+        return false;
+    }
+    while (b >= 0 && b != a) {
+        b = info->idom[b];
+    }
+    return b == a;
+}
+
+static sir_loop* find_loop(loop_info* info, sir_block* header) {
+    for (size_t i = 0; i < info->num_loops; ++i) {
+        if (info->loops[i].header == header) {
+            return &info->loops[i];
+        }
+    }
+    return NULL;
+}
+
+// Adds the blocks that reach latch without passing through the header.
+static void add_loop_body(loop_info* info, sir_loop* loop, int latch, int* stack) {
+    size_t depth = 0;
+    if (!loop->contains[latch]) {
+        loop->contains[latch] = true;
+        loop->num_blocks++;
+        stack[depth++] = latch;
+    }
+    while (depth > 0) {
+        int b = stack[--depth];
+        for (int k = info->pred_start[b]; k < info->pred_start[b + 1]; ++k) {
+            int p = info->preds[k];
+            if (info->order_index[p] >= 0 && !loop->contains[p]) {
+                loop->contains[p] = true;
+                loop->num_blocks++;
+                stack[depth++] = p;
+            }
+        }
+    }
+}
+
+static int compare_loop_size(const void* a, const void* b) {
+    size_t x = ((const sir_loop*)a)->num_blocks;
+    size_t y = ((const sir_loop*)b)->num_blocks;
+    return x < y ? -1 : x > y;
+}
+
+// An edge whose target dominates its source closes a loop. Back edges to
+// the same header make one loop between them.
+static void find_natural_loops(loop_info* info) {
+    sir_function* fn = info->fn;
+    size_t n = fn->num_blocks;
+    size_t max_loops = 0;
+    int* stack = malloc((n + 1) * sizeof(int));
+    for (size_t i = 0; i < info->num_reachable; ++i) {
+        int b = info->order[i];
+        int count = num_successors(fn->blocks[b]);
+        for (int k = 0; k < count; ++k) {
+            sir_block* header = successor(fn->blocks[b], k);
+            int h = header->index;
+            if (!block_dominates(info, h, b)) {
+                continue;
+            }
+            sir_loop* loop = find_loop(info, header);
+            if (loop == NULL) {
+                if (info->num_loops == max_loops) {
+                    max_loops = max_loops ? max_loops * 2 : 4;
+                    info->loops = realloc(info->loops, max_loops * sizeof(sir_loop));
+                }
+                loop = &info->loops[info->num_loops++];
+                loop->header = header;
+                loop->contains = calloc(n + 1, sizeof(bool));
+                loop->contains[h] = true;
+                loop->num_blocks = 1;
+                loop->parent = -1;
+                loop->depth = 1;
+            }
+            add_loop_body(info, loop, b, stack);
+        }
+    }
+    free(stack);
+
+    // Nested loops are strictly smaller than the loops around them, so
+    // sorting by size puts inner loops first and makes the first larger loop
+    // holding a header its parent.
+    if (info->num_loops > 1) {
+        qsort(info->loops, info->num_loops, sizeof(sir_loop), compare_loop_size);
+    }
+    for (size_t i = 0; i < info->num_loops; ++i) {
+        for (size_t j = i + 1; j < info->num_loops; ++j) {
+            if (info->loops[j].contains[info->loops[i].header->index]) {
+                info->loops[i].parent = (int)j;
+                break;
+            }
+        }
+    }
+    for (size_t i = info->num_loops; i > 0; --i) {
+        sir_loop* loop = &info->loops[i - 1];
+        loop->depth = loop->parent >= 0 ? info->loops[loop->parent].depth + 1 : 1;
+    }
+}
+
+loop_info* analyze_loops(sir_function* fn) {
+    loop_info* info = calloc(1, sizeof(loop_info));
+    info->fn = fn;
+    number_sir_blocks(fn);
+    find_predecessors(info);
+    number_blocks(info);
+    find_dominators(info);
+    find_natural_loops(info);
+    return info;
+}
+
+void free_loop_info(loop_info* info) {
+    for (size_t i = 0; i < info->num_loops; ++i) {
+        free(info->loops[i].contains);
+    }
+    free(info->loops);
+    free(info->idom);
+    free(info->order);
+    free(info->order_index);
+    free(info->pred_start);
+    free(info->preds);
+    free(info);
+}
+
+// Makes sure the loop is entered through a single block that does nothing
+// but jump to the header. Returns false when one had to be made, which
+// leaves info out of date.
+static bool ensure_preheader(loop_info* info, sir_loop* loop) {
+    sir_function* fn = info->fn;
+    int header = loop->header->index;
+    int outside = 0;
+    int last = -1;
+    for (int k = info->pred_start[header]; k < info->pred_start[header + 1]; ++k) {
+        int p = info->preds[k];
+        if (info->order_index[p] >= 0 && !loop->contains[p]) {
+            outside++;
+            last = p;
+        }
+    }
+    if (header != 0 && outside == 1 && sir_terminator(fn->blocks[last])->op == SIR_JUMP) {
+        return true;
+    }
+
+    // Laid out just before the header so that it falls through into it.
+    sir_block* preheader = insert_sir_block(fn, (size_t)header);
+    for (int k = info->pred_start[header]; k < info->pred_start[header + 1]; ++k) {
+        int p = info->preds[k];
+        if (info->order_index[p] >= 0 && !loop->contains[p]) {
+            sir_redirect(sir_terminator(fn->blocks[p]), loop->header, preheader);
+        }
+    }
+    sir_inst* jump = sir_emit(preheader, SIR_JUMP, -1, sir_none(), sir_none());
+    jump->target = loop->header;
+    return false;
+}
+
+loop_info* analyze_loops_with_preheaders(sir_function* fn) {
+    for (;;) {
+        loop_info* info = analyze_loops(fn);
+        bool done = true;
+        for (size_t i = 0; i < info->num_loops && done; ++i) {
+            done = ensure_preheader(info, &info->loops[i]);
+        }
+        if (done) {
+            return info;
+        }
+        free_loop_info(info);
+    }
+}
+
+sir_block* loop_preheader(loop_info* info, sir_loop* loop) {
+    int header = loop->header->index;
+    for (int k = info->pred_start[header]; k < info->pred_start[header + 1]; ++k) {
+        int p = info->preds[k];
+        if (info->order_index[p] >= 0 && !loop->contains[p]) {
+            return info->fn->blocks[p];
+        }
+    }
+    return NULL;
+}
+
+// Where a vreg is defined; a parameter is defined before the entry's first
+// instruction, and a definition in an unreachable block is in no block.
+typedef struct def_site {
+    int block;
+    int inst;
+} def_site;
+
+static void check_use(loop_info* info, const int* defs, def_site* sites, bool* dominates_uses, sir_operand operand,
+                      int block, int inst) {
+    if (operand.kind != SIR_OPERAND_VREG || defs[operand.vreg] != 1) {
+        return;
+    }
+    def_site* site = &sites[operand.vreg];
+    bool dominated = site->block == block ? site->inst < inst
+                                          : site->block >= 0 && block_dominates(info, site->block, block);
+    if (!dominated) {
+        dominates_uses[operand.vreg] = false;
+    }
+}
+
+void find_definitions(loop_info* info, int* defs, bool* dominates_uses) {
+    sir_function* fn = info->fn;
+    def_site* sites = malloc((fn->num_vregs + 1) * sizeof(def_site));
+    for (size_t v = 0; v < fn->num_vregs; ++v) {
+        defs[v] = 0;
+        sites[v].block = -1;
+        dominates_uses[v] = true;
+    }
+    for (size_t i = 0; i < fn->num_params; ++i) {
+        defs[fn->params[i]]++;
+        sites[fn->params[i]].block = 0;
+        sites[fn->params[i]].inst = -1;
+    }
+    for (size_t i = 0; i < fn->num_blocks; ++i) {
+        sir_block* block = fn->blocks[i];
+        for (size_t j = 0; j < block->num_insts; ++j) {
+            int dst = block->insts[j].dst;
+            if (dst >= 0) {
+                defs[dst]++;
+                sites[dst].block = info->order_index[i] >= 0 ? (int)i : -1;
+                sites[dst].inst = (int)j;
+            }
+        }
+    }
+    for (size_t i = 0; i < fn->num_blocks; ++i) {
+        sir_block* block = fn->blocks[i];
+        for (size_t j = 0; j < block->num_insts; ++j) {
+            sir_inst* inst = &block->insts[j];
+            check_use(info, defs, sites, dominates_uses, inst->a, (int)i, (int)j);
+            check_use(info, defs, sites, dominates_uses, inst->b, (int)i, (int)j);
+            for (size_t k = 0; k < inst->num_args; ++k) {
+                check_use(info, defs, sites, dominates_uses, inst->args[k], (int)i, (int)j);
+            }
+        }
+    }
+    free(sites);
+}
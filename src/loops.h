@@ -0,0 +1,48 @@
+#ifndef LOOPS_H
+#define LOOPS_H
+
+#include "sir.h"
+
+// A natural loop: the header and every block that can reach one of the
+// header's back edges without passing through the header.
+typedef struct sir_loop {
+    sir_block* header;
+    bool* contains;             // indexed by block index
+    size_t num_blocks;
+    int parent;                 // innermost enclosing loop, -1 if none
+    int depth;                  // 1 for an outermost loop
+} sir_loop;
+
+// Dominators and loops of one function. Blocks are referred to by index,
+// so the analysis is only good until blocks are added or removed.
+// Unreachable blocks have no dominator and belong to no loop.
+typedef struct loop_info {
+    sir_function* fn;
+    int* idom;                  // immediate dominator, -1 for the entry
+    int* order;                 // reachable blocks in reverse postorder
+    int* order_index;           // position in order, -1 if unreachable
+    size_t num_reachable;
+    int* pred_start;            // predecessors of block i are
+    int* preds;                 // preds[pred_start[i] .. pred_start[i + 1])
+    sir_loop* loops;            // inner loops before the loops around them
+    size_t num_loops;
+} loop_info;
+
+loop_info* analyze_loops(sir_function* fn);
+bool block_dominates(loop_info* info, int a, int b);
+void free_loop_info(loop_info* info);
+
+// Gives every loop a preheader: a single block outside the loop that does
+// nothing but jump to the header. Returns the analysis of the result.
+loop_info* analyze_loops_with_preheaders(sir_function* fn);
+// The header's only predecessor outside the loop, once it has a preheader.
+sir_block* loop_preheader(loop_info* info, sir_loop* loop);
+
+// Counts the definitions of each vreg, a parameter counting as one, and
+// finds the vregs whose single definition is seen by every use. Only those
+// hold the same value wherever they are read; anywhere else a use may be
+// reading the value from before the definition, or from an earlier trip
+// round a loop. Both arrays have room for every vreg.
+void find_definitions(loop_info* info, int* defs, bool* dominates_uses);
+
+#endif // LOOPS_H
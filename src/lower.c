@@ -0,0 +1,642 @@
+#include "lower.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include "types.h"
+
+// A switch is dispatched over clusters of its sorted cases. A run of cases
+// becomes a jump table when at least SWITCH_TABLE_MIN_DENSITY percent of
+// its range has a case, or a few bit tests when it spans fewer than 32
+// values and goes to at most SWITCH_BIT_TEST_MAX_DESTS places. The clusters
+// are then searched with a balanced binary tree of compares.
+#define SWITCH_TABLE_MIN_CASES 4
+#define SWITCH_TABLE_MIN_DENSITY 40
+#define SWITCH_BIT_TEST_MAX_DESTS 3
+#define SWITCH_CHAIN_MAX_CASES 3
+
+// Every local becomes a vreg of its own for the whole function; scopes only
+// decide which vreg a name means at each point.
+typedef struct lower_local {
+    const char* name;
+    int vreg;
+} lower_local;
+
+// Each case label starts a block of its own.
+typedef struct lower_case {
+    int value;
+    sir_block* block;
+} lower_case;
+
+typedef struct lower_switch {
+    lower_case* cases;
+    size_t num_cases;
+    size_t max_cases;
+    sir_block* default_block;
+    sir_block* last_label;      // block the latest label started
+} lower_switch;
+
+typedef enum {
+    CLUSTER_CASE,       // a single case, one compare
+    CLUSTER_TABLE,      // a jump table over [low, high]
+    CLUSTER_BITS,       // one bit mask per destination over [low, high]
+} cluster_kind;
+
+typedef struct case_cluster {
+    cluster_kind kind;
+    lower_case* cases;
+    size_t num_cases;
+    int low;
+    int high;
+} case_cluster;
+
+typedef struct lowerer {
+    sir_program* program;
+    sir_function* fn;
+    sir_block* block;
+    lower_local* locals;
+    size_t num_locals;
+    size_t max_locals;
+    sir_block* break_target;
+    sir_block* continue_target;
+    lower_switch* current_switch;
+} lowerer;
+
+static int type_size(builtin_types type) {
+    switch (type) {
+        case CHAR:
+            return 1;
+        case INT:
+            return 4;
+        default:
+            fatal_error("Error: codegen does not support locals of type %s\n", type_tostring(type));
+    }
+}
+
+static void push_local(lowerer* l, const char* name, int vreg) {
+    if (l->num_locals == l->max_locals) {
+        l->max_locals = l->max_locals ? l->max_locals * 2 : 16;
+        l->locals = counted_realloc(ALLOC_IR, l->locals, l->max_locals * sizeof(lower_local));
+    }
+    l->locals[l->num_locals].name = name;
+    l->locals[l->num_locals].vreg = vreg;
+    l->num_locals++;
+}
+
+static int find_local(lowerer* l, const char* name) {
+    for (size_t i = l->num_locals; i > 0; --i) {
+        if (strcmp(l->locals[i - 1].name, name) == 0) {
+            return l->locals[i - 1].vreg;
+        }
+    }
+    return -1;
+}
+
+static sir_global* resolve_global(lowerer* l, const char* name) {
+    sir_global* global = find_sir_global(l->program, name);
+    if (global == NULL) {
+        fatal_error("Error: codegen could not resolve '%s' in function %s\n", name, l->fn->name);
+    }
+    return global;
+}
+
+static int new_temp(lowerer* l) {
+    return new_sir_vreg(l->fn, 4, NULL);
+}
+
+static sir_opcode binary_opcode(operator_type op) {
+    switch (op) {
+        case OP_ADD: return SIR_ADD;
+        case OP_SUBTRACT: return SIR_SUB;
+        case OP_MULTIPLY: return SIR_MUL;
+        case OP_DIVIDE: return SIR_DIV;
+        case OP_MODULO: return SIR_MOD;
+        case OP_EQUAL: return SIR_EQ;
+        case OP_NOT_EQUAL: return SIR_NE;
+        case OP_LESS: return SIR_LT;
+        case OP_LESS_EQUAL: return SIR_LE;
+        case OP_GREATER: return SIR_GT;
+        case OP_GREATER_EQUAL: return SIR_GE;
+        default:
+            fatal_error("Error: codegen does not support binary operator %s\n", op_ToString(op));
+    }
+}
+
+static sir_operand lower_expression(lowerer* l, ast_node* node);
+
+static sir_operand lower_call(lowerer* l, ast_call_expr_node* call) {
+    sir_operand* args = malloc((call->num_arguments + 1) * sizeof(sir_operand));
+    for (size_t i = 0; i < call->num_arguments; ++i) {
+        args[i] = lower_expression(l, call->arguments[i]);
+    }
+    bool is_void = call->value_type != NULL && ((const c_type*)call->value_type)->kind == TYPE_VOID;
+    int dst = is_void ? -1 : new_temp(l);
+    sir_inst* inst = sir_emit(l->block, SIR_CALL, dst, sir_none(), sir_none());
+    inst->symbol = call->function_name;
+    inst->args = args;
+    inst->num_args = call->num_arguments;
+    return dst >= 0 ? sir_vreg_operand(dst) : sir_imm_operand(0);
+}
+
+// Locals are used in place: nothing inside an expression can assign them.
+static sir_operand lower_expression(lowerer* l, ast_node* node) {
+    switch (node->type) {
+        case AST_LITERAL:
+            return sir_imm_operand((int)ast_literal_value(node));
+        case AST_IDENTIFIER: {
+            int vreg = find_local(l, node->value);
+            if (vreg >= 0) {
+                return sir_vreg_operand(vreg);
+            }
+            sir_global* global = resolve_global(l, node->value);
+            int dst = new_temp(l);
+            sir_emit(l->block, SIR_LOAD_GLOBAL, dst, sir_none(), sir_none())->symbol = global->name;
+            return sir_vreg_operand(dst);
+        }
+        case AST_BINARY_EXPR: {
+            ast_binary_expr_node* binary = (ast_binary_expr_node*)node;
+            sir_operand left = lower_expression(l, binary->left);
+            sir_operand right = lower_expression(l, binary->right);
+            int dst = new_temp(l);
+            sir_emit(l->block, binary_opcode(binary->op), dst, left, right);
+            return sir_vreg_operand(dst);
+        }
+        case AST_UNARY_EXPR: {
+            ast_unary_expr_node* unary = (ast_unary_expr_node*)node;
+            sir_operand operand = lower_expression(l, unary->operand);
+            if (unary->op == OP_ADD) {
+                return operand;
+            }
+            sir_opcode op;
+            if (unary->op == OP_SUBTRACT) {
+                op = SIR_NEG;
+            } else if (unary->op == OP_LOGICAL_NOT) {
+                op = SIR_NOT;
+            } else {
+                fatal_error("Error: codegen does not support unary operator %s\n", op_ToString(unary->op));
+            }
+            int dst = new_temp(l);
+            sir_emit(l->block, op, dst, operand, sir_none());
+            return sir_vreg_operand(dst);
+        }
+        case AST_CALL_EXPR:
+            return lower_call(l, (ast_call_expr_node*)node);
+        case AST_INDEX_EXPR: {
+            ast_index_expr_node* index = (ast_index_expr_node*)node;
+            sir_global* global = resolve_global(l, index->array->value);
+            sir_operand position = lower_expression(l, index->index);
+            int dst = new_temp(l);
+            sir_emit(l->block, SIR_LOAD_ELEM, dst, position, sir_none())->symbol = global->name;
+            return sir_vreg_operand(dst);
+        }
+        default:
+            fatal_error("Error: codegen does not support expression node %d\n", node->type);
+    }
+}
+
+static void lower_statement(lowerer* l, ast_node* node);
+
+static void lower_block(lowerer* l, ast_block_node* block) {
+    size_t scope_start = l->num_locals;
+    for (size_t i = 0; i < block->num_declarations; ++i) {
+        lower_statement(l, block->declarations[i]);
+    }
+    l->num_locals = scope_start;
+}
+
+static void jump_to(lowerer* l, sir_block* target) {
+    sir_emit(l->block, SIR_JUMP, -1, sir_none(), sir_none())->target = target;
+}
+
+// Loops are laid out with the test at the bottom, so each iteration takes
+// one branch and no jump:
+//
+//   init; jump test
+//   body: ...
+//   next: step
+//   test: branch cond, body, exit
+//   exit:
+//
+// A do-while enters at body instead, and its test is next. The blocks a
+// break or continue jumps to exist before the body is lowered and are moved
+// into place afterwards.
+static void lower_loop(lowerer* l, ast_loop_node* loop) {
+    size_t scope_start = l->num_locals;
+    sir_block* outer_break = l->break_target;
+    sir_block* outer_continue = l->continue_target;
+    if (loop->init != NULL) {
+        lower_statement(l, loop->init);
+    }
+
+    sir_block* body = new_sir_block(l->fn);
+    sir_block* next = new_sir_block(l->fn);
+    sir_block* test = loop->type == AST_DO_WHILE_STMT ? next : new_sir_block(l->fn);
+    sir_block* exit = new_sir_block(l->fn);
+    jump_to(l, loop->type == AST_DO_WHILE_STMT ? body : test);
+
+    l->block = body;
+    l->break_target = exit;
+    l->continue_target = next;
+    lower_statement(l, loop->body);
+    jump_to(l, next);
+
+    place_sir_block(l->fn, next);
+    l->block = next;
+    if (loop->step != NULL) {
+        lower_statement(l, loop->step);
+    }
+    if (test != next) {
+        jump_to(l, test);
+        place_sir_block(l->fn, test);
+        l->block = test;
+    }
+    if (loop->condition != NULL) {
+        sir_inst* branch = sir_emit(l->block, SIR_BRANCH, -1, lower_expression(l, loop->condition), sir_none());
+        branch->target = body;
+        branch->other = exit;
+    } else {
+        jump_to(l, body);
+    }
+
+    place_sir_block(l->fn, exit);
+    l->block = exit;
+    l->break_target = outer_break;
+    l->continue_target = outer_continue;
+    l->num_locals = scope_start;
+}
+
+static sir_operand emit_value(lowerer* l, sir_opcode op, sir_operand a, sir_operand b) {
+    int dst = new_temp(l);
+    sir_emit(l->block, op, dst, a, b);
+    return sir_vreg_operand(dst);
+}
+
+static void branch_on(lowerer* l, sir_operand condition, sir_block* target, sir_block* other) {
+    sir_inst* branch = sir_emit(l->block, SIR_BRANCH, -1, condition, sir_none());
+    branch->target = target;
+    branch->other = other;
+}
+
+static int compare_cases(const void* a, const void* b) {
+    int left = ((const lower_case*)a)->value;
+    int right = ((const lower_case*)b)->value;
+    return (left > right) - (left < right);
+}
+
+// The most leading cases that are dense enough for a table, or 0. No table
+// can reach past a range of count * 100 / SWITCH_TABLE_MIN_DENSITY, which
+// keeps sparse switches from being quadratic.
+static size_t table_extent(lower_case* cases, size_t count) {
+    size_t best = 0;
+    for (size_t n = 1; n <= count; ++n) {
+        long long range = (long long)cases[n - 1].value - cases[0].value + 1;
+        if (range * SWITCH_TABLE_MIN_DENSITY > (long long)count * 100) {
+            break;
+        }
+        if (n >= SWITCH_TABLE_MIN_CASES && range * SWITCH_TABLE_MIN_DENSITY <= (long long)n * 100) {
+            best = n;
+        }
+    }
+    return best;
+}
+
+// Bit tests pay off once they replace more compares than they take.
+static bool bit_tests_pay_off(size_t num_cases, size_t num_dests) {
+    return (num_dests == 1 && num_cases >= 3) || (num_dests == 2 && num_cases >= 5) ||
+           (num_dests == 3 && num_cases >= 6);
+}
+
+// The most leading cases that one set of bit tests can cover, or 0.
+static size_t bit_test_extent(lower_case* cases, size_t count) {
+    sir_block* dests[SWITCH_BIT_TEST_MAX_DESTS];
+    size_t num_dests = 0;
+    size_t best = 0;
+    for (size_t n = 0; n < count && (long long)cases[n].value - cases[0].value < 32; ++n) {
+        size_t d = 0;
+        while (d < num_dests && dests[d] != cases[n].block) {
+            ++d;
+        }
+        if (d == num_dests) {
+            if (num_dests == SWITCH_BIT_TEST_MAX_DESTS) {
+                break;
+            }
+            dests[num_dests++] = cases[n].block;
+        }
+        if (bit_tests_pay_off(n + 1, num_dests)) {
+            best = n + 1;
+        }
+    }
+    return best;
+}
+
+// Greedy from the smallest case: bit tests when they cover at least what a
+// table would, since they need no memory, then a table, then a lone case.
+static size_t find_clusters(lower_case* cases, size_t count, case_cluster* clusters) {
+    size_t num_clusters = 0;
+    for (size_t i = 0; i < count;) {
+        size_t table = table_extent(cases + i, count - i);
+        size_t bits = bit_test_extent(cases + i, count - i);
+        case_cluster* cluster = &clusters[num_clusters++];
+        cluster->kind = CLUSTER_CASE;
+        cluster->num_cases = 1;
+        if (bits > 0 && bits >= table) {
+            cluster->kind = CLUSTER_BITS;
+            cluster->num_cases = bits;
+        } else if (table > 0) {
+            cluster->kind = CLUSTER_TABLE;
+            cluster->num_cases = table;
+        }
+        cluster->cases = cases + i;
+        cluster->low = cases[i].value;
+        cluster->high = cases[i + cluster->num_cases - 1].value;
+        i += cluster->num_cases;
+    }
+    return num_clusters;
+}
+
+// value is known to lie in [low_bound, high_bound], so a cluster covering
+// all of that needs no range check. Tables and bit tests index from the
+// cluster's low value; one unsigned compare of the rebased value checks
+// both ends of its range.
+static void lower_cluster(lowerer* l, sir_operand value, case_cluster* cluster, sir_block* otherwise,
+                          long long low_bound, long long high_bound) {
+    if (cluster->kind == CLUSTER_CASE) {
+        if (low_bound == high_bound) {
+            jump_to(l, cluster->cases[0].block);
+        } else {
+            branch_on(l, emit_value(l, SIR_EQ, value, sir_imm_operand(cluster->low)), cluster->cases[0].block,
+                      otherwise);
+        }
+        return;
+    }
+
+    sir_operand index = value;
+    if (cluster->low != 0) {
+        index = emit_value(l, SIR_SUB, value, sir_imm_operand(cluster->low));
+    }
+    size_t range = (size_t)((long long)cluster->high - cluster->low + 1);
+    if (low_bound < cluster->low || high_bound > cluster->high) {
+        sir_block* in_range = new_sir_block(l->fn);
+        branch_on(l, emit_value(l, SIR_ULT, index, sir_imm_operand((int)range)), in_range, otherwise);
+        l->block = in_range;
+    }
+
+    if (cluster->kind == CLUSTER_TABLE) {
+        sir_block** table = malloc(range * sizeof(sir_block*));
+        for (size_t k = 0; k < range; ++k) {
+            table[k] = otherwise;
+        }
+        for (size_t k = 0; k < cluster->num_cases; ++k) {
+            table[(long long)cluster->cases[k].value - cluster->low] = cluster->cases[k].block;
+        }
+        sir_inst* jump = sir_emit(l->block, SIR_JUMP_TABLE, -1, index, sir_none());
+        jump->table = table;
+        jump->table_size = range;
+        return;
+    }
+
+    // One test per destination, in the order they first appear.
+    bool* done = calloc(cluster->num_cases, sizeof(bool));
+    for (size_t k = 0; k < cluster->num_cases; ++k) {
+        if (done[k]) {
+            continue;
+        }
+        sir_block* dest = cluster->cases[k].block;
+        unsigned int mask = 0;
+        bool is_last = true;
+        for (size_t m = k; m < cluster->num_cases; ++m) {
+            if (cluster->cases[m].block == dest) {
+                mask |= 1u << (cluster->cases[m].value - cluster->low);
+                done[m] = true;
+            } else if (!done[m]) {
+                is_last = false;
+            }
+        }
+        sir_block* next = is_last ? otherwise : new_sir_block(l->fn);
+        branch_on(l, emit_value(l, SIR_BIT_TEST, index, sir_imm_operand((int)mask)), dest, next);
+        l->block = next;
+    }
+    free(done);
+}
+
+static void lower_clusters(lowerer* l, sir_operand value, case_cluster* clusters, size_t count,
+                           sir_block* otherwise, long long low_bound, long long high_bound) {
+    if (count == 0) {
+        jump_to(l, otherwise);
+        return;
+    }
+    bool all_cases = true;
+    for (size_t i = 0; i < count; ++i) {
+        all_cases &= clusters[i].kind == CLUSTER_CASE;
+    }
+    if (count == 1 || (all_cases && count <= SWITCH_CHAIN_MAX_CASES)) {
+        for (size_t i = 0; i + 1 < count; ++i) {
+            sir_block* next = new_sir_block(l->fn);
+            lower_cluster(l, value, &clusters[i], next, low_bound, high_bound);
+            l->block = next;
+        }
+        lower_cluster(l, value, &clusters[count - 1], otherwise, low_bound, high_bound);
+        return;
+    }
+
+    size_t mid = count / 2;
+    int pivot = clusters[mid].low;
+    sir_block* left = new_sir_block(l->fn);
+    sir_block* right = new_sir_block(l->fn);
+    branch_on(l, emit_value(l, SIR_LT, value, sir_imm_operand(pivot)), left, right);
+    l->block = left;
+    lower_clusters(l, value, clusters, mid, otherwise, low_bound, (long long)pivot - 1);
+    l->block = right;
+    lower_clusters(l, value, clusters + mid, count - mid, otherwise, pivot, high_bound);
+}
+
+// The dispatch goes after the body, once all of its case labels are known:
+//
+//   cond; jump dispatch
+//   body: ...; jump exit
+//   dispatch: clusters of cases, searched as a balanced tree
+//   exit:
+//
+// break leaves for exit; continue still belongs to the enclosing loop.
+static void lower_switch_stmt(lowerer* l, ast_switch_node* node) {
+    sir_operand value = lower_expression(l, node->condition);
+    sir_block* dispatch = new_sir_block(l->fn);
+    sir_block* exit = new_sir_block(l->fn);
+    jump_to(l, dispatch);
+
+    lower_switch* outer_switch = l->current_switch;
+    sir_block* outer_break = l->break_target;
+    lower_switch cases = { NULL, 0, 0, NULL, NULL };
+    l->current_switch = &cases;
+    l->break_target = exit;
+    // Whatever comes before the first label is unreachable.
+    l->block = new_sir_block(l->fn);
+    lower_statement(l, node->body);
+    jump_to(l, exit);
+    l->current_switch = outer_switch;
+    l->break_target = outer_break;
+
+    place_sir_block(l->fn, dispatch);
+    l->block = dispatch;
+    if (cases.num_cases > 1) {
+        qsort(cases.cases, cases.num_cases, sizeof(lower_case), compare_cases);
+    }
+    case_cluster* clusters = malloc((cases.num_cases + 1) * sizeof(case_cluster));
+    size_t num_clusters = find_clusters(cases.cases, cases.num_cases, clusters);
+    lower_clusters(l, value, clusters, num_clusters, cases.default_block ? cases.default_block : exit, INT_MIN,
+                   INT_MAX);
+    free(clusters);
+    counted_free(ALLOC_IR, cases.cases);
+
+    place_sir_block(l->fn, exit);
+    l->block = exit;
+}
+
+static void lower_case_label(lowerer* l, ast_case_node* node) {
+    lower_switch* current = l->current_switch;
+    if (current == NULL) {
+        fatal_error("Error: codegen found a case label outside of a switch in function %s\n", l->fn->name);
+    }
+    // Labels in a row share their block, so that they count as one
+    // destination when the cases are clustered.
+    sir_block* block = l->block;
+    if (block != current->last_label || block->num_insts > 0) {
+        block = new_sir_block(l->fn);
+        jump_to(l, block);
+        l->block = block;
+        current->last_label = block;
+    }
+    if (node->value == NULL) {
+        current->default_block = block;
+        return;
+    }
+    if (current->num_cases == current->max_cases) {
+        current->max_cases = current->max_cases ? current->max_cases * 2 : 16;
+        current->cases = counted_realloc(ALLOC_IR, current->cases, current->max_cases * sizeof(lower_case));
+    }
+    current->cases[current->num_cases].value = (int)ast_eval_constant(node->value);
+    current->cases[current->num_cases].block = block;
+    current->num_cases++;
+}
+
+static void lower_statement(lowerer* l, ast_node* node) {
+    switch (node->type) {
+        case AST_VARIABLE_DECL: {
+            ast_variable_decl_node* var_decl = (ast_variable_decl_node*)node;
+            const char* name = var_decl->identifier_node->value;
+            sir_operand value = sir_none();
+            if (var_decl->value != NULL) {
+                value = lower_expression(l, var_decl->value);
+            }
+            int vreg = new_sir_vreg(l->fn, type_size(var_decl->type_node), name);
+            if (var_decl->value != NULL) {
+                sir_emit(l->block, SIR_COPY, vreg, value, sir_none());
+            }
+            push_local(l, name, vreg);
+            break;
+        }
+        case AST_ASSIGNMENT: {
+            ast_assignment_node* assignment = (ast_assignment_node*)node;
+            const char* name = assignment->identifier_node->value;
+            sir_operand value = lower_expression(l, assignment->value);
+            int vreg = find_local(l, name);
+            if (assignment->index != NULL) {
+                sir_global* global = resolve_global(l, name);
+                sir_operand position = lower_expression(l, assignment->index);
+                sir_emit(l->block, SIR_STORE_ELEM, -1, position, value)->symbol = global->name;
+            } else if (vreg >= 0) {
+                sir_emit(l->block, SIR_COPY, vreg, value, sir_none());
+            } else {
+                sir_emit(l->block, SIR_STORE_GLOBAL, -1, value, sir_none())->symbol = resolve_global(l, name)->name;
+            }
+            break;
+        }
+        case AST_RETURN_STMT: {
+            ast_return_node* return_stmt = (ast_return_node*)node;
+            sir_operand value = sir_none();
+            if (return_stmt->expr != NULL) {
+                value = lower_expression(l, return_stmt->expr);
+            }
+            // A char function's result is converted like any other store.
+            if (l->fn->return_size == 1 && value.kind != SIR_OPERAND_NONE) {
+                int narrowed = new_sir_vreg(l->fn, 1, NULL);
+                sir_emit(l->block, SIR_COPY, narrowed, value, sir_none());
+                value = sir_vreg_operand(narrowed);
+            }
+            if (l->fn->return_size == 0) {
+                value = sir_none();
+            }
+            sir_emit(l->block, SIR_RETURN, -1, value, sir_none());
+            // Whatever follows is unreachable, but still needs a block.
+            l->block = new_sir_block(l->fn);
+            break;
+        }
+        case AST_BLOCK:
+            lower_block(l, (ast_block_node*)node);
+            break;
+        case AST_CALL_EXPR:
+            lower_call(l, (ast_call_expr_node*)node);
+            break;
+        case AST_WHILE_STMT:
+        case AST_DO_WHILE_STMT:
+        case AST_FOR_STMT:
+            lower_loop(l, (ast_loop_node*)node);
+            break;
+        case AST_SWITCH_STMT:
+            lower_switch_stmt(l, (ast_switch_node*)node);
+            break;
+        case AST_CASE_LABEL:
+            lower_case_label(l, (ast_case_node*)node);
+            break;
+        case AST_BREAK_STMT:
+        case AST_CONTINUE_STMT:
+            jump_to(l, node->type == AST_BREAK_STMT ? l->break_target : l->continue_target);
+            l->block = new_sir_block(l->fn);
+            break;
+        default:
+            fatal_error("Error: codegen does not support statement node %d\n", node->type);
+    }
+}
+
+static void lower_function(sir_program* program, ast_function_decl_node* function_decl) {
+    sir_function* fn = create_sir_function(function_decl->function_name);
+    add_sir_function(program, fn);
+    fn->return_size = function_decl->return_type == VOID ? 0 : type_size(function_decl->return_type);
+    lowerer l = { program, fn, new_sir_block(fn), NULL, 0, 0, NULL, NULL, NULL };
+
+    fn->params = malloc((function_decl->num_parameters + 1) * sizeof(int));
+    for (size_t i = 0; i < function_decl->num_parameters; ++i) {
+        ast_variable_decl_node* param = (ast_variable_decl_node*)function_decl->parameters[i];
+        const char* name = param->identifier_node->value;
+        int vreg = new_sir_vreg(fn, type_size(param->type_node), name);
+        fn->params[fn->num_params++] = vreg;
+        push_local(&l, name, vreg);
+    }
+
+    lower_block(&l, function_decl->body);
+
+    // Falling off the end of a function returns 0, which is what main needs.
+    sir_emit(l.block, SIR_RETURN, -1, fn->return_size ? sir_imm_operand(0) : sir_none(), sir_none());
+
+    counted_free(ALLOC_IR, l.locals);
+}
+
+void lower_program(ast_program_node* program, sir_program* sir) {
+    for (size_t i = 0; i < program->num_declarations; ++i) {
+        ast_node* declaration = program->declarations[i];
+        if (declaration->type == AST_VARIABLE_DECL) {
+            ast_variable_decl_node* var_decl = (ast_variable_decl_node*)declaration;
+            int size = type_size(var_decl->type_node);
+            if (var_decl->array_length > 0) {
+                add_sir_array(sir, var_decl->identifier_node->value, size, var_decl->array_length,
+                              var_decl->is_constant);
+                continue;
+            }
+            long long value = var_decl->value != NULL ? ast_eval_constant(var_decl->value) : 0;
+            add_sir_global(sir, var_decl->identifier_node->value, size, value, var_decl->is_constant);
+        } else if (declaration->type == AST_FUNCTION_DECL) {
+            lower_function(sir, (ast_function_decl_node*)declaration);
+        } else {
+            fatal_error("Error: codegen does not support global declaration node %d\n", declaration->type);
+        }
+    }
+}
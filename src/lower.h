@@ -0,0 +1,11 @@
+#ifndef LOWER_H
+#define LOWER_H
+
+#include "ast.h"
+#include "sir.h"
+
+// Translates a type-checked program into SIR, adding to sir as it goes so
+// that a fatal error leaves nothing that sir does not own.
+void lower_program(ast_program_node* program, sir_program* sir);
+
+#endif // LOWER_H
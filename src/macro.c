@@ -0,0 +1,544 @@
+#include "macro.h"
+
+#include "hash.h"
+
+#define MACRO_ARENA_BLOCK_SIZE (64 * 1024)
+
+typedef struct token_sink {
+    token** tokens;
+    int* num_tokens;
+    int* max_tokens;
+} token_sink;
+
+bool is_pp_directive(const token* t) {
+    return t->kind >= PP_INCLUDE && t->kind <= PP_UNKNOWN && (t->flags & TOKEN_AT_LINE_START);
+}
+
+bool is_pp_identifier(tag kind) {
+    return kind == IDENTIFIER || (kind >= KW_INT && kind <= KW_CONST);
+}
+
+// Bump allocator for definitions, hide-sets and pasted tokens. Everything
+// lives until the translation unit is done.
+static void* arena_alloc(macro_table* table, size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    macro_arena_block* block = table->arena;
+    if (block == NULL || block->size - block->used < size) {
+        size_t block_size = size > MACRO_ARENA_BLOCK_SIZE ? size : MACRO_ARENA_BLOCK_SIZE;
+        block = counted_malloc(ALLOC_LEXER, sizeof(macro_arena_block) + block_size);
+        if (block == NULL) {
+            fatal_error("Error: Failed to allocate memory for macros!\n");
+        }
+        block->next = table->arena;
+        block->used = 0;
+        block->size = block_size;
+        table->arena = block;
+    }
+    void* p = block->data + block->used;
+    block->used += size;
+    return p;
+}
+
+static char* arena_strdup(macro_table* table, const char* str, size_t length) {
+    char* copy = arena_alloc(table, length + 1);
+    memcpy(copy, str, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+static void stack_push(pp_token_stack* stack, pp_token t) {
+    if (stack->length == stack->capacity) {
+        stack->capacity = stack->capacity ? stack->capacity * 2 : 256;
+        stack->items = counted_realloc(ALLOC_LEXER, stack->items, stack->capacity * sizeof(pp_token));
+        if (stack->items == NULL) {
+            fatal_error("Error: Failed to allocate memory for macro expansion!\n");
+        }
+    }
+    stack->items[stack->length++] = t;
+}
+
+void init_macro_table(macro_table* table) {
+    memset(table, 0, sizeof(*table));
+    table->capacity = 256;
+    table->slots = calloc(table->capacity, sizeof(pp_macro*));
+    if (table->slots == NULL) {
+        fatal_error("Error: Failed to allocate memory for macros!\n");
+    }
+}
+
+void free_macro_table(macro_table* table) {
+    while (table->arena != NULL) {
+        macro_arena_block* next = table->arena->next;
+        free(table->arena);
+        table->arena = next;
+    }
+    free(table->slots);
+    free(table->pending.items);
+    free(table->scratch.items);
+    free(table->args.items);
+    free_buffer(&table->spelling);
+}
+
+static pp_macro** find_macro_slot(macro_table* table, const char* name) {
+    size_t mask = table->capacity - 1;
+    size_t i = (size_t)hash_string(name, 0) & mask;
+    while (table->slots[i] != NULL && strcmp(table->slots[i]->name, name) != 0) {
+        i = (i + 1) & mask;
+    }
+    return &table->slots[i];
+}
+
+static void grow_macro_table(macro_table* table) {
+    pp_macro** old_slots = table->slots;
+    size_t old_capacity = table->capacity;
+    table->capacity *= 2;
+    table->slots = calloc(table->capacity, sizeof(pp_macro*));
+    if (table->slots == NULL) {
+        fatal_error("Error: Failed to allocate memory for macros!\n");
+    }
+    for (size_t i = 0; i < old_capacity; ++i) {
+        if (old_slots[i] != NULL) {
+            *find_macro_slot(table, old_slots[i]->name) = old_slots[i];
+        }
+    }
+    free(old_slots);
+}
+
+pp_macro* lookup_macro(macro_table* table, const char* name) {
+    pp_macro* macro = *find_macro_slot(table, name);
+    return macro != NULL && macro->defined ? macro : NULL;
+}
+
+// #undef keeps the slot so a later #define reuses it.
+void undefine_macro(macro_table* table, const char* name) {
+    pp_macro* macro = *find_macro_slot(table, name);
+    if (macro != NULL) {
+        macro->defined = false;
+    }
+}
+
+static int find_param(const pp_macro* macro, const char* name) {
+    for (int i = 0; i < macro->num_params; ++i) {
+        if (strcmp(macro->params[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// tokens[start] is the #define; the directive runs to end.
+void define_macro(macro_table* table, const char* path, const token* tokens, int start, int end) {
+    if (start + 1 >= end || !is_pp_identifier(tokens[start + 1].kind)) {
+        fatal_error("Error: %s:%d: macro name missing in #define\n", path, tokens[start].line);
+    }
+    const token* name = &tokens[start + 1];
+    pp_macro** slot = find_macro_slot(table, name->lexme);
+    pp_macro* macro = *slot;
+    if (macro == NULL) {
+        macro = arena_alloc(table, sizeof(pp_macro));
+        macro->name = name->lexme;
+        macro->mark = 0;
+        *slot = macro;
+        if (++table->num_macros * 2 > table->capacity) {
+            grow_macro_table(table);
+        }
+    }
+    macro->tokens = tokens;
+    macro->params = NULL;
+    macro->num_params = 0;
+    macro->param_index = NULL;
+    macro->function_like = false;
+    macro->variadic = false;
+
+    int body = start + 2;
+    if (body < end && tokens[body].kind == LPAREN && !(tokens[body].flags & TOKEN_AFTER_SPACE)) {
+        const char* params[MACRO_MAX_PARAMS];
+        int num_params = 0;
+        int i = body + 1;
+        macro->function_like = true;
+        while (i < end && tokens[i].kind != RPAREN) {
+            if (num_params == MACRO_MAX_PARAMS) {
+                fatal_error("Error: %s:%d: too many parameters for macro '%s'\n", path, name->line, name->lexme);
+            }
+            if (i + 2 < end && tokens[i].kind == DOT && tokens[i + 1].kind == DOT && tokens[i + 2].kind == DOT) {
+                params[num_params++] = "__VA_ARGS__";
+                macro->variadic = true;
+                i += 3;
+            } else if (is_pp_identifier(tokens[i].kind)) {
+                params[num_params++] = tokens[i].lexme;
+                i++;
+            } else {
+                break;
+            }
+            if (macro->variadic || i >= end || tokens[i].kind != COMMA) {
+                break;
+            }
+            i++;
+        }
+        if (i >= end || tokens[i].kind != RPAREN) {
+            fatal_error("Error: %s:%d: malformed parameter list for macro '%s'\n", path, name->line, name->lexme);
+        }
+        body = i + 1;
+        macro->num_params = num_params;
+        macro->params = arena_alloc(table, num_params * sizeof(char*) + 1);
+        memcpy(macro->params, params, num_params * sizeof(char*));
+    }
+    macro->body_start = body;
+    macro->body_end = end;
+
+    // Parameter references are resolved once here instead of per expansion.
+    if (macro->function_like && end > body) {
+        macro->param_index = arena_alloc(table, (size_t)(end - body));
+        for (int i = body; i < end; ++i) {
+            macro->param_index[i - body] = is_pp_identifier(tokens[i].kind) ? (signed char)find_param(macro, tokens[i].lexme) : -1;
+        }
+        for (int i = body; i < end; ++i) {
+            if (tokens[i].kind == HASH && (i + 1 >= end || macro->param_index[i + 1 - body] < 0)) {
+                fatal_error("Error: %s:%d: '#' is not followed by a macro parameter\n", path, tokens[i].line);
+            }
+        }
+    }
+    if (end > body && (tokens[body].kind == HASH_HASH || tokens[end - 1].kind == HASH_HASH)) {
+        fatal_error("Error: %s:%d: '##' cannot appear at either end of a macro expansion\n", path, name->line);
+    }
+    macro->defined = true;
+}
+
+token* make_pp_token(macro_table* table, const char* lexme, tag kind, int line) {
+    token* t = arena_alloc(table, sizeof(token));
+    t->lexme = arena_strdup(table, lexme, strlen(lexme));
+    t->kind = kind;
+    t->line = line;
+    t->flags = 0;
+    return t;
+}
+
+static bool hideset_contains(const pp_hideset* hideset, const pp_macro* macro) {
+    for (; hideset != NULL; hideset = hideset->next) {
+        if (hideset->macro == macro) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static pp_hideset* hideset_add(macro_table* table, pp_hideset* hideset, const pp_macro* macro) {
+    if (hideset_contains(hideset, macro)) {
+        return hideset;
+    }
+    pp_hideset* node = arena_alloc(table, sizeof(pp_hideset));
+    node->macro = macro;
+    node->next = hideset;
+    return node;
+}
+
+// Marks every macro of a hide-set with a fresh generation so membership
+// tests during a union or intersection are O(1) instead of a list walk.
+static unsigned int mark_hideset(macro_table* table, const pp_hideset* hideset) {
+    unsigned int mark = ++table->generation;
+    for (; hideset != NULL; hideset = hideset->next) {
+        ((pp_macro*) hideset->macro)->mark = mark;
+    }
+    return mark;
+}
+
+static pp_hideset* hideset_union(macro_table* table, pp_hideset* a, pp_hideset* b) {
+    if (a == NULL || a == b) {
+        return b;
+    }
+    if (b == NULL) {
+        return a;
+    }
+    unsigned int mark = mark_hideset(table, b);
+    for (; a != NULL; a = a->next) {
+        if (a->macro->mark != mark) {
+            pp_hideset* node = arena_alloc(table, sizeof(pp_hideset));
+            node->macro = a->macro;
+            node->next = b;
+            b = node;
+        }
+    }
+    return b;
+}
+
+static pp_hideset* hideset_intersect(macro_table* table, pp_hideset* a, pp_hideset* b) {
+    if (a == b) {
+        return a;
+    }
+    if (a == NULL || b == NULL) {
+        return NULL;
+    }
+    unsigned int mark = mark_hideset(table, b);
+    pp_hideset* result = NULL;
+    for (; a != NULL; a = a->next) {
+        if (a->macro->mark == mark) {
+            pp_hideset* node = arena_alloc(table, sizeof(pp_hideset));
+            node->macro = a->macro;
+            node->next = result;
+            result = node;
+        }
+    }
+    return result;
+}
+
+static bool next_token(macro_table* table, macro_input* in, pp_token* out) {
+    if (table->pending.length > in->pending_base) {
+        *out = table->pending.items[--table->pending.length];
+        return true;
+    }
+    if (in->tokens != NULL && in->index < in->end && !is_pp_directive(&in->tokens[in->index])) {
+        out->tok = &in->tokens[in->index++];
+        out->hideset = NULL;
+        return true;
+    }
+    return false;
+}
+
+static const token* peek_token(macro_table* table, macro_input* in) {
+    if (table->pending.length > in->pending_base) {
+        return table->pending.items[table->pending.length - 1].tok;
+    }
+    if (in->tokens != NULL && in->index < in->end && !is_pp_directive(&in->tokens[in->index])) {
+        return &in->tokens[in->index];
+    }
+    return NULL;
+}
+
+static void sink_token(macro_table* table, token_sink* sink, pp_token t) {
+    if (sink == NULL) {
+        stack_push(&table->scratch, t);
+        return;
+    }
+    if (*sink->num_tokens == *sink->max_tokens) {
+        resize_tokens(sink->tokens, sink->max_tokens);
+    }
+    (*sink->tokens)[(*sink->num_tokens)++] = *t.tok;
+}
+
+// Reads "( args )" after a function-like macro name onto the args stack.
+// bounds[i]..bounds[i + 1] delimits argument i.
+static void collect_args(macro_table* table, macro_input* in, const pp_macro* macro, const token* name,
+                         size_t* bounds, pp_token* rparen) {
+    pp_token t;
+    next_token(table, in, &t);
+
+    int num_args = 0;
+    int depth = 0;
+    bounds[0] = table->args.length;
+    for (;;) {
+        if (!next_token(table, in, &t)) {
+            fatal_error("Error: %s:%d: unterminated argument list invoking macro '%s'\n", in->path, name->line, macro->name);
+        }
+        tag kind = t.tok->kind;
+        if (depth == 0 && kind == RPAREN) {
+            *rparen = t;
+            break;
+        }
+        // Commas inside __VA_ARGS__ belong to the argument.
+        if (depth == 0 && kind == COMMA && !(macro->variadic && num_args == macro->num_params - 1)) {
+            if (num_args + 1 >= MACRO_MAX_PARAMS) {
+                fatal_error("Error: %s:%d: too many arguments invoking macro '%s'\n", in->path, name->line, macro->name);
+            }
+            bounds[++num_args] = table->args.length;
+            continue;
+        }
+        if (kind == LPAREN) {
+            depth++;
+        } else if (kind == RPAREN) {
+            depth--;
+        }
+        stack_push(&table->args, t);
+    }
+    bounds[++num_args] = table->args.length;
+
+    if (macro->num_params == 0 && num_args == 1 && bounds[1] == bounds[0]) {
+        num_args = 0;
+    }
+    if (macro->variadic && num_args == macro->num_params - 1) {
+        bounds[num_args + 1] = bounds[num_args];
+        num_args++;
+    }
+    if (num_args != macro->num_params) {
+        fatal_error("Error: %s:%d: macro '%s' expects %d arguments, got %d\n", in->path, name->line,
+                    macro->name, macro->num_params, num_args);
+    }
+}
+
+static void spell_token(buffer* out, const token* t) {
+    if (t->kind == STRING || t->kind == CHARACTER) {
+        char quote = t->kind == STRING ? '"' : '\'';
+        buffer_putc(out, quote);
+        buffer_puts(out, t->lexme);
+        buffer_putc(out, quote);
+    } else if (t->lexme != NULL) {
+        buffer_puts(out, t->lexme);
+    }
+}
+
+// # param: the argument's spelling as a string literal. STRING lexemes keep
+// their source escapes, so quotes and backslashes of nested literals are
+// escaped once more.
+static pp_token stringize(macro_table* table, size_t from, size_t to, int line) {
+    buffer* text = &table->spelling;
+    text->length = 0;
+    for (size_t i = from; i < to; ++i) {
+        const token* t = table->args.items[i].tok;
+        if (i > from && (t->flags & TOKEN_AFTER_SPACE)) {
+            buffer_putc(text, ' ');
+        }
+        if (t->kind == STRING || t->kind == CHARACTER) {
+            char quote = t->kind == STRING ? '"' : '\'';
+            buffer_puts(text, quote == '"' ? "\\\"" : "'");
+            for (const char* c = t->lexme; *c; ++c) {
+                if (*c == '"' || *c == '\\') {
+                    buffer_putc(text, '\\');
+                }
+                buffer_putc(text, *c);
+            }
+            buffer_puts(text, quote == '"' ? "\\\"" : "'");
+        } else {
+            spell_token(text, t);
+        }
+    }
+    buffer_putc(text, '\0');
+    pp_token result = {make_pp_token(table, text->data, STRING, line), NULL};
+    return result;
+}
+
+// a ## b: glues rhs onto the last token of the expansion being built and
+// relexes the result, which must be a single token.
+static void paste_token(macro_table* table, size_t base, pp_token rhs, const char* path) {
+    if (table->scratch.length == base) {
+        stack_push(&table->scratch, rhs);
+        return;
+    }
+    pp_token* lhs = &table->scratch.items[table->scratch.length - 1];
+    buffer* text = &table->spelling;
+    text->length = 0;
+    spell_token(text, lhs->tok);
+    spell_token(text, rhs.tok);
+    buffer_putc(text, '\0');
+
+    bool word = text->length > 1;
+    for (const char* c = text->data; *c; ++c) {
+        word = word && (is_alnum(*c) || *c == '_');
+    }
+    tag kind;
+    if (word) {
+        kind = is_digit(text->data[0]) ? NUMBER : get_keyword(text->data);
+    } else {
+        lexer l = init_lexer_from_source("<paste>", text->data);
+        token* tokens = tokenizer(&l);
+        if (l.tokens_count != 2) {
+            fatal_error("Error: %s:%d: pasting \"%s\" and \"%s\" does not give a valid token\n", path,
+                        lhs->tok->line, lhs->tok->lexme, rhs.tok->lexme);
+        }
+        kind = tokens[0].kind;
+        free(tokens[0].lexme);
+        free(tokens);
+    }
+    lhs->tok = make_pp_token(table, text->data, kind, lhs->tok->line);
+}
+
+static void expand_input(macro_table* table, macro_input* in, token_sink* sink);
+
+// Fully expands one argument on its own, appending the result to scratch.
+static void expand_argument(macro_table* table, size_t from, size_t to, const char* path) {
+    macro_input arg = {NULL, 0, 0, table->pending.length, path};
+    for (size_t i = to; i > from; --i) {
+        stack_push(&table->pending, table->args.items[i - 1]);
+    }
+    expand_input(table, &arg, NULL);
+}
+
+// Builds the replacement list on scratch, adds the hide-set to every token
+// and pushes the result back onto the input so it is rescanned.
+static void substitute(macro_table* table, macro_input* in, const pp_macro* macro, const size_t* bounds,
+                       pp_hideset* hideset, int line) {
+    size_t base = table->scratch.length;
+    for (int i = macro->body_start; i < macro->body_end; ++i) {
+        const token* t = &macro->tokens[i];
+        int param = macro->param_index ? macro->param_index[i - macro->body_start] : -1;
+        int next_param = macro->param_index && i + 1 < macro->body_end ? macro->param_index[i + 1 - macro->body_start] : -1;
+
+        if (macro->function_like && t->kind == HASH) {
+            stack_push(&table->scratch, stringize(table, bounds[next_param], bounds[next_param + 1], line));
+            i++;
+        } else if (t->kind == HASH_HASH) {
+            if (next_param >= 0) {
+                // An empty argument is a placemarker: nothing is pasted.
+                size_t from = bounds[next_param];
+                size_t to = bounds[next_param + 1];
+                if (from < to) {
+                    paste_token(table, base, table->args.items[from], in->path);
+                    for (size_t a = from + 1; a < to; ++a) {
+                        stack_push(&table->scratch, table->args.items[a]);
+                    }
+                }
+            } else {
+                pp_token rhs = {&macro->tokens[i + 1], NULL};
+                paste_token(table, base, rhs, in->path);
+            }
+            i++;
+        } else if (param >= 0) {
+            bool pasted = i + 1 < macro->body_end && macro->tokens[i + 1].kind == HASH_HASH;
+            if (pasted) {
+                for (size_t a = bounds[param]; a < bounds[param + 1]; ++a) {
+                    stack_push(&table->scratch, table->args.items[a]);
+                }
+            } else {
+                expand_argument(table, bounds[param], bounds[param + 1], in->path);
+            }
+        } else {
+            pp_token body = {t, NULL};
+            stack_push(&table->scratch, body);
+        }
+    }
+
+    pp_hideset* last_in = NULL;
+    pp_hideset* last_out = hideset;
+    for (size_t i = table->scratch.length; i > base; --i) {
+        pp_token t = table->scratch.items[i - 1];
+        if (t.hideset != last_in) {
+            last_in = t.hideset;
+            last_out = hideset_union(table, t.hideset, hideset);
+        }
+        t.hideset = last_out;
+        stack_push(&table->pending, t);
+    }
+    table->scratch.length = base;
+}
+
+static void expand_input(macro_table* table, macro_input* in, token_sink* sink) {
+    pp_token t;
+    while (next_token(table, in, &t)) {
+        pp_macro* macro = is_pp_identifier(t.tok->kind) ? lookup_macro(table, t.tok->lexme) : NULL;
+        if (macro == NULL || hideset_contains(t.hideset, macro)) {
+            sink_token(table, sink, t);
+            continue;
+        }
+        if (!macro->function_like) {
+            substitute(table, in, macro, NULL, hideset_add(table, t.hideset, macro), t.tok->line);
+            continue;
+        }
+
+        const token* next = peek_token(table, in);
+        if (next == NULL || next->kind != LPAREN) {
+            sink_token(table, sink, t);
+            continue;
+        }
+        size_t bounds[MACRO_MAX_PARAMS + 1];
+        pp_token rparen;
+        collect_args(table, in, macro, t.tok, bounds, &rparen);
+        pp_hideset* hideset = hideset_add(table, hideset_intersect(table, t.hideset, rparen.hideset), macro);
+        substitute(table, in, macro, bounds, hideset, t.tok->line);
+        table->args.length = bounds[0];
+    }
+}
+
+// Expands the input until it runs into a directive or its end, appending
+// the result to out.
+void expand_macros(macro_table* table, macro_input* in, token** out, int* num_out, int* max_out) {
+    token_sink sink = {out, num_out, max_out};
+    expand_input(table, in, &sink);
+}
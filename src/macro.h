@@ -0,0 +1,86 @@
+#ifndef MACRO_H
+#define MACRO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "lexer.h"
+#include "buffer.h"
+
+#define MACRO_MAX_PARAMS 127
+
+// A definition is a token-index range of the file that defined it; expanding
+// it splices references to those tokens instead of copying them. Only the
+// results of # and ## are new tokens.
+typedef struct pp_macro {
+    const char* name;
+    const token* tokens;
+    int body_start;
+    int body_end;
+    const char** params;
+    int num_params;
+    signed char* param_index;
+    bool function_like;
+    bool variadic;
+    bool defined;
+    unsigned int mark;
+} pp_macro;
+
+// Hide-sets are immutable lists shared between tokens, so marking a whole
+// expansion costs one node rather than one per token.
+typedef struct pp_hideset {
+    const pp_macro* macro;
+    struct pp_hideset* next;
+} pp_hideset;
+
+typedef struct pp_token {
+    const token* tok;
+    pp_hideset* hideset;
+} pp_token;
+
+typedef struct pp_token_stack {
+    pp_token* items;
+    size_t length;
+    size_t capacity;
+} pp_token_stack;
+
+typedef struct macro_arena_block {
+    struct macro_arena_block* next;
+    size_t used;
+    size_t size;
+    char data[];
+} macro_arena_block;
+
+typedef struct macro_table {
+    pp_macro** slots;
+    size_t capacity;
+    size_t num_macros;
+    macro_arena_block* arena;
+    unsigned int generation;
+    pp_token_stack pending;
+    pp_token_stack scratch;
+    pp_token_stack args;
+    buffer spelling;
+} macro_table;
+
+// Tokens are read from the pending stack above pending_base first, then from
+// tokens[index, end) up to the next directive.
+typedef struct macro_input {
+    const token* tokens;
+    int index;
+    int end;
+    size_t pending_base;
+    const char* path;
+} macro_input;
+
+bool is_pp_directive(const token* t);
+bool is_pp_identifier(tag kind);
+void init_macro_table(macro_table* table);
+void free_macro_table(macro_table* table);
+pp_macro* lookup_macro(macro_table* table, const char* name);
+void define_macro(macro_table* table, const char* path, const token* tokens, int start, int end);
+void undefine_macro(macro_table* table, const char* name);
+token* make_pp_token(macro_table* table, const char* lexme, tag kind, int line);
+void expand_macros(macro_table* table, macro_input* in, token** out, int* num_out, int* max_out);
+
+#endif // MACRO_H
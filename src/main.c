@@ -1,25 +1,49 @@
-#include "parser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compat.h"
+#include "driver.h"
+#include "server.h"
+
+// --server and --connect take an optional =PATH for the socket.
+static bool match_mode(const char* arg, const char* mode, const char** socket_path) {
+    size_t length = strlen(mode);
+    if (strncmp(arg, mode, length) != 0 || (arg[length] != '\0' && arg[length] != '=')) {
+        return false;
+    }
+    *socket_path = arg[length] == '=' ? arg + length + 1 : NULL;
+    return true;
+}
 
+// Running the compiled program stays in the client, so a crash in user code
+// can never take the server down with it.
+static bool runs_program(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--run") == 0 || strcmp(argv[i], "--interp") == 0) {
+            return true;
+        }
+    }
+    return false;
+}
 
 int main(int argc, char** argv) {
-    if (argc < 2) {
-        printf("ERROR: no input file\n");
-        exit(1);
+    compile_environment env = {NULL, 1, 2, NULL, NULL};
+    const char* socket_path;
+    if (argc > 1 && match_mode(argv[1], "--server", &socket_path)) {
+        return run_server(socket_path);
     }
-    lexer l = init_lexer(argv[1]);
-    token* tokens = tokenizer(&l);
-    parser p = init_parser(&l, tokens);
-
-    ast_program_node* program = parse_program(&p);
-    print_ast(program);
-    print_symbol_table(p.global_symbol_table);
-
-    // TOOD: free all the ast nodes
-
-    free(l.content);
-    free(tokens);
-
-    return 0;
+    if (argc > 1 && match_mode(argv[1], "--connect", &socket_path)) {
+        argv[1] = argv[0];
+        argc--;
+        argv++;
+        if (!runs_program(argc, argv)) {
+            char* path = socket_path ? _strdup(socket_path) : default_server_socket();
+            int exit_code = run_client(path, argc, argv);
+            free(path);
+            if (exit_code >= 0) {
+                return exit_code;
+            }
+        }
+    }
+    return run_compiler(argc, argv, &env);
 }
-
-
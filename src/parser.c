@@ -1,16 +1,16 @@
 #include "parser.h"
 
+#include <limits.h>
+
 
 void consume(parser* p, tag expected) {
     if (get_current_token(p).kind != expected){
-        fprintf(stderr, "Error: Expected '%s' but found '%s'.\n", tag_tostring(expected), get_current_token(p).lexme);
-        exit(1);
+        fatal_error("Error: Expected '%s' but found '%s'.\n", tag_tostring(expected), get_current_token(p).lexme);
     }
     if (p->current_token_index < p->num_tokens - 1) {
         p->current_token_index++;
     } else {
-        fprintf(stderr, "Error: Attempting to consume beyond the end of tokens.\n");
-        exit(1);
+        fatal_error("Error: Attempting to consume beyond the end of tokens.\n");
     }
 }
 
@@ -18,8 +18,7 @@ void consume_simicolon(parser* p) {
     if (get_current_token(p).kind == SIMICOLON) {
         consume(p, SIMICOLON);
     } else {
-        fprintf(stderr, "Error: Expected ';', got %s\n", get_current_token(p).lexme);
-        exit(1);
+        fatal_error("Error: Expected ';', got %s\n", get_current_token(p).lexme);
     }
 }
 
@@ -31,8 +30,7 @@ token get_next_token(parser* p) {
     if (p->current_token_index < p->num_tokens - 1) {
         return p->tokens[p->current_token_index + 1];
     } else {
-        fprintf(stderr, "Error: Attempting to access beyond the end of tokens.\n");
-        exit(1);
+        fatal_error("Error: Attempting to access beyond the end of tokens.\n");
     }
 }
 
@@ -40,8 +38,7 @@ token get_next_next_token(parser* p) {
     if (p->current_token_index < p->num_tokens - 2) {
         return p->tokens[p->current_token_index + 2];
     } else {
-        fprintf(stderr, "Error: Attempting to access beyond the end of tokens.\n");
-        exit(1);
+        fatal_error("Error: Attempting to access beyond the end of tokens.\n");
     }
 }
 
@@ -49,8 +46,7 @@ token get_prev_token(parser* p) {
     if (p->current_token_index > 0) {
         return p->tokens[p->current_token_index - 1];
     } else {
-        fprintf(stderr, "Error: Attempting to access before the start of tokens.\n");
-        exit(1);
+        fatal_error("Error: Attempting to access before the start of tokens.\n");
     }
 }
 
@@ -72,80 +68,149 @@ bool is_unary_operator(tag kind) {
 
 bool is_binary_operator(tag kind) {
     return kind == PLUS || kind == MINUS || kind == MULTIPLY || kind == DIVIDE || kind == MODULO ||
-           kind == ASSIGN || kind == EQUAL || kind == NOT_EQUAL;
+           kind == ASSIGN || kind == EQUAL || kind == NOT_EQUAL || kind == LESS || kind == LESS_EQUAL ||
+           kind == GREATER || kind == GREATER_EQUAL;
 }
 
 parser init_parser(lexer* l, token* tokens) {
     parser p = { tokens, l->tokens_count, 0 };
 
     p.global_symbol_table = create_symbol_table();
+    p.types = create_type_table();
 
     return p;
 }
 
 
-ast_node* parse_expression(parser* p) {
-    if (is_binary_operator(get_next_token(p).kind)) {
-        return (ast_node*)parse_binary_expr(p);
-    } else {
-        return parse_literal(p);
+int operator_precedence(tag kind) {
+    switch (kind) {
+        case MULTIPLY:
+        case DIVIDE:
+        case MODULO:
+            return 4;
+        case PLUS:
+        case MINUS:
+            return 3;
+        case LESS:
+        case LESS_EQUAL:
+        case GREATER:
+        case GREATER_EQUAL:
+            return 2;
+        case EQUAL:
+        case NOT_EQUAL:
+            return 1;
+        default:
+            return 0;
     }
 }
 
-ast_binary_expr_node* parse_binary_expr(parser* p) {
-    ast_node* left = parse_literal(p);
-
-    tag operator_kind = get_current_token(p).kind;
-    if (!is_binary_operator(operator_kind)) {
-        fprintf(stderr, "Error: Expected binary operator, got %s\n", get_current_token(p).lexme);
-        exit(1);
-    }
-    consume(p, operator_kind);
-    ast_node* right = parse_literal(p);
-
-    operator_type op;
-    switch (operator_kind) {
+operator_type to_operator_type(tag kind) {
+    switch (kind) {
         case PLUS:
-            op = OP_ADD;
-            break;
+            return OP_ADD;
         case MINUS:
-            op = OP_SUBTRACT;
-            break;
+            return OP_SUBTRACT;
         case MULTIPLY:
-            op = OP_MULTIPLY;
-            break;
+            return OP_MULTIPLY;
+        case DIVIDE:
+            return OP_DIVIDE;
+        case MODULO:
+            return OP_MODULO;
+        case EQUAL:
+            return OP_EQUAL;
+        case NOT_EQUAL:
+            return OP_NOT_EQUAL;
+        case LESS:
+            return OP_LESS;
+        case LESS_EQUAL:
+            return OP_LESS_EQUAL;
+        case GREATER:
+            return OP_GREATER;
+        case GREATER_EQUAL:
+            return OP_GREATER_EQUAL;
+        case LOGICAL_NOT:
+            return OP_LOGICAL_NOT;
         default:
-            fprintf(stderr, "Error: Unsupported binary operator\n");
-            exit(1);
+            fatal_error("Error: Unsupported operator %s\n", tag_tostring(kind));
     }
-
-    return create_binary_expr_node(left, right, op);
 }
 
-ast_assignment_node* parse_assignment(parser* p) {
-    ast_node* identifier_node = parse_identifier(p);
-    symbol* variable_symbol = find_symbol(p->global_symbol_table, identifier_node->value);
+ast_node* parse_expression(parser* p) {
+    return parse_binary_expr(p, 1);
+}
 
-    if (variable_symbol == NULL) {
-        fprintf(stderr, "ERROR: Variable '%s' not found in the current scope.\n", identifier_node->value);
-        exit(EXIT_FAILURE);
+ast_node* parse_unary_expr(parser* p) {
+    token current_token = get_current_token(p);
+    if (current_token.kind == MINUS || current_token.kind == PLUS || current_token.kind == LOGICAL_NOT) {
+        consume(p, current_token.kind);
+        ast_node* operand = parse_unary_expr(p);
+        return (ast_node*)create_unary_expr_node(operand, to_operator_type(current_token.kind));
     }
-
-    if (variable_symbol->is_const){
-        fprintf(stderr, "ERROR: Variable '%s' is a constant, cannot be assigned a value.\n", identifier_node->value);
-        exit(EXIT_FAILURE);
+    if (current_token.kind == LPAREN) {
+        consume(p, LPAREN);
+        ast_node* expr = parse_expression(p);
+        consume(p, RPAREN);
+        return expr;
     }
+    return parse_literal(p);
+}
 
-    if (variable_symbol->type != VARIABLE) {
-        fprintf(stderr, "ERROR: '%s' is not a variable; cannot be assigned a value.\n", identifier_node->value);
-        exit(EXIT_FAILURE);
+// Precedence climbing: every operator binds at least as tightly as min_precedence,
+// and all supported binary operators are left associative.
+ast_node* parse_binary_expr(parser* p, int min_precedence) {
+    ast_node* left = parse_unary_expr(p);
+
+    while (operator_precedence(get_current_token(p).kind) >= min_precedence) {
+        tag operator_kind = get_current_token(p).kind;
+        int precedence = operator_precedence(operator_kind);
+        consume(p, operator_kind);
+
+        ast_node* right = parse_binary_expr(p, precedence + 1);
+        left = (ast_node*)create_binary_expr_node(left, right, to_operator_type(operator_kind));
     }
 
-    consume(p, ASSIGN);
-    ast_node* value = parse_literal(p);
+    return left;
+}
+
+ast_assignment_node* parse_assignment(parser* p) {
+    ast_assignment_node* assignment = parse_assignment_expr(p);
     consume_simicolon(p);
+    return assignment;
+}
 
-    return create_assignment_node(identifier_node, value);
+// An assignment without the semicolon, as in the step of a for. The type
+// checker decides whether the name can be assigned; the symbol table does
+// not know parameters, which loops commonly count down.
+ast_assignment_node* parse_assignment_expr(parser* p) {
+    ast_node* identifier_node = parse_identifier(p);
+    ast_node* index = NULL;
+    if (get_current_token(p).kind == LBRACKET) {
+        consume(p, LBRACKET);
+        index = parse_expression(p);
+        consume(p, RBRACKET);
+    }
+    consume(p, ASSIGN);
+    ast_node* value = parse_expression(p);
+
+    ast_assignment_node* assignment = create_assignment_node(identifier_node, value);
+    assignment->index = index;
+    return assignment;
+}
+
+// The length of an array declaration, [N] with N a positive integer.
+size_t parse_array_length(parser* p) {
+    consume(p, LBRACKET);
+    token length_token = get_current_token(p);
+    if (length_token.kind != NUMBER || strchr(length_token.lexme, '.') != NULL) {
+        fatal_error("Error: Expected array length, got %s\n", length_token.lexme);
+    }
+    long long length = strtoll(length_token.lexme, NULL, 0);
+    if (length <= 0 || length > INT_MAX) {
+        fatal_error("Error: array length %s is out of range\n", length_token.lexme);
+    }
+    consume(p, NUMBER);
+    consume(p, RBRACKET);
+    return (size_t)length;
 }
 
 ast_variable_decl_node* parse_variable_declaration(parser* p, scope* s) {
@@ -156,18 +221,28 @@ ast_variable_decl_node* parse_variable_declaration(parser* p, scope* s) {
     }
     builtin_types type_node = parse_type(p);
     ast_node* identifier_node = parse_identifier(p);
+    size_t array_length = 0;
+    if (get_current_token(p).kind == LBRACKET) {
+        array_length = parse_array_length(p);
+    }
 
-    ast_node* value;
+    ast_node* value = NULL;
     if (get_current_token(p).kind == ASSIGN){
         consume(p, ASSIGN);
-        value = parse_literal(p);
+        value = parse_expression(p);
     }
     consume_simicolon(p);
 
-    symbol* var = create_symbol(identifier_node->value, VARIABLE, constant);
+    const c_type* var_type = qualified_type(p->types, builtin_c_type(p->types, type_node), constant ? TYPE_CONST : 0);
+    if (array_length > 0) {
+        var_type = array_type(p->types, var_type, array_length);
+    }
+    symbol* var = create_symbol(identifier_node->value, VARIABLE, constant, var_type);
     add_symbol_to_scope(s, var);
 
-    return create_variable_decl_node(type_node, identifier_node, value, constant);
+    ast_variable_decl_node* decl = create_variable_decl_node(type_node, identifier_node, value, constant);
+    decl->array_length = array_length;
+    return decl;
 }
 
 
@@ -210,7 +285,7 @@ ast_function_decl_node* parse_function_declaration(parser* p) {
 
         ast_variable_decl_node* param_decl = create_variable_decl_node(type, id, NULL, constant);
 
-        parameters = (ast_node**)realloc(parameters, (num_parameters + 1) * sizeof(ast_node*));
+        parameters = (ast_node**)counted_realloc(ALLOC_AST, parameters, (num_parameters + 1) * sizeof(ast_node*));
         parameters[num_parameters++] = (ast_node*)param_decl;
 
         // Check for a comma between parameters
@@ -227,7 +302,14 @@ ast_function_decl_node* parse_function_declaration(parser* p) {
 
     ast_function_decl_node* function_decl = create_function_decl_node(return_type, function_name, parameters, num_parameters, body);
 
-    symbol* function_symbol = create_symbol(function_name, FUNCTION, false);
+    // As in C, a parameter's own const is not part of the function's type.
+    const c_type** param_types = counted_malloc(ALLOC_SYMBOLS, (num_parameters + 1) * sizeof(c_type*));
+    for (size_t i = 0; i < num_parameters; ++i) {
+        param_types[i] = builtin_c_type(p->types, ((ast_variable_decl_node*)parameters[i])->type_node);
+    }
+    const c_type* type = function_type(p->types, builtin_c_type(p->types, return_type), param_types, num_parameters);
+    counted_free(ALLOC_SYMBOLS, param_types);
+    symbol* function_symbol = create_symbol(function_name, FUNCTION, false, type);
     add_symbol_to_scope(p->global_symbol_table->scopes[0], function_symbol);
 
     return function_decl;
@@ -243,6 +325,10 @@ ast_node* parse_declaration(parser* p, scope* scope) {
         }
         ast_variable_decl_node* variable_decl = parse_variable_declaration(p, scope);
         return (ast_node*)variable_decl;
+    } else if (current_token.kind == IDENTIFIER && get_next_token(p).kind == LPAREN) {
+        ast_call_expr_node* call = parse_call(p);
+        consume_simicolon(p);
+        return (ast_node*)call;
     } else if (current_token.kind == IDENTIFIER) {
         ast_assignment_node* variable_asg = parse_assignment(p);
         return (ast_node*)variable_asg;
@@ -251,9 +337,22 @@ ast_node* parse_declaration(parser* p, scope* scope) {
         return (ast_node*)return_stmt;
     } else if (current_token.kind == LBRACE) {
         return (ast_node*)parse_block(p);
+    } else if (current_token.kind == KW_WHILE) {
+        return (ast_node*)parse_while_stmt(p, scope);
+    } else if (current_token.kind == KW_DO) {
+        return (ast_node*)parse_do_while_stmt(p, scope);
+    } else if (current_token.kind == KW_FOR) {
+        return (ast_node*)parse_for_stmt(p);
+    } else if (current_token.kind == KW_SWITCH) {
+        return (ast_node*)parse_switch_stmt(p, scope);
+    } else if (current_token.kind == KW_CASE || current_token.kind == KW_DEFAULT) {
+        return (ast_node*)parse_case_label(p);
+    } else if (current_token.kind == KW_BREAK || current_token.kind == KW_CONTINUE) {
+        consume(p, current_token.kind);
+        consume_simicolon(p);
+        return create_ast_node(current_token.kind == KW_BREAK ? AST_BREAK_STMT : AST_CONTINUE_STMT, NULL, NULL);
     } else if (current_token.kind != ENDOF) {
-        fprintf(stderr, "Error: Unexpected token in declaration, got %s\n", current_token.lexme);
-        exit(1);
+        fatal_error("Error: Unexpected token in declaration, got %s\n", current_token.lexme);
     }
 
     return NULL;
@@ -281,8 +380,7 @@ builtin_types parse_type(parser* p) {
             return DOUBLE;
             break;
         default:
-            fprintf(stderr, "Error: Expected type, got %s\n", current_token.lexme);
-            exit(1);
+            fatal_error("Error: Expected type, got %s\n", current_token.lexme);
     }
     return VOID;
 
@@ -291,8 +389,7 @@ builtin_types parse_type(parser* p) {
 ast_node* parse_identifier(parser* p) {
     token current_token = get_current_token(p);
     if (current_token.kind != IDENTIFIER) {
-        fprintf(stderr, "Error: Expected identifier, got %s\n", current_token.lexme);
-        exit(1);
+        fatal_error("Error: Expected identifier, got %s\n", current_token.lexme);
     }
 
     char* identifier_value = current_token.lexme;
@@ -303,18 +400,146 @@ ast_node* parse_identifier(parser* p) {
 ast_node* parse_literal(parser* p) {
     token current_token = get_current_token(p);
     if (current_token.kind == NUMBER || current_token.kind == CHARACTER) {
-        char* literal_value = _strdup(current_token.lexme);
+        char* literal_value = counted_strdup(ALLOC_AST, current_token.lexme);
+        const char* literal_type = "int";
+        if (current_token.kind == CHARACTER) {
+            literal_type = "char";
+        } else if (strchr(literal_value, '.') != NULL) {
+            literal_type = "double";
+        }
         consume(p, current_token.kind);
-        return create_ast_node(AST_LITERAL, literal_value, NULL);
-    }else if (current_token.kind == IDENTIFIER) {
+        return create_ast_node(AST_LITERAL, literal_value, literal_type);
+    } else if (current_token.kind == IDENTIFIER && get_next_token(p).kind == LPAREN) {
+        return (ast_node*)parse_call(p);
+    } else if (current_token.kind == IDENTIFIER && get_next_token(p).kind == LBRACKET) {
+        ast_node* array = parse_identifier(p);
+        consume(p, LBRACKET);
+        ast_node* index = parse_expression(p);
+        consume(p, RBRACKET);
+        return (ast_node*)create_index_expr_node(array, index);
+    } else if (current_token.kind == IDENTIFIER) {
         ast_node* id = parse_identifier(p);
         return create_ast_node(AST_IDENTIFIER, id->value, NULL);
     } else {
-        fprintf(stderr, "Error: Expected literal, got %s\n", current_token.lexme);
-        exit(1);
+        fatal_error("Error: Expected literal, got %s\n", current_token.lexme);
     }
 }
 
+// Whether the callee exists and takes these arguments is left to the type
+// checker, so a call may come before the function it names.
+ast_call_expr_node* parse_call(parser* p) {
+    ast_node* identifier_node = parse_identifier(p);
+    consume(p, LPAREN);
+
+    ast_node** arguments = NULL;
+    size_t num_arguments = 0;
+    while (get_current_token(p).kind != RPAREN) {
+        ast_node* argument = parse_expression(p);
+        arguments = (ast_node**)counted_realloc(ALLOC_AST, arguments, (num_arguments + 1) * sizeof(ast_node*));
+        arguments[num_arguments++] = argument;
+
+        if (get_current_token(p).kind == COMMA) {
+            consume(p, COMMA);
+        } else {
+            break;
+        }
+    }
+    consume(p, RPAREN);
+
+    return create_call_expr_node(identifier_node->value, arguments, num_arguments);
+}
+
+// The body of a loop is one statement. Whether break and continue are
+// inside a loop is left to the type checker.
+ast_node* parse_loop_body(parser* p, scope* scope) {
+    if (get_current_token(p).kind == ENDOF) {
+        fatal_error("Error: Expected loop body, got end of file\n");
+    }
+    return parse_declaration(p, scope);
+}
+
+ast_loop_node* parse_while_stmt(parser* p, scope* scope) {
+    consume(p, KW_WHILE);
+    consume(p, LPAREN);
+    ast_node* condition = parse_expression(p);
+    consume(p, RPAREN);
+    ast_node* body = parse_loop_body(p, scope);
+    return create_loop_node(AST_WHILE_STMT, NULL, condition, NULL, body);
+}
+
+ast_loop_node* parse_do_while_stmt(parser* p, scope* scope) {
+    consume(p, KW_DO);
+    ast_node* body = parse_loop_body(p, scope);
+    consume(p, KW_WHILE);
+    consume(p, LPAREN);
+    ast_node* condition = parse_expression(p);
+    consume(p, RPAREN);
+    consume_simicolon(p);
+    return create_loop_node(AST_DO_WHILE_STMT, NULL, condition, NULL, body);
+}
+
+// for (init; condition; step) body, where each of the three may be empty.
+// A variable declared in init is scoped to the loop.
+ast_loop_node* parse_for_stmt(parser* p) {
+    consume(p, KW_FOR);
+    consume(p, LPAREN);
+    scope* loop_scope = create_scope();
+    add_scope_to_table(p->global_symbol_table, loop_scope);
+
+    ast_node* init = NULL;
+    token current_token = get_current_token(p);
+    if (current_token.kind == SIMICOLON) {
+        consume(p, SIMICOLON);
+    } else if (is_type(current_token) || current_token.kind == KW_CONST) {
+        init = (ast_node*)parse_variable_declaration(p, loop_scope);
+    } else {
+        init = (ast_node*)parse_assignment(p);
+    }
+
+    ast_node* condition = NULL;
+    if (get_current_token(p).kind != SIMICOLON) {
+        condition = parse_expression(p);
+    }
+    consume_simicolon(p);
+
+    ast_node* step = NULL;
+    if (get_current_token(p).kind == IDENTIFIER && get_next_token(p).kind == LPAREN) {
+        step = (ast_node*)parse_call(p);
+    } else if (get_current_token(p).kind != RPAREN) {
+        step = (ast_node*)parse_assignment_expr(p);
+    }
+    consume(p, RPAREN);
+
+    ast_node* body = parse_loop_body(p, loop_scope);
+    return create_loop_node(AST_FOR_STMT, init, condition, step, body);
+}
+
+ast_switch_node* parse_switch_stmt(parser* p, scope* scope) {
+    consume(p, KW_SWITCH);
+    consume(p, LPAREN);
+    ast_node* condition = parse_expression(p);
+    consume(p, RPAREN);
+    if (get_current_token(p).kind == ENDOF) {
+        fatal_error("Error: Expected switch body, got end of file\n");
+    }
+    ast_node* body = parse_declaration(p, scope);
+    return create_switch_node(condition, body);
+}
+
+// case value: or default:, on its own; what follows is the next statement.
+// Whether the label is inside a switch is left to the type checker.
+ast_case_node* parse_case_label(parser* p) {
+    ast_node* value = NULL;
+    if (get_current_token(p).kind == KW_DEFAULT) {
+        consume(p, KW_DEFAULT);
+    } else {
+        consume(p, KW_CASE);
+        value = parse_expression(p);
+    }
+    consume(p, COLON);
+    return create_case_node(value);
+}
+
 ast_return_node* parse_return_stmt(parser* p) {
     consume(p, KW_RETURN);
 
@@ -325,13 +550,18 @@ ast_return_node* parse_return_stmt(parser* p) {
     return create_return_node(expr);
 }
 
-ast_program_node* parse_program(parser* p) {
-    ast_program_node* program_node = create_program_node();
+// Appends the remaining top-level declarations to program, which may already
+// hold the ones of a precompiled header.
+void parse_declarations(parser* p, ast_program_node* program_node) {
     while (get_current_token(p).kind != ENDOF) {
         ast_node* declaration = parse_declaration(p, p->global_symbol_table->scopes[0]);
         add_child((ast_node*)program_node, declaration);
     }
+}
 
+ast_program_node* parse_program(parser* p) {
+    ast_program_node* program_node = create_program_node();
+    parse_declarations(p, program_node);
     return program_node;
 }
 
@@ -8,6 +8,7 @@
 #include "lexer.h"
 #include "ast.h"
 #include "symbol_table.h"
+#include "types.h"
 
 typedef struct parser {
     token* tokens;
@@ -15,6 +16,7 @@ typedef struct parser {
     int current_token_index;
     symbol_table* global_symbol_table;
     scope* current_scope;
+    type_table* types;
 } parser;
 
 parser init_parser(lexer* l, token* tokens);
@@ -27,16 +29,30 @@ bool is_unary_operator(tag kind);
 bool is_binary_operator(tag kind);
 token get_prev_token(parser* p);
 ast_program_node* parse_program(parser* p);
+void parse_declarations(parser* p, ast_program_node* program_node);
 ast_variable_decl_node* parse_variable_declaration(parser* p, scope* s);
 builtin_types parse_type(parser* p);
 ast_node* parse_identifier(parser* p);
 ast_node* parse_literal(parser* p);
 ast_node* parse_declaration(parser* p, scope* scope);
 ast_assignment_node* parse_assignment(parser* p);
+ast_assignment_node* parse_assignment_expr(parser* p);
+size_t parse_array_length(parser* p);
 ast_block_node* parse_block(parser* p);
 ast_function_decl_node* parse_function_declaration(parser* p);
 ast_return_node* parse_return_stmt(parser* p);
-ast_binary_expr_node* parse_binary_expr(parser* p);
+ast_node* parse_loop_body(parser* p, scope* scope);
+ast_loop_node* parse_while_stmt(parser* p, scope* scope);
+ast_loop_node* parse_do_while_stmt(parser* p, scope* scope);
+ast_loop_node* parse_for_stmt(parser* p);
+ast_switch_node* parse_switch_stmt(parser* p, scope* scope);
+ast_case_node* parse_case_label(parser* p);
+ast_call_expr_node* parse_call(parser* p);
+int operator_precedence(tag kind);
+operator_type to_operator_type(tag kind);
+ast_node* parse_expression(parser* p);
+ast_node* parse_unary_expr(parser* p);
+ast_node* parse_binary_expr(parser* p, int min_precedence);
 
 #endif // PARSER_H
 
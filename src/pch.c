@@ -0,0 +1,598 @@
+#include "pch.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hash.h"
+#include "compat.h"
+
+#define PCH_MAGIC "SCCPCH04"
+#define PCH_NULL_TYPE 0xFF
+#define PCH_NULL_NODE AST_BINARY_NULL_NODE
+#define PCH_NULL_STRING AST_BINARY_NULL_STRING
+
+// Layout, all integers in host byte order since a PCH is only valid for the
+// scc binary that wrote it:
+//   magic, compiler id
+//   dependencies:  count, then (hash, path) each
+//   once files:    count, then path each
+//   macros:        count, then the tokens of an equivalent #define each
+//   scopes:        count, then (count, then (name, type, is_const, c_type) each) each
+//   declarations:  count, then the nodes as write_ast_node_binary lays them out
+// Strings are a length followed by the bytes and a NUL, so they can be used
+// in place. A c_type is its kind and qualifiers, then for derived types the
+// base type, an array's length or a function's parameter count and types.
+
+static void put_u8(buffer* out, uint8_t value) {
+    buffer_putc(out, (char)value);
+}
+
+static void put_u32(buffer* out, uint32_t value) {
+    buffer_append(out, &value, sizeof(value));
+}
+
+static void put_u64(buffer* out, uint64_t value) {
+    buffer_append(out, &value, sizeof(value));
+}
+
+static void put_string(buffer* out, const char* str) {
+    if (str == NULL) {
+        put_u32(out, PCH_NULL_STRING);
+        return;
+    }
+    uint32_t length = (uint32_t)strlen(str);
+    put_u32(out, length);
+    buffer_append(out, str, length + 1);
+}
+
+static void put_token(buffer* out, tag kind, const char* lexme, int line, unsigned char flags) {
+    put_u32(out, (uint32_t)kind);
+    put_u32(out, (uint32_t)line);
+    put_u8(out, flags);
+    put_string(out, lexme);
+}
+
+static size_t count_macro_tokens(const pp_macro* macro) {
+    size_t count = 2 + (size_t)(macro->body_end - macro->body_start);
+    if (macro->function_like) {
+        count += 2 + (macro->num_params > 0 ? 2 * (size_t)macro->num_params - 1 : 0);
+        if (macro->variadic) {
+            count += 2;
+        }
+    }
+    return count;
+}
+
+// Rebuilds the #define directive so loading goes through define_macro like
+// any other definition.
+static void put_macro(buffer* out, const pp_macro* macro) {
+    put_u32(out, (uint32_t)count_macro_tokens(macro));
+    int line = macro->body_start > 0 ? macro->tokens[macro->body_start - 1].line : 0;
+    put_token(out, PP_DEFINE, "define", line, TOKEN_AT_LINE_START);
+    put_token(out, IDENTIFIER, macro->name, line, TOKEN_AFTER_SPACE);
+    if (macro->function_like) {
+        put_token(out, LPAREN, "(", line, 0);
+        for (int i = 0; i < macro->num_params; ++i) {
+            if (i > 0) {
+                put_token(out, COMMA, ",", line, 0);
+            }
+            if (macro->variadic && i == macro->num_params - 1) {
+                put_token(out, DOT, ".", line, 0);
+                put_token(out, DOT, ".", line, 0);
+                put_token(out, DOT, ".", line, 0);
+            } else {
+                put_token(out, IDENTIFIER, macro->params[i], line, 0);
+            }
+        }
+        put_token(out, RPAREN, ")", line, 0);
+    }
+    for (int i = macro->body_start; i < macro->body_end; ++i) {
+        const token* t = &macro->tokens[i];
+        put_token(out, t->kind, t->lexme, t->line, t->flags);
+    }
+}
+
+static void put_type(buffer* out, const c_type* t) {
+    if (t == NULL) {
+        put_u8(out, PCH_NULL_TYPE);
+        return;
+    }
+    put_u8(out, (uint8_t)t->kind);
+    put_u8(out, (uint8_t)t->qualifiers);
+    switch (t->kind) {
+        case TYPE_POINTER:
+            put_type(out, t->base);
+            break;
+        case TYPE_ARRAY:
+            put_type(out, t->base);
+            put_u64(out, t->length);
+            break;
+        case TYPE_FUNCTION:
+            put_type(out, t->base);
+            put_u32(out, (uint32_t)t->length);
+            for (size_t i = 0; i < t->length; ++i) {
+                put_type(out, t->params[i]);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void write_pch(preprocessor* pp, const cache_dependency* dependencies, size_t num_dependencies,
+               symbol_table* symbols, ast_program_node* program, buffer* out) {
+    buffer_append(out, PCH_MAGIC, 8);
+    put_u64(out, compute_compiler_id());
+
+    put_u64(out, num_dependencies);
+    for (size_t i = 0; i < num_dependencies; ++i) {
+        put_u64(out, dependencies[i].hash);
+        put_string(out, dependencies[i].path);
+    }
+
+    put_u64(out, pp->num_once_files);
+    for (size_t i = 0; i < pp->num_once_files; ++i) {
+        put_string(out, pp->once_files[i]);
+    }
+
+    macro_table* macros = &pp->macros;
+    size_t num_macros = 0;
+    for (size_t i = 0; i < macros->capacity; ++i) {
+        num_macros += macros->slots[i] != NULL && macros->slots[i]->defined;
+    }
+    put_u64(out, num_macros);
+    for (size_t i = 0; i < macros->capacity; ++i) {
+        if (macros->slots[i] != NULL && macros->slots[i]->defined) {
+            put_macro(out, macros->slots[i]);
+        }
+    }
+
+    put_u64(out, symbols->num_scopes);
+    for (size_t i = 0; i < symbols->num_scopes; ++i) {
+        scope* s = symbols->scopes[i];
+        put_u64(out, s->num_symbols);
+        for (size_t j = 0; j < s->num_symbols; ++j) {
+            put_string(out, s->symbols[j]->name);
+            put_u8(out, (uint8_t)s->symbols[j]->type);
+            put_u8(out, s->symbols[j]->is_const);
+            put_type(out, s->symbols[j]->decl_type);
+        }
+    }
+
+    put_u64(out, program->num_declarations);
+    for (size_t i = 0; i < program->num_declarations; ++i) {
+        write_ast_node_binary(program->declarations[i], out);
+    }
+}
+
+typedef struct pch_reader {
+    const pch_file* pch;
+    size_t position;
+} pch_reader;
+
+SCC_NORETURN static void pch_corrupt(const pch_reader* r) {
+    fatal_error("Error: %s: precompiled header is corrupt\n", r->pch->path);
+}
+
+static const void* take(pch_reader* r, size_t size) {
+    if (size > r->pch->size - r->position) {
+        pch_corrupt(r);
+    }
+    const void* p = r->pch->data + r->position;
+    r->position += size;
+    return p;
+}
+
+static uint8_t get_u8(pch_reader* r) {
+    return *(const uint8_t*)take(r, 1);
+}
+
+static uint32_t get_u32(pch_reader* r) {
+    uint32_t value;
+    memcpy(&value, take(r, sizeof(value)), sizeof(value));
+    return value;
+}
+
+static uint64_t get_u64(pch_reader* r) {
+    uint64_t value;
+    memcpy(&value, take(r, sizeof(value)), sizeof(value));
+    return value;
+}
+
+// Counts read from the file are bounded by its size before anything is
+// allocated for them.
+static size_t get_count(pch_reader* r) {
+    uint64_t count = get_u64(r);
+    if (count > r->pch->size) {
+        pch_corrupt(r);
+    }
+    return (size_t)count;
+}
+
+static char* get_string(pch_reader* r) {
+    uint32_t length = get_u32(r);
+    if (length == PCH_NULL_STRING) {
+        return NULL;
+    }
+    char* str = (char*)take(r, (size_t)length + 1);
+    if (str[length] != '\0') {
+        pch_corrupt(r);
+    }
+    return str;
+}
+
+static void check_pch_dependencies(const pch_file* pch) {
+    for (size_t i = 0; i < pch->num_dependencies; ++i) {
+        if (!dependency_unchanged(pch->dependencies[i].path, pch->dependencies[i].hash)) {
+            fatal_error("Error: %s is out of date: %s has changed\n", pch->path, pch->dependencies[i].path);
+        }
+    }
+}
+
+static int64_t mtime_ns(const struct stat* st) {
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+pch_file* load_pch(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fatal_error("Error: Failed to open precompiled header %s\n", path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 16) {
+        close(fd);
+        fatal_error("Error: %s is not a precompiled header\n", path);
+    }
+    void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fatal_error("Error: Failed to map precompiled header %s\n", path);
+    }
+
+    pch_file* pch = calloc(1, sizeof(pch_file));
+    pch->path = _strdup(path);
+    pch->data = data;
+    pch->size = (size_t)st.st_size;
+    pch->mtime_ns = mtime_ns(&st);
+    pch->content_hash = hash_bytes(pch->data, pch->size, 0);
+
+    pch_reader r = {pch, 0};
+    if (memcmp(take(&r, 8), PCH_MAGIC, 8) != 0) {
+        fatal_error("Error: %s is not a precompiled header\n", path);
+    }
+    if (get_u64(&r) != compute_compiler_id()) {
+        fatal_error("Error: %s was written by a different scc build; regenerate it with --emit-pch\n", path);
+    }
+
+    pch->num_dependencies = get_count(&r);
+    pch->dependencies = malloc((pch->num_dependencies + 1) * sizeof(cache_dependency));
+    for (size_t i = 0; i < pch->num_dependencies; ++i) {
+        cache_dependency* dependency = &pch->dependencies[i];
+        dependency->hash = get_u64(&r);
+        dependency->path = get_string(&r);
+        if (dependency->path == NULL) {
+            pch_corrupt(&r);
+        }
+    }
+    check_pch_dependencies(pch);
+
+    pch->num_once_files = get_count(&r);
+    pch->once_files = malloc((pch->num_once_files + 1) * sizeof(char*));
+    for (size_t i = 0; i < pch->num_once_files; ++i) {
+        pch->once_files[i] = get_string(&r);
+    }
+
+    // Macro tokens go in one array that every job's macro table points into.
+    pch->num_macros = get_count(&r);
+    pch->macro_bounds = malloc((2 * pch->num_macros + 1) * sizeof(int));
+    size_t capacity = 256;
+    size_t num_tokens = 0;
+    pch->macro_tokens = malloc(capacity * sizeof(token));
+    for (size_t i = 0; i < pch->num_macros; ++i) {
+        uint32_t count = get_u32(&r);
+        if (count < 2 || count > pch->size) {
+            pch_corrupt(&r);
+        }
+        while (num_tokens + count > capacity) {
+            capacity *= 2;
+        }
+        pch->macro_tokens = realloc(pch->macro_tokens, capacity * sizeof(token));
+        pch->macro_bounds[2 * i] = (int)num_tokens;
+        for (uint32_t j = 0; j < count; ++j) {
+            token* t = &pch->macro_tokens[num_tokens++];
+            t->kind = (tag)get_u32(&r);
+            t->line = (int)get_u32(&r);
+            t->flags = get_u8(&r);
+            t->lexme = get_string(&r);
+            if (t->lexme == NULL) {
+                pch_corrupt(&r);
+            }
+        }
+        pch->macro_bounds[2 * i + 1] = (int)num_tokens;
+    }
+
+    // Scopes and declarations are decoded per job, since each job owns and
+    // may rewrite its AST.
+    pch->declarations_offset = r.position;
+    return pch;
+}
+
+void free_pch(pch_file* pch) {
+    munmap(pch->data, pch->size);
+    free(pch->dependencies);
+    free(pch->once_files);
+    free(pch->macro_tokens);
+    free(pch->macro_bounds);
+    free(pch->path);
+    free(pch);
+}
+
+pch_cache* create_pch_cache() {
+    pch_cache* cache = calloc(1, sizeof(pch_cache));
+    if (cache == NULL) {
+        fatal_error("Error: Failed to allocate PCH cache!\n");
+    }
+    pthread_mutex_init(&cache->lock, NULL);
+    return cache;
+}
+
+void free_pch_cache(pch_cache* cache) {
+    for (size_t i = 0; i < cache->num_files; ++i) {
+        free_pch(cache->files[i]);
+    }
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->files);
+    free(cache);
+}
+
+const pch_file* acquire_pch(pch_cache* cache, const char* path) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        fatal_error("Error: Failed to open precompiled header %s\n", path);
+    }
+    pch_file* pch = NULL;
+    pthread_mutex_lock(&cache->lock);
+    for (size_t i = cache->num_files; i > 0 && pch == NULL; --i) {
+        pch_file* candidate = cache->files[i - 1];
+        if (strcmp(candidate->path, path) == 0 && candidate->size == (size_t)st.st_size &&
+            candidate->mtime_ns == mtime_ns(&st)) {
+            pch = candidate;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+    if (pch != NULL) {
+        check_pch_dependencies(pch);
+        return pch;
+    }
+
+    pch = load_pch(path);
+    pthread_mutex_lock(&cache->lock);
+    if (cache->num_files == cache->max_files) {
+        cache->max_files = cache->max_files ? cache->max_files * 2 : 4;
+        cache->files = realloc(cache->files, cache->max_files * sizeof(pch_file*));
+    }
+    cache->files[cache->num_files++] = pch;
+    pthread_mutex_unlock(&cache->lock);
+    return pch;
+}
+
+void apply_pch_macros(const pch_file* pch, preprocessor* pp) {
+    for (size_t i = 0; i < pch->num_once_files; ++i) {
+        mark_once_file(pp, pch->once_files[i]);
+    }
+    for (size_t i = 0; i < pch->num_macros; ++i) {
+        define_macro(&pp->macros, pch->path, pch->macro_tokens, pch->macro_bounds[2 * i], pch->macro_bounds[2 * i + 1]);
+    }
+}
+
+static ast_node* get_node(pch_reader* r) {
+    uint8_t type = get_u8(r);
+    switch (type) {
+        case PCH_NULL_NODE:
+            return NULL;
+        case AST_FUNCTION_DECL: {
+            builtin_types return_type = (builtin_types)get_u8(r);
+            const char* name = get_string(r);
+            uint32_t num_parameters = get_u32(r);
+            if (name == NULL || num_parameters > r->pch->size) {
+                pch_corrupt(r);
+            }
+            ast_node** parameters = malloc((num_parameters + 1) * sizeof(ast_node*));
+            for (uint32_t i = 0; i < num_parameters; ++i) {
+                parameters[i] = get_node(r);
+            }
+            ast_node* body = get_node(r);
+            if (body == NULL || body->type != AST_BLOCK) {
+                pch_corrupt(r);
+            }
+            ast_function_decl_node* function = create_function_decl_node(return_type, name, parameters, num_parameters,
+                                                                         (ast_block_node*)body);
+            free(parameters);
+            return (ast_node*)function;
+        }
+        case AST_VARIABLE_DECL: {
+            builtin_types type_node = (builtin_types)get_u8(r);
+            bool constant = get_u8(r) != 0;
+            uint32_t array_length = get_u32(r);
+            ast_node* identifier = get_node(r);
+            ast_node* value = get_node(r);
+            ast_variable_decl_node* variable = create_variable_decl_node(type_node, identifier, value, constant);
+            variable->array_length = array_length;
+            return (ast_node*)variable;
+        }
+        case AST_RETURN_STMT:
+            return (ast_node*)create_return_node(get_node(r));
+        case AST_BINARY_EXPR: {
+            operator_type op = (operator_type)get_u8(r);
+            ast_node* left = get_node(r);
+            ast_node* right = get_node(r);
+            return (ast_node*)create_binary_expr_node(left, right, op);
+        }
+        case AST_UNARY_EXPR: {
+            operator_type op = (operator_type)get_u8(r);
+            return (ast_node*)create_unary_expr_node(get_node(r), op);
+        }
+        case AST_ASSIGNMENT: {
+            ast_node* identifier = get_node(r);
+            ast_node* value = get_node(r);
+            ast_assignment_node* assignment = create_assignment_node(identifier, value);
+            assignment->index = get_node(r);
+            return (ast_node*)assignment;
+        }
+        case AST_BLOCK: {
+            ast_block_node* block = create_block_node();
+            uint32_t count = get_u32(r);
+            if (count > r->pch->size) {
+                pch_corrupt(r);
+            }
+            block->declarations = counted_malloc(ALLOC_AST, (count + 1) * sizeof(ast_node*));
+            for (uint32_t i = 0; i < count; ++i) {
+                block->declarations[block->num_declarations++] = get_node(r);
+            }
+            return (ast_node*)block;
+        }
+        case AST_IDENTIFIER:
+        case AST_LITERAL:
+        case AST_PARAMETER: {
+            const char* value = get_string(r);
+            const char* type_str = get_string(r);
+            return create_ast_node((ast_node_type)type, value, type_str);
+        }
+        case AST_WHILE_STMT:
+        case AST_DO_WHILE_STMT:
+        case AST_FOR_STMT: {
+            ast_node* init = get_node(r);
+            ast_node* condition = get_node(r);
+            ast_node* step = get_node(r);
+            ast_node* body = get_node(r);
+            if (body == NULL) {
+                pch_corrupt(r);
+            }
+            return (ast_node*)create_loop_node((ast_node_type)type, init, condition, step, body);
+        }
+        case AST_BREAK_STMT:
+        case AST_CONTINUE_STMT:
+            return create_ast_node((ast_node_type)type, NULL, NULL);
+        case AST_INDEX_EXPR: {
+            ast_node* array = get_node(r);
+            ast_node* index = get_node(r);
+            if (array == NULL || array->type != AST_IDENTIFIER || index == NULL) {
+                pch_corrupt(r);
+            }
+            return (ast_node*)create_index_expr_node(array, index);
+        }
+        case AST_SWITCH_STMT: {
+            ast_node* condition = get_node(r);
+            ast_node* body = get_node(r);
+            if (condition == NULL || body == NULL) {
+                pch_corrupt(r);
+            }
+            return (ast_node*)create_switch_node(condition, body);
+        }
+        case AST_CASE_LABEL:
+            return (ast_node*)create_case_node(get_node(r));
+        case AST_CALL_EXPR: {
+            const char* name = get_string(r);
+            uint32_t num_arguments = get_u32(r);
+            if (name == NULL || num_arguments > r->pch->size) {
+                pch_corrupt(r);
+            }
+            ast_node** arguments = counted_malloc(ALLOC_AST, (num_arguments + 1) * sizeof(ast_node*));
+            for (uint32_t i = 0; i < num_arguments; ++i) {
+                arguments[i] = get_node(r);
+            }
+            return (ast_node*)create_call_expr_node(name, arguments, num_arguments);
+        }
+        default:
+            pch_corrupt(r);
+    }
+}
+
+// Types are rebuilt through the job's own table, so they stay comparable by
+// pointer with the ones its parser makes.
+static const c_type* get_type(pch_reader* r, type_table* types) {
+    uint8_t kind = get_u8(r);
+    if (kind == PCH_NULL_TYPE) {
+        return NULL;
+    }
+    unsigned qualifiers = get_u8(r);
+    const c_type* t;
+    switch (kind) {
+        case TYPE_VOID:
+            t = builtin_c_type(types, VOID);
+            break;
+        case TYPE_CHAR:
+            t = builtin_c_type(types, CHAR);
+            break;
+        case TYPE_INT:
+            t = builtin_c_type(types, INT);
+            break;
+        case TYPE_DOUBLE:
+            t = builtin_c_type(types, DOUBLE);
+            break;
+        case TYPE_POINTER:
+        case TYPE_ARRAY: {
+            const c_type* base = get_type(r, types);
+            if (base == NULL) {
+                pch_corrupt(r);
+            }
+            t = kind == TYPE_POINTER ? pointer_type(types, base) : array_type(types, base, get_count(r));
+            break;
+        }
+        case TYPE_FUNCTION: {
+            const c_type* return_type = get_type(r, types);
+            uint32_t num_params = get_u32(r);
+            if (return_type == NULL || num_params > r->pch->size) {
+                pch_corrupt(r);
+            }
+            const c_type** params = counted_malloc(ALLOC_SYMBOLS, (num_params + 1) * sizeof(c_type*));
+            for (uint32_t i = 0; i < num_params; ++i) {
+                params[i] = get_type(r, types);
+                if (params[i] == NULL) {
+                    pch_corrupt(r);
+                }
+            }
+            t = function_type(types, return_type, params, num_params);
+            counted_free(ALLOC_SYMBOLS, params);
+            break;
+        }
+        default:
+            pch_corrupt(r);
+    }
+    return qualified_type(types, t, qualifiers);
+}
+
+void apply_pch_declarations(const pch_file* pch, symbol_table* symbols, type_table* types, ast_program_node* program) {
+    pch_reader r = {pch, pch->declarations_offset};
+
+    size_t num_scopes = get_count(&r);
+    for (size_t i = 0; i < num_scopes; ++i) {
+        scope* s = i == 0 ? symbols->scopes[0] : create_scope();
+        size_t num_symbols = get_count(&r);
+        // Sized up front rather than grown one symbol at a time.
+        s->symbols = counted_realloc(ALLOC_SYMBOLS, s->symbols, (s->num_symbols + num_symbols + 1) * sizeof(symbol*));
+        for (size_t j = 0; j < num_symbols; ++j) {
+            const char* name = get_string(&r);
+            symbol_type type = (symbol_type)get_u8(&r);
+            bool is_const = get_u8(&r) != 0;
+            const c_type* decl_type = get_type(&r, types);
+            if (name == NULL) {
+                pch_corrupt(&r);
+            }
+            s->symbols[s->num_symbols++] = create_symbol(name, type, is_const, decl_type);
+        }
+        if (i > 0) {
+            add_scope_to_table(symbols, s);
+        }
+    }
+
+    size_t num_declarations = get_count(&r);
+    program->declarations = counted_realloc(ALLOC_AST, program->declarations,
+                                            (program->num_declarations + num_declarations + 1) * sizeof(ast_node*));
+    for (size_t i = 0; i < num_declarations; ++i) {
+        program->declarations[program->num_declarations++] = get_node(&r);
+    }
+}
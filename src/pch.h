@@ -0,0 +1,57 @@
+#ifndef PCH_H
+#define PCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "lexer.h"
+#include "ast.h"
+#include "symbol_table.h"
+#include "types.h"
+#include "preprocessor.h"
+#include "cache.h"
+
+// A precompiled header: the state a translation unit is in right after
+// including some header, that is its macros, #pragma once files, symbol
+// scopes and global declarations. The file is mapped read-only and loaded
+// once per run; macro tokens point straight into the mapping, so applying
+// it to a job costs a few table inserts instead of lexing and parsing.
+typedef struct pch_file {
+    char* path;
+    char* data;
+    size_t size;
+    int64_t mtime_ns;
+    uint64_t content_hash;
+    cache_dependency* dependencies;
+    size_t num_dependencies;
+    const char** once_files;
+    size_t num_once_files;
+    token* macro_tokens;
+    int* macro_bounds;
+    size_t num_macros;
+    size_t declarations_offset;
+} pch_file;
+
+// The PCHs a compile server keeps mapped between runs. An entry is reused
+// while the file's size and mtime match and its dependencies are unchanged;
+// replaced entries stay mapped until the cache is freed, since runs still
+// in flight may point into them.
+typedef struct pch_cache {
+    pch_file** files;
+    size_t num_files;
+    size_t max_files;
+    pthread_mutex_t lock;
+} pch_cache;
+
+void write_pch(preprocessor* pp, const cache_dependency* dependencies, size_t num_dependencies,
+               symbol_table* symbols, ast_program_node* program, buffer* out);
+pch_file* load_pch(const char* path);
+void free_pch(pch_file* pch);
+pch_cache* create_pch_cache();
+void free_pch_cache(pch_cache* cache);
+const pch_file* acquire_pch(pch_cache* cache, const char* path);
+void apply_pch_macros(const pch_file* pch, preprocessor* pp);
+void apply_pch_declarations(const pch_file* pch, symbol_table* symbols, type_table* types, ast_program_node* program);
+
+#endif // PCH_H
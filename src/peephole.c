@@ -0,0 +1,471 @@
+#include "peephole.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Windowed peephole pass over the backend's instruction list. Each rule looks
+// at the instructions starting at one position and rewrites them in place;
+// the driver sweeps the function until no rule fires.
+
+typedef struct peephole_rule {
+    const char* name;
+    size_t window;                                  // instructions needed from i
+    bool (*apply)(x86_function* fn, size_t i);
+} peephole_rule;
+
+static bool is_reg(x86_operand operand, x86_reg reg) {
+    return operand.kind == OPERAND_REG && operand.reg == reg;
+}
+
+static bool addresses_with(x86_operand operand, x86_reg reg) {
+    return operand.kind == OPERAND_MEM && (operand.reg == reg || (operand.scale != 0 && operand.index == reg));
+}
+
+static bool mentions_reg(x86_operand operand, x86_reg reg) {
+    return (operand.kind == OPERAND_REG && operand.reg == reg) || addresses_with(operand, reg);
+}
+
+static bool same_operand(x86_operand a, x86_operand b) {
+    if (a.kind != b.kind || a.size != b.size) {
+        return false;
+    }
+    switch (a.kind) {
+        case OPERAND_REG:
+        case OPERAND_VEC:
+            return a.reg == b.reg;
+        case OPERAND_IMM:
+        case OPERAND_LABEL:
+            return a.imm == b.imm;
+        case OPERAND_MEM:
+            return a.reg == b.reg && a.imm == b.imm && a.scale == b.scale && (a.scale == 0 || a.index == b.index);
+        case OPERAND_SYMBOL:
+            return strcmp(a.symbol, b.symbol) == 0;
+        default:
+            return true;
+    }
+}
+
+static bool writes_flags(x86_opcode op) {
+    switch (op) {
+        case X86_ADD:
+        case X86_SUB:
+        case X86_IMUL:
+        case X86_IDIV:
+        case X86_NEG:
+        case X86_XOR:
+        case X86_CMP:
+        case X86_BT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// A jmp through a register goes somewhere only the jump table knows.
+static bool is_direct_jump(x86_inst* inst) {
+    return inst->op == X86_JMP && inst->dst.kind == OPERAND_LABEL;
+}
+
+static bool touches_stack(x86_inst* inst) {
+    return inst->op == X86_PUSH || inst->op == X86_POP || inst->op == X86_CALL || inst->op == X86_RET ||
+           mentions_reg(inst->dst, REG_RSP) || mentions_reg(inst->src, REG_RSP);
+}
+
+static bool is_control_flow(x86_opcode op) {
+    return op == X86_LABEL || op == X86_JMP || op == X86_JCC || op == X86_CALL || op == X86_RET;
+}
+
+static bool reads_reg(x86_inst* inst, x86_reg reg) {
+    if (mentions_reg(inst->src, reg)) {
+        return true;
+    }
+    if (addresses_with(inst->dst, reg)) {
+        return true;
+    }
+    switch (inst->op) {
+        case X86_ADD:
+        case X86_SUB:
+        case X86_IMUL:
+        case X86_CMP:
+        case X86_BT:
+        case X86_NEG:
+        case X86_SHL:
+        case X86_SAR:
+        case X86_SHR:
+        case X86_PUSH:
+        case X86_JMP:
+            return is_reg(inst->dst, reg);
+        case X86_XOR:
+            return is_reg(inst->dst, reg) && !same_operand(inst->dst, inst->src);
+        case X86_IDIV:
+            return is_reg(inst->dst, reg) || reg == REG_RAX || reg == REG_RDX;
+        case X86_CDQ:
+        case X86_RET:
+            return reg == REG_RAX;
+        case X86_SETCC:
+            return is_reg(inst->dst, reg);
+        case X86_CALL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// True when inst replaces the whole value of reg without looking at it.
+static bool overwrites_reg(x86_inst* inst, x86_reg reg) {
+    switch (inst->op) {
+        case X86_MOV:
+        case X86_MOVSX:
+        case X86_MOVZX:
+        case X86_POP:
+        case X86_LEA:
+            return is_reg(inst->dst, reg) && inst->dst.size >= 4 && !mentions_reg(inst->src, reg);
+        case X86_XOR:
+            return is_reg(inst->dst, reg) && same_operand(inst->dst, inst->src) && inst->dst.size >= 4;
+        case X86_CDQ:
+            return reg == REG_RDX;
+        default:
+            return false;
+    }
+}
+
+static size_t find_label(x86_function* fn, long long label) {
+    for (size_t i = 0; i < fn->num_insts; ++i) {
+        if (fn->insts[i].op == X86_LABEL && fn->insts[i].dst.imm == label) {
+            return i;
+        }
+    }
+    return fn->num_insts;
+}
+
+// Follows fall-through and jumps from start; gives up (reports live) once the
+// search budget is spent, so loops cannot make it run away.
+static bool reg_live_from(x86_function* fn, size_t start, x86_reg reg, int* budget) {
+    for (size_t j = start; j < fn->num_insts; ++j) {
+        if (--*budget <= 0) {
+            return true;
+        }
+        x86_inst* inst = &fn->insts[j];
+        if (reads_reg(inst, reg)) {
+            return true;
+        }
+        if (overwrites_reg(inst, reg)) {
+            return false;
+        }
+        if (inst->op == X86_RET) {
+            return false;
+        }
+        if (inst->op == X86_JMP) {
+            if (!is_direct_jump(inst)) {
+                return true;
+            }
+            return reg_live_from(fn, find_label(fn, inst->dst.imm), reg, budget);
+        }
+        if (inst->op == X86_JCC && reg_live_from(fn, find_label(fn, inst->dst.imm), reg, budget)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool reg_dead_after(x86_function* fn, size_t i, x86_reg reg) {
+    int budget = 256;
+    return !reg_live_from(fn, i + 1, reg, &budget);
+}
+
+// Condition codes produced by codegen are consumed immediately by SETcc/Jcc,
+// so they are never live across a label or an unconditional jump.
+static bool flags_dead_after(x86_function* fn, size_t i) {
+    for (size_t j = i + 1; j < fn->num_insts; ++j) {
+        x86_opcode op = fn->insts[j].op;
+        if (op == X86_SETCC || op == X86_JCC) {
+            return false;
+        }
+        if (writes_flags(op) || op == X86_JMP || op == X86_RET || op == X86_CALL) {
+            return true;
+        }
+    }
+    return true;
+}
+
+static void remove_inst(x86_function* fn, size_t i) {
+    memmove(&fn->insts[i], &fn->insts[i + 1], (fn->num_insts - i - 1) * sizeof(x86_inst));
+    fn->num_insts--;
+}
+
+static x86_cond invert_cond(x86_cond cond) {
+    return (x86_cond)(cond ^ 1);
+}
+
+// mov %r, %r
+static bool rule_self_move(x86_function* fn, size_t i) {
+    x86_inst* inst = &fn->insts[i];
+    if (inst->op == X86_MOV && inst->dst.kind == OPERAND_REG && same_operand(inst->dst, inst->src) &&
+        inst->dst.size == 8) {
+        remove_inst(fn, i);
+        return true;
+    }
+    return false;
+}
+
+// jmp L; L:
+static bool rule_jump_to_next(x86_function* fn, size_t i) {
+    x86_inst* inst = &fn->insts[i];
+    if (!is_direct_jump(inst)) {
+        return false;
+    }
+    for (size_t j = i + 1; j < fn->num_insts && fn->insts[j].op == X86_LABEL; ++j) {
+        if (fn->insts[j].dst.imm == inst->dst.imm) {
+            remove_inst(fn, i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// push %rax; <no stack or %rcx use>...; pop %rcx  =>  mov %eax, %ecx; ...
+// The stack machine only pushes 32-bit expression values, so a 32-bit copy
+// preserves everything the pop's consumer reads.
+static bool rule_push_pop(x86_function* fn, size_t i) {
+    x86_inst* push = &fn->insts[i];
+    if (push->op != X86_PUSH || push->dst.kind != OPERAND_REG) {
+        return false;
+    }
+    x86_reg from = push->dst.reg;
+    for (size_t j = i + 1; j < fn->num_insts && j < i + 8; ++j) {
+        x86_inst* inst = &fn->insts[j];
+        if (inst->op == X86_POP && inst->dst.kind == OPERAND_REG) {
+            x86_reg to = inst->dst.reg;
+            for (size_t k = i + 1; k < j; ++k) {
+                if (mentions_reg(fn->insts[k].dst, to) || mentions_reg(fn->insts[k].src, to) ||
+                    reads_reg(&fn->insts[k], to)) {
+                    return false;
+                }
+            }
+            remove_inst(fn, j);
+            fn->insts[i].op = X86_MOV;
+            fn->insts[i].dst = x86_reg_operand(to, 4);
+            fn->insts[i].src = x86_reg_operand(from, 4);
+            return true;
+        }
+        if (touches_stack(inst) || is_control_flow(inst->op)) {
+            return false;
+        }
+    }
+    return false;
+}
+
+// mov X, %a; mov %a, %b  =>  mov X, %b   when %a is dead afterwards
+static bool rule_forward_move(x86_function* fn, size_t i) {
+    x86_inst* first = &fn->insts[i];
+    x86_inst* second = &fn->insts[i + 1];
+    if ((first->op != X86_MOV && first->op != X86_MOVSX && first->op != X86_MOVZX) ||
+        first->dst.kind != OPERAND_REG || second->op != X86_MOV || second->dst.kind != OPERAND_REG ||
+        !same_operand(second->src, first->dst)) {
+        return false;
+    }
+    x86_reg a = first->dst.reg;
+    x86_reg b = second->dst.reg;
+    if (a == b || mentions_reg(first->src, b) || !reg_dead_after(fn, i + 1, a)) {
+        return false;
+    }
+    first->dst.reg = b;
+    remove_inst(fn, i + 1);
+    return true;
+}
+
+// mov $K, %r; mov %r, M  =>  mov $K, M   when %r is dead afterwards
+static bool rule_store_immediate(x86_function* fn, size_t i) {
+    x86_inst* mov = &fn->insts[i];
+    x86_inst* store = &fn->insts[i + 1];
+    if (mov->op != X86_MOV || mov->src.kind != OPERAND_IMM || mov->dst.kind != OPERAND_REG ||
+        store->op != X86_MOV || !is_reg(store->src, mov->dst.reg) || store->src.size > mov->dst.size ||
+        (store->dst.kind != OPERAND_MEM && store->dst.kind != OPERAND_SYMBOL) ||
+        !reg_dead_after(fn, i + 1, mov->dst.reg)) {
+        return false;
+    }
+    long long value = mov->src.imm;
+    if (store->dst.size == 1) {
+        value = (signed char)value;
+    }
+    store->src = x86_imm_operand(value, store->dst.size);
+    remove_inst(fn, i);
+    return true;
+}
+
+// jmp/ret followed by anything but a label: nothing can reach it
+static bool rule_unreachable(x86_function* fn, size_t i) {
+    x86_opcode op = fn->insts[i].op;
+    if ((op == X86_JMP || op == X86_RET) && fn->insts[i + 1].op != X86_LABEL) {
+        remove_inst(fn, i + 1);
+        return true;
+    }
+    return false;
+}
+
+// mov %eax, M; mov M, %eax  =>  mov %eax, M
+static bool rule_store_load(x86_function* fn, size_t i) {
+    x86_inst* store = &fn->insts[i];
+    x86_inst* load = &fn->insts[i + 1];
+    if (store->op != X86_MOV || store->src.kind != OPERAND_REG ||
+        (store->dst.kind != OPERAND_MEM && store->dst.kind != OPERAND_SYMBOL) ||
+        !same_operand(load->src, store->dst) || load->dst.kind != OPERAND_REG ||
+        load->dst.reg != store->src.reg) {
+        return false;
+    }
+    if (load->op == X86_MOV) {
+        remove_inst(fn, i + 1);
+        return true;
+    }
+    if (load->op == X86_MOVSX || load->op == X86_MOVZX) {
+        load->src = store->src;
+        return true;
+    }
+    return false;
+}
+
+// mov $K, %ecx; [inst]; op %ecx, %eax  =>  [inst]; op $K, %eax
+static bool rule_immediate_operand(x86_function* fn, size_t i) {
+    x86_inst* mov = &fn->insts[i];
+    if (mov->op != X86_MOV || mov->src.kind != OPERAND_IMM || mov->dst.kind != OPERAND_REG) {
+        return false;
+    }
+    x86_reg scratch = mov->dst.reg;
+    for (size_t j = i + 1; j < fn->num_insts && j <= i + 2; ++j) {
+        x86_inst* inst = &fn->insts[j];
+        bool takes_imm = inst->op == X86_ADD || inst->op == X86_SUB || inst->op == X86_IMUL ||
+                         inst->op == X86_CMP || inst->op == X86_XOR;
+        if (takes_imm && is_reg(inst->src, scratch) && inst->dst.kind == OPERAND_REG &&
+            inst->dst.reg != scratch && reg_dead_after(fn, j, scratch)) {
+            inst->src = x86_imm_operand(mov->src.imm, inst->src.size);
+            remove_inst(fn, i);
+            return true;
+        }
+        if (mentions_reg(inst->dst, scratch) || mentions_reg(inst->src, scratch) || reads_reg(inst, scratch) ||
+            is_control_flow(inst->op) || overwrites_reg(inst, scratch)) {
+            return false;
+        }
+    }
+    return false;
+}
+
+// mov $0, %r  =>  xor %r, %r
+static bool rule_zero_idiom(x86_function* fn, size_t i) {
+    x86_inst* inst = &fn->insts[i];
+    if (inst->op != X86_MOV || inst->dst.kind != OPERAND_REG || inst->src.kind != OPERAND_IMM ||
+        inst->src.imm != 0 || inst->dst.size < 4 || !flags_dead_after(fn, i)) {
+        return false;
+    }
+    inst->op = X86_XOR;
+    inst->dst.size = 4;
+    inst->src = inst->dst;
+    return true;
+}
+
+// cmp; setcc %al; movzbl %al, %eax; cmp $0, %eax; je/jne L  =>  cmp; jcc L
+static bool rule_compare_branch(x86_function* fn, size_t i) {
+    x86_inst* w = &fn->insts[i];
+    if (w[0].op != X86_CMP || w[1].op != X86_SETCC || w[2].op != X86_MOVZX || w[3].op != X86_CMP ||
+        w[4].op != X86_JCC) {
+        return false;
+    }
+    x86_reg value = w[2].dst.reg;
+    if (!is_reg(w[1].dst, value) || !is_reg(w[2].src, value) || !is_reg(w[3].dst, value) ||
+        w[3].src.kind != OPERAND_IMM || w[3].src.imm != 0 || (w[4].cond != CC_E && w[4].cond != CC_NE) ||
+        !reg_dead_after(fn, i + 4, value)) {
+        return false;
+    }
+    // je branches when the condition was false, jne when it was true.
+    x86_cond cond = w[4].cond == CC_NE ? w[1].cond : invert_cond(w[1].cond);
+    w[1].op = X86_JCC;
+    w[1].cond = cond;
+    w[1].dst = w[4].dst;
+    remove_inst(fn, i + 4);
+    remove_inst(fn, i + 3);
+    remove_inst(fn, i + 2);
+    return true;
+}
+
+// jcc L1; jmp L2; L1:  =>  j!cc L2; L1:
+static bool rule_invert_branch(x86_function* fn, size_t i) {
+    x86_inst* w = &fn->insts[i];
+    if (w[0].op != X86_JCC || !is_direct_jump(&w[1]) || w[2].op != X86_LABEL || w[0].dst.imm != w[2].dst.imm) {
+        return false;
+    }
+    w[0].cond = invert_cond(w[0].cond);
+    w[0].dst = w[1].dst;
+    remove_inst(fn, i + 1);
+    return true;
+}
+
+// add/sub $0 and imul $1 with nobody reading the flags
+static bool rule_identity_arith(x86_function* fn, size_t i) {
+    x86_inst* inst = &fn->insts[i];
+    if (inst->src.kind != OPERAND_IMM) {
+        return false;
+    }
+    bool identity = ((inst->op == X86_ADD || inst->op == X86_SUB) && inst->src.imm == 0) ||
+                    (inst->op == X86_IMUL && inst->src.imm == 1);
+    if (identity && flags_dead_after(fn, i)) {
+        remove_inst(fn, i);
+        return true;
+    }
+    return false;
+}
+
+static const peephole_rule rules[] = {
+    { "self-move", 1, rule_self_move },
+    { "jump-to-next", 2, rule_jump_to_next },
+    { "push-pop-to-move", 2, rule_push_pop },
+    { "forward-move", 2, rule_forward_move },
+    { "store-load", 2, rule_store_load },
+    { "store-immediate", 2, rule_store_immediate },
+    { "unreachable", 2, rule_unreachable },
+    { "immediate-operand", 2, rule_immediate_operand },
+    { "zero-idiom", 1, rule_zero_idiom },
+    { "compare-branch", 5, rule_compare_branch },
+    { "identity-arith", 1, rule_identity_arith },
+    { "invert-branch", 3, rule_invert_branch },
+};
+
+#define NUM_RULES (sizeof(rules) / sizeof(rules[0]))
+
+size_t peephole_rule_count() {
+    return NUM_RULES;
+}
+
+const char* peephole_rule_name(size_t rule) {
+    return rules[rule].name;
+}
+
+void peephole_function(x86_function* fn, peephole_stats* stats) {
+    stats->insts_before += fn->num_insts;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 0; i < fn->num_insts; ++i) {
+            for (size_t r = 0; r < NUM_RULES; ++r) {
+                if (i + rules[r].window <= fn->num_insts && rules[r].apply(fn, i)) {
+                    stats->hits[r]++;
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+    stats->insts_after += fn->num_insts;
+}
+
+void peephole_module(x86_module* m, peephole_stats* stats) {
+    for (size_t i = 0; i < m->num_functions; ++i) {
+        peephole_function(m->functions[i], stats);
+    }
+}
+
+void print_peephole_stats(peephole_stats* stats, buffer* out) {
+    buffer_printf(out, "peephole: %zu -> %zu instructions\n", stats->insts_before, stats->insts_after);
+    for (size_t r = 0; r < NUM_RULES; ++r) {
+        buffer_printf(out, "  %-20s %8zu\n", rules[r].name, stats->hits[r]);
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include <stddef.h>
+#include "x86.h"
+#include "buffer.h"
+
+#define PEEPHOLE_MAX_RULES 32
+
+typedef struct peephole_stats {
+    size_t hits[PEEPHOLE_MAX_RULES];
+    size_t insts_before;
+    size_t insts_after;
+} peephole_stats;
+
+void peephole_function(x86_function* fn, peephole_stats* stats);
+void peephole_module(x86_module* m, peephole_stats* stats);
+size_t peephole_rule_count();
+const char* peephole_rule_name(size_t rule);
+void print_peephole_stats(peephole_stats* stats, buffer* out);
+
+#endif // PEEPHOLE_H
@@ -0,0 +1,689 @@
+#include "preprocessor.h"
+
+#include <limits.h>
+#include <sys/stat.h>
+#include "hash.h"
+
+#define PP_MAX_INCLUDE_DEPTH 200
+
+header_cache* create_header_cache() {
+    header_cache* cache = malloc(sizeof(header_cache));
+    if (cache == NULL) {
+        fatal_error("Error: Failed to allocate header cache!\n");
+    }
+    cache->capacity = 64;
+    cache->num_files = 0;
+    cache->revalidate = false;
+    cache->retired = NULL;
+    cache->num_retired = 0;
+    cache->max_retired = 0;
+    cache->slots = calloc(cache->capacity, sizeof(pp_file*));
+    if (cache->slots == NULL) {
+        fatal_error("Error: Failed to allocate header cache!\n");
+    }
+    pthread_mutex_init(&cache->lock, NULL);
+    return cache;
+}
+
+static void free_pp_file(pp_file* file) {
+    for (int i = 0; i < file->num_tokens; ++i) {
+        free(file->tokens[i].lexme);
+    }
+    free(file->tokens);
+    free(file->content);
+    free(file->path);
+    free(file->guard);
+    free(file);
+}
+
+void free_header_cache(header_cache* cache) {
+    for (size_t i = 0; i < cache->capacity; ++i) {
+        if (cache->slots[i] != NULL) {
+            free_pp_file(cache->slots[i]);
+        }
+    }
+    for (size_t i = 0; i < cache->num_retired; ++i) {
+        free_pp_file(cache->retired[i]);
+    }
+    free(cache->retired);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->slots);
+    free(cache);
+}
+
+// Open addressing on the canonical path; callers hold the lock.
+static pp_file** find_slot(header_cache* cache, const char* path) {
+    size_t mask = cache->capacity - 1;
+    size_t i = (size_t)hash_string(path, 0) & mask;
+    while (cache->slots[i] != NULL && strcmp(cache->slots[i]->path, path) != 0) {
+        i = (i + 1) & mask;
+    }
+    return &cache->slots[i];
+}
+
+static void grow_header_cache(header_cache* cache) {
+    pp_file** old_slots = cache->slots;
+    size_t old_capacity = cache->capacity;
+    cache->capacity *= 2;
+    cache->slots = calloc(cache->capacity, sizeof(pp_file*));
+    if (cache->slots == NULL) {
+        fatal_error("Error: Failed to grow header cache!\n");
+    }
+    for (size_t i = 0; i < old_capacity; ++i) {
+        if (old_slots[i] != NULL) {
+            *find_slot(cache, old_slots[i]->path) = old_slots[i];
+        }
+    }
+    free(old_slots);
+}
+
+static bool is_conditional_start(tag kind) {
+    return kind == PP_IF || kind == PP_IFDEF || kind == PP_IFNDEF;
+}
+
+static int directive_end(const token* tokens, int start, int num_tokens) {
+    int end = start + 1;
+    while (end < num_tokens && !(tokens[end].flags & TOKEN_AT_LINE_START)) {
+        end++;
+    }
+    return end;
+}
+
+// Recognizes "#ifndef X" and "#if !defined X" / "#if !defined(X)" lines.
+static const char* guard_candidate(const token* tokens, int start, int end) {
+    int length = end - start - 1;
+    const token* args = tokens + start + 1;
+    if (tokens[start].kind == PP_IFNDEF && length == 1 && is_pp_identifier(args[0].kind)) {
+        return args[0].lexme;
+    }
+    if (tokens[start].kind == PP_IF && length >= 3 && args[0].kind == LOGICAL_NOT &&
+        strcmp(args[1].lexme, "defined") == 0) {
+        if (length == 3 && is_pp_identifier(args[2].kind)) {
+            return args[2].lexme;
+        }
+        if (length == 5 && args[2].kind == LPAREN && is_pp_identifier(args[3].kind) && args[4].kind == RPAREN) {
+            return args[3].lexme;
+        }
+    }
+    return NULL;
+}
+
+// A file is guarded when its first line opens a guard conditional whose
+// matching #endif is the last line, with no #else/#elif at the outer level.
+static char* detect_include_guard(const token* tokens, int num_tokens) {
+    if (num_tokens == 0 || !is_pp_directive(&tokens[0])) {
+        return NULL;
+    }
+    const char* guard = guard_candidate(tokens, 0, directive_end(tokens, 0, num_tokens));
+    if (guard == NULL) {
+        return NULL;
+    }
+
+    int depth = 0;
+    for (int i = 0; i < num_tokens; ++i) {
+        if (!is_pp_directive(&tokens[i])) {
+            continue;
+        }
+        if (is_conditional_start(tokens[i].kind)) {
+            depth++;
+        } else if ((tokens[i].kind == PP_ELSE || tokens[i].kind == PP_ELIF) && depth == 1) {
+            return NULL;
+        } else if (tokens[i].kind == PP_ENDIF && --depth == 0) {
+            return directive_end(tokens, i, num_tokens) == num_tokens ? counted_strdup(ALLOC_LEXER, guard) : NULL;
+        }
+    }
+    return NULL;
+}
+
+static int64_t mtime_ns(const struct stat* st) {
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+static bool header_unchanged(const pp_file* file) {
+    struct stat st;
+    return stat(file->path, &st) == 0 && (int64_t)st.st_size == file->size && mtime_ns(&st) == file->mtime_ns;
+}
+
+static pp_file* load_header(char* path) {
+    // Stat before reading, so a write racing with the read shows up as a
+    // changed mtime on the next lookup.
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        fatal_error("Error: File %s not found!\n", path);
+    }
+    size_t size;
+    char* content = read_source_file(path, &size);
+    pp_file* file = malloc(sizeof(pp_file));
+    if (file == NULL) {
+        fatal_error("Error: Failed to allocate memory for header %s!\n", path);
+    }
+    file->path = counted_strdup(ALLOC_LEXER, path);
+    file->content = content;
+    file->content_hash = hash_bytes(content, size, 0);
+    file->size = (int64_t)st.st_size;
+    file->mtime_ns = mtime_ns(&st);
+
+    lexer l = init_lexer_from_source(file->path, content);
+    file->tokens = tokenizer(&l);
+    file->num_tokens = l.tokens_count - 1;
+    file->guard = detect_include_guard(file->tokens, file->num_tokens);
+    file->users = 0;
+    file->retired = false;
+    return file;
+}
+
+// Callers hold the lock. A copy nobody uses goes at once.
+static void retire_header(header_cache* cache, pp_file* file) {
+    if (file->users == 0) {
+        free_pp_file(file);
+        return;
+    }
+    if (cache->num_retired == cache->max_retired) {
+        cache->max_retired = cache->max_retired ? cache->max_retired * 2 : 16;
+        cache->retired = realloc(cache->retired, cache->max_retired * sizeof(pp_file*));
+        if (cache->retired == NULL) {
+            fatal_error("Error: Failed to allocate header cache!\n");
+        }
+    }
+    file->retired = true;
+    cache->retired[cache->num_retired++] = file;
+}
+
+// Drops one reference taken by get_header; the last one frees a retired copy.
+static void release_header(header_cache* cache, pp_file* file) {
+    pthread_mutex_lock(&cache->lock);
+    if (--file->users == 0 && file->retired) {
+        for (size_t i = 0; i < cache->num_retired; ++i) {
+            if (cache->retired[i] == file) {
+                cache->retired[i] = cache->retired[--cache->num_retired];
+                break;
+            }
+        }
+        free_pp_file(file);
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// Returns the shared copy of a header, lexing it on first use, with a
+// reference the caller must release. Lexing happens outside the lock; if two
+// jobs race on the same header, the loser's copy is dropped.
+static pp_file* get_header(header_cache* cache, char* path) {
+    pthread_mutex_lock(&cache->lock);
+    pp_file* file = *find_slot(cache, path);
+    if (file != NULL) {
+        file->users++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    if (file != NULL && (!cache->revalidate || header_unchanged(file))) {
+        return file;
+    }
+    if (file != NULL) {
+        release_header(cache, file);
+    }
+
+    pp_file* loaded = load_header(path);
+    pthread_mutex_lock(&cache->lock);
+    pp_file** slot = find_slot(cache, path);
+    if (*slot == NULL || (*slot)->size != loaded->size || (*slot)->mtime_ns != loaded->mtime_ns) {
+        pp_file* stale = *slot;
+        *slot = loaded;
+        loaded = NULL;
+        if (stale != NULL) {
+            retire_header(cache, stale);
+        } else if (++cache->num_files * 2 > cache->capacity) {
+            grow_header_cache(cache);
+        }
+    }
+    file = *find_slot(cache, path);
+    file->users++;
+    pthread_mutex_unlock(&cache->lock);
+    if (loaded != NULL) {
+        free_pp_file(loaded);
+    }
+    return file;
+}
+
+preprocessor init_preprocessor(header_cache* headers, char** include_dirs, size_t num_include_dirs) {
+    preprocessor pp = {0};
+    pp.headers = headers;
+    pp.include_dirs = include_dirs;
+    pp.num_include_dirs = num_include_dirs;
+    init_macro_table(&pp.macros);
+    pp.max_output = 256;
+    pp.output = counted_malloc(ALLOC_LEXER, pp.max_output * sizeof(token));
+    if (pp.output == NULL) {
+        fatal_error("Error: Failed to allocate memory for tokens!\n");
+    }
+    return pp;
+}
+
+void free_preprocessor(preprocessor* pp) {
+    for (size_t i = 0; i < pp->num_once_files; ++i) {
+        free(pp->once_files[i]);
+    }
+    free(pp->once_files);
+    free_macro_table(&pp->macros);
+    free(pp->conditionals);
+    free(pp->main_path);
+    free(pp->condition);
+    free(pp->expanded);
+    for (size_t i = 0; i < pp->num_dependencies; ++i) {
+        release_header(pp->headers, pp->dependencies[i]);
+    }
+    free(pp->dependencies);
+}
+
+static void* grow_array(void* array, size_t* capacity, size_t element_size) {
+    *capacity = *capacity ? *capacity * 2 : 16;
+    array = counted_realloc(ALLOC_LEXER, array, *capacity * element_size);
+    if (array == NULL) {
+        fatal_error("Error: Failed to allocate memory in the preprocessor!\n");
+    }
+    return array;
+}
+
+static void emit_token(preprocessor* pp, const token* t) {
+    if (pp->num_output == pp->max_output) {
+        resize_tokens(&pp->output, &pp->max_output);
+    }
+    pp->output[pp->num_output++] = *t;
+}
+
+static bool is_active(preprocessor* pp) {
+    return pp->num_conditionals == 0 || pp->conditionals[pp->num_conditionals - 1].active;
+}
+
+typedef struct pp_expression {
+    token* tokens;
+    int num_tokens;
+    int index;
+    const char* path;
+    int line;
+} pp_expression;
+
+static long long parse_pp_expression(pp_expression* e, int min_precedence);
+
+static long long parse_pp_primary(pp_expression* e) {
+    if (e->index >= e->num_tokens) {
+        fatal_error("Error: %s:%d: incomplete #if expression\n", e->path, e->line);
+    }
+    token* t = &e->tokens[e->index++];
+    switch (t->kind) {
+        case NUMBER:
+            return strtoll(t->lexme, NULL, 10);
+        case CHARACTER:
+            return (unsigned char)t->lexme[0];
+        case LPAREN: {
+            long long value = parse_pp_expression(e, 1);
+            if (e->index >= e->num_tokens || e->tokens[e->index].kind != RPAREN) {
+                fatal_error("Error: %s:%d: expected ')' in #if expression\n", e->path, e->line);
+            }
+            e->index++;
+            return value;
+        }
+        case LOGICAL_NOT:
+            return !parse_pp_primary(e);
+        case MINUS:
+            return -parse_pp_primary(e);
+        case PLUS:
+            return parse_pp_primary(e);
+        default:
+            // Identifiers left after macro expansion evaluate to 0.
+            if (is_pp_identifier(t->kind)) {
+                return 0;
+            }
+            fatal_error("Error: %s:%d: unexpected '%s' in #if expression\n", e->path, e->line, t->lexme);
+    }
+}
+
+static int pp_precedence(tag kind) {
+    switch (kind) {
+        case LOGICAL_OR:
+            return 1;
+        case LOGICAL_AND:
+            return 2;
+        case BITWISE_OR:
+            return 3;
+        case BITWISE_AND:
+            return 4;
+        case EQUAL:
+        case NOT_EQUAL:
+            return 5;
+        case LESS:
+        case LESS_EQUAL:
+        case GREATER:
+        case GREATER_EQUAL:
+            return 6;
+        case PLUS:
+        case MINUS:
+            return 7;
+        case MULTIPLY:
+        case DIVIDE:
+        case MODULO:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+static long long parse_pp_expression(pp_expression* e, int min_precedence) {
+    long long left = parse_pp_primary(e);
+    while (e->index < e->num_tokens) {
+        tag op = e->tokens[e->index].kind;
+        int precedence = pp_precedence(op);
+        if (precedence == 0 || precedence < min_precedence) {
+            break;
+        }
+        e->index++;
+        long long right = parse_pp_expression(e, precedence + 1);
+        switch (op) {
+            case LOGICAL_OR: left = left || right; break;
+            case LOGICAL_AND: left = left && right; break;
+            case BITWISE_OR: left = left | right; break;
+            case BITWISE_AND: left = left & right; break;
+            case EQUAL: left = left == right; break;
+            case NOT_EQUAL: left = left != right; break;
+            case LESS: left = left < right; break;
+            case LESS_EQUAL: left = left <= right; break;
+            case GREATER: left = left > right; break;
+            case GREATER_EQUAL: left = left >= right; break;
+            case PLUS: left = left + right; break;
+            case MINUS: left = left - right; break;
+            case MULTIPLY: left = left * right; break;
+            case DIVIDE:
+            case MODULO:
+                if (right == 0) {
+                    fatal_error("Error: %s:%d: division by zero in #if expression\n", e->path, e->line);
+                }
+                left = op == DIVIDE ? left / right : left % right;
+                break;
+            default:
+                break;
+        }
+    }
+    return left;
+}
+
+// Resolves defined(X), expands macros, then evaluates the directive's
+// arguments as an integer constant expression.
+static bool evaluate_condition(preprocessor* pp, const char* path, token* tokens, int start, int end) {
+    static token one = {"1", NUMBER, 0, 0};
+    static token zero = {"0", NUMBER, 0, 0};
+    if (pp->max_condition < end - start) {
+        pp->max_condition = end - start;
+        pp->condition = counted_realloc(ALLOC_LEXER, pp->condition, pp->max_condition * sizeof(token));
+        if (pp->condition == NULL) {
+            fatal_error("Error: Failed to allocate memory for tokens!\n");
+        }
+    }
+    token* resolved = pp->condition;
+    int num_resolved = 0;
+
+    for (int i = start + 1; i < end; ++i) {
+        if (tokens[i].kind == IDENTIFIER && strcmp(tokens[i].lexme, "defined") == 0) {
+            bool parenthesized = i + 1 < end && tokens[i + 1].kind == LPAREN;
+            int name = i + (parenthesized ? 2 : 1);
+            if (name >= end || !is_pp_identifier(tokens[name].kind) ||
+                (parenthesized && (name + 1 >= end || tokens[name + 1].kind != RPAREN))) {
+                fatal_error("Error: %s:%d: malformed defined()\n", path, tokens[start].line);
+            }
+            resolved[num_resolved++] = lookup_macro(&pp->macros, tokens[name].lexme) ? one : zero;
+            i = name + (parenthesized ? 1 : 0);
+        } else {
+            resolved[num_resolved++] = tokens[i];
+        }
+    }
+
+    if (pp->max_expanded < num_resolved + 16) {
+        pp->max_expanded = num_resolved + 16;
+        pp->expanded = counted_realloc(ALLOC_LEXER, pp->expanded, pp->max_expanded * sizeof(token));
+        if (pp->expanded == NULL) {
+            fatal_error("Error: Failed to allocate memory for tokens!\n");
+        }
+    }
+    int num_list = 0;
+    macro_input in = {resolved, 0, num_resolved, pp->macros.pending.length, path};
+    expand_macros(&pp->macros, &in, &pp->expanded, &num_list, &pp->max_expanded);
+    token* list = pp->expanded;
+
+    pp_expression e = {list, num_list, 0, path, tokens[start].line};
+    if (num_list == 0) {
+        fatal_error("Error: %s:%d: #%s with no expression\n", path, e.line, tokens[start].lexme);
+    }
+    long long value = parse_pp_expression(&e, 1);
+    if (e.index != e.num_tokens) {
+        fatal_error("Error: %s:%d: unexpected '%s' in #if expression\n", path, e.line, list[e.index].lexme);
+    }
+    return value != 0;
+}
+
+static void push_conditional(preprocessor* pp, bool condition) {
+    if (pp->num_conditionals == pp->max_conditionals) {
+        pp->conditionals = grow_array(pp->conditionals, &pp->max_conditionals, sizeof(pp_conditional));
+    }
+    bool parent_active = is_active(pp);
+    pp_conditional c = {parent_active, parent_active && condition, parent_active && condition, false};
+    pp->conditionals[pp->num_conditionals++] = c;
+}
+
+static bool is_once_file(preprocessor* pp, const char* path) {
+    for (size_t i = 0; i < pp->num_once_files; ++i) {
+        if (strcmp(pp->once_files[i], path) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void mark_once_file(preprocessor* pp, const char* path) {
+    if (is_once_file(pp, path)) {
+        return;
+    }
+    if (pp->num_once_files == pp->max_once_files) {
+        pp->once_files = grow_array(pp->once_files, &pp->max_once_files, sizeof(char*));
+    }
+    pp->once_files[pp->num_once_files++] = _strdup(path);
+}
+
+// Takes over the reference get_header returned file with; each dependency
+// holds one until the preprocessor is freed.
+static void add_dependency(preprocessor* pp, pp_file* file) {
+    for (size_t i = 0; i < pp->num_dependencies; ++i) {
+        if (pp->dependencies[i] == file) {
+            release_header(pp->headers, file);
+            return;
+        }
+    }
+    if (pp->num_dependencies == pp->max_dependencies) {
+        pp->dependencies = grow_array(pp->dependencies, &pp->max_dependencies, sizeof(pp_file*));
+    }
+    pp->dependencies[pp->num_dependencies++] = file;
+}
+
+// Tries dir/name and returns its canonical path, or NULL if there is no
+// such regular file.
+static char* try_include_path(const char* dir, size_t dir_length, const char* name) {
+    char candidate[PATH_MAX];
+    int length = dir_length > 0
+        ? snprintf(candidate, sizeof(candidate), "%.*s/%s", (int)dir_length, dir, name)
+        : snprintf(candidate, sizeof(candidate), "%s", name);
+    struct stat st;
+    if (length < 0 || length >= (int)sizeof(candidate) || stat(candidate, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return NULL;
+    }
+    return realpath(candidate, NULL);
+}
+
+// "name" searches the including file's directory first, then the -I
+// directories; <name> searches only the -I directories.
+static char* resolve_include(preprocessor* pp, const char* current_path, const token* name) {
+    char* resolved = NULL;
+    if (name->lexme[0] == '/') {
+        return try_include_path("", 0, name->lexme);
+    }
+    if (name->kind == STRING) {
+        const char* slash = strrchr(current_path, '/');
+        resolved = slash ? try_include_path(current_path, (size_t)(slash - current_path), name->lexme)
+                         : try_include_path(".", 1, name->lexme);
+    }
+    for (size_t i = 0; resolved == NULL && i < pp->num_include_dirs; ++i) {
+        resolved = try_include_path(pp->include_dirs[i], strlen(pp->include_dirs[i]), name->lexme);
+    }
+    return resolved;
+}
+
+static void preprocess_tokens(preprocessor* pp, char* path, token* tokens, int num_tokens);
+
+static void include_file(preprocessor* pp, const char* path, token* tokens, int start, int end) {
+    if (start + 1 >= end || (tokens[start + 1].kind != STRING && tokens[start + 1].kind != IDENTIFIER)) {
+        fatal_error("Error: %s:%d: #include expects \"file\" or <file>\n", path, tokens[start].line);
+    }
+    token* name = &tokens[start + 1];
+    char* resolved = resolve_include(pp, path, name);
+    if (resolved == NULL) {
+        fatal_error("Error: %s:%d: include file '%s' not found\n", path, name->line, name->lexme);
+    }
+
+    // Guarded and #pragma once headers are skipped without being reopened.
+    if (is_once_file(pp, resolved)) {
+        free(resolved);
+        return;
+    }
+    pp_file* file = get_header(pp->headers, resolved);
+    free(resolved);
+    add_dependency(pp, file);
+    if (file->guard != NULL && lookup_macro(&pp->macros, file->guard) != NULL) {
+        return;
+    }
+
+    if (++pp->include_depth > PP_MAX_INCLUDE_DEPTH) {
+        fatal_error("Error: %s:%d: #include nested too deeply\n", path, name->line);
+    }
+    preprocess_tokens(pp, file->path, file->tokens, file->num_tokens);
+    pp->include_depth--;
+}
+
+static void handle_directive(preprocessor* pp, char* path, token* tokens, int start, int end, size_t base_depth) {
+    token* directive = &tokens[start];
+    pp_conditional* top = pp->num_conditionals > base_depth ? &pp->conditionals[pp->num_conditionals - 1] : NULL;
+
+    switch (directive->kind) {
+        case PP_IFDEF:
+        case PP_IFNDEF: {
+            if (start + 1 >= end || !is_pp_identifier(tokens[start + 1].kind)) {
+                fatal_error("Error: %s:%d: macro name missing in #%s\n", path, directive->line, directive->lexme);
+            }
+            bool defined = lookup_macro(&pp->macros, tokens[start + 1].lexme) != NULL;
+            push_conditional(pp, directive->kind == PP_IFDEF ? defined : !defined);
+            return;
+        }
+        case PP_IF:
+            push_conditional(pp, is_active(pp) && evaluate_condition(pp, path, tokens, start, end));
+            return;
+        case PP_ELIF:
+            if (top == NULL || top->seen_else) {
+                fatal_error("Error: %s:%d: #elif without #if\n", path, directive->line);
+            }
+            if (top->parent_active && !top->taken) {
+                top->active = evaluate_condition(pp, path, tokens, start, end);
+                top->taken = top->active;
+            } else {
+                top->active = false;
+            }
+            return;
+        case PP_ELSE:
+            if (top == NULL || top->seen_else) {
+                fatal_error("Error: %s:%d: #else without #if\n", path, directive->line);
+            }
+            top->seen_else = true;
+            top->active = top->parent_active && !top->taken;
+            top->taken = true;
+            return;
+        case PP_ENDIF:
+            if (top == NULL) {
+                fatal_error("Error: %s:%d: #endif without #if\n", path, directive->line);
+            }
+            pp->num_conditionals--;
+            return;
+        default:
+            break;
+    }
+
+    if (!is_active(pp)) {
+        return;
+    }
+    switch (directive->kind) {
+        case PP_INCLUDE:
+            include_file(pp, path, tokens, start, end);
+            break;
+        case PP_DEFINE:
+            define_macro(&pp->macros, path, tokens, start, end);
+            break;
+        case PP_UNDEF:
+            if (start + 1 >= end || !is_pp_identifier(tokens[start + 1].kind)) {
+                fatal_error("Error: %s:%d: macro name missing in #undef\n", path, directive->line);
+            }
+            undefine_macro(&pp->macros, tokens[start + 1].lexme);
+            break;
+        case PP_PRAGMA:
+            if (start + 1 < end && strcmp(tokens[start + 1].lexme, "once") == 0) {
+                mark_once_file(pp, path);
+            }
+            break;
+        case PP_ERROR: {
+            buffer message = init_buffer(64);
+            for (int i = start + 1; i < end; ++i) {
+                buffer_printf(&message, i > start + 1 ? " %s" : "%s", tokens[i].lexme);
+            }
+            buffer_putc(&message, '\0');
+            report_error("Error: %s:%d: #error %s\n", path, directive->line, message.data);
+            free_buffer(&message);
+            abort_compilation();
+        }
+        default:
+            // A lone '#' is the null directive.
+            if (directive->lexme[0] != '\0') {
+                fatal_error("Error: %s:%d: unknown directive #%s\n", path, directive->line, directive->lexme);
+            }
+            break;
+    }
+}
+
+static void preprocess_tokens(preprocessor* pp, char* path, token* tokens, int num_tokens) {
+    size_t base_depth = pp->num_conditionals;
+    int i = 0;
+    while (i < num_tokens) {
+        if (is_pp_directive(&tokens[i])) {
+            int end = directive_end(tokens, i, num_tokens);
+            handle_directive(pp, path, tokens, i, end, base_depth);
+            i = end;
+        } else {
+            if (is_active(pp)) {
+                macro_input in = {tokens, i, num_tokens, pp->macros.pending.length, path};
+                expand_macros(&pp->macros, &in, &pp->output, &pp->num_output, &pp->max_output);
+                i = in.index;
+            } else {
+                i++;
+            }
+        }
+    }
+    if (pp->num_conditionals != base_depth) {
+        fatal_error("Error: %s: unterminated conditional directive\n", path);
+    }
+}
+
+// Runs the directives in the lexer's token stream and returns the tokens the
+// parser should see; l->tokens_count is updated to match. main_path is where
+// the file was actually read from, which is not its display name when a
+// compile server runs on behalf of a client in another directory.
+token* preprocess(preprocessor* pp, const char* main_path, lexer* l, token* tokens) {
+    pp->main_path = realpath(main_path, NULL);
+    if (pp->main_path == NULL) {
+        pp->main_path = _strdup(main_path);
+    }
+    preprocess_tokens(pp, pp->main_path, tokens, l->tokens_count - 1);
+    emit_token(pp, &tokens[l->tokens_count - 1]);
+
+    l->tokens_count = pp->num_output;
+    return pp->output;
+}
@@ -0,0 +1,83 @@
+#ifndef PREPROCESSOR_H
+#define PREPROCESSOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "lexer.h"
+#include "macro.h"
+
+// A header read and lexed once per run and shared by every translation unit.
+// guard is the macro of an #ifndef/#endif pair wrapping the whole file, if
+// there is one: once it is defined, including the file again is a no-op.
+typedef struct pp_file {
+    char* path;
+    char* content;
+    token* tokens;
+    int num_tokens;
+    uint64_t content_hash;
+    int64_t size;
+    int64_t mtime_ns;
+    char* guard;
+    size_t users;               // preprocessors holding it, under the cache lock
+    bool retired;
+} pp_file;
+
+// With revalidate set, as in a long-running compile server, every lookup
+// checks the file's size and mtime and relexes it if either changed. The
+// stale copy is retired rather than freed while jobs still running point
+// into its tokens, and freed when the last of them finishes.
+typedef struct header_cache {
+    pp_file** slots;
+    size_t num_files;
+    size_t capacity;
+    bool revalidate;
+    pp_file** retired;
+    size_t num_retired;
+    size_t max_retired;
+    pthread_mutex_t lock;
+} header_cache;
+
+typedef struct pp_conditional {
+    bool parent_active;
+    bool active;
+    bool taken;
+    bool seen_else;
+} pp_conditional;
+
+typedef struct preprocessor {
+    header_cache* headers;
+    char** include_dirs;
+    size_t num_include_dirs;
+    macro_table macros;
+    pp_conditional* conditionals;
+    size_t num_conditionals;
+    size_t max_conditionals;
+    char** once_files;
+    size_t num_once_files;
+    size_t max_once_files;
+    pp_file** dependencies;
+    size_t num_dependencies;
+    size_t max_dependencies;
+    token* output;
+    int num_output;
+    int max_output;
+    int include_depth;
+    // Owned here rather than by the code using them, so that a fatal error
+    // in an #if or anywhere in the file still frees them.
+    char* main_path;
+    token* condition;
+    int max_condition;
+    token* expanded;
+    int max_expanded;
+} preprocessor;
+
+header_cache* create_header_cache();
+void free_header_cache(header_cache* cache);
+preprocessor init_preprocessor(header_cache* headers, char** include_dirs, size_t num_include_dirs);
+void free_preprocessor(preprocessor* pp);
+void mark_once_file(preprocessor* pp, const char* path);
+token* preprocess(preprocessor* pp, const char* main_path, lexer* l, token* tokens);
+
+#endif // PREPROCESSOR_H
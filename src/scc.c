@@ -0,0 +1,150 @@
+#include "scc.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "compat.h"
+#include "driver.h"
+
+struct scc_context {
+    header_cache* headers;
+    pch_cache* pchs;
+    char* pch_path;
+    char** include_dirs;
+    size_t num_include_dirs;
+    compile_cache cache;
+    bool use_cache;
+};
+
+scc_context* scc_create_context(void) {
+    scc_context* ctx = calloc(1, sizeof(scc_context));
+    if (ctx == NULL) {
+        return NULL;
+    }
+    // Callers may edit headers between compilations, as with the server.
+    ctx->headers = create_header_cache();
+    ctx->headers->revalidate = true;
+    ctx->pchs = create_pch_cache();
+    return ctx;
+}
+
+void scc_destroy_context(scc_context* ctx) {
+    if (ctx == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < ctx->num_include_dirs; ++i) {
+        free(ctx->include_dirs[i]);
+    }
+    free(ctx->include_dirs);
+    if (ctx->use_cache) {
+        free_compile_cache(&ctx->cache);
+    }
+    free(ctx->pch_path);
+    free_pch_cache(ctx->pchs);
+    free_header_cache(ctx->headers);
+    free(ctx);
+}
+
+int scc_add_include_dir(scc_context* ctx, const char* directory) {
+    char** include_dirs = realloc(ctx->include_dirs, (ctx->num_include_dirs + 1) * sizeof(char*));
+    if (include_dirs == NULL) {
+        return -1;
+    }
+    ctx->include_dirs = include_dirs;
+    ctx->include_dirs[ctx->num_include_dirs++] = _strdup(directory);
+    return 0;
+}
+
+// A NULL directory means the default cache location.
+int scc_enable_cache(scc_context* ctx, const char* directory, size_t max_bytes) {
+    if (ctx->use_cache) {
+        free_compile_cache(&ctx->cache);
+        ctx->use_cache = false;
+    }
+    char* path = directory ? _strdup(directory) : default_cache_directory();
+    ctx->use_cache = init_compile_cache(&ctx->cache, path, max_bytes ? max_bytes : CACHE_DEFAULT_MAX_BYTES);
+    free(path);
+    return ctx->use_cache ? 0 : -1;
+}
+
+// The PCH is opened by the first compilation that needs it and stays mapped
+// in the context; problems with it are reported in that compilation's result.
+int scc_use_pch(scc_context* ctx, const char* path) {
+    free(ctx->pch_path);
+    ctx->pch_path = path ? _strdup(path) : NULL;
+    return 0;
+}
+
+// Hands a buffer's bytes to the caller as a NUL-terminated string.
+static char* take_buffer(buffer* b, size_t* size) {
+    buffer_putc(b, '\0');
+    char* data = b->data;
+    *size = b->length - 1;
+    b->data = NULL;
+    b->length = 0;
+    b->capacity = 0;
+    return data;
+}
+
+int scc_compile(scc_context* ctx, const char* name, const char* source, size_t size, scc_mode mode,
+                scc_result* result) {
+    memset(result, 0, sizeof(*result));
+    compile_options options;
+    init_compile_options(&options);
+    options.cache = ctx->use_cache ? &ctx->cache : NULL;
+    options.headers = ctx->headers;
+    options.include_dirs = ctx->include_dirs;
+    options.num_include_dirs = ctx->num_include_dirs;
+    options.keep_output = true;
+    options.output_fd = -1;
+    options.error_fd = -1;
+    switch (mode) {
+        case SCC_MODE_ASM:
+            options.emit_asm = true;
+            break;
+        case SCC_MODE_OBJECT:
+            options.emit_object = true;
+            break;
+        case SCC_MODE_RUN:
+            options.run = true;
+            break;
+        case SCC_MODE_INTERPRET:
+            options.interpret = true;
+            break;
+        case SCC_MODE_DUMP:
+            break;
+    }
+
+    buffer diagnostics = init_buffer(0);
+    if (ctx->pch_path != NULL) {
+        options.pch = open_pch(ctx->pchs, ctx->pch_path, NULL, &diagnostics);
+        if (options.pch == NULL) {
+            buffer empty = init_buffer(0);
+            result->status = 1;
+            result->exit_code = 1;
+            result->output = take_buffer(&empty, &result->output_size);
+            result->diagnostics = take_buffer(&diagnostics, &result->diagnostics_size);
+            return result->status;
+        }
+    }
+
+    compile_job job;
+    init_compile_job(&job, (char*)name, &options);
+    job.source = source;
+    job.source_size = size;
+    run_compile_job(&job);
+
+    result->status = job.failed ? 1 : 0;
+    result->exit_code = job.exit_code;
+    result->output = take_buffer(&job.output, &result->output_size);
+    buffer_append(&diagnostics, job.diag.messages.data, job.diag.messages.length);
+    buffer_append(&diagnostics, job.report.data, job.report.length);
+    result->diagnostics = take_buffer(&diagnostics, &result->diagnostics_size);
+    free_compile_job(&job);
+    return result->status;
+}
+
+void scc_free_result(scc_result* result) {
+    free(result->output);
+    free(result->diagnostics);
+    memset(result, 0, sizeof(*result));
+}
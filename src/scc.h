@@ -0,0 +1,52 @@
+#ifndef SCC_H
+#define SCC_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// libscc: the compiler as a library. A context owns everything that outlives
+// one compilation (the lexed header cache, mapped PCHs, the on-disk cache
+// and the include path) and can be reused for any number of compilations of
+// in-memory sources. Nothing is global: separate contexts are independent
+// and may be used from different threads, one thread per context at a time.
+// Errors never exit the process; they come back in the result.
+typedef struct scc_context scc_context;
+
+typedef enum scc_mode {
+    SCC_MODE_ASM,
+    SCC_MODE_OBJECT,
+    SCC_MODE_DUMP,
+    SCC_MODE_RUN,
+    SCC_MODE_INTERPRET,
+} scc_mode;
+
+// status is 0 when compilation succeeded. exit_code is what main returned
+// in the run modes. output holds the assembly, ELF object or AST dump;
+// diagnostics holds every error and warning text. Both are NUL-terminated
+// and owned by the result.
+typedef struct scc_result {
+    int status;
+    int exit_code;
+    char* output;
+    size_t output_size;
+    char* diagnostics;
+    size_t diagnostics_size;
+} scc_result;
+
+scc_context* scc_create_context(void);
+void scc_destroy_context(scc_context* ctx);
+int scc_add_include_dir(scc_context* ctx, const char* directory);
+int scc_enable_cache(scc_context* ctx, const char* directory, size_t max_bytes);
+int scc_use_pch(scc_context* ctx, const char* path);
+int scc_compile(scc_context* ctx, const char* name, const char* source, size_t size, scc_mode mode,
+                scc_result* result);
+void scc_free_result(scc_result* result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SCC_H
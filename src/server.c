@@ -0,0 +1,398 @@
+// SO_PEERCRED and accept4 are GNU extensions.
+#define _GNU_SOURCE
+#include "server.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "compat.h"
+#include "buffer.h"
+#include "driver.h"
+
+typedef struct compile_server {
+    int listen_fd;
+    header_cache* headers;
+    pch_cache* pchs;
+    size_t active;
+    pthread_mutex_t lock;
+    pthread_cond_t idle;
+} compile_server;
+
+typedef struct server_connection {
+    compile_server* server;
+    int fd;
+} server_connection;
+
+static volatile sig_atomic_t stop_requested;
+
+char* default_server_socket() {
+    const char* path = getenv("SCC_SERVER_SOCKET");
+    if (path != NULL && path[0] != '\0') {
+        return _strdup(path);
+    }
+    buffer name = init_buffer(64);
+    const char* runtime = getenv("XDG_RUNTIME_DIR");
+    if (runtime != NULL && runtime[0] != '\0') {
+        buffer_printf(&name, "%s/scc.sock", runtime);
+    } else {
+        buffer_printf(&name, "/tmp/scc-%u.sock", (unsigned)getuid());
+    }
+    buffer_putc(&name, '\0');
+    return name.data;
+}
+
+static bool make_address(const char* socket_path, struct sockaddr_un* address) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address->sun_path)) {
+        return false;
+    }
+    strcpy(address->sun_path, socket_path);
+    return true;
+}
+
+static bool recv_fully(int fd, void* data, size_t size) {
+    char* p = data;
+    while (size > 0) {
+        ssize_t n = recv(fd, p, size, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+static bool send_fully(int fd, const void* data, size_t size) {
+    const char* p = data;
+    while (size > 0) {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+// Closes every descriptor a message carried, for when it is rejected.
+static void close_received_fds(struct msghdr* message) {
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(message); cmsg != NULL; cmsg = CMSG_NXTHDR(message, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; ++i) {
+            int received;
+            memcpy(&received, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            close(received);
+        }
+    }
+}
+
+// The header travels with the client's stdout and stderr attached.
+static bool recv_header(int fd, server_request_header* header, int fds[2]) {
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    struct iovec iov = {header, sizeof(*header)};
+    struct msghdr message = {0};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    ssize_t n;
+    do {
+        n = recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        return false;
+    }
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(2 * sizeof(int))) {
+        close_received_fds(&message);
+        return false;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), 2 * sizeof(int));
+    if (n < (ssize_t)sizeof(*header) && !recv_fully(fd, (char*)header + n, sizeof(*header) - (size_t)n)) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    return true;
+}
+
+static bool send_header(int fd, const server_request_header* header, const int fds[2]) {
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = {(void*)header, sizeof(*header)};
+    struct msghdr message = {0};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, 2 * sizeof(int));
+    ssize_t n;
+    do {
+        n = sendmsg(fd, &message, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    return n == (ssize_t)sizeof(*header);
+}
+
+// Only the user who started the server may use it.
+static bool peer_is_owner(int fd) {
+    struct ucred credentials;
+    socklen_t length = sizeof(credentials);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0 && credentials.uid == geteuid();
+}
+
+// Runs one client's invocation. The payload is the client's working
+// directory followed by argc strings, each NUL-terminated.
+static void serve_request(compile_server* server, int fd) {
+    server_request_header header;
+    int fds[2];
+    if (!peer_is_owner(fd) || !recv_header(fd, &header, fds)) {
+        return;
+    }
+    int32_t exit_code = 1;
+    char* payload = NULL;
+    if (header.magic == SERVER_MAGIC && header.size <= SERVER_MAX_REQUEST && header.argc > 0 &&
+        header.argc <= header.size) {
+        payload = malloc(header.size + 1);
+    }
+    if (payload != NULL && recv_fully(fd, payload, header.size)) {
+        payload[header.size] = '\0';
+        char** argv = malloc((header.argc + 1) * sizeof(char*));
+        char* p = payload;
+        char* end = payload + header.size;
+        char* working_directory = p;
+        p += strlen(p) + 1;
+        uint32_t argc = 0;
+        while (argc < header.argc && p < end) {
+            argv[argc++] = p;
+            p += strlen(p) + 1;
+        }
+        argv[argc] = NULL;
+        if (argc == header.argc && working_directory[0] == '/') {
+            compile_environment env = {working_directory, fds[0], fds[1], server->headers, server->pchs};
+            exit_code = run_compiler((int)argc, argv, &env);
+        } else {
+            dprintf(fds[1], "Error: malformed compile server request\n");
+        }
+        free(argv);
+    }
+    free(payload);
+    close(fds[0]);
+    close(fds[1]);
+    send_fully(fd, &exit_code, sizeof(exit_code));
+}
+
+static void* connection_main(void* arg) {
+    server_connection* connection = arg;
+    compile_server* server = connection->server;
+    serve_request(server, connection->fd);
+    close(connection->fd);
+    free(connection);
+
+    pthread_mutex_lock(&server->lock);
+    if (--server->active == 0) {
+        pthread_cond_signal(&server->idle);
+    }
+    pthread_mutex_unlock(&server->lock);
+    return NULL;
+}
+
+static void handle_stop_signal(int signal_number) {
+    (void)signal_number;
+    stop_requested = 1;
+}
+
+// Binds the socket, refusing to steal it from a server that still answers.
+static int listen_on(const char* socket_path) {
+    struct sockaddr_un address;
+    if (!make_address(socket_path, &address)) {
+        fprintf(stderr, "Error: socket path %s is too long\n", socket_path);
+        return -1;
+    }
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe >= 0 && connect(probe, (struct sockaddr*)&address, sizeof(address)) == 0) {
+        fprintf(stderr, "Error: a compile server is already listening on %s\n", socket_path);
+        close(probe);
+        return -1;
+    }
+    if (probe >= 0) {
+        close(probe);
+    }
+    struct stat st;
+    if (lstat(socket_path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "Error: %s exists and is not a socket\n", socket_path);
+            return -1;
+        }
+        unlink(socket_path);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Error: cannot create socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    mode_t previous_mask = umask(0077);
+    int bound = bind(fd, (struct sockaddr*)&address, sizeof(address));
+    umask(previous_mask);
+    if (bound != 0 || listen(fd, 64) != 0) {
+        fprintf(stderr, "Error: cannot listen on %s: %s\n", socket_path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int run_server(const char* socket_path) {
+    char* path = socket_path ? _strdup(socket_path) : default_server_socket();
+    compile_server server = {0};
+    server.listen_fd = listen_on(path);
+    if (server.listen_fd < 0) {
+        free(path);
+        return 1;
+    }
+    server.headers = create_header_cache();
+    server.headers->revalidate = true;
+    server.pchs = create_pch_cache();
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.idle, NULL);
+
+    // No SA_RESTART, so a stop signal breaks accept() out of its wait.
+    struct sigaction action = {0};
+    action.sa_handler = handle_stop_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    // Connection threads must not take the stop signals meant for accept().
+    sigset_t stop_signals;
+    sigset_t previous_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+
+    fprintf(stderr, "scc: compile server listening on %s\n", path);
+    while (!stop_requested) {
+        int fd = accept4(server.listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            fprintf(stderr, "Error: accept failed: %s\n", strerror(errno));
+            break;
+        }
+        server_connection* connection = malloc(sizeof(server_connection));
+        connection->server = &server;
+        connection->fd = fd;
+
+        pthread_mutex_lock(&server.lock);
+        server.active++;
+        pthread_mutex_unlock(&server.lock);
+
+        pthread_t thread;
+        pthread_attr_t attributes;
+        pthread_attr_init(&attributes);
+        pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+        pthread_sigmask(SIG_BLOCK, &stop_signals, &previous_signals);
+        int created = pthread_create(&thread, &attributes, connection_main, connection);
+        pthread_sigmask(SIG_SETMASK, &previous_signals, NULL);
+        pthread_attr_destroy(&attributes);
+        if (created != 0) {
+            close(fd);
+            free(connection);
+            pthread_mutex_lock(&server.lock);
+            server.active--;
+            pthread_mutex_unlock(&server.lock);
+        }
+    }
+
+    close(server.listen_fd);
+    unlink(path);
+
+    // Runs in flight still point into the caches.
+    pthread_mutex_lock(&server.lock);
+    while (server.active > 0) {
+        pthread_cond_wait(&server.idle, &server.lock);
+    }
+    pthread_mutex_unlock(&server.lock);
+
+    pthread_cond_destroy(&server.idle);
+    pthread_mutex_destroy(&server.lock);
+    free_pch_cache(server.pchs);
+    free_header_cache(server.headers);
+    free(path);
+    return 0;
+}
+
+// Returns the server's exit code for the run, or -1 if no server is
+// listening and the caller should compile in-process instead.
+int run_client(const char* socket_path, int argc, char** argv) {
+    struct sockaddr_un address;
+    if (!make_address(socket_path, &address)) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    char* working_directory = getcwd(NULL, 0);
+    if (working_directory == NULL) {
+        close(fd);
+        return -1;
+    }
+    buffer payload = init_buffer(256);
+    buffer_append(&payload, working_directory, strlen(working_directory) + 1);
+    for (int i = 0; i < argc; ++i) {
+        buffer_append(&payload, argv[i], strlen(argv[i]) + 1);
+    }
+    free(working_directory);
+
+    server_request_header header = {SERVER_MAGIC, (uint32_t)argc, (uint32_t)payload.length};
+    int fds[2] = {1, 2};
+    int32_t exit_code;
+    // Once the request is out the server may have produced output, so a
+    // failure from here on is an error rather than a reason to retry locally.
+    if (payload.length > SERVER_MAX_REQUEST) {
+        fprintf(stderr, "Error: command line too long for the compile server\n");
+        exit_code = 1;
+    } else if (!send_header(fd, &header, fds) || !send_fully(fd, payload.data, payload.length) ||
+               !recv_fully(fd, &exit_code, sizeof(exit_code))) {
+        fprintf(stderr, "Error: lost connection to the compile server at %s\n", socket_path);
+        exit_code = 1;
+    }
+    free_buffer(&payload);
+    close(fd);
+    return exit_code;
+}
@@ -0,0 +1,25 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A compile server keeps one scc process warm: lexed headers and mapped PCHs
+// stay resident between runs. Clients connect over a Unix socket, send their
+// working directory and argv along with their stdout and stderr descriptors,
+// and get the exit code back once the server has written the output
+// straight to those descriptors.
+#define SERVER_MAGIC 0x31434353u
+#define SERVER_MAX_REQUEST ((uint32_t)1 << 20)
+
+typedef struct server_request_header {
+    uint32_t magic;
+    uint32_t argc;
+    uint32_t size;
+} server_request_header;
+
+char* default_server_socket();
+int run_server(const char* socket_path);
+int run_client(const char* socket_path, int argc, char** argv);
+
+#endif // SERVER_H
@@ -0,0 +1,563 @@
+#include "simplify.h"
+#include "loops.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SIMPLIFY_MAX_ROUNDS 4
+// Times one instruction is offered to the rules again after a rewrite.
+#define SIMPLIFY_MAX_REWRITES 4
+
+// Each rule looks at one instruction and may rewrite it in place, putting
+// whatever it needs computed first in front of it with emit_before. Blocks
+// are rebuilt as they are simplified, so emitting is just appending.
+typedef struct simplifier {
+    sir_function* fn;
+    sir_block* block;           // being rebuilt
+} simplifier;
+
+typedef struct simplify_rule {
+    const char* name;
+    bool (*apply)(simplifier* s, sir_inst* inst);
+} simplify_rule;
+
+static sir_operand emit_before(simplifier* s, sir_opcode op, sir_operand a, sir_operand b) {
+    int dst = new_sir_vreg(s->fn, 4, NULL);
+    sir_emit(s->block, op, dst, a, b);
+    return sir_vreg_operand(dst);
+}
+
+static void rewrite(sir_inst* inst, sir_opcode op, sir_operand a, sir_operand b) {
+    inst->op = op;
+    inst->a = a;
+    inst->b = b;
+}
+
+static bool is_imm(sir_operand operand, int value) {
+    return operand.kind == SIR_OPERAND_IMM && operand.imm == value;
+}
+
+static bool same_vreg(sir_operand a, sir_operand b) {
+    return a.kind == SIR_OPERAND_VREG && b.kind == SIR_OPERAND_VREG && a.vreg == b.vreg;
+}
+
+// k when value is 2^k, -1 otherwise.
+static int log2_exact(unsigned int value) {
+    if (value == 0 || (value & (value - 1)) != 0) {
+        return -1;
+    }
+    int k = 0;
+    while (value > 1) {
+        value >>= 1;
+        k++;
+    }
+    return k;
+}
+
+static bool rule_commute_constant(simplifier* s, sir_inst* inst) {
+    (void)s;
+    if (inst->a.kind != SIR_OPERAND_IMM || inst->b.kind != SIR_OPERAND_VREG) {
+        return false;
+    }
+    switch (inst->op) {
+        case SIR_ADD:
+        case SIR_MUL:
+        case SIR_EQ:
+        case SIR_NE: break;
+        case SIR_LT: inst->op = SIR_GT; break;
+        case SIR_LE: inst->op = SIR_GE; break;
+        case SIR_GT: inst->op = SIR_LT; break;
+        case SIR_GE: inst->op = SIR_LE; break;
+        default: return false;
+    }
+    sir_operand a = inst->a;
+    inst->a = inst->b;
+    inst->b = a;
+    return true;
+}
+
+static bool rule_add_zero(simplifier* s, sir_inst* inst) {
+    (void)s;
+    if ((inst->op != SIR_ADD && inst->op != SIR_SUB) || !is_imm(inst->b, 0)) {
+        return false;
+    }
+    rewrite(inst, SIR_COPY, inst->a, sir_none());
+    return true;
+}
+
+static bool rule_sub_from_zero(simplifier* s, sir_inst* inst) {
+    (void)s;
+    if (inst->op != SIR_SUB || !is_imm(inst->a, 0)) {
+        return false;
+    }
+    rewrite(inst, SIR_NEG, inst->b, sir_none());
+    return true;
+}
+
+static bool rule_sub_self(simplifier* s, sir_inst* inst) {
+    (void)s;
+    if (inst->op != SIR_SUB || !same_vreg(inst->a, inst->b)) {
+        return false;
+    }
+    rewrite(inst, SIR_COPY, sir_imm_operand(0), sir_none());
+    return true;
+}
+
+static bool rule_mul_identity(simplifier* s, sir_inst* inst) {
+    (void)s;
+    if (inst->op != SIR_MUL || inst->b.kind != SIR_OPERAND_IMM) {
+        return false;
+    }
+    switch (inst->b.imm) {
+        case 0: rewrite(inst, SIR_COPY, sir_imm_operand(0), sir_none()); return true;
+        case 1: rewrite(inst, SIR_COPY, inst->a, sir_none()); return true;
+        case -1: rewrite(inst, SIR_NEG, inst->a, sir_none()); return true;
+        default: return false;
+    }
+}
+
+// Wrapping makes x * 2^31 the same as x << 31, so INT_MIN counts.
+static bool rule_mul_pow2(simplifier* s, sir_inst* inst) {
+    (void)s;
+    if (inst->op != SIR_MUL || inst->b.kind != SIR_OPERAND_IMM) {
+        return false;
+    }
+    int k = log2_exact((unsigned int)inst->b.imm);
+    if (k < 1) {
+        return false;
+    }
+    rewrite(inst, SIR_SHL, inst->a, sir_imm_operand(k));
+    return true;
+}
+
+static bool rule_div_one(simplifier* s, sir_inst* inst) {
+    (void)s;
+    if (inst->op != SIR_DIV || !is_imm(inst->b, 1)) {
+        return false;
+    }
+    rewrite(inst, SIR_COPY, inst->a, sir_none());
+    return true;
+}
+
+// Divisors that this leaves for the machine: 0 and -1, which may trap, and
+// INT_MIN, whose magnitude does not fit.
+static bool is_reducible_divisor(sir_operand b) {
+    return b.kind == SIR_OPERAND_IMM && b.imm != 0 && b.imm != -1 && b.imm != 1 && b.imm != INT_MIN;
+}
+
+// Division truncates towards zero and a shift rounds down, so a negative x
+// is first biased by 2^k - 1, made from its sign bits:
+//
+//   t = x + ((x >> 31) >>> (32 - k)),  x / 2^k = t >> k
+static bool rule_div_pow2(simplifier* s, sir_inst* inst) {
+    if (inst->op != SIR_DIV || !is_reducible_divisor(inst->b)) {
+        return false;
+    }
+    int divisor = inst->b.imm;
+    int k = log2_exact((unsigned int)abs(divisor));
+    if (k < 1) {
+        return false;
+    }
+    sir_operand x = inst->a;
+    sir_operand bias = k == 1 ? emit_before(s, SIR_SHR, x, sir_imm_operand(31))
+                              : emit_before(s, SIR_SHR, emit_before(s, SIR_SAR, x, sir_imm_operand(31)),
+                                            sir_imm_operand(32 - k));
+    sir_operand biased = emit_before(s, SIR_ADD, x, bias);
+    if (divisor > 0) {
+        rewrite(inst, SIR_SAR, biased, sir_imm_operand(k));
+    } else {
+        rewrite(inst, SIR_NEG, emit_before(s, SIR_SAR, biased, sir_imm_operand(k)), sir_none());
+    }
+    return true;
+}
+
+// The magic number of Hacker's Delight 10-1 for a divisor d >= 2: the
+// multiplier m and shift s with x / d = (x * m >> 32 + s) for all x >= 0,
+// and one less than that for x < 0. m may come out above INT_MAX, in which
+// case it is stored wrapped.
+static void signed_magic(unsigned int d, int* multiplier, int* shift) {
+    const unsigned int two31 = 0x80000000u;
+    unsigned int anc = two31 - 1 - two31 % d;
+    unsigned int q1 = two31 / anc;
+    unsigned int r1 = two31 - q1 * anc;
+    unsigned int q2 = two31 / d;
+    unsigned int r2 = two31 - q2 * d;
+    unsigned int delta;
+    int p = 31;
+    do {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc) {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= d) {
+            q2++;
+            r2 -= d;
+        }
+        delta = d - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+    *multiplier = (int)(q2 + 1);
+    *shift = p - 32;
+}
+
+// x / d as a multiply by the magic number:
+//
+//   q = mulhigh x, m      (+ x when m wrapped negative)
+//   q = q >> s
+//   x / d = q + (x >>> 31)
+static bool rule_div_magic(simplifier* s, sir_inst* inst) {
+    if (inst->op != SIR_DIV || !is_reducible_divisor(inst->b)) {
+        return false;
+    }
+    int divisor = inst->b.imm;
+    int multiplier, shift;
+    signed_magic((unsigned int)abs(divisor), &multiplier, &shift);
+    sir_operand x = inst->a;
+    sir_operand q = emit_before(s, SIR_MUL_HIGH, x, sir_imm_operand(multiplier));
+    if (multiplier < 0) {
+        q = emit_before(s, SIR_ADD, q, x);
+    }
+    if (shift > 0) {
+        q = emit_before(s, SIR_SAR, q, sir_imm_operand(shift));
+    }
+    sir_operand sign = emit_before(s, SIR_SHR, x, sir_imm_operand(31));
+    if (divisor > 0) {
+        rewrite(inst, SIR_ADD, q, sign);
+    } else {
+        rewrite(inst, SIR_NEG, emit_before(s, SIR_ADD, q, sign), sir_none());
+    }
+    return true;
+}
+
+static bool rule_mod_one(simplifier* s, sir_inst* inst) {
+    (void)s;
+    if (inst->op != SIR_MOD || !is_imm(inst->b, 1)) {
+        return false;
+    }
+    rewrite(inst, SIR_COPY, sir_imm_operand(0), sir_none());
+    return true;
+}
+
+// x % d = x - x / |d| * |d|. The division and multiply are simplified in
+// the next round.
+static bool rule_mod_constant(simplifier* s, sir_inst* inst) {
+    if (inst->op != SIR_MOD || !is_reducible_divisor(inst->b)) {
+        return false;
+    }
+    sir_operand magnitude = sir_imm_operand(abs(inst->b.imm));
+    sir_operand q = emit_before(s, SIR_DIV, inst->a, magnitude);
+    rewrite(inst, SIR_SUB, inst->a, emit_before(s, SIR_MUL, q, magnitude));
+    return true;
+}
+
+static bool rule_shift_zero(simplifier* s, sir_inst* inst) {
+    (void)s;
+    if ((inst->op != SIR_SHL && inst->op != SIR_SAR && inst->op != SIR_SHR) || !is_imm(inst->b, 0)) {
+        return false;
+    }
+    rewrite(inst, SIR_COPY, inst->a, sir_none());
+    return true;
+}
+
+static bool rule_compare_self(simplifier* s, sir_inst* inst) {
+    (void)s;
+    if (!same_vreg(inst->a, inst->b)) {
+        return false;
+    }
+    switch (inst->op) {
+        case SIR_EQ:
+        case SIR_LE:
+        case SIR_GE: rewrite(inst, SIR_COPY, sir_imm_operand(1), sir_none()); return true;
+        case SIR_NE:
+        case SIR_LT:
+        case SIR_GT:
+        case SIR_ULT: rewrite(inst, SIR_COPY, sir_imm_operand(0), sir_none()); return true;
+        default: return false;
+    }
+}
+
+static const simplify_rule rules[] = {
+    { "commute-constant", rule_commute_constant },
+    { "add-zero", rule_add_zero },
+    { "sub-from-zero", rule_sub_from_zero },
+    { "sub-self", rule_sub_self },
+    { "mul-identity", rule_mul_identity },
+    { "mul-pow2", rule_mul_pow2 },
+    { "div-one", rule_div_one },
+    { "div-pow2", rule_div_pow2 },
+    { "div-magic", rule_div_magic },
+    { "mod-one", rule_mod_one },
+    { "mod-constant", rule_mod_constant },
+    { "shift-zero", rule_shift_zero },
+    { "compare-self", rule_compare_self },
+};
+
+#define NUM_RULES (sizeof(rules) / sizeof(rules[0]))
+
+size_t simplify_rule_count() {
+    return NUM_RULES;
+}
+
+const char* simplify_rule_name(size_t rule) {
+    return rules[rule].name;
+}
+
+static bool simplify_block(simplifier* s, sir_block* block, simplify_stats* stats) {
+    sir_inst* insts = block->insts;
+    size_t num_insts = block->num_insts;
+    block->insts = NULL;
+    block->num_insts = 0;
+    block->max_insts = 0;
+    s->block = block;
+    bool changed = false;
+    for (size_t i = 0; i < num_insts; ++i) {
+        sir_inst inst = insts[i];
+        for (int rewrites = 0; rewrites < SIMPLIFY_MAX_REWRITES && !sir_is_vector(inst.op); ++rewrites) {
+            size_t r = 0;
+            while (r < NUM_RULES && !rules[r].apply(s, &inst)) {
+                r++;
+            }
+            if (r == NUM_RULES) {
+                break;
+            }
+            stats->hits[r]++;
+            changed = true;
+        }
+        sir_append(block, inst);
+    }
+    free(insts);
+    return changed;
+}
+
+// Strength reduction works on one loop at a time. A basic induction
+// variable is a 4-byte vreg defined once in the loop, by i = i + c or
+// i - c, or by a copy from a temporary that is, with c invariant.
+typedef struct induction_finder {
+    sir_function* fn;
+    sir_loop* loop;
+    int* loop_defs;             // definitions of each vreg in the loop
+    sir_inst** def_insts;       // the last of them
+    sir_block** def_blocks;
+} induction_finder;
+
+typedef struct reduction {
+    int iv;
+    sir_operand step;
+    sir_block* update_block;    // where iv is updated
+    sir_operand factor;
+    int vreg;                   // iv * factor, kept up to date
+} reduction;
+
+static bool is_loop_invariant(induction_finder* f, sir_operand operand) {
+    return operand.kind != SIR_OPERAND_VREG || f->loop_defs[operand.vreg] == 0;
+}
+
+// The step of i's update, when inst is i + c, c + i or i - c.
+static bool find_step(induction_finder* f, sir_inst* inst, int iv, sir_operand* step) {
+    if (inst->op == SIR_ADD && inst->a.kind == SIR_OPERAND_VREG && inst->a.vreg == iv &&
+        is_loop_invariant(f, inst->b)) {
+        *step = inst->b;
+        return true;
+    }
+    if (inst->op == SIR_ADD && inst->b.kind == SIR_OPERAND_VREG && inst->b.vreg == iv &&
+        is_loop_invariant(f, inst->a)) {
+        *step = inst->a;
+        return true;
+    }
+    if (inst->op == SIR_SUB && inst->a.kind == SIR_OPERAND_VREG && inst->a.vreg == iv &&
+        inst->b.kind == SIR_OPERAND_IMM) {
+        *step = sir_imm_operand((int)(0u - (unsigned int)inst->b.imm));
+        return true;
+    }
+    return false;
+}
+
+static bool find_induction(induction_finder* f, int iv, sir_operand* step) {
+    if (f->loop_defs[iv] != 1 || f->fn->vregs[iv].size != 4) {
+        return false;
+    }
+    sir_inst* def = f->def_insts[iv];
+    if (def->op == SIR_COPY && def->a.kind == SIR_OPERAND_VREG) {
+        int temp = def->a.vreg;
+        return f->loop_defs[temp] == 1 && f->def_blocks[temp] == f->def_blocks[iv] &&
+               f->def_insts[temp] < def && find_step(f, f->def_insts[temp], iv, step);
+    }
+    return find_step(f, def, iv, step);
+}
+
+static void count_loop_definitions(induction_finder* f) {
+    sir_function* fn = f->fn;
+    memset(f->loop_defs, 0, fn->num_vregs * sizeof(int));
+    for (size_t i = 0; i < fn->num_blocks; ++i) {
+        if (!f->loop->contains[i]) {
+            continue;
+        }
+        sir_block* block = fn->blocks[i];
+        for (size_t j = 0; j < block->num_insts; ++j) {
+            int dst = block->insts[j].dst;
+            if (dst >= 0) {
+                f->loop_defs[dst]++;
+                f->def_insts[dst] = &block->insts[j];
+                f->def_blocks[dst] = block;
+            }
+        }
+    }
+}
+
+static void insert_inst(sir_block* block, size_t position, sir_inst inst) {
+    sir_append(block, inst);
+    memmove(&block->insts[position + 1], &block->insts[position], (block->num_insts - 1 - position) * sizeof(sir_inst));
+    block->insts[position] = inst;
+}
+
+static sir_inst make_inst(sir_opcode op, int dst, sir_operand a, sir_operand b) {
+    sir_inst inst = { 0 };
+    inst.op = op;
+    inst.dst = dst;
+    inst.a = a;
+    inst.b = b;
+    return inst;
+}
+
+// Starts r = iv * factor in the preheader and steps it by step * factor
+// right after iv's update in the loop.
+static void start_reduction(sir_function* fn, sir_block* preheader, reduction* r) {
+    size_t end = preheader->num_insts - 1;
+    insert_inst(preheader, end++, make_inst(SIR_MUL, r->vreg, sir_vreg_operand(r->iv), r->factor));
+    sir_operand increment;
+    if (r->step.kind == SIR_OPERAND_IMM && r->factor.kind == SIR_OPERAND_IMM) {
+        increment = sir_imm_operand((int)((unsigned int)r->step.imm * (unsigned int)r->factor.imm));
+    } else {
+        increment = sir_vreg_operand(new_sir_vreg(fn, 4, NULL));
+        insert_inst(preheader, end, make_inst(SIR_MUL, increment.vreg, r->step, r->factor));
+    }
+    sir_block* block = r->update_block;
+    for (size_t j = 0; j < block->num_insts; ++j) {
+        if (block->insts[j].dst == r->iv) {
+            insert_inst(block, j + 1, make_inst(SIR_ADD, r->vreg, sir_vreg_operand(r->vreg), increment));
+            return;
+        }
+    }
+}
+
+static bool same_operand(sir_operand a, sir_operand b) {
+    return a.kind == b.kind && (a.kind != SIR_OPERAND_VREG || a.vreg == b.vreg) &&
+           (a.kind != SIR_OPERAND_IMM || a.imm == b.imm);
+}
+
+// Replaces i * k in the loop with a running product. Every multiply by the
+// same invariant k shares one; each costs an add per trip instead.
+static size_t reduce_loop(induction_finder* f, sir_block* preheader) {
+    sir_function* fn = f->fn;
+    count_loop_definitions(f);
+    reduction* reductions = NULL;
+    size_t num_reductions = 0;
+    size_t reduced = 0;
+    for (size_t i = 0; i < fn->num_blocks; ++i) {
+        if (!f->loop->contains[i]) {
+            continue;
+        }
+        sir_block* block = fn->blocks[i];
+        for (size_t j = 0; j < block->num_insts; ++j) {
+            sir_inst* inst = &block->insts[j];
+            if (inst->op != SIR_MUL) {
+                continue;
+            }
+            sir_operand step;
+            int iv;
+            sir_operand factor;
+            if (inst->a.kind == SIR_OPERAND_VREG && is_loop_invariant(f, inst->b) &&
+                find_induction(f, inst->a.vreg, &step)) {
+                iv = inst->a.vreg;
+                factor = inst->b;
+            } else if (inst->b.kind == SIR_OPERAND_VREG && is_loop_invariant(f, inst->a) &&
+                       find_induction(f, inst->b.vreg, &step)) {
+                iv = inst->b.vreg;
+                factor = inst->a;
+            } else {
+                continue;
+            }
+            // Shifts and copies are cheaper than the add.
+            if (factor.kind == SIR_OPERAND_IMM &&
+                (factor.imm == 0 || factor.imm == INT_MIN || log2_exact((unsigned int)abs(factor.imm)) >= 0)) {
+                continue;
+            }
+            reduction* r = NULL;
+            for (size_t k = 0; k < num_reductions; ++k) {
+                if (reductions[k].iv == iv && same_operand(reductions[k].factor, factor)) {
+                    r = &reductions[k];
+                }
+            }
+            if (r == NULL) {
+                reductions = realloc(reductions, (num_reductions + 1) * sizeof(reduction));
+                r = &reductions[num_reductions++];
+                r->iv = iv;
+                r->step = step;
+                r->update_block = f->def_blocks[iv];
+                r->factor = factor;
+                r->vreg = new_sir_vreg(fn, 4, NULL);
+            }
+            rewrite(inst, SIR_COPY, sir_vreg_operand(r->vreg), sir_none());
+            reduced++;
+        }
+    }
+    // Inserting moves instructions, so the updates go in once the loop has
+    // been scanned.
+    for (size_t k = 0; k < num_reductions; ++k) {
+        start_reduction(fn, preheader, &reductions[k]);
+    }
+    free(reductions);
+    return reduced;
+}
+
+static size_t reduce_inductions(sir_function* fn) {
+    loop_info* info = analyze_loops_with_preheaders(fn);
+    size_t reduced = 0;
+    if (info->num_loops > 0) {
+        induction_finder f;
+        f.fn = fn;
+        for (size_t l = 0; l < info->num_loops; ++l) {
+            // Reductions add vregs, so the arrays are made for each loop.
+            f.loop = &info->loops[l];
+            f.loop_defs = malloc((fn->num_vregs + 1) * sizeof(int));
+            f.def_insts = malloc((fn->num_vregs + 1) * sizeof(sir_inst*));
+            f.def_blocks = malloc((fn->num_vregs + 1) * sizeof(sir_block*));
+            reduced += reduce_loop(&f, loop_preheader(info, f.loop));
+            free(f.loop_defs);
+            free(f.def_insts);
+            free(f.def_blocks);
+        }
+    }
+    free_loop_info(info);
+    return reduced;
+}
+
+void simplify_sir_function(sir_function* fn, simplify_stats* stats) {
+    stats->reduced += reduce_inductions(fn);
+    simplifier s = { fn, NULL };
+    bool changed = true;
+    for (int round = 0; round < SIMPLIFY_MAX_ROUNDS && changed; ++round) {
+        changed = false;
+        for (size_t i = 0; i < fn->num_blocks; ++i) {
+            changed |= simplify_block(&s, fn->blocks[i], stats);
+        }
+    }
+}
+
+void simplify_sir_program(sir_program* program, simplify_stats* stats) {
+    for (size_t i = 0; i < program->num_functions; ++i) {
+        simplify_sir_function(program->functions[i], stats);
+    }
+}
+
+void print_simplify_stats(simplify_stats* stats, buffer* out) {
+    buffer_printf(out, "simplify: %zu induction multiplies reduced\n", stats->reduced);
+    for (size_t r = 0; r < NUM_RULES; ++r) {
+        buffer_printf(out, "  %-20s %8zu\n", rules[r].name, stats->hits[r]);
+    }
+}
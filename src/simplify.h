@@ -0,0 +1,27 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include <stddef.h>
+#include "buffer.h"
+#include "sir.h"
+
+#define SIMPLIFY_MAX_RULES 32
+
+typedef struct simplify_stats {
+    size_t hits[SIMPLIFY_MAX_RULES];
+    size_t reduced;             // induction variable multiplies made additions
+} simplify_stats;
+
+// Algebraic simplification and strength reduction. In every loop, i * k
+// with i a basic induction variable and k invariant becomes a running sum
+// that steps along with i. Then a table of rules rewrites one instruction
+// at a time: identities such as x + 0 and x - x go, multiplies and divides
+// by powers of two become shifts, and division by any other constant a
+// multiply by its magic number. Leaves the dead code behind for fold.
+void simplify_sir_function(sir_function* fn, simplify_stats* stats);
+void simplify_sir_program(sir_program* program, simplify_stats* stats);
+size_t simplify_rule_count();
+const char* simplify_rule_name(size_t rule);
+void print_simplify_stats(simplify_stats* stats, buffer* out);
+
+#endif // SIMPLIFY_H
@@ -1,2 +1,437 @@
 #include "sir.h"
 
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compat.h"
+#include "diagnostics.h"
+#include "hash.h"
+
+sir_operand sir_none() {
+    sir_operand operand = { SIR_OPERAND_NONE, -1, 0 };
+    return operand;
+}
+
+sir_operand sir_vreg_operand(int vreg) {
+    sir_operand operand = { SIR_OPERAND_VREG, vreg, 0 };
+    return operand;
+}
+
+sir_operand sir_imm_operand(int imm) {
+    sir_operand operand = { SIR_OPERAND_IMM, -1, imm };
+    return operand;
+}
+
+bool sir_is_terminator(sir_opcode op) {
+    return op == SIR_JUMP || op == SIR_BRANCH || op == SIR_JUMP_TABLE || op == SIR_RETURN;
+}
+
+// Whether removing the instruction could change anything but its dst. A
+// division may trap, so it stays even when its result is unused.
+bool sir_has_side_effects(sir_opcode op) {
+    switch (op) {
+        case SIR_STORE_GLOBAL:
+        case SIR_STORE_ELEM:
+        case SIR_VSTORE:
+        case SIR_CALL:
+        case SIR_DIV:
+        case SIR_MOD:
+            return true;
+        default:
+            return sir_is_terminator(op);
+    }
+}
+
+bool sir_is_vector(sir_opcode op) {
+    return op >= SIR_VLOAD && op <= SIR_VSUM;
+}
+
+const char* sir_opcode_tostring(sir_opcode op) {
+    switch (op) {
+        case SIR_COPY: return "copy";
+        case SIR_LOAD_GLOBAL: return "load";
+        case SIR_STORE_GLOBAL: return "store";
+        case SIR_LOAD_ELEM: return "loadelem";
+        case SIR_STORE_ELEM: return "storeelem";
+        case SIR_ADD: return "add";
+        case SIR_SUB: return "sub";
+        case SIR_MUL: return "mul";
+        case SIR_DIV: return "div";
+        case SIR_MOD: return "mod";
+        case SIR_SHL: return "shl";
+        case SIR_SAR: return "sar";
+        case SIR_SHR: return "shr";
+        case SIR_MUL_HIGH: return "mulhigh";
+        case SIR_EQ: return "eq";
+        case SIR_NE: return "ne";
+        case SIR_LT: return "lt";
+        case SIR_LE: return "le";
+        case SIR_GT: return "gt";
+        case SIR_GE: return "ge";
+        case SIR_ULT: return "ult";
+        case SIR_BIT_TEST: return "bittest";
+        case SIR_NEG: return "neg";
+        case SIR_NOT: return "not";
+        case SIR_VLOAD: return "vload";
+        case SIR_VSTORE: return "vstore";
+        case SIR_VSPLAT: return "vsplat";
+        case SIR_VADD: return "vadd";
+        case SIR_VSUB: return "vsub";
+        case SIR_VMUL: return "vmul";
+        case SIR_VSUM: return "vsum";
+        case SIR_CALL: return "call";
+        case SIR_JUMP: return "jump";
+        case SIR_BRANCH: return "branch";
+        case SIR_JUMP_TABLE: return "jumptable";
+        case SIR_RETURN: return "return";
+        default: return "?";
+    }
+}
+
+// The value a vreg of this size holds after value is written to it.
+int sir_truncate(int value, int size) {
+    return size == 1 ? (signed char)value : value;
+}
+
+sir_program* create_sir_program() {
+    sir_program* program = malloc(sizeof(sir_program));
+    program->functions = NULL;
+    program->num_functions = 0;
+    program->globals = NULL;
+    program->num_globals = 0;
+    program->function_slots = NULL;
+    program->global_slots = NULL;
+    program->num_function_slots = 0;
+    program->num_global_slots = 0;
+    return program;
+}
+
+static const char* slot_name(sir_program* program, bool functions, size_t index) {
+    return functions ? program->functions[index]->name : program->globals[index].name;
+}
+
+static size_t* find_slot(sir_program* program, bool functions, const char* name) {
+    size_t* slots = functions ? program->function_slots : program->global_slots;
+    size_t mask = (functions ? program->num_function_slots : program->num_global_slots) - 1;
+    for (size_t i = hash_string(name, 0) & mask;; i = (i + 1) & mask) {
+        if (slots[i] == 0 || strcmp(slot_name(program, functions, slots[i] - 1), name) == 0) {
+            return &slots[i];
+        }
+    }
+}
+
+// Called after the new entry has been appended, so count includes it.
+static void index_name(sir_program* program, bool functions, size_t count) {
+    size_t* num_slots = functions ? &program->num_function_slots : &program->num_global_slots;
+    size_t** slots = functions ? &program->function_slots : &program->global_slots;
+    if (count * 2 > *num_slots) {
+        free(*slots);
+        *num_slots = *num_slots ? *num_slots * 2 : 16;
+        *slots = calloc(*num_slots, sizeof(size_t));
+        for (size_t i = 0; i + 1 < count; ++i) {
+            *find_slot(program, functions, slot_name(program, functions, i)) = i + 1;
+        }
+    }
+    *find_slot(program, functions, slot_name(program, functions, count - 1)) = count;
+}
+
+sir_function* create_sir_function(const char* name) {
+    sir_function* fn = malloc(sizeof(sir_function));
+    fn->name = _strdup(name);
+    fn->params = NULL;
+    fn->num_params = 0;
+    fn->return_size = 0;
+    fn->blocks = NULL;
+    fn->num_blocks = 0;
+    fn->max_blocks = 0;
+    fn->vregs = NULL;
+    fn->num_vregs = 0;
+    fn->max_vregs = 0;
+    return fn;
+}
+
+void add_sir_function(sir_program* program, sir_function* fn) {
+    program->functions = realloc(program->functions, (program->num_functions + 1) * sizeof(sir_function*));
+    program->functions[program->num_functions++] = fn;
+    index_name(program, true, program->num_functions);
+}
+
+void add_sir_global(sir_program* program, const char* name, int size, long long value, bool is_const) {
+    program->globals = realloc(program->globals, (program->num_globals + 1) * sizeof(sir_global));
+    sir_global* global = &program->globals[program->num_globals++];
+    global->name = _strdup(name);
+    global->size = size;
+    global->length = 0;
+    global->value = value;
+    global->is_const = is_const;
+    index_name(program, false, program->num_globals);
+}
+
+void add_sir_array(sir_program* program, const char* name, int size, size_t length, bool is_const) {
+    add_sir_global(program, name, size, 0, is_const);
+    program->globals[program->num_globals - 1].length = length;
+}
+
+// SIZE_MAX when the program does not define name.
+size_t find_sir_function_index(sir_program* program, const char* name) {
+    if (program->num_functions == 0) {
+        return SIZE_MAX;
+    }
+    return *find_slot(program, true, name) - 1;
+}
+
+sir_function* find_sir_function(sir_program* program, const char* name) {
+    size_t index = find_sir_function_index(program, name);
+    return index != SIZE_MAX ? program->functions[index] : NULL;
+}
+
+sir_global* find_sir_global(sir_program* program, const char* name) {
+    if (program->num_globals == 0) {
+        return NULL;
+    }
+    size_t slot = *find_slot(program, false, name);
+    return slot ? &program->globals[slot - 1] : NULL;
+}
+
+static void free_sir_block(sir_block* block) {
+    for (size_t i = 0; i < block->num_insts; ++i) {
+        free(block->insts[i].args);
+        free(block->insts[i].table);
+    }
+    free(block->insts);
+    free(block);
+}
+
+void free_sir_function(sir_function* fn) {
+    for (size_t i = 0; i < fn->num_blocks; ++i) {
+        free_sir_block(fn->blocks[i]);
+    }
+    free(fn->blocks);
+    free(fn->vregs);
+    free(fn->params);
+    free(fn->name);
+    free(fn);
+}
+
+void free_sir_program(sir_program* program) {
+    for (size_t i = 0; i < program->num_functions; ++i) {
+        free_sir_function(program->functions[i]);
+    }
+    for (size_t i = 0; i < program->num_globals; ++i) {
+        free(program->globals[i].name);
+    }
+    free(program->functions);
+    free(program->globals);
+    free(program->function_slots);
+    free(program->global_slots);
+    free(program);
+}
+
+int new_sir_vreg(sir_function* fn, int size, const char* name) {
+    if (fn->num_vregs == fn->max_vregs) {
+        fn->max_vregs = fn->max_vregs ? fn->max_vregs * 2 : 16;
+        fn->vregs = realloc(fn->vregs, fn->max_vregs * sizeof(sir_vreg));
+    }
+    fn->vregs[fn->num_vregs].size = size;
+    fn->vregs[fn->num_vregs].name = name;
+    return (int)fn->num_vregs++;
+}
+
+sir_block* insert_sir_block(sir_function* fn, size_t position) {
+    if (fn->num_blocks == fn->max_blocks) {
+        fn->max_blocks = fn->max_blocks ? fn->max_blocks * 2 : 8;
+        fn->blocks = realloc(fn->blocks, fn->max_blocks * sizeof(sir_block*));
+    }
+    sir_block* block = malloc(sizeof(sir_block));
+    block->insts = NULL;
+    block->num_insts = 0;
+    block->max_insts = 0;
+    block->index = (int)position;
+    memmove(&fn->blocks[position + 1], &fn->blocks[position], (fn->num_blocks - position) * sizeof(sir_block*));
+    fn->blocks[position] = block;
+    fn->num_blocks++;
+    return block;
+}
+
+sir_block* new_sir_block(sir_function* fn) {
+    return insert_sir_block(fn, fn->num_blocks);
+}
+
+// Moves block to the end of the layout. A block can so be created early, to
+// be jumped to, and still be placed after the code that comes before it.
+void place_sir_block(sir_function* fn, sir_block* block) {
+    size_t i = 0;
+    while (fn->blocks[i] != block) {
+        ++i;
+    }
+    memmove(&fn->blocks[i], &fn->blocks[i + 1], (fn->num_blocks - i - 1) * sizeof(sir_block*));
+    fn->blocks[fn->num_blocks - 1] = block;
+}
+
+// removed is indexed by block index. The caller makes sure nothing still
+// jumps to a removed block.
+void remove_sir_blocks(sir_function* fn, const bool* removed) {
+    size_t kept = 0;
+    for (size_t i = 0; i < fn->num_blocks; ++i) {
+        if (removed[fn->blocks[i]->index]) {
+            free_sir_block(fn->blocks[i]);
+        } else {
+            fn->blocks[kept++] = fn->blocks[i];
+        }
+    }
+    fn->num_blocks = kept;
+    number_sir_blocks(fn);
+}
+
+void number_sir_blocks(sir_function* fn) {
+    for (size_t i = 0; i < fn->num_blocks; ++i) {
+        fn->blocks[i]->index = (int)i;
+    }
+}
+
+// The returned pointer is only good until the next instruction is added.
+sir_inst* sir_append(sir_block* block, sir_inst inst) {
+    if (block->num_insts == block->max_insts) {
+        block->max_insts = block->max_insts ? block->max_insts * 2 : 8;
+        block->insts = realloc(block->insts, block->max_insts * sizeof(sir_inst));
+    }
+    block->insts[block->num_insts] = inst;
+    return &block->insts[block->num_insts++];
+}
+
+sir_inst* sir_emit(sir_block* block, sir_opcode op, int dst, sir_operand a, sir_operand b) {
+    sir_inst inst = { op, dst, a, b, NULL, NULL, 0, NULL, NULL, NULL, 0 };
+    return sir_append(block, inst);
+}
+
+sir_inst* sir_terminator(sir_block* block) {
+    if (block->num_insts == 0 || !sir_is_terminator(block->insts[block->num_insts - 1].op)) {
+        return NULL;
+    }
+    return &block->insts[block->num_insts - 1];
+}
+
+// The blocks a terminator can go to, duplicates included: target, then
+// other, then the entries of a jump table. Each comes back as the field
+// holding it, so that edges can be redirected through it.
+size_t sir_num_successors(const sir_inst* term) {
+    return (term->target != NULL) + (term->other != NULL) + term->table_size;
+}
+
+sir_block** sir_successor(sir_inst* term, size_t i) {
+    if (term->target != NULL) {
+        if (i == 0) {
+            return &term->target;
+        }
+        i--;
+    }
+    if (term->other != NULL) {
+        if (i == 0) {
+            return &term->other;
+        }
+        i--;
+    }
+    return &term->table[i];
+}
+
+void sir_redirect(sir_inst* term, sir_block* from, sir_block* to) {
+    size_t count = sir_num_successors(term);
+    for (size_t i = 0; i < count; ++i) {
+        sir_block** successor = sir_successor(term, i);
+        if (*successor == from) {
+            *successor = to;
+        }
+    }
+}
+
+// Instructions that survive into machine code; jumps mostly fall through.
+size_t sir_function_size(sir_function* fn) {
+    size_t size = 0;
+    for (size_t i = 0; i < fn->num_blocks; ++i) {
+        sir_block* block = fn->blocks[i];
+        size += block->num_insts;
+        if (block->num_insts > 0 && block->insts[block->num_insts - 1].op == SIR_JUMP) {
+            size--;
+        }
+    }
+    return size;
+}
+
+static void print_operand(sir_operand operand, buffer* out) {
+    if (operand.kind == SIR_OPERAND_VREG) {
+        buffer_printf(out, "%%%d", operand.vreg);
+    } else if (operand.kind == SIR_OPERAND_IMM) {
+        buffer_printf(out, "%d", operand.imm);
+    }
+}
+
+void print_sir_function(sir_function* fn, buffer* out) {
+    number_sir_blocks(fn);
+    buffer_printf(out, "function %s(", fn->name);
+    for (size_t i = 0; i < fn->num_params; ++i) {
+        buffer_printf(out, i ? ", %%%d" : "%%%d", fn->params[i]);
+    }
+    buffer_puts(out, ")\n");
+    for (size_t i = 0; i < fn->num_blocks; ++i) {
+        sir_block* block = fn->blocks[i];
+        buffer_printf(out, "b%d:\n", block->index);
+        for (size_t j = 0; j < block->num_insts; ++j) {
+            sir_inst* inst = &block->insts[j];
+            buffer_putc(out, '\t');
+            if (inst->dst >= 0) {
+                buffer_printf(out, "%%%d:%d = ", inst->dst, fn->vregs[inst->dst].size);
+            }
+            buffer_puts(out, sir_opcode_tostring(inst->op));
+            if (inst->symbol != NULL) {
+                buffer_printf(out, " %s", inst->symbol);
+            }
+            if (inst->a.kind != SIR_OPERAND_NONE) {
+                buffer_putc(out, ' ');
+                print_operand(inst->a, out);
+            }
+            if (inst->b.kind != SIR_OPERAND_NONE) {
+                buffer_puts(out, ", ");
+                print_operand(inst->b, out);
+            }
+            if (inst->op == SIR_CALL) {
+                buffer_putc(out, '(');
+                for (size_t k = 0; k < inst->num_args; ++k) {
+                    if (k > 0) {
+                        buffer_puts(out, ", ");
+                    }
+                    print_operand(inst->args[k], out);
+                }
+                buffer_putc(out, ')');
+            }
+            if (inst->target != NULL) {
+                buffer_printf(out, " b%d", inst->target->index);
+            }
+            if (inst->other != NULL) {
+                buffer_printf(out, ", b%d", inst->other->index);
+            }
+            for (size_t k = 0; k < inst->table_size; ++k) {
+                buffer_printf(out, k ? ", b%d" : " [b%d", inst->table[k]->index);
+            }
+            if (inst->table_size > 0) {
+                buffer_putc(out, ']');
+            }
+            buffer_putc(out, '\n');
+        }
+    }
+}
+
+void print_sir_program(sir_program* program, buffer* out) {
+    for (size_t i = 0; i < program->num_globals; ++i) {
+        sir_global* global = &program->globals[i];
+        if (global->length > 0) {
+            buffer_printf(out, "%s %s:%d[%zu]\n", global->is_const ? "const" : "global", global->name, global->size,
+                          global->length);
+            continue;
+        }
+        buffer_printf(out, "%s %s:%d = %lld\n", global->is_const ? "const" : "global", global->name, global->size,
+                      global->value);
+    }
+    for (size_t i = 0; i < program->num_functions; ++i) {
+        print_sir_function(program->functions[i], out);
+    }
+}
@@ -1,5 +1,168 @@
-#ifndef IR_H
-#define IR_H
+#ifndef SIR_H
+#define SIR_H
 
-#endif // IR_H
+#include <stddef.h>
+#include <stdbool.h>
+#include "buffer.h"
 
+// SIR is the native backend's intermediate representation: each function is
+// a list of basic blocks of three-address instructions over virtual
+// registers. Locals and temporaries alike are vregs, and a vreg may be
+// assigned more than once. A 1-byte vreg truncates what is written to it
+// and sign-extends when read; all arithmetic is 32-bit. Every block ends in
+// exactly one terminator (jump, branch or return).
+//
+// Only the vectorizer makes vector instructions. A vector vreg is 16 or 32
+// bytes wide and holds that many bytes' worth of 4-byte lanes.
+typedef enum {
+    SIR_COPY,           // dst = a
+    SIR_LOAD_GLOBAL,    // dst = symbol
+    SIR_STORE_GLOBAL,   // symbol = a
+    SIR_LOAD_ELEM,      // dst = symbol[a]
+    SIR_STORE_ELEM,     // symbol[a] = b
+    SIR_ADD,            // dst = a + b
+    SIR_SUB,
+    SIR_MUL,
+    SIR_DIV,
+    SIR_MOD,
+    SIR_SHL,            // dst = a << b, b in [0, 32)
+    SIR_SAR,            // dst = a >> b, shifting in copies of the sign bit
+    SIR_SHR,            // dst = a >> b, shifting in zeros
+    SIR_MUL_HIGH,       // dst = high 32 bits of the 64-bit product a * b
+    SIR_EQ,
+    SIR_NE,
+    SIR_LT,
+    SIR_LE,
+    SIR_GT,
+    SIR_GE,
+    SIR_ULT,            // dst = a < b, compared as unsigned
+    SIR_BIT_TEST,       // dst = bit a of b, a in [0, 32)
+    SIR_NEG,            // dst = -a
+    SIR_NOT,            // dst = !a
+    SIR_VLOAD,          // dst = symbol[a], symbol[a + 1], ... one per lane
+    SIR_VSTORE,         // symbol[a], symbol[a + 1], ... = the lanes of b
+    SIR_VSPLAT,         // every lane of dst = a
+    SIR_VADD,           // lanewise dst = a + b
+    SIR_VSUB,
+    SIR_VMUL,
+    SIR_VSUM,           // dst = the sum of the lanes of a
+    SIR_CALL,           // dst = symbol(args), dst is -1 for a void callee
+    SIR_JUMP,           // goto target
+    SIR_BRANCH,         // if (a) goto target else goto other
+    SIR_JUMP_TABLE,     // goto table[a], a in [0, table_size)
+    SIR_RETURN,         // return a, a is none for void
+} sir_opcode;
+
+typedef enum {
+    SIR_OPERAND_NONE,
+    SIR_OPERAND_VREG,
+    SIR_OPERAND_IMM,
+} sir_operand_kind;
+
+typedef struct sir_operand {
+    sir_operand_kind kind;
+    int vreg;
+    int imm;
+} sir_operand;
+
+typedef struct sir_inst {
+    sir_opcode op;
+    int dst;                    // -1 when nothing is defined
+    sir_operand a;
+    sir_operand b;
+    const char* symbol;         // global or callee
+    sir_operand* args;
+    size_t num_args;
+    struct sir_block* target;
+    struct sir_block* other;
+    struct sir_block** table;   // owned, like args
+    size_t table_size;
+} sir_inst;
+
+typedef struct sir_block {
+    sir_inst* insts;
+    size_t num_insts;
+    size_t max_insts;
+    int index;                  // position in the function, see number_sir_blocks
+} sir_block;
+
+typedef struct sir_vreg {
+    int size;                   // 1 or 4 bytes, or a vector's width
+    const char* name;           // source variable, NULL for temporaries
+} sir_vreg;
+
+// blocks[0] is the entry; the order of blocks is also their layout.
+typedef struct sir_function {
+    char* name;
+    int* params;                // vregs, in argument order
+    size_t num_params;
+    int return_size;            // 0 for void
+    sir_block** blocks;
+    size_t num_blocks;
+    size_t max_blocks;
+    sir_vreg* vregs;
+    size_t num_vregs;
+    size_t max_vregs;
+} sir_function;
+
+// An array has length elements of size bytes each, all zero; a scalar has
+// length 0 and starts out as value.
+typedef struct sir_global {
+    char* name;
+    int size;
+    size_t length;
+    long long value;
+    bool is_const;
+} sir_global;
+
+// Functions and globals are also hashed by name; a slot holds an index
+// into functions or globals plus one, or 0 when empty.
+typedef struct sir_program {
+    sir_function** functions;
+    size_t num_functions;
+    sir_global* globals;
+    size_t num_globals;
+    size_t* function_slots;
+    size_t* global_slots;
+    size_t num_function_slots;
+    size_t num_global_slots;
+} sir_program;
+
+sir_operand sir_none();
+sir_operand sir_vreg_operand(int vreg);
+sir_operand sir_imm_operand(int imm);
+bool sir_is_terminator(sir_opcode op);
+bool sir_has_side_effects(sir_opcode op);
+bool sir_is_vector(sir_opcode op);
+const char* sir_opcode_tostring(sir_opcode op);
+int sir_truncate(int value, int size);
+
+sir_program* create_sir_program();
+sir_function* create_sir_function(const char* name);
+void add_sir_function(sir_program* program, sir_function* fn);
+void add_sir_global(sir_program* program, const char* name, int size, long long value, bool is_const);
+void add_sir_array(sir_program* program, const char* name, int size, size_t length, bool is_const);
+size_t find_sir_function_index(sir_program* program, const char* name);
+sir_function* find_sir_function(sir_program* program, const char* name);
+sir_global* find_sir_global(sir_program* program, const char* name);
+void free_sir_function(sir_function* fn);
+void free_sir_program(sir_program* program);
+
+int new_sir_vreg(sir_function* fn, int size, const char* name);
+sir_block* new_sir_block(sir_function* fn);
+sir_block* insert_sir_block(sir_function* fn, size_t position);
+void place_sir_block(sir_function* fn, sir_block* block);
+void remove_sir_blocks(sir_function* fn, const bool* removed);
+void number_sir_blocks(sir_function* fn);
+sir_inst* sir_append(sir_block* block, sir_inst inst);
+sir_inst* sir_emit(sir_block* block, sir_opcode op, int dst, sir_operand a, sir_operand b);
+sir_inst* sir_terminator(sir_block* block);
+size_t sir_num_successors(const sir_inst* term);
+sir_block** sir_successor(sir_inst* term, size_t i);
+void sir_redirect(sir_inst* term, sir_block* from, sir_block* to);
+size_t sir_function_size(sir_function* fn);
+
+void print_sir_function(sir_function* fn, buffer* out);
+void print_sir_program(sir_program* program, buffer* out);
+
+#endif // SIR_H
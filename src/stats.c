@@ -0,0 +1,133 @@
+#include "stats.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+double monotonic_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// CPU time of the calling thread, so parallel jobs each see only their own.
+double cpu_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+size_t peak_rss_kb() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    return (size_t)usage.ru_maxrss;
+}
+
+static size_t total(const size_t* values) {
+    size_t sum = 0;
+    for (int i = 0; i < NUM_ALLOC_CATEGORIES; ++i) {
+        sum += values[i];
+    }
+    return sum;
+}
+
+void init_compile_stats(compile_stats* stats) {
+    memset(stats, 0, sizeof(compile_stats));
+    stats->alloc_start = *current_alloc_counters();
+}
+
+void free_compile_stats(compile_stats* stats) {
+    free_gvn_stats(&stats->backend.gvn);
+}
+
+void stats_begin_phase(compile_stats* stats, const char* name) {
+    if (stats->num_phases == STATS_MAX_PHASES) {
+        return;
+    }
+    stats->phases[stats->num_phases].name = name;
+    stats->phase_alloc_start = *current_alloc_counters();
+    stats->phase_cpu_start = cpu_seconds();
+    stats->phase_wall_start = monotonic_seconds();
+}
+
+void stats_end_phase(compile_stats* stats) {
+    if (stats->num_phases == STATS_MAX_PHASES) {
+        return;
+    }
+    phase_stats* phase = &stats->phases[stats->num_phases++];
+    phase->wall_seconds = monotonic_seconds() - stats->phase_wall_start;
+    phase->cpu_seconds = cpu_seconds() - stats->phase_cpu_start;
+    alloc_counters* now = current_alloc_counters();
+    phase->allocations = total(now->allocations) - total(stats->phase_alloc_start.allocations);
+    phase->bytes = total(now->bytes) - total(stats->phase_alloc_start.bytes);
+}
+
+void print_stats_text(compile_stats* stats, buffer* out) {
+    double wall = 0;
+    double cpu = 0;
+    buffer_printf(out, "%-20s %12s %12s %10s %12s\n", "phase", "wall (us)", "cpu (us)", "allocs", "bytes");
+    for (size_t i = 0; i < stats->num_phases; ++i) {
+        phase_stats* phase = &stats->phases[i];
+        buffer_printf(out, "%-20s %12.1f %12.1f %10zu %12zu\n", phase->name, phase->wall_seconds * 1e6,
+                      phase->cpu_seconds * 1e6, phase->allocations, phase->bytes);
+        wall += phase->wall_seconds;
+        cpu += phase->cpu_seconds;
+    }
+    buffer_printf(out, "%-20s %12.1f %12.1f\n", "total", wall * 1e6, cpu * 1e6);
+
+    alloc_counters* now = current_alloc_counters();
+    buffer_puts(out, "allocations by owner:\n");
+    for (int i = 0; i < NUM_ALLOC_CATEGORIES; ++i) {
+        buffer_printf(out, "  %-18s %10zu %12zu\n", alloc_category_tostring((alloc_category)i),
+                      now->allocations[i] - stats->alloc_start.allocations[i],
+                      now->bytes[i] - stats->alloc_start.bytes[i]);
+    }
+    buffer_printf(out, "peak rss: %zu KiB\n", peak_rss_kb());
+    backend_stats* backend = &stats->backend;
+    if (backend->num_functions > 0) {
+        buffer_printf(out, "backend: %zu functions on %zu thread%s\n", backend->num_functions, backend->num_threads,
+                      backend->num_threads == 1 ? "" : "s");
+        print_peephole_stats(&backend->peephole, out);
+        print_simplify_stats(&backend->simplify, out);
+        print_gvn_stats(&backend->gvn, out);
+    }
+}
+
+void print_stats_json(compile_stats* stats, buffer* out) {
+    buffer_puts(out, "{\"phases\":[");
+    for (size_t i = 0; i < stats->num_phases; ++i) {
+        phase_stats* phase = &stats->phases[i];
+        buffer_printf(out, "%s{\"name\":\"%s\",\"wall_us\":%.3f,\"cpu_us\":%.3f,\"allocations\":%zu,\"bytes\":%zu}",
+                      i ? "," : "", phase->name, phase->wall_seconds * 1e6, phase->cpu_seconds * 1e6,
+                      phase->allocations, phase->bytes);
+    }
+    buffer_puts(out, "],\"allocations\":{");
+    alloc_counters* now = current_alloc_counters();
+    for (int i = 0; i < NUM_ALLOC_CATEGORIES; ++i) {
+        buffer_printf(out, "%s\"%s\":{\"count\":%zu,\"bytes\":%zu}", i ? "," : "",
+                      alloc_category_tostring((alloc_category)i),
+                      now->allocations[i] - stats->alloc_start.allocations[i],
+                      now->bytes[i] - stats->alloc_start.bytes[i]);
+    }
+    backend_stats* backend = &stats->backend;
+    buffer_printf(out, "},\"peak_rss_kb\":%zu,\"backend\":{\"functions\":%zu,\"threads\":%zu}", peak_rss_kb(),
+                  backend->num_functions, backend->num_threads);
+    buffer_printf(out, ",\"peephole\":{\"before\":%zu,\"after\":%zu,\"rules\":{", backend->peephole.insts_before,
+                  backend->peephole.insts_after);
+    for (size_t r = 0; r < peephole_rule_count(); ++r) {
+        buffer_printf(out, "%s\"%s\":%zu", r ? "," : "", peephole_rule_name(r), backend->peephole.hits[r]);
+    }
+    buffer_printf(out, "}},\"simplify\":{\"reduced\":%zu,\"rules\":{", backend->simplify.reduced);
+    for (size_t r = 0; r < simplify_rule_count(); ++r) {
+        buffer_printf(out, "%s\"%s\":%zu", r ? "," : "", simplify_rule_name(r), backend->simplify.hits[r]);
+    }
+    buffer_printf(out, "}},\"gvn\":{\"eliminated\":%zu,\"functions\":{", backend->gvn.eliminated);
+    for (size_t i = 0; i < backend->gvn.num_functions; ++i) {
+        buffer_printf(out, "%s\"%s\":%zu", i ? "," : "", backend->gvn.functions[i].name,
+                      backend->gvn.functions[i].eliminated);
+    }
+    buffer_puts(out, "}}}\n");
+}
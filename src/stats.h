@@ -0,0 +1,40 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "allocator.h"
+#include "backend.h"
+#include "buffer.h"
+
+#define STATS_MAX_PHASES 32
+
+typedef struct phase_stats {
+    const char* name;
+    double wall_seconds;
+    double cpu_seconds;
+    size_t allocations;
+    size_t bytes;
+} phase_stats;
+
+typedef struct compile_stats {
+    phase_stats phases[STATS_MAX_PHASES];
+    size_t num_phases;
+    double phase_wall_start;
+    double phase_cpu_start;
+    alloc_counters phase_alloc_start;
+    alloc_counters alloc_start;
+    backend_stats backend;
+} compile_stats;
+
+void init_compile_stats(compile_stats* stats);
+void free_compile_stats(compile_stats* stats);
+void stats_begin_phase(compile_stats* stats, const char* name);
+void stats_end_phase(compile_stats* stats);
+double monotonic_seconds();
+double cpu_seconds();
+size_t peak_rss_kb();
+void print_stats_text(compile_stats* stats, buffer* out);
+void print_stats_json(compile_stats* stats, buffer* out);
+
+#endif // STATS_H
@@ -1,26 +1,28 @@
 #include "symbol_table.h"
+#include "types.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 
-symbol* create_symbol(const char* name, symbol_type type, bool is_const) {
-    symbol* sym = malloc(sizeof(symbol));
-    sym->name = _strdup(name);
+symbol* create_symbol(const char* name, symbol_type type, bool is_const, const struct c_type* decl_type) {
+    symbol* sym = counted_malloc(ALLOC_SYMBOLS, sizeof(symbol));
+    sym->name = counted_strdup(ALLOC_SYMBOLS, name);
     sym->type = type;
     sym->is_const = is_const;
+    sym->decl_type = decl_type;
     return sym;
 }
 
 scope* create_scope() {
-    scope* s = malloc(sizeof(scope));
+    scope* s = counted_malloc(ALLOC_SYMBOLS, sizeof(scope));
     s->symbols = NULL;
     s->num_symbols = 0;
     return s;
 }
 
 symbol_table* create_symbol_table() {
-    symbol_table* st = malloc(sizeof(symbol_table));
+    symbol_table* st = counted_malloc(ALLOC_SYMBOLS, sizeof(symbol_table));
     st->scopes = NULL;
     st->num_scopes = 0;
 
@@ -31,12 +33,12 @@ symbol_table* create_symbol_table() {
 }
 
 void add_symbol_to_scope(scope* s, symbol* sym) {
-    s->symbols = realloc(s->symbols, (s->num_symbols + 1) * sizeof(symbol*));
+    s->symbols = counted_realloc(ALLOC_SYMBOLS, s->symbols, (s->num_symbols + 1) * sizeof(symbol*));
     s->symbols[s->num_symbols++] = sym;
 }
 
 void add_scope_to_table(symbol_table* st, scope* s) {
-    st->scopes = realloc(st->scopes, (st->num_scopes + 1) * sizeof(scope*));
+    st->scopes = counted_realloc(ALLOC_SYMBOLS, st->scopes, (st->num_scopes + 1) * sizeof(scope*));
     st->scopes[st->num_scopes++] = s;
 }
 
@@ -62,33 +64,61 @@ symbol* find_global_symbol(symbol_table* st, const char* name) {
     return NULL;
 }
 
-void print_symbol_table(symbol_table* st) {
-    printf("---------------------------------\n");
+static const char* symbol_type_tostring(symbol_type type) {
+    switch (type) {
+        case VARIABLE:
+            return "Variable";
+        case FUNCTION:
+            return "Function";
+        case TYPE:
+            return "Type";
+        default:
+            return "Unknown";
+    }
+}
+
+void print_symbol_table(symbol_table* st, buffer* out) {
+    static const char rule[] = "---------------------------------\n";
+    buffer_append(out, rule, sizeof(rule) - 1);
     for (size_t i = 0; i < st->num_scopes; ++i) {
         scope* current_scope = st->scopes[i];
-        printf("Scope %zu:\n", i + 1);
+        buffer_printf(out, "Scope %zu:\n", i + 1);
 
         for (size_t j = 0; j < current_scope->num_symbols; ++j) {
             symbol* sym = current_scope->symbols[j];
-            printf("  Name: %s, Type: ", sym->name);
-            switch (sym->type) {
-                case VARIABLE:
-                    printf("Variable");
-                    break;
-                case FUNCTION:
-                    printf("Function");
-                    break;
-                case TYPE:
-                    printf("Type");
-                    break;
-                default:
-                    printf("Unknown");
-                    break;
-            }
-
-            printf("\n");
+            buffer_puts(out, "  Name: ");
+            buffer_puts(out, sym->name);
+            buffer_puts(out, ", Type: ");
+            buffer_puts(out, symbol_type_tostring(sym->type));
+            buffer_putc(out, '\n');
         }
 
-        printf("---------------------------------\n");
+        buffer_append(out, rule, sizeof(rule) - 1);
+    }
+}
+
+// Scopes in creation order, the global scope first, each an array of its
+// symbols. One line, like dump_ast_json.
+void dump_symbol_table_json(symbol_table* st, buffer* out) {
+    buffer_puts(out, "{\"scopes\":[");
+    for (size_t i = 0; i < st->num_scopes; ++i) {
+        scope* current_scope = st->scopes[i];
+        buffer_puts(out, i ? ",[" : "[");
+        for (size_t j = 0; j < current_scope->num_symbols; ++j) {
+            symbol* sym = current_scope->symbols[j];
+            buffer_puts(out, j ? ",{\"name\":" : "{\"name\":");
+            buffer_put_json_string(out, sym->name);
+            buffer_puts(out, sym->type == FUNCTION ? ",\"kind\":\"function\"" :
+                             sym->type == TYPE     ? ",\"kind\":\"type\"" :
+                                                     ",\"kind\":\"variable\"");
+            if (sym->decl_type != NULL) {
+                buffer_puts(out, ",\"type\":\"");
+                print_c_type(sym->decl_type, out);
+                buffer_putc(out, '"');
+            }
+            buffer_puts(out, sym->is_const ? ",\"const\":true}" : ",\"const\":false}");
+        }
+        buffer_putc(out, ']');
     }
+    buffer_puts(out, "]}\n");
 }
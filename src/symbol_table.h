@@ -1,7 +1,12 @@
 #ifndef SYMBOL_TABLE_H
 #define SYMBOL_TABLE_H
 
+#include <stddef.h>
 #include <stdbool.h>
+#include "compat.h"
+#include "allocator.h"
+#include "buffer.h"
+#include "diagnostics.h"
 
 typedef enum {
     VARIABLE,
@@ -9,10 +14,13 @@ typedef enum {
     TYPE,
 } symbol_type;
 
+struct c_type;
+
 typedef struct {
     const char* name;
     symbol_type type;
     bool is_const;
+    const struct c_type* decl_type;
 } symbol;
 
 typedef struct {
@@ -26,14 +34,15 @@ typedef struct {
     scope* current_scope;
 } symbol_table;
 
-symbol* create_symbol(const char* name, symbol_type type, bool is_const);
+symbol* create_symbol(const char* name, symbol_type type, bool is_const, const struct c_type* decl_type);
 scope* create_scope();
 symbol_table* create_symbol_table();
 void add_symbol_to_scope(scope* s, symbol* sym);
 void add_scope_to_table(symbol_table* st, scope* s);
 symbol* find_symbol(symbol_table* st, const char* name);
 symbol* find_global_symbol(symbol_table* st, const char* name);
-void print_symbol_table(symbol_table* st);
+void print_symbol_table(symbol_table* st, buffer* out);
+void dump_symbol_table_json(symbol_table* st, buffer* out);
 
 #endif // SYMBOL_TABLE_H
 
@@ -0,0 +1,227 @@
+#include "thread_pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "compat.h"
+
+typedef struct worker_context {
+    thread_pool* pool;
+    size_t index;
+} worker_context;
+
+// Index of the pool worker running on this thread, so tasks submitted from
+// inside a task land on the submitter's own deque.
+static SCC_THREAD_LOCAL thread_pool* worker_pool;
+static SCC_THREAD_LOCAL size_t worker_index;
+
+size_t available_cores() {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (size_t)cores : 1;
+}
+
+static void init_work_queue(work_queue* q) {
+    q->capacity = 16;
+    q->tasks = malloc(q->capacity * sizeof(task));
+    if (q->tasks == NULL) {
+        fprintf(stderr, "Error: Failed to allocate work queue!\n");
+        exit(1);
+    }
+    q->head = 0;
+    q->tail = 0;
+    pthread_mutex_init(&q->lock, NULL);
+}
+
+static void push_task(work_queue* q, task t) {
+    pthread_mutex_lock(&q->lock);
+    if (q->tail - q->head == q->capacity) {
+        task* tasks = malloc(q->capacity * 2 * sizeof(task));
+        if (tasks == NULL) {
+            fprintf(stderr, "Error: Failed to grow work queue!\n");
+            exit(1);
+        }
+        for (size_t i = q->head; i < q->tail; ++i) {
+            tasks[i - q->head] = q->tasks[i % q->capacity];
+        }
+        free(q->tasks);
+        q->tasks = tasks;
+        q->tail -= q->head;
+        q->head = 0;
+        q->capacity *= 2;
+    }
+    q->tasks[q->tail % q->capacity] = t;
+    q->tail++;
+    pthread_mutex_unlock(&q->lock);
+}
+
+static bool pop_task(work_queue* q, task* t) {
+    pthread_mutex_lock(&q->lock);
+    bool found = q->tail != q->head;
+    if (found) {
+        q->tail--;
+        *t = q->tasks[q->tail % q->capacity];
+    }
+    pthread_mutex_unlock(&q->lock);
+    return found;
+}
+
+static bool steal_task(work_queue* q, task* t) {
+    pthread_mutex_lock(&q->lock);
+    bool found = q->tail != q->head;
+    if (found) {
+        *t = q->tasks[q->head % q->capacity];
+        q->head++;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return found;
+}
+
+static bool find_task(thread_pool* pool, size_t index, task* t) {
+    if (pop_task(&pool->queues[index], t)) {
+        return true;
+    }
+    for (size_t i = 1; i < pool->num_threads; ++i) {
+        if (steal_task(&pool->queues[(index + i) % pool->num_threads], t)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void* worker_main(void* arg) {
+    worker_context* context = arg;
+    thread_pool* pool = context->pool;
+    size_t index = context->index;
+    free(context);
+    worker_pool = pool;
+    worker_index = index;
+
+    for (;;) {
+        task t;
+        if (find_task(pool, index, &t)) {
+            pthread_mutex_lock(&pool->lock);
+            pool->queued--;
+            pthread_mutex_unlock(&pool->lock);
+
+            t.fn(t.arg);
+
+            pthread_mutex_lock(&pool->lock);
+            if (--pool->pending == 0) {
+                pthread_cond_broadcast(&pool->all_done);
+            }
+            pthread_mutex_unlock(&pool->lock);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        while (pool->queued == 0 && !pool->shutting_down) {
+            pthread_cond_wait(&pool->work_available, &pool->lock);
+        }
+        bool done = pool->queued == 0 && pool->shutting_down;
+        pthread_mutex_unlock(&pool->lock);
+        if (done) {
+            return NULL;
+        }
+    }
+}
+
+// num_threads == 0 sizes the pool to the available cores.
+thread_pool* create_thread_pool(size_t num_threads) {
+    if (num_threads == 0) {
+        num_threads = available_cores();
+    }
+    thread_pool* pool = malloc(sizeof(thread_pool));
+    if (pool == NULL) {
+        fprintf(stderr, "Error: Failed to allocate thread pool!\n");
+        exit(1);
+    }
+    pool->threads = malloc(num_threads * sizeof(pthread_t));
+    pool->queues = malloc(num_threads * sizeof(work_queue));
+    if (pool->threads == NULL || pool->queues == NULL) {
+        fprintf(stderr, "Error: Failed to allocate thread pool!\n");
+        exit(1);
+    }
+    pool->num_threads = num_threads;
+    pool->next_queue = 0;
+    pool->queued = 0;
+    pool->pending = 0;
+    pool->shutting_down = false;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_available, NULL);
+    pthread_cond_init(&pool->all_done, NULL);
+
+    for (size_t i = 0; i < num_threads; ++i) {
+        init_work_queue(&pool->queues[i]);
+    }
+    for (size_t i = 0; i < num_threads; ++i) {
+        worker_context* context = malloc(sizeof(worker_context));
+        if (context == NULL) {
+            fprintf(stderr, "Error: Failed to allocate thread pool!\n");
+            exit(1);
+        }
+        context->pool = pool;
+        context->index = i;
+        if (pthread_create(&pool->threads[i], NULL, worker_main, context) != 0) {
+            fprintf(stderr, "Error: Failed to start worker thread!\n");
+            exit(1);
+        }
+    }
+    return pool;
+}
+
+// Work submitted from outside the pool is dealt round-robin across the
+// deques; work submitted by a task stays on that worker's deque.
+void thread_pool_submit(thread_pool* pool, task_fn fn, void* arg) {
+    size_t index;
+    if (worker_pool == pool) {
+        index = worker_index;
+    } else {
+        pthread_mutex_lock(&pool->lock);
+        index = pool->next_queue++ % pool->num_threads;
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    // Count the task before it becomes visible so a worker that grabs it
+    // straight away never drives the counters below zero.
+    pthread_mutex_lock(&pool->lock);
+    pool->pending++;
+    pool->queued++;
+    pthread_mutex_unlock(&pool->lock);
+
+    task t = {fn, arg};
+    push_task(&pool->queues[index], t);
+
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->work_available);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Blocks until every submitted task has finished.
+void thread_pool_wait(thread_pool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->all_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void free_thread_pool(thread_pool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->shutting_down = true;
+    pthread_cond_broadcast(&pool->work_available);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < pool->num_threads; ++i) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    for (size_t i = 0; i < pool->num_threads; ++i) {
+        free(pool->queues[i].tasks);
+        pthread_mutex_destroy(&pool->queues[i].lock);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_available);
+    pthread_cond_destroy(&pool->all_done);
+    free(pool->queues);
+    free(pool->threads);
+    free(pool);
+}
@@ -0,0 +1,44 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+typedef void (*task_fn)(void* arg);
+
+typedef struct task {
+    task_fn fn;
+    void* arg;
+} task;
+
+// One deque per worker. The owner pushes and pops at the tail; idle workers
+// steal from the head, so the oldest (usually largest) pending work moves.
+typedef struct work_queue {
+    task* tasks;
+    size_t head;
+    size_t tail;
+    size_t capacity;
+    pthread_mutex_t lock;
+} work_queue;
+
+typedef struct thread_pool {
+    pthread_t* threads;
+    work_queue* queues;
+    size_t num_threads;
+    size_t next_queue;
+    size_t queued;
+    size_t pending;
+    bool shutting_down;
+    pthread_mutex_t lock;
+    pthread_cond_t work_available;
+    pthread_cond_t all_done;
+} thread_pool;
+
+size_t available_cores();
+thread_pool* create_thread_pool(size_t num_threads);
+void thread_pool_submit(thread_pool* pool, task_fn fn, void* arg);
+void thread_pool_wait(thread_pool* pool);
+void free_thread_pool(thread_pool* pool);
+
+#endif // THREAD_POOL_H
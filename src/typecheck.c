@@ -0,0 +1,541 @@
+#include "typecheck.h"
+
+#include "hash.h"
+
+// The checker keeps its own scopes rather than asking the symbol table,
+// whose lookups scan every scope ever opened. Each name has one slot in an
+// open-addressed table pointing at its innermost binding; a binding
+// remembers the one it shadows, so leaving a scope just pops its bindings
+// and restores those. Every lookup and every scope exit is then O(1) per
+// name, and the pass as a whole is linear.
+typedef struct binding {
+    const char* name;
+    uint64_t hash;
+    const c_type* type;
+    bool is_function;
+    size_t depth;
+    long shadowed;
+} binding;
+
+typedef struct name_slot {
+    const char* name;
+    uint64_t hash;
+    long top;
+} name_slot;
+
+// The switch being checked. Its case values are case_values[first_case..],
+// above those of the switches around it.
+typedef struct switch_context {
+    size_t first_case;
+    bool has_default;
+} switch_context;
+
+typedef struct checker {
+    type_table* types;
+    name_slot* slots;
+    size_t num_slots;
+    size_t num_names;
+    binding* bindings;
+    size_t num_bindings;
+    size_t max_bindings;
+    size_t depth;
+    ast_function_decl_node* function;
+    const c_type* return_type;
+    size_t loop_depth;
+    size_t break_depth;         // loops and switches
+    switch_context* current_switch;
+    int* case_values;
+    size_t num_case_values;
+    size_t max_case_values;
+} checker;
+
+static name_slot* find_slot(checker* c, const char* name, uint64_t hash) {
+    size_t mask = c->num_slots - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        name_slot* slot = &c->slots[i];
+        if (slot->name == NULL || (slot->hash == hash && strcmp(slot->name, name) == 0)) {
+            return slot;
+        }
+    }
+}
+
+static void grow_slots(checker* c) {
+    name_slot* old = c->slots;
+    size_t num_old = c->num_slots;
+    c->num_slots = num_old * 2;
+    c->slots = counted_malloc(ALLOC_SYMBOLS, c->num_slots * sizeof(name_slot));
+    memset(c->slots, 0, c->num_slots * sizeof(name_slot));
+    for (size_t i = 0; i < num_old; ++i) {
+        if (old[i].name != NULL) {
+            *find_slot(c, old[i].name, old[i].hash) = old[i];
+        }
+    }
+    counted_free(ALLOC_SYMBOLS, old);
+}
+
+static binding* lookup(checker* c, const char* name) {
+    name_slot* slot = find_slot(c, name, hash_string(name, 0));
+    return slot->name == NULL || slot->top < 0 ? NULL : &c->bindings[slot->top];
+}
+
+static void bind(checker* c, const char* name, const c_type* type, bool is_function) {
+    uint64_t hash = hash_string(name, 0);
+    name_slot* slot = find_slot(c, name, hash);
+    if (slot->name == NULL) {
+        if ((c->num_names + 1) * 2 > c->num_slots) {
+            grow_slots(c);
+            slot = find_slot(c, name, hash);
+        }
+        slot->name = name;
+        slot->hash = hash;
+        slot->top = -1;
+        c->num_names++;
+    } else if (slot->top >= 0 && c->bindings[slot->top].depth == c->depth) {
+        fatal_error("Error: '%s' is already declared in this scope\n", name);
+    }
+
+    if (c->num_bindings == c->max_bindings) {
+        c->max_bindings *= 2;
+        c->bindings = counted_realloc(ALLOC_SYMBOLS, c->bindings, c->max_bindings * sizeof(binding));
+    }
+    binding* b = &c->bindings[c->num_bindings];
+    b->name = name;
+    b->hash = hash;
+    b->type = type;
+    b->is_function = is_function;
+    b->depth = c->depth;
+    b->shadowed = slot->top;
+    slot->top = (long)c->num_bindings++;
+}
+
+static void leave_scope(checker* c, size_t mark) {
+    while (c->num_bindings > mark) {
+        binding* b = &c->bindings[--c->num_bindings];
+        find_slot(c, b->name, b->hash)->top = b->shadowed;
+    }
+    c->depth--;
+}
+
+static void type_error(const char* fmt, const c_type* from, const c_type* to) {
+    buffer a = init_buffer(32);
+    buffer b = init_buffer(32);
+    print_c_type(from, &a);
+    buffer_putc(&a, '\0');
+    print_c_type(to, &b);
+    buffer_putc(&b, '\0');
+    char message[256];
+    snprintf(message, sizeof(message), fmt, a.data, b.data);
+    free_buffer(&a);
+    free_buffer(&b);
+    fatal_error("%s", message);
+}
+
+// Integer promotion: char operands are computed as int.
+static const c_type* promote(checker* c, const c_type* t) {
+    return t->kind == TYPE_CHAR ? builtin_c_type(c->types, INT) : t;
+}
+
+static void check_conversion(const c_type* from, const c_type* to, const char* context);
+static const c_type* check_element(checker* c, const char* name, ast_node* index);
+
+static const c_type* check_expression(checker* c, ast_node* node) {
+    const c_type* type = NULL;
+    switch (node->type) {
+        case AST_LITERAL:
+            if (strcmp(node->type_str, "double") == 0) {
+                type = builtin_c_type(c->types, DOUBLE);
+            } else if (strcmp(node->type_str, "char") == 0) {
+                type = builtin_c_type(c->types, CHAR);
+            } else {
+                type = builtin_c_type(c->types, INT);
+            }
+            node->value_type = type;
+            return type;
+        case AST_IDENTIFIER: {
+            binding* b = lookup(c, node->value);
+            if (b == NULL) {
+                fatal_error("Error: '%s' is not declared\n", node->value);
+            }
+            if (b->is_function) {
+                fatal_error("Error: function '%s' is used as a value\n", node->value);
+            }
+            if (b->type->kind == TYPE_ARRAY) {
+                fatal_error("Error: array '%s' is used as a value\n", node->value);
+            }
+            // Reading a variable yields its value, which is never qualified.
+            type = b->type->unqualified;
+            node->value_type = type;
+            return type;
+        }
+        case AST_UNARY_EXPR: {
+            ast_unary_expr_node* unary = (ast_unary_expr_node*)node;
+            const c_type* operand = check_expression(c, unary->operand);
+            if (!is_arithmetic_type(operand)) {
+                type_error("Error: invalid operand to unary '%s' (have '%s')\n", operand, operand);
+            }
+            type = unary->op == OP_LOGICAL_NOT ? builtin_c_type(c->types, INT) : promote(c, operand);
+            unary->value_type = type;
+            return type;
+        }
+        case AST_BINARY_EXPR: {
+            ast_binary_expr_node* binary = (ast_binary_expr_node*)node;
+            const c_type* left = check_expression(c, binary->left);
+            const c_type* right = check_expression(c, binary->right);
+            if (!is_arithmetic_type(left) || !is_arithmetic_type(right)) {
+                type_error("Error: invalid operands to binary operator ('%s' and '%s')\n", left, right);
+            }
+            if (binary->op == OP_MODULO && (!is_integer_type(left) || !is_integer_type(right))) {
+                type_error("Error: invalid operands to binary %% ('%s' and '%s')\n", left, right);
+            }
+            if (binary->op == OP_EQUAL || binary->op == OP_NOT_EQUAL || binary->op == OP_LESS ||
+                binary->op == OP_LESS_EQUAL || binary->op == OP_GREATER || binary->op == OP_GREATER_EQUAL) {
+                type = builtin_c_type(c->types, INT);
+            } else if (left->kind == TYPE_DOUBLE || right->kind == TYPE_DOUBLE) {
+                type = builtin_c_type(c->types, DOUBLE);
+            } else {
+                type = builtin_c_type(c->types, INT);
+            }
+            binary->value_type = type;
+            return type;
+        }
+        case AST_CALL_EXPR: {
+            ast_call_expr_node* call = (ast_call_expr_node*)node;
+            binding* b = lookup(c, call->function_name);
+            if (b == NULL) {
+                fatal_error("Error: function '%s' is not declared\n", call->function_name);
+            }
+            if (!b->is_function) {
+                fatal_error("Error: '%s' is not a function\n", call->function_name);
+            }
+            const c_type* function = b->type;
+            if (call->num_arguments != function->length) {
+                fatal_error("Error: function '%s' takes %zu arguments, %zu given\n", call->function_name,
+                            function->length, call->num_arguments);
+            }
+            for (size_t i = 0; i < call->num_arguments; ++i) {
+                check_conversion(check_expression(c, call->arguments[i]), function->params[i], "argument");
+            }
+            type = function->base;
+            call->value_type = type;
+            return type;
+        }
+        case AST_INDEX_EXPR: {
+            ast_index_expr_node* index = (ast_index_expr_node*)node;
+            type = check_element(c, index->array->value, index->index)->unqualified;
+            index->value_type = type;
+            return type;
+        }
+        default:
+            fatal_error("Error: Unexpected node in expression\n");
+    }
+}
+
+// The element type of array name, indexed by index.
+static const c_type* check_element(checker* c, const char* name, ast_node* index) {
+    binding* b = lookup(c, name);
+    if (b == NULL) {
+        fatal_error("Error: '%s' is not declared\n", name);
+    }
+    if (b->is_function || b->type->kind != TYPE_ARRAY) {
+        fatal_error("Error: subscripted value '%s' is not an array\n", name);
+    }
+    if (!is_integer_type(check_expression(c, index))) {
+        fatal_error("Error: array subscript is not an integer\n");
+    }
+    return b->type->base;
+}
+
+// Arithmetic values convert to one another implicitly; anything else must
+// match exactly, ignoring qualifiers.
+static void check_conversion(const c_type* from, const c_type* to, const char* context) {
+    if ((is_arithmetic_type(from) && is_arithmetic_type(to)) || from->unqualified == to->unqualified) {
+        return;
+    }
+    char fmt[128];
+    snprintf(fmt, sizeof(fmt), "Error: incompatible types in %s: '%%s' to '%%s'\n", context);
+    type_error(fmt, from, to);
+}
+
+static const c_type* variable_type(checker* c, ast_variable_decl_node* decl) {
+    const char* name = decl->identifier_node->value;
+    if (decl->type_node == VOID) {
+        fatal_error("Error: variable '%s' declared void\n", name);
+    }
+    const c_type* type =
+        qualified_type(c->types, builtin_c_type(c->types, decl->type_node), decl->is_constant ? TYPE_CONST : 0);
+    return decl->array_length > 0 ? array_type(c->types, type, decl->array_length) : type;
+}
+
+static void check_statement(checker* c, ast_node* node);
+
+static void check_statements(checker* c, ast_node** statements, size_t num_statements) {
+    for (size_t i = 0; i < num_statements; ++i) {
+        check_statement(c, statements[i]);
+    }
+}
+
+// Arrays live in static storage only, zero-initialized like any global
+// without an initializer.
+static void check_variable_decl(checker* c, ast_variable_decl_node* decl) {
+    const c_type* type = variable_type(c, decl);
+    if (type->kind == TYPE_ARRAY && c->function != NULL) {
+        fatal_error("Error: array '%s' must be declared at file scope\n", decl->identifier_node->value);
+    }
+    if (type->kind == TYPE_ARRAY && decl->value != NULL) {
+        fatal_error("Error: array '%s' cannot have an initializer\n", decl->identifier_node->value);
+    }
+    if (decl->value != NULL) {
+        check_conversion(check_expression(c, decl->value), type, "initialization");
+    }
+    bind(c, decl->identifier_node->value, type, false);
+}
+
+// A controlling expression is compared against zero, so it must be scalar.
+static void check_condition(checker* c, ast_node* condition) {
+    if (condition == NULL) {
+        return;
+    }
+    if (!is_arithmetic_type(check_expression(c, condition))) {
+        fatal_error("Error: loop condition is not a scalar value\n");
+    }
+}
+
+static void check_loop(checker* c, ast_loop_node* loop) {
+    // The init of a for is a scope of its own around the whole loop.
+    size_t mark = c->num_bindings;
+    c->depth++;
+    check_statement(c, loop->init);
+    check_condition(c, loop->condition);
+    check_statement(c, loop->step);
+    c->loop_depth++;
+    c->break_depth++;
+    check_statement(c, loop->body);
+    c->loop_depth--;
+    c->break_depth--;
+    leave_scope(c, mark);
+}
+
+static bool is_constant_expression(ast_node* node) {
+    switch (node->type) {
+        case AST_LITERAL:
+            return true;
+        case AST_UNARY_EXPR:
+            return is_constant_expression(((ast_unary_expr_node*)node)->operand);
+        case AST_BINARY_EXPR: {
+            ast_binary_expr_node* binary = (ast_binary_expr_node*)node;
+            return is_constant_expression(binary->left) && is_constant_expression(binary->right);
+        }
+        default:
+            return false;
+    }
+}
+
+static void check_case_label(checker* c, ast_case_node* label) {
+    switch_context* context = c->current_switch;
+    if (context == NULL) {
+        fatal_error("Error: %s label not within a switch statement\n", label->value ? "case" : "default");
+    }
+    if (label->value == NULL) {
+        if (context->has_default) {
+            fatal_error("Error: multiple default labels in one switch\n");
+        }
+        context->has_default = true;
+        return;
+    }
+    if (!is_integer_type(check_expression(c, label->value)) || !is_constant_expression(label->value)) {
+        fatal_error("Error: case label is not an integer constant expression\n");
+    }
+    if (c->num_case_values == c->max_case_values) {
+        c->max_case_values = c->max_case_values ? c->max_case_values * 2 : 16;
+        c->case_values = counted_realloc(ALLOC_SYMBOLS, c->case_values, c->max_case_values * sizeof(int));
+    }
+    c->case_values[c->num_case_values++] = (int)ast_eval_constant(label->value);
+}
+
+static int compare_case_values(const void* a, const void* b) {
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+// Duplicate values are found by sorting once the whole body has been seen.
+static void check_switch(checker* c, ast_switch_node* switch_stmt) {
+    if (!is_integer_type(check_expression(c, switch_stmt->condition))) {
+        fatal_error("Error: switch condition is not an integer\n");
+    }
+    switch_context context = { c->num_case_values, false };
+    switch_context* outer = c->current_switch;
+    c->current_switch = &context;
+    c->break_depth++;
+    check_statement(c, switch_stmt->body);
+    c->break_depth--;
+    c->current_switch = outer;
+
+    int* values = c->case_values + context.first_case;
+    size_t count = c->num_case_values - context.first_case;
+    qsort(values, count, sizeof(int), compare_case_values);
+    for (size_t i = 1; i < count; ++i) {
+        if (values[i] == values[i - 1]) {
+            fatal_error("Error: duplicate case value %d\n", values[i]);
+        }
+    }
+    c->num_case_values = context.first_case;
+}
+
+static void check_statement(checker* c, ast_node* node) {
+    if (node == NULL) {
+        return;
+    }
+    switch (node->type) {
+        case AST_VARIABLE_DECL:
+            check_variable_decl(c, (ast_variable_decl_node*)node);
+            break;
+        case AST_ASSIGNMENT: {
+            ast_assignment_node* assignment = (ast_assignment_node*)node;
+            const char* name = assignment->identifier_node->value;
+            binding* b = lookup(c, name);
+            if (b == NULL) {
+                fatal_error("Error: '%s' is not declared\n", name);
+            }
+            if (b->is_function) {
+                fatal_error("Error: cannot assign to function '%s'\n", name);
+            }
+            const c_type* target = b->type;
+            if (assignment->index != NULL) {
+                target = check_element(c, name, assignment->index);
+            } else if (target->kind == TYPE_ARRAY) {
+                fatal_error("Error: cannot assign to array '%s'\n", name);
+            }
+            if (target->qualifiers & TYPE_CONST) {
+                fatal_error("Error: cannot assign to const variable '%s'\n", name);
+            }
+            check_conversion(check_expression(c, assignment->value), target, "assignment");
+            break;
+        }
+        case AST_RETURN_STMT: {
+            ast_return_node* ret = (ast_return_node*)node;
+            if (c->function == NULL) {
+                fatal_error("Error: return outside of a function\n");
+            }
+            if (ret->expr == NULL) {
+                if (c->return_type->kind != TYPE_VOID) {
+                    fatal_error("Error: non-void function '%s' should return a value\n", c->function->function_name);
+                }
+                break;
+            }
+            const c_type* value = check_expression(c, ret->expr);
+            if (c->return_type->kind == TYPE_VOID) {
+                fatal_error("Error: void function '%s' should not return a value\n", c->function->function_name);
+            }
+            check_conversion(value, c->return_type, "return");
+            break;
+        }
+        case AST_BLOCK: {
+            ast_block_node* block = (ast_block_node*)node;
+            size_t mark = c->num_bindings;
+            c->depth++;
+            check_statements(c, block->declarations, block->num_declarations);
+            leave_scope(c, mark);
+            break;
+        }
+        case AST_CALL_EXPR:
+            check_expression(c, node);
+            break;
+        case AST_WHILE_STMT:
+        case AST_DO_WHILE_STMT:
+        case AST_FOR_STMT:
+            check_loop(c, (ast_loop_node*)node);
+            break;
+        case AST_SWITCH_STMT:
+            check_switch(c, (ast_switch_node*)node);
+            break;
+        case AST_CASE_LABEL:
+            check_case_label(c, (ast_case_node*)node);
+            break;
+        case AST_BREAK_STMT:
+            if (c->break_depth == 0) {
+                fatal_error("Error: break statement not within a loop or switch\n");
+            }
+            break;
+        case AST_CONTINUE_STMT:
+            if (c->loop_depth == 0) {
+                fatal_error("Error: continue statement not within a loop\n");
+            }
+            break;
+        case AST_FUNCTION_DECL:
+            fatal_error("Error: function '%s' defined inside another function\n",
+                        ((ast_function_decl_node*)node)->function_name);
+        default:
+            fatal_error("Error: Unexpected statement\n");
+    }
+}
+
+static void declare_function(checker* c, ast_function_decl_node* function) {
+    const c_type** params = counted_malloc(ALLOC_SYMBOLS, (function->num_parameters + 1) * sizeof(c_type*));
+    for (size_t i = 0; i < function->num_parameters; ++i) {
+        params[i] = variable_type(c, (ast_variable_decl_node*)function->parameters[i])->unqualified;
+    }
+    const c_type* return_type = builtin_c_type(c->types, function->return_type);
+    bind(c, function->function_name, function_type(c->types, return_type, params, function->num_parameters), true);
+    counted_free(ALLOC_SYMBOLS, params);
+}
+
+static void check_function(checker* c, ast_function_decl_node* function) {
+    const c_type* return_type = builtin_c_type(c->types, function->return_type);
+
+    // Parameters and the outermost block of the body share one scope.
+    size_t mark = c->num_bindings;
+    c->depth++;
+    c->function = function;
+    c->return_type = return_type;
+    for (size_t i = 0; i < function->num_parameters; ++i) {
+        ast_variable_decl_node* param = (ast_variable_decl_node*)function->parameters[i];
+        bind(c, param->identifier_node->value, variable_type(c, param), false);
+    }
+    if (function->body != NULL) {
+        check_statements(c, function->body->declarations, function->body->num_declarations);
+    }
+    c->function = NULL;
+    c->return_type = NULL;
+    leave_scope(c, mark);
+}
+
+void typecheck_program(type_table* types, ast_program_node* program) {
+    checker c = {0};
+    c.types = types;
+    c.num_slots = 64;
+    c.slots = counted_malloc(ALLOC_SYMBOLS, c.num_slots * sizeof(name_slot));
+    memset(c.slots, 0, c.num_slots * sizeof(name_slot));
+    c.max_bindings = 64;
+    c.bindings = counted_malloc(ALLOC_SYMBOLS, c.max_bindings * sizeof(binding));
+
+    // scc has no prototypes, so every function is in scope from the start of
+    // the file, which lets functions call each other in any order.
+    for (size_t i = 0; i < program->num_declarations; ++i) {
+        ast_node* decl = program->declarations[i];
+        if (decl != NULL && decl->type == AST_FUNCTION_DECL) {
+            declare_function(&c, (ast_function_decl_node*)decl);
+        }
+    }
+
+    for (size_t i = 0; i < program->num_declarations; ++i) {
+        ast_node* decl = program->declarations[i];
+        if (decl == NULL) {
+            continue;
+        }
+        switch (decl->type) {
+            case AST_FUNCTION_DECL:
+                check_function(&c, (ast_function_decl_node*)decl);
+                break;
+            case AST_VARIABLE_DECL:
+                check_variable_decl(&c, (ast_variable_decl_node*)decl);
+                break;
+            default:
+                fatal_error("Error: Unexpected declaration at file scope\n");
+        }
+    }
+
+    counted_free(ALLOC_SYMBOLS, c.slots);
+    counted_free(ALLOC_SYMBOLS, c.bindings);
+    counted_free(ALLOC_SYMBOLS, c.case_values);
+}
@@ -0,0 +1,12 @@
+#ifndef TYPECHECK_H
+#define TYPECHECK_H
+
+#include "ast.h"
+#include "types.h"
+
+// Checks program against C's rules for the subset scc accepts and sets the
+// value_type of every expression. Reports the first error through
+// fatal_error. Runs in time linear in the size of the program.
+void typecheck_program(type_table* types, ast_program_node* program);
+
+#endif // TYPECHECK_H
@@ -0,0 +1,170 @@
+#include "types.h"
+
+#include <string.h>
+#include "hash.h"
+
+// Types belong to the symbols of one compilation, so they are counted and
+// freed with them. In a key, unqualified is NULL for an unqualified type;
+// the interned type then points at itself.
+static c_type* intern(type_table* types, const c_type* key) {
+    uint64_t h = hash_combine((uint64_t)key->kind, key->qualifiers);
+    h = hash_combine(h, (uint64_t)(uintptr_t)key->base);
+    h = hash_combine(h, (uint64_t)(uintptr_t)key->unqualified);
+    h = hash_combine(h, key->length);
+    if (key->kind == TYPE_FUNCTION) {
+        for (size_t i = 0; i < key->length; ++i) {
+            h = hash_combine(h, (uint64_t)(uintptr_t)key->params[i]);
+        }
+    }
+
+    size_t index = h & (types->num_buckets - 1);
+    for (c_type* t = types->buckets[index]; t != NULL; t = t->next) {
+        if (t->hash == h && t->kind == key->kind && t->qualifiers == key->qualifiers && t->base == key->base &&
+            (t->unqualified == t ? NULL : t->unqualified) == key->unqualified && t->length == key->length &&
+            (key->kind != TYPE_FUNCTION ||
+             key->length == 0 || memcmp(t->params, key->params, key->length * sizeof(c_type*)) == 0)) {
+            return t;
+        }
+    }
+
+    c_type* t = counted_malloc(ALLOC_SYMBOLS, sizeof(c_type));
+    if (t == NULL) {
+        fatal_error("Error: Failed to allocate memory for a type!\n");
+    }
+    *t = *key;
+    t->hash = h;
+    if (key->kind == TYPE_FUNCTION && key->length > 0) {
+        t->params = counted_malloc(ALLOC_SYMBOLS, key->length * sizeof(c_type*));
+        memcpy(t->params, key->params, key->length * sizeof(c_type*));
+    }
+    if (t->unqualified == NULL) {
+        t->unqualified = t;
+    }
+
+    if (++types->num_types > types->num_buckets) {
+        size_t num_buckets = types->num_buckets * 2;
+        c_type** buckets = counted_malloc(ALLOC_SYMBOLS, num_buckets * sizeof(c_type*));
+        memset(buckets, 0, num_buckets * sizeof(c_type*));
+        for (size_t i = 0; i < types->num_buckets; ++i) {
+            c_type* next;
+            for (c_type* old = types->buckets[i]; old != NULL; old = next) {
+                next = old->next;
+                old->next = buckets[old->hash & (num_buckets - 1)];
+                buckets[old->hash & (num_buckets - 1)] = old;
+            }
+        }
+        counted_free(ALLOC_SYMBOLS, types->buckets);
+        types->buckets = buckets;
+        types->num_buckets = num_buckets;
+        index = h & (num_buckets - 1);
+    }
+    t->next = types->buckets[index];
+    types->buckets[index] = t;
+    return t;
+}
+
+static const c_type* scalar_type(type_table* types, type_kind kind, int size) {
+    c_type key = {.kind = kind, .size = size, .align = size};
+    return intern(types, &key);
+}
+
+type_table* create_type_table() {
+    type_table* types = counted_malloc(ALLOC_SYMBOLS, sizeof(type_table));
+    if (types == NULL) {
+        fatal_error("Error: Failed to allocate type table!\n");
+    }
+    types->num_buckets = 64;
+    types->num_types = 0;
+    types->buckets = counted_malloc(ALLOC_SYMBOLS, types->num_buckets * sizeof(c_type*));
+    memset(types->buckets, 0, types->num_buckets * sizeof(c_type*));
+    types->builtins[INT] = scalar_type(types, TYPE_INT, 4);
+    types->builtins[CHAR] = scalar_type(types, TYPE_CHAR, 1);
+    types->builtins[DOUBLE] = scalar_type(types, TYPE_DOUBLE, 8);
+    types->builtins[VOID] = scalar_type(types, TYPE_VOID, 0);
+    return types;
+}
+
+const c_type* builtin_c_type(type_table* types, builtin_types builtin) {
+    return types->builtins[builtin];
+}
+
+const c_type* pointer_type(type_table* types, const c_type* base) {
+    c_type key = {.kind = TYPE_POINTER, .size = 8, .align = 8, .base = base};
+    return intern(types, &key);
+}
+
+const c_type* array_type(type_table* types, const c_type* element, size_t length) {
+    c_type key = {.kind = TYPE_ARRAY, .size = element->size * (int)length, .align = element->align,
+                  .base = element, .length = length};
+    return intern(types, &key);
+}
+
+const c_type* function_type(type_table* types, const c_type* return_type, const c_type** params, size_t num_params) {
+    c_type key = {.kind = TYPE_FUNCTION, .align = 1, .base = return_type, .length = num_params, .params = params};
+    return intern(types, &key);
+}
+
+// Qualifiers accumulate: const applied to a volatile int is const volatile.
+const c_type* qualified_type(type_table* types, const c_type* base, unsigned qualifiers) {
+    qualifiers |= base->qualifiers;
+    const c_type* unqualified = base->unqualified;
+    if (qualifiers == 0) {
+        return unqualified;
+    }
+    c_type key = *unqualified;
+    key.qualifiers = qualifiers;
+    key.unqualified = unqualified;
+    key.next = NULL;
+    return intern(types, &key);
+}
+
+bool is_integer_type(const c_type* t) {
+    return t->kind == TYPE_CHAR || t->kind == TYPE_INT;
+}
+
+bool is_arithmetic_type(const c_type* t) {
+    return is_integer_type(t) || t->kind == TYPE_DOUBLE;
+}
+
+// C spelling read left to right: "const int", "int*", "char[4]", "int(int, char)".
+void print_c_type(const c_type* t, buffer* out) {
+    if (t->qualifiers & TYPE_CONST) {
+        buffer_puts(out, "const ");
+    }
+    if (t->qualifiers & TYPE_VOLATILE) {
+        buffer_puts(out, "volatile ");
+    }
+    switch (t->kind) {
+        case TYPE_VOID:
+            buffer_puts(out, "void");
+            break;
+        case TYPE_CHAR:
+            buffer_puts(out, "char");
+            break;
+        case TYPE_INT:
+            buffer_puts(out, "int");
+            break;
+        case TYPE_DOUBLE:
+            buffer_puts(out, "double");
+            break;
+        case TYPE_POINTER:
+            print_c_type(t->base, out);
+            buffer_putc(out, '*');
+            break;
+        case TYPE_ARRAY:
+            print_c_type(t->base, out);
+            buffer_printf(out, "[%zu]", t->length);
+            break;
+        case TYPE_FUNCTION:
+            print_c_type(t->base, out);
+            buffer_putc(out, '(');
+            for (size_t i = 0; i < t->length; ++i) {
+                if (i > 0) {
+                    buffer_puts(out, ", ");
+                }
+                print_c_type(t->params[i], out);
+            }
+            buffer_putc(out, ')');
+            break;
+    }
+}
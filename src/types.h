@@ -0,0 +1,57 @@
+#ifndef TYPES_H
+#define TYPES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "ast.h"
+#include "buffer.h"
+
+typedef enum {
+    TYPE_VOID,
+    TYPE_CHAR,
+    TYPE_INT,
+    TYPE_DOUBLE,
+    TYPE_POINTER,
+    TYPE_ARRAY,
+    TYPE_FUNCTION,
+} type_kind;
+
+#define TYPE_CONST    0x1
+#define TYPE_VOLATILE 0x2
+
+// A C type. Every type is built once per type table, so two types are the
+// same exactly when their pointers are equal. base is the pointee, the
+// element or the return type; a qualified type keeps its kind and points at
+// its unqualified version instead.
+typedef struct c_type {
+    type_kind kind;
+    unsigned qualifiers;
+    int size;
+    int align;
+    const struct c_type* base;
+    const struct c_type* unqualified;
+    size_t length;                  // array elements or parameter count
+    const struct c_type** params;
+    uint64_t hash;
+    struct c_type* next;            // bucket chain
+} c_type;
+
+typedef struct type_table {
+    c_type** buckets;
+    size_t num_buckets;
+    size_t num_types;
+    const c_type* builtins[VOID + 1];
+} type_table;
+
+type_table* create_type_table();
+const c_type* builtin_c_type(type_table* types, builtin_types builtin);
+const c_type* pointer_type(type_table* types, const c_type* base);
+const c_type* array_type(type_table* types, const c_type* element, size_t length);
+const c_type* function_type(type_table* types, const c_type* return_type, const c_type** params, size_t num_params);
+const c_type* qualified_type(type_table* types, const c_type* base, unsigned qualifiers);
+bool is_integer_type(const c_type* t);
+bool is_arithmetic_type(const c_type* t);
+void print_c_type(const c_type* t, buffer* out);
+
+#endif // TYPES_H
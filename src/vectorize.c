@@ -0,0 +1,641 @@
+#include "vectorize.h"
+#include "loops.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// What a value computed in the loop body looks like across the lanes.
+typedef enum value_shape {
+    SHAPE_UNKNOWN,              // not computed yet in this iteration
+    SHAPE_UNIFORM,              // the same in every lane
+    SHAPE_INDEX,                // the induction variable plus an offset
+    SHAPE_VECTOR,               // one value per lane
+    SHAPE_REDUCTION,            // a scalar the iterations add to
+} value_shape;
+
+// An element the body reads or writes, at the induction variable plus
+// offset. Accesses are kept in body order.
+typedef struct vector_access {
+    const char* symbol;
+    int offset;
+    bool is_store;
+} vector_access;
+
+// sum = sum + value (or - value), over length instructions from at.
+typedef struct vector_reduction {
+    size_t at;
+    size_t length;
+    int sum;
+    sir_operand value;
+    bool is_sub;
+} vector_reduction;
+
+// A scalar operand and the vreg that holds it in vector form.
+typedef struct vector_value {
+    sir_operand key;
+    int vreg;
+} vector_value;
+
+typedef struct vectorizer {
+    sir_function* fn;
+    sir_program* program;
+    int width;                  // bytes per vector
+    loop_info* info;
+    sir_loop* loop;
+    sir_block* latch;
+    int iv;
+    sir_operand bound;
+    size_t body_end;            // latch instructions before the increment
+    value_shape* shapes;
+    int* offsets;               // from the induction variable, for SHAPE_INDEX
+    int* loop_defs;
+    int* loop_uses;
+    bool* used_outside;
+    vector_access* accesses;
+    size_t num_accesses;
+    vector_reduction* reductions;
+    size_t num_reductions;
+    char reason[160];
+} vectorizer;
+
+const char* vector_target_name(vector_target target) {
+    switch (target) {
+        case VECTOR_SSE2: return "sse2";
+        case VECTOR_AVX2: return "avx2";
+        default: return "none";
+    }
+}
+
+static bool reject(vectorizer* v, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(v->reason, sizeof(v->reason), format, args);
+    va_end(args);
+    return false;
+}
+
+static const char* value_name(vectorizer* v, int vreg) {
+    const char* name = v->fn->vregs[vreg].name;
+    return name != NULL ? name : "a temporary";
+}
+
+static void count_operand(vectorizer* v, sir_operand operand, bool inside) {
+    if (operand.kind != SIR_OPERAND_VREG) {
+        return;
+    }
+    if (inside) {
+        v->loop_uses[operand.vreg]++;
+    } else {
+        v->used_outside[operand.vreg] = true;
+    }
+}
+
+static void count_uses(vectorizer* v) {
+    sir_function* fn = v->fn;
+    for (size_t i = 0; i < fn->num_blocks; ++i) {
+        bool inside = v->loop->contains[i];
+        sir_block* block = fn->blocks[i];
+        for (size_t j = 0; j < block->num_insts; ++j) {
+            sir_inst* inst = &block->insts[j];
+            if (inside && inst->dst >= 0) {
+                v->loop_defs[inst->dst]++;
+            }
+            count_operand(v, inst->a, inside);
+            count_operand(v, inst->b, inside);
+            for (size_t k = 0; k < inst->num_args; ++k) {
+                count_operand(v, inst->args[k], inside);
+            }
+        }
+    }
+}
+
+static bool is_increment(sir_inst* inst, int dst, int iv) {
+    if (inst->op != SIR_ADD || inst->dst != dst) {
+        return false;
+    }
+    return (inst->a.kind == SIR_OPERAND_VREG && inst->a.vreg == iv && inst->b.kind == SIR_OPERAND_IMM &&
+            inst->b.imm == 1) ||
+           (inst->b.kind == SIR_OPERAND_VREG && inst->b.vreg == iv && inst->a.kind == SIR_OPERAND_IMM &&
+            inst->a.imm == 1);
+}
+
+// The header tests i < n and the latch ends in i = i + 1 and a jump back.
+static bool match_counted_loop(vectorizer* v, size_t index) {
+    loop_info* info = v->info;
+    sir_loop* loop = v->loop;
+    for (size_t i = 0; i < info->num_loops; ++i) {
+        if (info->loops[i].parent == (int)index) {
+            return reject(v, "contains another loop");
+        }
+    }
+    sir_block* header = loop->header;
+    if (header->index == 0) {
+        return reject(v, "loop is the function entry");
+    }
+    if (loop->num_blocks != 2) {
+        return reject(v, "body has control flow");
+    }
+    sir_inst* test = &header->insts[0];
+    sir_inst* branch = sir_terminator(header);
+    if (header->num_insts != 2 || test->op != SIR_LT || test->a.kind != SIR_OPERAND_VREG || branch->op != SIR_BRANCH ||
+        branch->a.kind != SIR_OPERAND_VREG || branch->a.vreg != test->dst || branch->target == header ||
+        !loop->contains[branch->target->index] || v->loop_uses[test->dst] != 1 || v->used_outside[test->dst]) {
+        return reject(v, "exit test is not i < n");
+    }
+    v->latch = branch->target;
+    v->iv = test->a.vreg;
+    v->bound = test->b;
+    if (v->fn->vregs[v->iv].size != 4) {
+        return reject(v, "induction variable is not an int");
+    }
+    if (v->bound.kind == SIR_OPERAND_VREG && v->loop_defs[v->bound.vreg] > 0) {
+        return reject(v, "bound changes inside the loop");
+    }
+
+    sir_block* latch = v->latch;
+    size_t n = latch->num_insts - 1;
+    if (n >= 1 && is_increment(&latch->insts[n - 1], v->iv, v->iv)) {
+        v->body_end = n - 1;
+    } else if (n >= 2 && latch->insts[n - 2].dst >= 0 && is_increment(&latch->insts[n - 2], latch->insts[n - 2].dst, v->iv) &&
+               latch->insts[n - 1].op == SIR_COPY && latch->insts[n - 1].dst == v->iv &&
+               latch->insts[n - 1].a.kind == SIR_OPERAND_VREG && latch->insts[n - 1].a.vreg == latch->insts[n - 2].dst &&
+               v->loop_uses[latch->insts[n - 2].dst] == 1 && !v->used_outside[latch->insts[n - 2].dst]) {
+        v->body_end = n - 2;
+    } else {
+        return reject(v, "no unit-stride induction variable");
+    }
+    if (v->loop_defs[v->iv] != 1) {
+        return reject(v, "induction variable is assigned in the body");
+    }
+    v->shapes[v->iv] = SHAPE_INDEX;
+    v->offsets[v->iv] = 0;
+    return true;
+}
+
+static value_shape shape_of(vectorizer* v, sir_operand operand) {
+    if (operand.kind != SIR_OPERAND_VREG || v->loop_defs[operand.vreg] == 0) {
+        return SHAPE_UNIFORM;
+    }
+    return v->shapes[operand.vreg];
+}
+
+// A value the vector code can compute: uniform or one per lane.
+static bool check_value(vectorizer* v, sir_operand operand) {
+    switch (shape_of(v, operand)) {
+        case SHAPE_UNIFORM:
+        case SHAPE_VECTOR:
+            return true;
+        case SHAPE_INDEX:
+            return reject(v, "induction variable is used as a value");
+        case SHAPE_REDUCTION:
+            return reject(v, "running sum '%s' is read inside the loop", value_name(v, operand.vreg));
+        default:
+            return reject(v, "%s is carried from one iteration to the next", value_name(v, operand.vreg));
+    }
+}
+
+static bool define(vectorizer* v, int dst, value_shape shape, int offset) {
+    if (v->fn->vregs[dst].size != 4) {
+        return reject(v, "%s is not an int", value_name(v, dst));
+    }
+    if (v->loop_defs[dst] != 1) {
+        return reject(v, "%s is assigned more than once", value_name(v, dst));
+    }
+    if (v->used_outside[dst]) {
+        return reject(v, "%s is used after the loop", value_name(v, dst));
+    }
+    v->shapes[dst] = shape;
+    v->offsets[dst] = offset;
+    return true;
+}
+
+static bool check_access(vectorizer* v, sir_inst* inst) {
+    sir_global* global = find_sir_global(v->program, inst->symbol);
+    if (global == NULL || global->length == 0) {
+        return reject(v, "'%s' is not an array", inst->symbol);
+    }
+    if (global->size != 4) {
+        return reject(v, "'%s' has %d-byte elements", inst->symbol, global->size);
+    }
+    if (shape_of(v, inst->a) != SHAPE_INDEX) {
+        return reject(v, "'%s' is not indexed by the induction variable", inst->symbol);
+    }
+    vector_access* access = &v->accesses[v->num_accesses++];
+    access->symbol = inst->symbol;
+    access->offset = inst->a.vreg == v->iv ? 0 : v->offsets[inst->a.vreg];
+    access->is_store = inst->op == SIR_STORE_ELEM;
+    return true;
+}
+
+// sum = sum + x, or sum - x, either directly or through a temporary that is
+// then copied back. sum must be read nowhere else in the loop.
+static bool match_reduction(vectorizer* v, size_t at) {
+    sir_inst* inst = &v->latch->insts[at];
+    if (inst->op != SIR_ADD && inst->op != SIR_SUB) {
+        return false;
+    }
+    for (int side = 0; side < (inst->op == SIR_ADD ? 2 : 1); ++side) {
+        sir_operand sum = side == 0 ? inst->a : inst->b;
+        sir_operand value = side == 0 ? inst->b : inst->a;
+        if (sum.kind != SIR_OPERAND_VREG || sum.vreg == v->iv || v->loop_defs[sum.vreg] != 1 ||
+            v->loop_uses[sum.vreg] != 1 || v->shapes[sum.vreg] != SHAPE_UNKNOWN ||
+            v->fn->vregs[sum.vreg].size != 4) {
+            continue;
+        }
+        size_t length = 0;
+        if (inst->dst == sum.vreg) {
+            length = 1;
+        } else if (at + 1 < v->body_end) {
+            sir_inst* copy = &v->latch->insts[at + 1];
+            if (copy->op == SIR_COPY && copy->dst == sum.vreg && copy->a.kind == SIR_OPERAND_VREG &&
+                copy->a.vreg == inst->dst && v->loop_defs[inst->dst] == 1 && v->loop_uses[inst->dst] == 1 &&
+                !v->used_outside[inst->dst]) {
+                length = 2;
+            }
+        }
+        if (length == 0) {
+            continue;
+        }
+        vector_reduction* reduction = &v->reductions[v->num_reductions++];
+        reduction->at = at;
+        reduction->length = length;
+        reduction->sum = sum.vreg;
+        reduction->value = value;
+        reduction->is_sub = inst->op == SIR_SUB;
+        v->shapes[sum.vreg] = SHAPE_REDUCTION;
+        return true;
+    }
+    return false;
+}
+
+static bool classify_body(vectorizer* v) {
+    for (size_t j = 0; j < v->body_end; ++j) {
+        sir_inst* inst = &v->latch->insts[j];
+        switch (inst->op) {
+            case SIR_LOAD_ELEM:
+                if (!check_access(v, inst) || !define(v, inst->dst, SHAPE_VECTOR, 0)) {
+                    return false;
+                }
+                break;
+            case SIR_STORE_ELEM:
+                if (!check_access(v, inst) || !check_value(v, inst->b)) {
+                    return false;
+                }
+                break;
+            case SIR_ADD:
+            case SIR_SUB:
+            case SIR_MUL: {
+                if (match_reduction(v, j)) {
+                    vector_reduction* reduction = &v->reductions[v->num_reductions - 1];
+                    if (!check_value(v, reduction->value)) {
+                        return false;
+                    }
+                    j += reduction->length - 1;
+                    break;
+                }
+                // i + k and i - k stay indices.
+                value_shape a = shape_of(v, inst->a);
+                value_shape b = shape_of(v, inst->b);
+                if (a == SHAPE_INDEX && inst->b.kind == SIR_OPERAND_IMM && inst->op != SIR_MUL) {
+                    int offset = inst->a.vreg == v->iv ? 0 : v->offsets[inst->a.vreg];
+                    offset += inst->op == SIR_ADD ? inst->b.imm : -inst->b.imm;
+                    if (!define(v, inst->dst, SHAPE_INDEX, offset)) {
+                        return false;
+                    }
+                    break;
+                }
+                if (b == SHAPE_INDEX && inst->a.kind == SIR_OPERAND_IMM && inst->op == SIR_ADD) {
+                    int offset = (inst->b.vreg == v->iv ? 0 : v->offsets[inst->b.vreg]) + inst->a.imm;
+                    if (!define(v, inst->dst, SHAPE_INDEX, offset)) {
+                        return false;
+                    }
+                    break;
+                }
+                if (!check_value(v, inst->a) || !check_value(v, inst->b) || !define(v, inst->dst, SHAPE_VECTOR, 0)) {
+                    return false;
+                }
+                break;
+            }
+            case SIR_COPY:
+                if (shape_of(v, inst->a) == SHAPE_INDEX) {
+                    int offset = inst->a.vreg == v->iv ? 0 : v->offsets[inst->a.vreg];
+                    if (!define(v, inst->dst, SHAPE_INDEX, offset)) {
+                        return false;
+                    }
+                    break;
+                }
+                if (!check_value(v, inst->a) || !define(v, inst->dst, SHAPE_VECTOR, 0)) {
+                    return false;
+                }
+                break;
+            default:
+                return reject(v, "unsupported operation '%s'", sir_opcode_tostring(inst->op));
+        }
+    }
+    return true;
+}
+
+// All lanes of a vector load or store happen at once, in body order. A
+// store and a load of the same array only keep their scalar order when the
+// load reads no element a neighbouring lane of the store writes, or reads
+// it on the same side of the store as the scalar loop did.
+static bool check_dependences(vectorizer* v) {
+    int lanes = v->width / 4;
+    for (size_t s = 0; s < v->num_accesses; ++s) {
+        vector_access* store = &v->accesses[s];
+        if (!store->is_store) {
+            continue;
+        }
+        for (size_t k = 0; k < v->num_accesses; ++k) {
+            vector_access* other = &v->accesses[k];
+            if (k == s || strcmp(other->symbol, store->symbol) != 0) {
+                continue;
+            }
+            if (other->is_store) {
+                if (other->offset != store->offset) {
+                    return reject(v, "'%s' is stored at different offsets", store->symbol);
+                }
+                continue;
+            }
+            int distance = store->offset - other->offset;
+            int magnitude = distance < 0 ? -distance : distance;
+            bool ok = k < s ? (distance <= 0 || distance >= lanes) : (distance == 0 || magnitude >= lanes);
+            if (!ok) {
+                return reject(v, "'%s' is read %d element%s from where it is written", store->symbol, magnitude,
+                              magnitude == 1 ? "" : "s");
+            }
+        }
+    }
+    return true;
+}
+
+static bool plan_loop(vectorizer* v, size_t index) {
+    count_uses(v);
+    if (!match_counted_loop(v, index) || !classify_body(v) || !check_dependences(v)) {
+        return false;
+    }
+    return true;
+}
+
+static int find_value(vector_value* values, size_t count, sir_operand key) {
+    for (size_t i = 0; i < count; ++i) {
+        if (values[i].key.kind == key.kind && values[i].key.vreg == key.vreg && values[i].key.imm == key.imm) {
+            return values[i].vreg;
+        }
+    }
+    return -1;
+}
+
+typedef struct vector_builder {
+    vectorizer* v;
+    sir_block* prepare;
+    sir_block* body;
+    int* vectors;               // vector form of each vreg the body defines
+    vector_value* splats;       // made once, before the loop
+    size_t num_splats;
+    vector_value* indices;      // iv + k, made once per iteration
+    size_t num_indices;
+} vector_builder;
+
+static sir_operand vector_of(vector_builder* b, sir_operand operand) {
+    vectorizer* v = b->v;
+    if (shape_of(v, operand) == SHAPE_VECTOR) {
+        return sir_vreg_operand(b->vectors[operand.vreg]);
+    }
+    int vreg = find_value(b->splats, b->num_splats, operand);
+    if (vreg < 0) {
+        vreg = new_sir_vreg(v->fn, v->width, NULL);
+        sir_emit(b->prepare, SIR_VSPLAT, vreg, operand, sir_none());
+        b->splats[b->num_splats].key = operand;
+        b->splats[b->num_splats++].vreg = vreg;
+    }
+    return sir_vreg_operand(vreg);
+}
+
+static sir_operand index_of(vector_builder* b, sir_operand operand) {
+    vectorizer* v = b->v;
+    int offset = operand.vreg == v->iv ? 0 : v->offsets[operand.vreg];
+    if (offset == 0) {
+        return sir_vreg_operand(v->iv);
+    }
+    sir_operand key = sir_imm_operand(offset);
+    int vreg = find_value(b->indices, b->num_indices, key);
+    if (vreg < 0) {
+        vreg = new_sir_vreg(v->fn, 4, NULL);
+        sir_emit(b->body, SIR_ADD, vreg, sir_vreg_operand(v->iv), key);
+        b->indices[b->num_indices].key = key;
+        b->indices[b->num_indices++].vreg = vreg;
+    }
+    return sir_vreg_operand(vreg);
+}
+
+static sir_opcode vector_opcode(sir_opcode op) {
+    switch (op) {
+        case SIR_ADD: return SIR_VADD;
+        case SIR_SUB: return SIR_VSUB;
+        default: return SIR_VMUL;
+    }
+}
+
+// Puts the vector loop in front of the scalar one:
+//
+//   check:   limit = n - (lanes - 1); branch limit < n, prepare, header
+//   prepare: splats and zeroed sums
+//   vheader: branch i < limit, vbody, vexit
+//   vbody:   the body, lanes iterations at a time; i = i + lanes
+//   vexit:   sum = sum + the lanes of its vector; jump header
+//
+// The check skips the vector loop when n - (lanes - 1) would wrap.
+static sir_block* transform_loop(vectorizer* v) {
+    sir_function* fn = v->fn;
+    loop_info* info = v->info;
+    sir_block* header = v->loop->header;
+    int lanes = v->width / 4;
+    size_t num_vregs = fn->num_vregs;
+
+    int h = header->index;
+    sir_block** entries = malloc((size_t)(info->pred_start[h + 1] - info->pred_start[h] + 1) * sizeof(sir_block*));
+    size_t num_entries = 0;
+    for (int k = info->pred_start[h]; k < info->pred_start[h + 1]; ++k) {
+        if (!v->loop->contains[info->preds[k]]) {
+            entries[num_entries++] = fn->blocks[info->preds[k]];
+        }
+    }
+
+    size_t position = (size_t)(h < v->latch->index ? h : v->latch->index);
+    sir_block* check = insert_sir_block(fn, position);
+    sir_block* prepare = insert_sir_block(fn, position + 1);
+    sir_block* vheader = insert_sir_block(fn, position + 2);
+    sir_block* vbody = insert_sir_block(fn, position + 3);
+    sir_block* vexit = insert_sir_block(fn, position + 4);
+    for (size_t i = 0; i < num_entries; ++i) {
+        sir_redirect(sir_terminator(entries[i]), header, check);
+    }
+    free(entries);
+
+    int limit = new_sir_vreg(fn, 4, NULL);
+    int ok = new_sir_vreg(fn, 4, NULL);
+    sir_emit(check, SIR_SUB, limit, v->bound, sir_imm_operand(lanes - 1));
+    sir_emit(check, SIR_LT, ok, sir_vreg_operand(limit), v->bound);
+    sir_inst* branch = sir_emit(check, SIR_BRANCH, -1, sir_vreg_operand(ok), sir_none());
+    branch->target = prepare;
+    branch->other = header;
+
+    int more = new_sir_vreg(fn, 4, NULL);
+    sir_emit(vheader, SIR_LT, more, sir_vreg_operand(v->iv), sir_vreg_operand(limit));
+    branch = sir_emit(vheader, SIR_BRANCH, -1, sir_vreg_operand(more), sir_none());
+    branch->target = vbody;
+    branch->other = vexit;
+
+    vector_builder b = { v, prepare, vbody, NULL, NULL, 0, NULL, 0 };
+    b.vectors = malloc((num_vregs + 1) * sizeof(int));
+    b.splats = malloc((v->body_end + 1) * 2 * sizeof(vector_value));
+    b.indices = malloc((v->body_end + 1) * sizeof(vector_value));
+    int* sums = malloc((v->num_reductions + 1) * sizeof(int));
+    for (size_t r = 0; r < v->num_reductions; ++r) {
+        sums[r] = new_sir_vreg(fn, v->width, NULL);
+        sir_emit(prepare, SIR_VSPLAT, sums[r], sir_imm_operand(0), sir_none());
+    }
+
+    size_t next_reduction = 0;
+    for (size_t j = 0; j < v->body_end; ++j) {
+        if (next_reduction < v->num_reductions && v->reductions[next_reduction].at == j) {
+            vector_reduction* reduction = &v->reductions[next_reduction];
+            int sum = sums[next_reduction++];
+            sir_operand value = vector_of(&b, reduction->value);
+            sir_emit(vbody, reduction->is_sub ? SIR_VSUB : SIR_VADD, sum, sir_vreg_operand(sum), value);
+            j += reduction->length - 1;
+            continue;
+        }
+        sir_inst inst = v->latch->insts[j];
+        if (inst.dst >= 0 && v->shapes[inst.dst] == SHAPE_INDEX) {
+            continue;
+        }
+        switch (inst.op) {
+            case SIR_LOAD_ELEM: {
+                int dst = new_sir_vreg(fn, v->width, NULL);
+                sir_emit(vbody, SIR_VLOAD, dst, index_of(&b, inst.a), sir_none())->symbol = inst.symbol;
+                b.vectors[inst.dst] = dst;
+                break;
+            }
+            case SIR_STORE_ELEM: {
+                sir_operand index = index_of(&b, inst.a);
+                sir_emit(vbody, SIR_VSTORE, -1, index, vector_of(&b, inst.b))->symbol = inst.symbol;
+                break;
+            }
+            case SIR_COPY:
+                b.vectors[inst.dst] = vector_of(&b, inst.a).vreg;
+                break;
+            default: {
+                int dst = new_sir_vreg(fn, v->width, NULL);
+                sir_operand left = vector_of(&b, inst.a);
+                sir_operand right = vector_of(&b, inst.b);
+                sir_emit(vbody, vector_opcode(inst.op), dst, left, right);
+                b.vectors[inst.dst] = dst;
+                break;
+            }
+        }
+    }
+    sir_emit(vbody, SIR_ADD, v->iv, sir_vreg_operand(v->iv), sir_imm_operand(lanes));
+    sir_emit(vbody, SIR_JUMP, -1, sir_none(), sir_none())->target = vheader;
+    sir_emit(prepare, SIR_JUMP, -1, sir_none(), sir_none())->target = vheader;
+
+    // The partial sums already carry the sign of a subtracting reduction.
+    for (size_t r = 0; r < v->num_reductions; ++r) {
+        int total = new_sir_vreg(fn, 4, NULL);
+        int sum = v->reductions[r].sum;
+        sir_emit(vexit, SIR_VSUM, total, sir_vreg_operand(sums[r]), sir_none());
+        sir_emit(vexit, SIR_ADD, sum, sir_vreg_operand(sum), sir_vreg_operand(total));
+    }
+    sir_emit(vexit, SIR_JUMP, -1, sir_none(), sir_none())->target = header;
+
+    free(b.vectors);
+    free(b.splats);
+    free(b.indices);
+    free(sums);
+    return vheader;
+}
+
+static bool is_seen(sir_block** seen, size_t num_seen, sir_block* block) {
+    for (size_t i = 0; i < num_seen; ++i) {
+        if (seen[i] == block) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Each transformation adds blocks, so the loops are found again after it;
+// headers already looked at, the new vector loops' included, are skipped.
+size_t vectorize_sir_function(sir_program* program, sir_function* fn, const vectorize_options* options) {
+    if (options->target == VECTOR_NONE) {
+        return 0;
+    }
+    int width = options->target == VECTOR_AVX2 ? 32 : 16;
+    sir_block** seen = NULL;
+    size_t num_seen = 0;
+    size_t vectorized = 0;
+    for (;;) {
+        loop_info* info = analyze_loops(fn);
+        size_t index = 0;
+        while (index < info->num_loops && is_seen(seen, num_seen, info->loops[index].header)) {
+            index++;
+        }
+        if (index == info->num_loops) {
+            free_loop_info(info);
+            break;
+        }
+        sir_loop* loop = &info->loops[index];
+        seen = realloc(seen, (num_seen + 2) * sizeof(sir_block*));
+        seen[num_seen++] = loop->header;
+
+        size_t n = fn->num_vregs + 1;
+        size_t body_size = 0;
+        for (size_t i = 0; i < fn->num_blocks; ++i) {
+            body_size += loop->contains[i] ? fn->blocks[i]->num_insts : 0;
+        }
+        vectorizer v = { fn, program, width, info, loop, NULL, -1, sir_none(), 0, NULL, NULL, NULL, NULL, NULL,
+                         NULL, 0, NULL, 0, "" };
+        v.shapes = calloc(n, sizeof(value_shape));
+        v.offsets = calloc(n, sizeof(int));
+        v.loop_defs = calloc(n, sizeof(int));
+        v.loop_uses = calloc(n, sizeof(int));
+        v.used_outside = calloc(n, sizeof(bool));
+        v.accesses = malloc((body_size + 1) * sizeof(vector_access));
+        v.reductions = malloc((body_size + 1) * sizeof(vector_reduction));
+
+        int block = loop->header->index;
+        if (plan_loop(&v, index)) {
+            seen[num_seen++] = transform_loop(&v);
+            vectorized++;
+            if (options->report) {
+                buffer_printf(options->report, "vectorize: vectorized loop in %s (block %d): %d lanes, %s\n",
+                              fn->name, block, width / 4, vector_target_name(options->target));
+            }
+        } else if (options->report) {
+            buffer_printf(options->report, "vectorize: kept loop in %s (block %d) scalar: %s\n", fn->name, block,
+                          v.reason);
+        }
+
+        free(v.shapes);
+        free(v.offsets);
+        free(v.loop_defs);
+        free(v.loop_uses);
+        free(v.used_outside);
+        free(v.accesses);
+        free(v.reductions);
+        free_loop_info(info);
+    }
+    free(seen);
+    return vectorized;
+}
+
+size_t vectorize_program(sir_program* program, const vectorize_options* options) {
+    size_t vectorized = 0;
+    for (size_t i = 0; i < program->num_functions; ++i) {
+        vectorized += vectorize_sir_function(program, program->functions[i], options);
+    }
+    return vectorized;
+}
@@ -0,0 +1,34 @@
+#ifndef VECTORIZE_H
+#define VECTORIZE_H
+
+#include "buffer.h"
+#include "sir.h"
+
+typedef enum vector_target {
+    VECTOR_NONE,                // vectorizing is off
+    VECTOR_SSE2,                // 4 lanes, any x86-64
+    VECTOR_AVX2,                // 8 lanes
+} vector_target;
+
+#define VECTORIZE_DEFAULT_TARGET VECTOR_SSE2
+
+typedef struct vectorize_options {
+    vector_target target;
+    buffer* report;             // one line per loop considered, or NULL
+} vectorize_options;
+
+// Vectorizes innermost counted loops of the form
+//
+//   header: c = lt i, n; branch c, body, exit
+//   body:   ... i = i + 1; jump header
+//
+// whose body is straight-line int arithmetic over array elements indexed
+// by i plus a constant, and sums into scalars. The vector loop runs while
+// a whole vector of iterations is left and the scalar loop, kept as it
+// was, finishes the rest. Returns the number of loops vectorized.
+size_t vectorize_sir_function(sir_program* program, sir_function* fn, const vectorize_options* options);
+size_t vectorize_program(sir_program* program, const vectorize_options* options);
+
+const char* vector_target_name(vector_target target);
+
+#endif // VECTORIZE_H
@@ -0,0 +1,268 @@
+#include "bytecode.h"
+
+#include <limits.h>
+
+// Threaded dispatch: with GCC/Clang every handler jumps straight to the next
+// one through a table of label addresses; elsewhere the same handlers are
+// cases of a switch.
+#if defined(__GNUC__)
+#define VM_DISPATCH() goto *dispatch[ip->op]
+#define VM_CASE(op) label_##op:
+#else
+#define VM_DISPATCH() goto dispatch_switch
+#define VM_CASE(op) case op:
+#endif
+
+#define VM_NEXT() \
+    ip++;         \
+    VM_DISPATCH()
+
+// Arithmetic wraps like the native backend instead of being undefined.
+#define WRAP(expr) ((int)(unsigned int)(expr))
+
+// Bytecode calls nest on the C stack, one register file per frame, so the
+// depth is bounded well inside what a pool thread's stack can hold.
+#define VM_MAX_CALL_DEPTH 2000
+
+static SCC_THREAD_LOCAL int call_depth;
+
+static void vm_division_error(bc_function* fn) {
+    fatal_error("Error: division by zero or overflow in %s\n", fn->name);
+}
+
+static void vm_index_error(bc_function* fn, int index) {
+    fatal_error("Error: array index %d out of bounds in %s\n", index, fn->name);
+}
+
+static int switch_target(const bc_switch* table, int value) {
+    if (table->values == NULL) {
+        unsigned int index = (unsigned int)value - (unsigned int)table->low;
+        return index < table->length ? table->targets[index] : table->otherwise;
+    }
+    size_t low = 0;
+    size_t high = table->length;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (table->values[middle] < value) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low < table->length && table->values[low] == value ? table->targets[low] : table->otherwise;
+}
+
+int vm_execute(bc_program* bc, bc_function* fn) {
+    return vm_call(bc, fn, NULL, 0);
+}
+
+int vm_call(bc_program* bc, bc_function* fn, const int* args, int num_args) {
+    int r[256];
+    memset(r, 0, (size_t)fn->num_registers * sizeof(int));
+    if (num_args > 0) {
+        memcpy(r, args, (size_t)num_args * sizeof(int));
+    }
+    int* globals = bc->globals;
+    const bc_inst* ip = fn->code;
+
+#if defined(__GNUC__)
+    static void* dispatch[BC_NUM_OPCODES] = {
+        [BC_LOADK] = &&label_BC_LOADK,
+        [BC_MOVE] = &&label_BC_MOVE,
+        [BC_LOADG] = &&label_BC_LOADG,
+        [BC_STOREG] = &&label_BC_STOREG,
+        [BC_LOADX] = &&label_BC_LOADX,
+        [BC_STOREX] = &&label_BC_STOREX,
+        [BC_ADD] = &&label_BC_ADD,
+        [BC_SUB] = &&label_BC_SUB,
+        [BC_MUL] = &&label_BC_MUL,
+        [BC_DIV] = &&label_BC_DIV,
+        [BC_MOD] = &&label_BC_MOD,
+        [BC_EQ] = &&label_BC_EQ,
+        [BC_NE] = &&label_BC_NE,
+        [BC_LT] = &&label_BC_LT,
+        [BC_LE] = &&label_BC_LE,
+        [BC_NEG] = &&label_BC_NEG,
+        [BC_NOT] = &&label_BC_NOT,
+        [BC_TRUNC8] = &&label_BC_TRUNC8,
+        [BC_CALL] = &&label_BC_CALL,
+        [BC_RET] = &&label_BC_RET,
+        [BC_JMP] = &&label_BC_JMP,
+        [BC_JZ] = &&label_BC_JZ,
+        [BC_JNZ] = &&label_BC_JNZ,
+        [BC_SWITCH] = &&label_BC_SWITCH,
+        [BC_ADDK] = &&label_BC_ADDK,
+        [BC_SUBK] = &&label_BC_SUBK,
+        [BC_MULK] = &&label_BC_MULK,
+        [BC_ADD_STOREG] = &&label_BC_ADD_STOREG,
+        [BC_ADD_RET] = &&label_BC_ADD_RET,
+        [BC_RETK] = &&label_BC_RETK,
+    };
+    VM_DISPATCH();
+#else
+dispatch_switch:
+    switch (ip->op) {
+#endif
+
+    VM_CASE(BC_LOADK) {
+        r[ip->a] = ip->k;
+        VM_NEXT();
+    }
+    VM_CASE(BC_MOVE) {
+        r[ip->a] = r[ip->b];
+        VM_NEXT();
+    }
+    VM_CASE(BC_LOADG) {
+        r[ip->a] = globals[ip->k];
+        VM_NEXT();
+    }
+    VM_CASE(BC_STOREG) {
+        globals[ip->k] = r[ip->a];
+        VM_NEXT();
+    }
+    VM_CASE(BC_LOADX) {
+        int index = r[ip->b];
+        if ((unsigned int)index >= (unsigned int)bc->global_lengths[ip->k]) {
+            vm_index_error(fn, index);
+        }
+        r[ip->a] = globals[bc->global_slots[ip->k] + index];
+        VM_NEXT();
+    }
+    VM_CASE(BC_STOREX) {
+        int index = r[ip->b];
+        if ((unsigned int)index >= (unsigned int)bc->global_lengths[ip->k]) {
+            vm_index_error(fn, index);
+        }
+        globals[bc->global_slots[ip->k] + index] = r[ip->a];
+        VM_NEXT();
+    }
+    VM_CASE(BC_ADD) {
+        r[ip->a] = WRAP((unsigned int)r[ip->b] + (unsigned int)r[ip->c]);
+        VM_NEXT();
+    }
+    VM_CASE(BC_SUB) {
+        r[ip->a] = WRAP((unsigned int)r[ip->b] - (unsigned int)r[ip->c]);
+        VM_NEXT();
+    }
+    VM_CASE(BC_MUL) {
+        r[ip->a] = WRAP((unsigned int)r[ip->b] * (unsigned int)r[ip->c]);
+        VM_NEXT();
+    }
+    VM_CASE(BC_DIV) {
+        int divisor = r[ip->c];
+        if (divisor == 0 || (divisor == -1 && r[ip->b] == INT_MIN)) {
+            vm_division_error(fn);
+        }
+        r[ip->a] = r[ip->b] / divisor;
+        VM_NEXT();
+    }
+    VM_CASE(BC_MOD) {
+        int divisor = r[ip->c];
+        if (divisor == 0 || (divisor == -1 && r[ip->b] == INT_MIN)) {
+            vm_division_error(fn);
+        }
+        r[ip->a] = r[ip->b] % divisor;
+        VM_NEXT();
+    }
+    VM_CASE(BC_EQ) {
+        r[ip->a] = r[ip->b] == r[ip->c];
+        VM_NEXT();
+    }
+    VM_CASE(BC_NE) {
+        r[ip->a] = r[ip->b] != r[ip->c];
+        VM_NEXT();
+    }
+    VM_CASE(BC_LT) {
+        r[ip->a] = r[ip->b] < r[ip->c];
+        VM_NEXT();
+    }
+    VM_CASE(BC_LE) {
+        r[ip->a] = r[ip->b] <= r[ip->c];
+        VM_NEXT();
+    }
+    VM_CASE(BC_NEG) {
+        r[ip->a] = WRAP(0u - (unsigned int)r[ip->b]);
+        VM_NEXT();
+    }
+    VM_CASE(BC_NOT) {
+        r[ip->a] = !r[ip->b];
+        VM_NEXT();
+    }
+    VM_CASE(BC_TRUNC8) {
+        r[ip->a] = (signed char)r[ip->b];
+        VM_NEXT();
+    }
+    VM_CASE(BC_CALL) {
+        bc_function* callee = bc->functions[ip->k];
+        if (++call_depth > VM_MAX_CALL_DEPTH) {
+            fatal_error("Error: call depth exceeds %d in %s\n", VM_MAX_CALL_DEPTH, callee->name);
+        }
+        r[ip->a] = vm_call(bc, callee, &r[ip->b], ip->c);
+        call_depth--;
+        VM_NEXT();
+    }
+    VM_CASE(BC_RET) {
+        return r[ip->a];
+    }
+    VM_CASE(BC_JMP) {
+        ip = fn->code + ip->k;
+        VM_DISPATCH();
+    }
+    VM_CASE(BC_JZ) {
+        if (r[ip->a] == 0) {
+            ip = fn->code + ip->k;
+            VM_DISPATCH();
+        }
+        VM_NEXT();
+    }
+    VM_CASE(BC_JNZ) {
+        if (r[ip->a] != 0) {
+            ip = fn->code + ip->k;
+            VM_DISPATCH();
+        }
+        VM_NEXT();
+    }
+    VM_CASE(BC_SWITCH) {
+        ip = fn->code + switch_target(&fn->switches[ip->k], r[ip->a]);
+        VM_DISPATCH();
+    }
+    VM_CASE(BC_ADDK) {
+        r[ip->a] = WRAP((unsigned int)r[ip->b] + (unsigned int)ip->k);
+        VM_NEXT();
+    }
+    VM_CASE(BC_SUBK) {
+        r[ip->a] = WRAP((unsigned int)r[ip->b] - (unsigned int)ip->k);
+        VM_NEXT();
+    }
+    VM_CASE(BC_MULK) {
+        r[ip->a] = WRAP((unsigned int)r[ip->b] * (unsigned int)ip->k);
+        VM_NEXT();
+    }
+    VM_CASE(BC_ADD_STOREG) {
+        globals[ip->k] = WRAP((unsigned int)r[ip->b] + (unsigned int)r[ip->c]);
+        VM_NEXT();
+    }
+    VM_CASE(BC_ADD_RET) {
+        return WRAP((unsigned int)r[ip->b] + (unsigned int)r[ip->c]);
+    }
+    VM_CASE(BC_RETK) {
+        return ip->k;
+    }
+
+#if !defined(__GNUC__)
+    default:
+        break;
+    }
+#endif
+    fatal_error("Error: invalid bytecode in %s\n", fn->name);
+}
+
+int vm_run_main(bc_program* bc) {
+    bc_function* fn = find_bc_function(bc, "main");
+    if (fn == NULL) {
+        fatal_error("Error: bytecode has no 'main' function\n");
+    }
+    // A fatal error unwinds past the frames without counting them back out.
+    call_depth = 0;
+    return vm_execute(bc, fn);
+}
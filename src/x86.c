@@ -0,0 +1,432 @@
+#include "x86.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compat.h"
+#include "diagnostics.h"
+
+x86_operand x86_none() {
+    x86_operand operand = { OPERAND_NONE, 0, REG_RAX, 0, NULL, REG_RAX, 0 };
+    return operand;
+}
+
+x86_operand x86_reg_operand(x86_reg reg, int size) {
+    x86_operand operand = { OPERAND_REG, size, reg, 0, NULL, REG_RAX, 0 };
+    return operand;
+}
+
+x86_operand x86_imm_operand(long long imm, int size) {
+    x86_operand operand = { OPERAND_IMM, size, REG_RAX, imm, NULL, REG_RAX, 0 };
+    return operand;
+}
+
+x86_operand x86_mem_operand(x86_reg base, long long disp, int size) {
+    x86_operand operand = { OPERAND_MEM, size, base, disp, NULL, REG_RAX, 0 };
+    return operand;
+}
+
+x86_operand x86_index_operand(x86_reg base, x86_reg index, int scale, int size) {
+    x86_operand operand = { OPERAND_MEM, size, base, 0, NULL, index, scale };
+    return operand;
+}
+
+x86_operand x86_vec_operand(int reg, int size) {
+    x86_operand operand = { OPERAND_VEC, size, (x86_reg)reg, 0, NULL, REG_RAX, 0 };
+    return operand;
+}
+
+x86_operand x86_label_operand(int label) {
+    x86_operand operand = { OPERAND_LABEL, 0, REG_RAX, label, NULL, REG_RAX, 0 };
+    return operand;
+}
+
+x86_operand x86_symbol_operand(const char* symbol, int size) {
+    x86_operand operand = { OPERAND_SYMBOL, size, REG_RAX, 0, symbol, REG_RAX, 0 };
+    return operand;
+}
+
+x86_module* create_x86_module() {
+    x86_module* m = malloc(sizeof(x86_module));
+    m->functions = NULL;
+    m->num_functions = 0;
+    m->globals = NULL;
+    m->num_globals = 0;
+    return m;
+}
+
+x86_function* create_x86_function(const char* name) {
+    x86_function* fn = malloc(sizeof(x86_function));
+    fn->name = _strdup(name);
+    fn->max_insts = 64;
+    fn->num_insts = 0;
+    fn->insts = malloc(fn->max_insts * sizeof(x86_inst));
+    fn->num_labels = 0;
+    if (fn->insts == NULL) {
+        fatal_error("Error: Failed to allocate instructions for %s!\n", name);
+    }
+    return fn;
+}
+
+void add_x86_function(x86_module* m, x86_function* fn) {
+    m->functions = realloc(m->functions, (m->num_functions + 1) * sizeof(x86_function*));
+    m->functions[m->num_functions++] = fn;
+}
+
+void add_x86_global(x86_module* m, const char* name, int size, long long value, bool is_const) {
+    m->globals = realloc(m->globals, (m->num_globals + 1) * sizeof(x86_global));
+    x86_global* global = &m->globals[m->num_globals++];
+    global->name = _strdup(name);
+    global->size = size;
+    global->length = 0;
+    global->value = value;
+    global->is_const = is_const;
+}
+
+void add_x86_array(x86_module* m, const char* name, int size, size_t length, bool is_const) {
+    add_x86_global(m, name, size, 0, is_const);
+    m->globals[m->num_globals - 1].length = length;
+}
+
+x86_global* find_x86_global(x86_module* m, const char* name) {
+    for (size_t i = 0; i < m->num_globals; ++i) {
+        if (strcmp(m->globals[i].name, name) == 0) {
+            return &m->globals[i];
+        }
+    }
+    return NULL;
+}
+
+void free_x86_module(x86_module* m) {
+    for (size_t i = 0; i < m->num_functions; ++i) {
+        free(m->functions[i]->name);
+        free(m->functions[i]->insts);
+        free(m->functions[i]);
+    }
+    for (size_t i = 0; i < m->num_globals; ++i) {
+        free(m->globals[i].name);
+    }
+    free(m->functions);
+    free(m->globals);
+    free(m);
+}
+
+int x86_new_label(x86_function* fn) {
+    return fn->num_labels++;
+}
+
+size_t x86_emit(x86_function* fn, x86_opcode op, x86_operand dst, x86_operand src) {
+    if (fn->num_insts == fn->max_insts) {
+        fn->max_insts *= 2;
+        fn->insts = realloc(fn->insts, fn->max_insts * sizeof(x86_inst));
+        if (fn->insts == NULL) {
+            fatal_error("Error: Failed to grow instructions for %s!\n", fn->name);
+        }
+    }
+
+    x86_inst* inst = &fn->insts[fn->num_insts];
+    inst->op = op;
+    inst->cond = CC_E;
+    inst->dst = dst;
+    inst->src = src;
+    return fn->num_insts++;
+}
+
+size_t x86_emit_cc(x86_function* fn, x86_opcode op, x86_cond cond, x86_operand dst) {
+    size_t index = x86_emit(fn, op, dst, x86_none());
+    fn->insts[index].cond = cond;
+    return index;
+}
+
+void x86_emit_label(x86_function* fn, int label) {
+    x86_emit(fn, X86_LABEL, x86_label_operand(label), x86_none());
+}
+
+const char* x86_reg_name(x86_reg reg, int size) {
+    static const char* names64[] = { "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+                                     "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15" };
+    static const char* names32[] = { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+                                     "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d" };
+    static const char* names16[] = { "ax", "cx", "dx", "bx", "sp", "bp", "si", "di",
+                                     "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w" };
+    static const char* names8[] = { "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+                                    "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b" };
+    switch (size) {
+        case 1:
+            return names8[reg];
+        case 2:
+            return names16[reg];
+        case 4:
+            return names32[reg];
+        default:
+            return names64[reg];
+    }
+}
+
+static char size_suffix(int size) {
+    switch (size) {
+        case 1:
+            return 'b';
+        case 2:
+            return 'w';
+        case 4:
+            return 'l';
+        default:
+            return 'q';
+    }
+}
+
+static const char* cond_name(x86_cond cond) {
+    switch (cond) {
+        case CC_B:
+            return "b";
+        case CC_AE:
+            return "ae";
+        case CC_E:
+            return "e";
+        case CC_NE:
+            return "ne";
+        case CC_L:
+            return "l";
+        case CC_GE:
+            return "ge";
+        case CC_LE:
+            return "le";
+        case CC_G:
+            return "g";
+    }
+    return "?";
+}
+
+static void write_operand(buffer* out, x86_function* fn, x86_operand operand) {
+    switch (operand.kind) {
+        case OPERAND_REG:
+            buffer_printf(out, "%%%s", x86_reg_name(operand.reg, operand.size));
+            break;
+        case OPERAND_IMM:
+            buffer_printf(out, "$%lld", operand.imm);
+            break;
+        case OPERAND_MEM:
+            if (operand.imm != 0) {
+                buffer_printf(out, "%lld", operand.imm);
+            }
+            if (operand.scale != 0) {
+                buffer_printf(out, "(%%%s,%%%s,%d)", x86_reg_name(operand.reg, 8), x86_reg_name(operand.index, 8),
+                              operand.scale);
+            } else {
+                buffer_printf(out, "(%%%s)", x86_reg_name(operand.reg, 8));
+            }
+            break;
+        case OPERAND_VEC:
+            buffer_printf(out, "%%%cmm%d", operand.size == 32 ? 'y' : 'x', (int)operand.reg);
+            break;
+        case OPERAND_LABEL:
+            buffer_printf(out, ".L%s.%lld", fn->name, operand.imm);
+            break;
+        case OPERAND_SYMBOL:
+            buffer_printf(out, "%s(%%rip)", operand.symbol);
+            break;
+        case OPERAND_NONE:
+            break;
+    }
+}
+
+static void write_binary(buffer* out, x86_function* fn, const char* mnemonic, x86_inst* inst) {
+    int size = inst->dst.kind == OPERAND_REG ? inst->dst.size : inst->src.size;
+    if (size == 0) {
+        size = inst->dst.size;
+    }
+    buffer_printf(out, "\t%s%c\t", mnemonic, size_suffix(size));
+    write_operand(out, fn, inst->src);
+    buffer_puts(out, ", ");
+    write_operand(out, fn, inst->dst);
+    buffer_putc(out, '\n');
+}
+
+// SSE forms are two-operand; the AVX2 forms repeat dst as the first source.
+static void write_vector(buffer* out, x86_function* fn, const char* mnemonic, x86_inst* inst) {
+    bool is_avx = inst->dst.size == 32 || inst->src.size == 32;
+    buffer_printf(out, "\t%s%s\t", is_avx ? "v" : "", mnemonic);
+    write_operand(out, fn, inst->src);
+    buffer_puts(out, ", ");
+    if (is_avx && inst->op != X86_MOVDQU) {
+        write_operand(out, fn, inst->dst);
+        buffer_puts(out, ", ");
+    }
+    write_operand(out, fn, inst->dst);
+    buffer_putc(out, '\n');
+}
+
+static void write_unary(buffer* out, x86_function* fn, const char* mnemonic, x86_operand operand) {
+    buffer_printf(out, "\t%s%c\t", mnemonic, size_suffix(operand.size));
+    write_operand(out, fn, operand);
+    buffer_putc(out, '\n');
+}
+
+static void write_inst(buffer* out, x86_function* fn, x86_inst* inst) {
+    switch (inst->op) {
+        case X86_LABEL:
+            buffer_printf(out, ".L%s.%lld:\n", fn->name, inst->dst.imm);
+            break;
+        case X86_MOV:
+            write_binary(out, fn, "mov", inst);
+            break;
+        case X86_MOVSX:
+        case X86_MOVZX:
+            buffer_printf(out, "\tmov%c%c%c\t", inst->op == X86_MOVSX ? 's' : 'z',
+                          size_suffix(inst->src.size), size_suffix(inst->dst.size));
+            write_operand(out, fn, inst->src);
+            buffer_puts(out, ", ");
+            write_operand(out, fn, inst->dst);
+            buffer_putc(out, '\n');
+            break;
+        case X86_ADD:
+            write_binary(out, fn, "add", inst);
+            break;
+        case X86_SUB:
+            write_binary(out, fn, "sub", inst);
+            break;
+        case X86_IMUL:
+            write_binary(out, fn, "imul", inst);
+            break;
+        case X86_SHL:
+            write_binary(out, fn, "shl", inst);
+            break;
+        case X86_SAR:
+            write_binary(out, fn, "sar", inst);
+            break;
+        case X86_SHR:
+            write_binary(out, fn, "shr", inst);
+            break;
+        case X86_XOR:
+            write_binary(out, fn, "xor", inst);
+            break;
+        case X86_CMP:
+            write_binary(out, fn, "cmp", inst);
+            break;
+        case X86_BT:
+            write_binary(out, fn, "bt", inst);
+            break;
+        case X86_IDIV:
+            write_unary(out, fn, "idiv", inst->dst);
+            break;
+        case X86_NEG:
+            write_unary(out, fn, "neg", inst->dst);
+            break;
+        case X86_CDQ:
+            buffer_puts(out, inst->dst.size == 8 ? "\tcqto\n" : "\tcltd\n");
+            break;
+        case X86_SETCC:
+            buffer_printf(out, "\tset%s\t", cond_name(inst->cond));
+            write_operand(out, fn, inst->dst);
+            buffer_putc(out, '\n');
+            break;
+        case X86_JMP:
+            if (inst->dst.kind == OPERAND_SYMBOL) {
+                buffer_printf(out, "\tjmp\t%s\n", inst->dst.symbol);
+                break;
+            }
+            buffer_puts(out, inst->dst.kind == OPERAND_REG ? "\tjmp\t*" : "\tjmp\t");
+            write_operand(out, fn, inst->dst);
+            buffer_putc(out, '\n');
+            break;
+        case X86_JCC:
+            buffer_printf(out, "\tj%s\t", cond_name(inst->cond));
+            write_operand(out, fn, inst->dst);
+            buffer_putc(out, '\n');
+            break;
+        case X86_PUSH:
+            write_unary(out, fn, "push", inst->dst);
+            break;
+        case X86_POP:
+            write_unary(out, fn, "pop", inst->dst);
+            break;
+        case X86_CALL:
+            buffer_printf(out, "\tcall\t%s\n", inst->dst.symbol);
+            break;
+        case X86_RET:
+            buffer_puts(out, "\tret\n");
+            break;
+        case X86_LEA:
+            if (inst->src.kind == OPERAND_LABEL) {
+                buffer_printf(out, "\tleaq\t.L%s.%lld(%%rip), ", fn->name, inst->src.imm);
+                write_operand(out, fn, inst->dst);
+                buffer_putc(out, '\n');
+                break;
+            }
+            write_binary(out, fn, "lea", inst);
+            break;
+        case X86_TABLE_ENTRY:
+            buffer_printf(out, "\t.long\t.L%s.%lld-.L%s.%lld\n", fn->name, inst->dst.imm, fn->name, inst->src.imm);
+            break;
+        case X86_MOVDQU:
+            write_vector(out, fn, "movdqu", inst);
+            break;
+        case X86_PADDD:
+            write_vector(out, fn, "paddd", inst);
+            break;
+        case X86_PSUBD:
+            write_vector(out, fn, "psubd", inst);
+            break;
+        case X86_PMULLD:
+            write_vector(out, fn, "pmulld", inst);
+            break;
+        case X86_PMULUDQ:
+            write_vector(out, fn, "pmuludq", inst);
+            break;
+        case X86_PSLLQ:
+            write_vector(out, fn, "psllq", inst);
+            break;
+        case X86_PSRLQ:
+            write_vector(out, fn, "psrlq", inst);
+            break;
+        case X86_POR:
+            write_vector(out, fn, "por", inst);
+            break;
+        case X86_VZEROUPPER:
+            buffer_puts(out, "\tvzeroupper\n");
+            break;
+    }
+}
+
+// Arrays are aligned for vector loads and stores.
+static void write_global(buffer* out, x86_global* global) {
+    static const char* directives[] = { NULL, ".byte", ".short", NULL, ".long", NULL, NULL, NULL, ".quad" };
+    if (global->length > 0) {
+        size_t size = global->length * (size_t)global->size;
+        buffer_printf(out, "\t.globl\t%s\n\t.type\t%s, @object\n\t.size\t%s, %zu\n\t.align\t16\n",
+                      global->name, global->name, global->name, size);
+        buffer_printf(out, "%s:\n\t.zero\t%zu\n", global->name, size);
+        return;
+    }
+    buffer_printf(out, "\t.globl\t%s\n\t.type\t%s, @object\n\t.size\t%s, %d\n\t.align\t%d\n",
+                  global->name, global->name, global->name, global->size, global->size);
+    buffer_printf(out, "%s:\n\t%s\t%lld\n", global->name, directives[global->size], global->value);
+}
+
+void x86_write_asm(x86_module* m, buffer* out) {
+    for (int is_const = 0; is_const <= 1; ++is_const) {
+        bool section_started = false;
+        for (size_t i = 0; i < m->num_globals; ++i) {
+            if (m->globals[i].is_const != is_const) {
+                continue;
+            }
+            if (!section_started) {
+                buffer_puts(out, is_const ? "\t.section\t.rodata\n" : "\t.data\n");
+                section_started = true;
+            }
+            write_global(out, &m->globals[i]);
+        }
+    }
+
+    buffer_puts(out, "\t.text\n");
+    for (size_t i = 0; i < m->num_functions; ++i) {
+        x86_function* fn = m->functions[i];
+        buffer_printf(out, "\t.globl\t%s\n\t.type\t%s, @function\n%s:\n", fn->name, fn->name, fn->name);
+        for (size_t j = 0; j < fn->num_insts; ++j) {
+            write_inst(out, fn, &fn->insts[j]);
+        }
+        buffer_printf(out, "\t.size\t%s, .-%s\n", fn->name, fn->name);
+    }
+    buffer_puts(out, "\t.section\t.note.GNU-stack,\"\",@progbits\n");
+}
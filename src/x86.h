@@ -0,0 +1,154 @@
+#ifndef X86_H
+#define X86_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "buffer.h"
+
+// Registers in hardware encoding order.
+typedef enum {
+    REG_RAX,
+    REG_RCX,
+    REG_RDX,
+    REG_RBX,
+    REG_RSP,
+    REG_RBP,
+    REG_RSI,
+    REG_RDI,
+    REG_R8,
+    REG_R9,
+    REG_R10,
+    REG_R11,
+    REG_R12,
+    REG_R13,
+    REG_R14,
+    REG_R15,
+} x86_reg;
+
+// Condition codes, valued as the low nibble of the Jcc/SETcc opcodes.
+typedef enum {
+    CC_B = 0x2,         // unsigned below, or the carry bt leaves
+    CC_AE = 0x3,
+    CC_E = 0x4,
+    CC_NE = 0x5,
+    CC_L = 0xC,
+    CC_GE = 0xD,
+    CC_LE = 0xE,
+    CC_G = 0xF,
+} x86_cond;
+
+typedef enum {
+    OPERAND_NONE,
+    OPERAND_REG,
+    OPERAND_IMM,
+    OPERAND_MEM,    // imm(reg), or imm(reg,index,scale) when scale is not 0
+    OPERAND_LABEL,  // function-local jump target, imm is the label id
+    OPERAND_SYMBOL, // global symbol: call target, or symbol(%rip) data access
+    OPERAND_VEC,    // vector register, reg is its number: %xmm for 16 bytes, %ymm for 32
+} x86_operand_kind;
+
+typedef struct x86_operand {
+    x86_operand_kind kind;
+    int size;           // 1, 4 or 8 bytes, or 16 or 32 for vectors
+    x86_reg reg;
+    long long imm;
+    const char* symbol;
+    x86_reg index;
+    int scale;
+} x86_operand;
+
+typedef enum {
+    X86_LABEL,          // pseudo-instruction, defines label dst.imm
+    X86_MOV,
+    X86_MOVSX,          // sign-extending load, e.g. movsbl
+    X86_MOVZX,          // zero-extending load, e.g. movzbl
+    X86_ADD,
+    X86_SUB,
+    X86_IMUL,
+    X86_IDIV,
+    X86_CDQ,
+    X86_NEG,
+    X86_SHL,            // src is an immediate count or %cl
+    X86_SAR,
+    X86_SHR,
+    X86_XOR,
+    X86_CMP,
+    X86_BT,             // carry = bit src of dst
+    X86_SETCC,
+    X86_JMP,            // to a label, indirect through a register, or a tail call to a symbol
+    X86_JCC,
+    X86_PUSH,
+    X86_POP,
+    X86_CALL,
+    X86_RET,
+    X86_LEA,            // src may be a label, addressed %rip-relative
+    X86_TABLE_ENTRY,    // pseudo-instruction, 4-byte offset of label dst from label src
+    // Vector instructions work on 4-byte lanes. With 32-byte operands they
+    // are encoded as their AVX2 forms, with dst as the first source.
+    X86_MOVDQU,
+    X86_PADDD,
+    X86_PSUBD,
+    X86_PMULLD,         // AVX2 only
+    X86_PMULUDQ,
+    X86_PSLLQ,          // src is an immediate shift count
+    X86_PSRLQ,
+    X86_POR,
+    X86_VZEROUPPER,
+} x86_opcode;
+
+typedef struct x86_inst {
+    x86_opcode op;
+    x86_cond cond;
+    x86_operand dst;
+    x86_operand src;
+} x86_inst;
+
+typedef struct x86_function {
+    char* name;
+    x86_inst* insts;
+    size_t num_insts;
+    size_t max_insts;
+    int num_labels;
+} x86_function;
+
+typedef struct x86_global {
+    char* name;
+    int size;
+    size_t length;      // elements of an all-zero array, 0 for a scalar
+    long long value;
+    bool is_const;      // placed in .rodata instead of .data
+} x86_global;
+
+typedef struct x86_module {
+    x86_function** functions;
+    size_t num_functions;
+    x86_global* globals;
+    size_t num_globals;
+} x86_module;
+
+x86_operand x86_none();
+x86_operand x86_reg_operand(x86_reg reg, int size);
+x86_operand x86_imm_operand(long long imm, int size);
+x86_operand x86_mem_operand(x86_reg base, long long disp, int size);
+x86_operand x86_index_operand(x86_reg base, x86_reg index, int scale, int size);
+x86_operand x86_vec_operand(int reg, int size);
+x86_operand x86_label_operand(int label);
+x86_operand x86_symbol_operand(const char* symbol, int size);
+
+x86_module* create_x86_module();
+x86_function* create_x86_function(const char* name);
+void add_x86_function(x86_module* m, x86_function* fn);
+void add_x86_global(x86_module* m, const char* name, int size, long long value, bool is_const);
+void add_x86_array(x86_module* m, const char* name, int size, size_t length, bool is_const);
+x86_global* find_x86_global(x86_module* m, const char* name);
+void free_x86_module(x86_module* m);
+
+int x86_new_label(x86_function* fn);
+size_t x86_emit(x86_function* fn, x86_opcode op, x86_operand dst, x86_operand src);
+size_t x86_emit_cc(x86_function* fn, x86_opcode op, x86_cond cond, x86_operand dst);
+void x86_emit_label(x86_function* fn, int label);
+
+const char* x86_reg_name(x86_reg reg, int size);
+void x86_write_asm(x86_module* m, buffer* out);
+
+#endif // X86_H
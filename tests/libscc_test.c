@@ -0,0 +1,254 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <malloc.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "driver.h"
+#include "scc.h"
+
+// Compiles and runs small programs through libscc and checks what main
+// returns, then checks that libscc and the scc binary turn the same source
+// into the same assembly. Each case is a regression for a specific bug.
+// Checks that need the compiler's internals go through the driver.
+//
+//   scc_libscc_test path/to/scc
+
+extern char** environ;
+
+typedef struct run_case {
+    const char* name;
+    const char* source;
+    int exit_code;
+    size_t max_asm_size;        // 0 for no limit on the assembly
+} run_case;
+
+static const run_case run_cases[] = {
+    // k is too large to inline into h, so inlining h into main clones a call
+    // with no arguments, whose empty argument array must not be shared.
+    {"inline_zero_arg_call",
+     "int g = 3;\n"
+     "int k() { int s = 1; s = s * g + 0; s = s * g + 1; s = s * g + 2; s = s * g + 3; s = s * g + 4;"
+     " s = s * g + 5; s = s * g + 6; s = s * g + 7; s = s * g + 8; s = s * g + 9; s = s * g + 10;"
+     " s = s * g + 11; s = s * g + 12; s = s * g + 13; s = s * g + 14; s = s * g + 15; s = s * g + 16;"
+     " s = s * g + 17; s = s * g + 18; s = s * g + 19; s = s * g + 20; s = s * g + 21; s = s * g + 22;"
+     " s = s * g + 23; s = s * g + 24; s = s * g + 25; s = s * g + 26; s = s * g + 27; s = s * g + 28;"
+     " s = s * g + 29; return s % 100; }\n"
+     "int h(int x) { return k() + x; }\n"
+     "int main() { return h(4); }\n",
+     88, 0},
+    // down calls itself, so inlining it into main would only bring the
+    // recursive call along to be inlined again.
+    {"inline_recursive_callee",
+     "int g = 10;\n"
+     "int down(int n) { while (n > 0) { return down(n - 1) + 1; } return 0; }\n"
+     "int main() { return down(g); }\n",
+     10, 2048},
+};
+
+// Sources whose code depends on a pass the command line runs by default,
+// so that libscc starting from other defaults shows up as a difference.
+static const char* const asm_cases[] = {
+    // gvn: the second a * b + 3 is the first one's value.
+    "int g;\n"
+    "int f(int a, int b) { g = a * b + 3; return (a * b + 3) * (a - b); }\n"
+    "int main() { return f(5, 2); }\n",
+    // simplify: x / 7 becomes a multiply and x * 8 a shift.
+    "int f(int x) { return x / 7 + x * 8; }\n"
+    "int main() { return f(50); }\n",
+};
+
+static char* read_file(const char* path, size_t* size) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *size = (size_t)ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* data = malloc(*size + 1);
+    if (fread(data, 1, *size, f) != *size) {
+        fclose(f);
+        free(data);
+        return NULL;
+    }
+    data[*size] = '\0';
+    fclose(f);
+    return data;
+}
+
+// Runs scc -S on file with stdout redirected to out_path.
+static int spawn_compiler(const char* scc, const char* file, const char* out_path) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 1, out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    char* argv[] = {(char*)scc, "-S", (char*)file, NULL};
+    pid_t pid;
+    int status = posix_spawn(&pid, scc, &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (status != 0) {
+        return -1;
+    }
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)) {
+        return -1;
+    }
+    return WEXITSTATUS(status);
+}
+
+static int check_asm(scc_context* ctx, const char* scc, const char* source) {
+    char source_path[] = "/tmp/scc_libscc_test_XXXXXX.c";
+    char out_path[] = "/tmp/scc_libscc_test_XXXXXX";
+    int source_fd = mkstemps(source_path, 2);
+    int out_fd = mkstemp(out_path);
+    if (source_fd < 0 || out_fd < 0) {
+        fprintf(stderr, "Error: cannot create temporary files\n");
+        return 1;
+    }
+    size_t size = strlen(source);
+    int failed = write(source_fd, source, size) != (ssize_t)size;
+    close(source_fd);
+    close(out_fd);
+
+    scc_result result;
+    scc_compile(ctx, source_path, source, size, SCC_MODE_ASM, &result);
+    size_t cli_size = 0;
+    char* cli_output = NULL;
+    if (!failed && result.status == 0 && spawn_compiler(scc, source_path, out_path) == 0) {
+        cli_output = read_file(out_path, &cli_size);
+    }
+    if (cli_output == NULL || cli_size != result.output_size || memcmp(cli_output, result.output, cli_size) != 0) {
+        fprintf(stderr, "library and command line outputs differ for:\n%s", source);
+        failed = 1;
+    }
+    free(cli_output);
+    scc_free_result(&result);
+    unlink(source_path);
+    unlink(out_path);
+    return failed;
+}
+
+static int check_run(scc_context* ctx, const run_case* c) {
+    scc_result result;
+    scc_compile(ctx, c->name, c->source, strlen(c->source), SCC_MODE_RUN, &result);
+    int failed = result.status != 0 || result.exit_code != c->exit_code;
+    if (failed) {
+        fprintf(stderr, "%s: status %d, exit code %d, expected %d\n%s", c->name, result.status, result.exit_code,
+                c->exit_code, result.diagnostics);
+    }
+    scc_free_result(&result);
+    if (c->max_asm_size > 0) {
+        scc_compile(ctx, c->name, c->source, strlen(c->source), SCC_MODE_ASM, &result);
+        if (result.status != 0 || result.output_size > c->max_asm_size) {
+            fprintf(stderr, "%s: %zu bytes of assembly, expected at most %zu\n%s", c->name, result.output_size,
+                    c->max_asm_size, result.diagnostics);
+            failed = 1;
+        }
+        scc_free_result(&result);
+    }
+    return failed;
+}
+
+// Compilations that fail in the preprocessor unwind through fatal_error;
+// repeating one must not grow the heap.
+static int check_failed_compile_leaks(scc_context* ctx) {
+    static const char* const sources[] = {
+        "#if 1 2\nint main() { return 0; }\n#endif\n",
+        "#if defined(\nint main() { return 0; }\n#endif\n",
+    };
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); ++i) {
+        size_t in_use = 0;
+        for (int run = 0; run <= 64; ++run) {
+            // The first run warms up whatever the context keeps.
+            if (run == 1) {
+                in_use = mallinfo2().uordblks;
+            }
+            scc_result result;
+            scc_compile(ctx, "bad_if.c", sources[i], strlen(sources[i]), SCC_MODE_ASM, &result);
+            failed |= result.status == 0;
+            scc_free_result(&result);
+        }
+        size_t now_in_use = mallinfo2().uordblks;
+        if (now_in_use > in_use + 1024) {
+            fprintf(stderr, "bad_if: %zu bytes still allocated after 64 failed compilations of:\n%s",
+                    now_in_use - in_use, sources[i]);
+            failed = 1;
+        }
+    }
+    return failed;
+}
+
+// A header edited between compilations, as under a compile server, is
+// relexed each time; the stale copies must go once no job uses them.
+static int check_header_edits() {
+    char dir[] = "/tmp/scc_libscc_test_XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        fprintf(stderr, "Error: cannot create a temporary directory\n");
+        return 1;
+    }
+    char header_path[sizeof(dir) + 16];
+    snprintf(header_path, sizeof(header_path), "%s/value.h", dir);
+    char* include_dirs[] = {dir};
+    header_cache* headers = create_header_cache();
+    headers->revalidate = true;
+    compile_options options;
+    init_compile_options(&options);
+    options.headers = headers;
+    options.include_dirs = include_dirs;
+    options.num_include_dirs = 1;
+    options.run = true;
+    options.keep_output = true;
+    options.output_fd = -1;
+    options.error_fd = -1;
+
+    const char* source = "#include \"value.h\"\nint main() { return VALUE; }\n";
+    int failed = 0;
+    for (int edit = 1; edit <= 8 && !failed; ++edit) {
+        // Every edit changes the size, so it is seen whatever the mtime.
+        FILE* f = fopen(header_path, "w");
+        fprintf(f, "#define VALUE %d\n%*s\n", edit, edit, "");
+        fclose(f);
+        compile_job job;
+        init_compile_job(&job, "header_edits.c", &options);
+        job.source = source;
+        job.source_size = strlen(source);
+        run_compile_job(&job);
+        if (job.failed || job.exit_code != edit) {
+            fprintf(stderr, "header_edits: edit %d ran with exit code %d\n%.*s", edit, job.exit_code,
+                    (int)job.diag.messages.length, job.diag.messages.data);
+            failed = 1;
+        }
+        free_compile_job(&job);
+    }
+    if (headers->num_retired != 0) {
+        fprintf(stderr, "header_edits: %zu stale header copies kept\n", headers->num_retired);
+        failed = 1;
+    }
+    free_header_cache(headers);
+    unlink(header_path);
+    rmdir(dir);
+    return failed;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Error: usage: scc_libscc_test path/to/scc\n");
+        return 1;
+    }
+    scc_context* ctx = scc_create_context();
+    int failures = 0;
+    for (size_t i = 0; i < sizeof(run_cases) / sizeof(run_cases[0]); ++i) {
+        failures += check_run(ctx, &run_cases[i]);
+    }
+    for (size_t i = 0; i < sizeof(asm_cases) / sizeof(asm_cases[0]); ++i) {
+        failures += check_asm(ctx, argv[1], asm_cases[i]);
+    }
+    failures += check_failed_compile_leaks(ctx);
+    scc_destroy_context(ctx);
+    failures += check_header_edits();
+    return failures != 0;
+}